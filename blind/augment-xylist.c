@@ -71,6 +71,7 @@ void augment_xylist_init(augment_xylist_t* axy) {
     axy->parity = PARITY_BOTH;
 	axy->uniformize = 10;
 	axy->verify_uniformize = TRUE;
+	axy->verify_early_reject = TRUE;
 }
 
 void augment_xylist_free_contents(augment_xylist_t* axy) {
@@ -191,6 +192,8 @@ static an_option_t options[] = {
 	 "don't uniformize the field stars during verification"},
 	{'\x83', "no-verify-dedup", no_argument, NULL,
 	 "don't deduplicate the field stars during verification"},
+	{'\x8b', "no-verify-early-reject", no_argument, NULL,
+	 "verify every match fully, even if it can't reach the log-odds thresholds"},
 	{'0', "no-fix-sdss",    no_argument, NULL,
 	 "don't try to fix SDSS idR files."},
 	{'C', "cancel",		   required_argument, "filename",
@@ -295,6 +298,9 @@ int augment_xylist_parse_option(char argchar, char* optarg,
 	case '\x83':
 		axy->verify_dedup = FALSE;
 		break;
+	case '\x8b':
+		axy->verify_early_reject = FALSE;
+		break;
 		/*
 		 case '\x86':
 		 axy->predistort = sip_read_header_file(optarg, NULL);
@@ -1169,6 +1175,7 @@ int augment_xylist(augment_xylist_t* axy,
 
 	qfits_header_add(hdr, "ANVERUNI", axy->verify_uniformize ? "T":"F", "Uniformize field during verification", NULL);
 	qfits_header_add(hdr, "ANVERDUP", axy->verify_dedup ? "T":"F", "Deduplicate field during verification", NULL);
+	qfits_header_add(hdr, "ANVERREJ", axy->verify_early_reject ? "T":"F", "Reject matches early during verification", NULL);
 
 	if (axy->odds_to_tune_up)
 		fits_header_add_double(hdr, "ANODDSTU", axy->odds_to_tune_up, "Odds ratio to tune up a match");
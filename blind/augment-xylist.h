@@ -147,6 +147,7 @@ struct augment_xylist_s {
 
 	anbool verify_uniformize;
 	anbool verify_dedup;
+	anbool verify_early_reject;
 
     // try to verify FITS input images?
     anbool try_verify;
@@ -35,6 +35,7 @@
 #include <string.h>
 #include <math.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include "blind.h"
 #include "tweak.h"
@@ -170,39 +171,101 @@ static anbool grab_field_tagalong_data(MatchObj* mo, xylist_t* xy, int N) {
 
 /** Index handling for in_parallel and not.
 
- Currently it supposedly could handle both "indexnames" and "indexes",
- but we should probably just assert that only one of these can be used.
+ Index "i" is either given by filename, "indexnames[i]", and loaded
+ here, or already loaded, "indexes[i]"; the other one is NULL.
  **/
+static index_t* load_index(const char* fn, int options,
+                           const index_mmap_policy_t* policy) {
+    index_t* ind = index_load(fn, options, NULL);
+    if (ind && !(options & INDEX_ONLY_LOAD_METADATA))
+        // (failures are logged; the index is still usable.)
+        index_set_mmap_policy(ind, policy);
+    return ind;
+}
+
 static index_t* get_index(blind_t* bp, int i) {
-    if (i < sl_size(bp->indexnames)) {
-        char* fn = sl_get(bp->indexnames, i);
-        index_t* ind = index_load(fn, bp->index_options, NULL);
+    char* fn = sl_get(bp->indexnames, i);
+    if (fn) {
+        index_t* ind = load_index(fn, bp->index_options, &bp->index_mmap_policy);
         if (!ind) {
             ERROR("Failed to load index %s", fn);
             exit( -1);
         }
         return ind;
     }
-    i -= sl_size(bp->indexnames);
     return pl_get(bp->indexes, i);
 }
 static char* get_index_name(blind_t* bp, int i) {
     index_t* index;
-    if (i < sl_size(bp->indexnames)) {
-        char* fn = sl_get(bp->indexnames, i);
+    char* fn = sl_get(bp->indexnames, i);
+    if (fn)
         return fn;
-    }
-    i -= sl_size(bp->indexnames);
     index = pl_get(bp->indexes, i);
     return index->indexname;
 }
 static void done_with_index(blind_t* bp, int i, index_t* ind) {
-    if (i < sl_size(bp->indexnames)) {
+    if (sl_get(bp->indexnames, i)) {
         index_close(ind);
     }
 }
 static int n_indexes(blind_t* bp) {
-    return sl_size(bp->indexnames) + pl_size(bp->indexes);
+    return sl_size(bp->indexnames);
+}
+
+/*
+ When the indexes are searched one at a time, the next one can be
+ loaded on a background thread while the current one is searched.
+ */
+struct index_prefetch {
+	pthread_t thread;
+	// index number, or -1 if none is being loaded.
+	int i;
+	char* fn;
+	int options;
+	const index_mmap_policy_t* policy;
+	index_t* index;
+};
+typedef struct index_prefetch index_prefetch_t;
+
+static void* index_prefetch_thread(void* arg) {
+	index_prefetch_t* pf = arg;
+	pf->index = load_index(pf->fn, pf->options, pf->policy);
+	return NULL;
+}
+
+static void start_index_prefetch(blind_t* bp, int i, index_prefetch_t* pf) {
+	pf->i = -1;
+	// only indexes given by filename need to be loaded.
+	if (!sl_get(bp->indexnames, i))
+		return;
+	pf->fn = sl_get(bp->indexnames, i);
+	pf->options = bp->index_options;
+	pf->policy = &bp->index_mmap_policy;
+	pf->index = NULL;
+	if (pthread_create(&pf->thread, NULL, index_prefetch_thread, pf)) {
+		SYSERROR("Failed to create thread to load index %s", pf->fn);
+		return;
+	}
+	pf->i = i;
+}
+
+// Waits for the index being loaded (if any); returns it if it's index "i".
+static index_t* finish_index_prefetch(blind_t* bp, int i, index_prefetch_t* pf) {
+	index_t* ind;
+	if (pf->i == -1)
+		return NULL;
+	pthread_join(pf->thread, NULL);
+	ind = pf->index;
+	if (pf->i != i) {
+		if (ind)
+			done_with_index(bp, pf->i, ind);
+		ind = NULL;
+	} else if (!ind) {
+		ERROR("Failed to load index %s", pf->fn);
+		exit( -1);
+	}
+	pf->i = -1;
+	return ind;
 }
 
 
@@ -286,9 +349,11 @@ void blind_set_ycol(blind_t* bp, const char* y) {
 
 void blind_add_index(blind_t* bp, const char* index) {
     sl_append(bp->indexnames, index);
+    pl_append(bp->indexes, NULL);
 }
 
 void blind_add_loaded_index(blind_t* bp, index_t* ind) {
+    sl_append(bp->indexnames, NULL);
     pl_append(bp->indexes, ind);
 }
 
@@ -471,6 +536,8 @@ void blind_run(blind_t* bp) {
         solver_clear_indexes(sp);
 
 	} else {
+		index_prefetch_t prefetch;
+		prefetch.i = -1;
 
         for (I=0; I<Nindexes; I++) {
             index_t* index;
@@ -483,10 +550,16 @@ void blind_run(blind_t* bp) {
 				break;
 
 			// Load the index...
-            index = get_index(bp, I);
+			index = finish_index_prefetch(bp, I, &prefetch);
+			if (!index)
+				index = get_index(bp, I);
             solver_add_index(sp, index);
 			logverb("Trying index %s...\n", index->indexname);
 
+			// ... and start loading the next one.
+			if (sp->nthreads > 1 && I+1 < Nindexes)
+				start_index_prefetch(bp, I+1, &prefetch);
+
 			// Record current CPU usage.
 			bp->cpu_start = get_cpu_usage();
 			// Record current wall-clock time.
@@ -499,6 +572,8 @@ void blind_run(blind_t* bp) {
             done_with_index(bp, I, index);
             solver_clear_indexes(sp);
 		}
+		// (if we stopped early)
+		finish_index_prefetch(bp, -1, &prefetch);
 	}
 
  cleanup:
@@ -548,7 +623,7 @@ int blind_parameters_are_sane(blind_t* bp, solver_t* sp) {
 		logerr("You must set a \"distractors\" proportion.\n");
 		return 0;
 	}
-	if (!(sl_size(bp->indexnames) || (bp->indexes_inparallel && pl_size(bp->indexes)))) {
+	if (!n_indexes(bp)) {
 		logerr("You must specify one or more indexes.\n");
 		return 0;
 	}
@@ -930,14 +1005,31 @@ static void remove_invalid_fields(il* fieldlist, int maxfield) {
     }
 }
 
+static void log_verify_stages(const solver_t* sp, int fieldnum) {
+	const int* n = sp->num_verify_stage;
+	int total = n[0] + n[VERIFY_REJECTED_ROR] + n[VERIFY_REJECTED_SAMPLE] +
+		n[VERIFY_REJECTED_REFS];
+	if (!total)
+		return;
+	logverb("Field %i: verified %i matches; rejected early: %i (%.1f%%) after RoR, "
+			"%i (%.1f%%) after sampling ref stars, %i (%.1f%%) after all ref stars.\n",
+			fieldnum, total,
+			n[VERIFY_REJECTED_ROR], 100.0 * n[VERIFY_REJECTED_ROR] / total,
+			n[VERIFY_REJECTED_SAMPLE], 100.0 * n[VERIFY_REJECTED_SAMPLE] / total,
+			n[VERIFY_REJECTED_REFS], 100.0 * n[VERIFY_REJECTED_REFS] / total);
+}
+
 static void solve_fields(blind_t* bp, sip_t* verify_wcs) {
 	solver_t* sp = &(bp->solver);
 	double last_utime, last_stime;
 	double utime, stime;
+	long last_majflt, last_minflt;
+	long majflt, minflt;
 	struct timeval wtime, last_wtime;
 	int fi;
 
 	get_resource_stats(&last_utime, &last_stime, NULL);
+	get_page_faults(&last_majflt, &last_minflt);
 	gettimeofday(&last_wtime, NULL);
 
 	for (fi = 0; fi < il_size(bp->fieldlist); fi++) {
@@ -980,6 +1072,7 @@ static void solve_fields(blind_t* bp, sip_t* verify_wcs) {
 		sp->numscaleok = 0;
 		sp->num_cxdx_skipped = 0;
 		sp->num_verified = 0;
+		memset(sp->num_verify_stage, 0, sizeof(sp->num_verify_stage));
 		sp->quit_now = FALSE;
 		sp->mo_template = &template ;
 		sp->record_match_callback = record_match_callback;
@@ -1008,6 +1101,7 @@ static void solve_fields(blind_t* bp, sip_t* verify_wcs) {
 
 			logverb("Field %i: tried %i quads, matched %i codes.\n",
                     fieldnum, sp->numtries, sp->nummatches);
+			log_verify_stages(sp, fieldnum);
 
 			if (sp->maxquads && sp->numtries >= sp->maxquads)
 				logmsg("  exceeded the number of quads to try: %i >= %i.\n",
@@ -1049,13 +1143,18 @@ static void solve_fields(blind_t* bp, sip_t* verify_wcs) {
 		solver_free_field(sp);
 
 		get_resource_stats(&utime, &stime, NULL);
+		get_page_faults(&majflt, &minflt);
 		gettimeofday(&wtime, NULL);
 		logverb("Spent %g s user, %g s system, %g s total, %g s wall time.\n",
 		       (utime - last_utime), (stime - last_stime), (stime - last_stime + utime - last_utime),
 		       millis_between(&last_wtime, &wtime) * 0.001);
+		logverb("Page faults: %li major, %li minor.\n",
+				majflt - last_majflt, minflt - last_minflt);
 
 		last_utime = utime;
 		last_stime = stime;
+		last_majflt = majflt;
+		last_minflt = minflt;
 		last_wtime = wtime;
 
 	cleanup:
@@ -1552,7 +1651,10 @@ static int write_corr_file(blind_t* bp) {
 			return -1;
 		}
 
-		fitstable_next_extension(tab);
+		if (fitstable_next_extension(tab)) {
+			ERROR("Failed to finish correspondence file extension.");
+			return -1;
+		}
 		fitstable_clear_table(tab);
 	}
 
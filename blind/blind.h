@@ -65,14 +65,18 @@ struct blind_params {
 	// If using solvedserver, limits of fields to ask for
 	int firstfield, lastfield;
 
-	// Indexes to use (base filenames)
+	// Indexes to use, in order: for each, either its base filename
+	// here (to be loaded by blind) or NULL...
 	sl* indexnames;
 
-    // Indexes to use (index_t objects)
+    // ... and NULL or the loaded index_t here.
     pl* indexes;
 
     int index_options;
 
+    // madvise/mlock policy for the indexes this loads.
+    index_mmap_policy_t index_mmap_policy;
+
     // Quad size fraction: select indexes that contain quads of size fraction
     // [quad_size_fraction_lo, quad_size_fraction_hi] of the image size.
     double quad_size_fraction_lo;
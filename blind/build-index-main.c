@@ -28,12 +28,13 @@
 #include <assert.h>
 
 #include "build-index.h"
+#include "kdtree.h"
 #include "boilerplate.h"
 #include "errors.h"
 #include "log.h"
 #include "starutil.h"
 
-const char* OPTIONS = "hvi:o:N:l:u:S:fU:H:s:m:n:r:d:p:R:L:EI:MTj:1:P:B:A:D:t:";
+const char* OPTIONS = "hvi:o:N:l:u:S:fU:H:s:m:n:r:d:p:R:L:EI:MTj:1:P:B:A:D:t:k:";
 
 static void print_help(char* progname) {
 	boilerplate_help_header(stdout);
@@ -86,6 +87,7 @@ static void print_help(char* progname) {
 		   "      [-M]: in-memory (don't use temp files)\n"
 		   "      [-T]: don't delete temp files\n"
 		   "      [-t <temp-dir>]: use this temp direcotry (default: /tmp)\n"
+		   "      [-k <threads>]: number of threads for building the kd-trees (default 1)\n"
 		   "      [-v]: add verbosity.\n"
 	       "\n", progname);
 }
@@ -136,6 +138,9 @@ int main(int argc, char** argv) {
 		case 'T':
 			p->delete_tempfiles = FALSE;
 			break;
+		case 'k':
+			kdtree_set_build_threads(atoi(optarg));
+			break;
 		case 'E':
 			p->scanoccupied = TRUE;
 			break;
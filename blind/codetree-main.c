@@ -31,7 +31,7 @@
 #include "codetree.h"
 #include "boilerplate.h"
 
-static const char* OPTIONS = "hR:i:o:bsSt:d:";
+static const char* OPTIONS = "hR:i:o:bsSt:d:k:V";
 
 static void printHelp(char* progname) {
 	boilerplate_help_header(stdout);
@@ -43,7 +43,9 @@ static void printHelp(char* progname) {
 		   "    [-t  <tree type>]:  {double,float,u32,u16}, default u16.\n"
 		   "    [-d  <data type>]:  {double,float,u32,u16}, default u16.\n"
 		   "    [-S]: include separate splitdim array\n"
+		   "    [-V]: store the nodes in van Emde Boas order (fewer page faults when mmapped)\n"
 		   "    [-R <target-leaf-node-size>]   (default 25)\n"
+		   "    [-k <threads>]: number of threads for building the kdtree (default 1)\n"
 		   "\n", progname);
 }
 
@@ -86,6 +88,12 @@ int main(int argc, char *argv[]) {
 		case 'S':
 			buildopts |= KD_BUILD_SPLITDIM;
 			break;
+		case 'V':
+			buildopts |= KD_BUILD_VEB;
+			break;
+		case 'k':
+			kdtree_set_build_threads(atoi(optarg));
+			break;
         case '?':
             fprintf(stderr, "Unknown option `-%c'.\n", optopt);
         case 'h':
@@ -99,8 +99,8 @@ codetree* codetree_build(codefile* codes,
 		datatype = KDT_DATA_U16;
 	if (!treetype)
 		treetype = KDT_TREE_U16;
-	if (!buildopts)
-		buildopts = KD_BUILD_SPLIT;
+	if (!(buildopts & (KD_BUILD_BBOX | KD_BUILD_SPLIT)))
+		buildopts |= KD_BUILD_SPLIT;
 
 	tt = kdtree_kdtypes_to_treetype(exttype, treetype, datatype);
 	N = codes->numcodes;
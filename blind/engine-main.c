@@ -50,6 +50,7 @@
 #include "log.h"
 #include "errors.h"
 #include "engine.h"
+#include "engine-server.h"
 #include "an-opts.h"
 #include "gslutils.h"
 
@@ -76,6 +77,8 @@ static an_option_t myopts[] = {
 	 "run the index files in parallel"},
 	{'D', "data-log file", required_argument, "file",
 	 "log data to the given filename"},
+	{'L', "listen", required_argument, "socket",
+	 "run as a server: keep the indexes loaded and run the jobs sent to this Unix-domain socket (eg, by \"solve-field --engine-socket\")"},
 };
 
 static void print_help(const char* progname, bl* opts) {
@@ -113,6 +116,7 @@ int main(int argc, char** args) {
     char* infn = NULL;
     FILE* fin = NULL;
     anbool fromstdin = FALSE;
+    char* sockpath = NULL;
 
 	bl* opts = opts_from_array(myopts, sizeof(myopts)/sizeof(an_option_t), NULL);
 	sl* inds = sl_new(4);
@@ -129,6 +133,9 @@ int main(int argc, char** args) {
 		case 'D':
 			datalog = optarg;
 			break;
+		case 'L':
+			sockpath = optarg;
+			break;
 		case 'p':
 			engine->inparallel = TRUE;
 			break;
@@ -167,7 +174,7 @@ int main(int argc, char** args) {
 		}
 	}
 
-	if (optind == argc && !infn) {
+	if (optind == argc && !infn && !sockpath) {
 		// Need extra args: filename
 		printf("You must specify at least one input file!\n\n");
 		help = TRUE;
@@ -299,6 +306,14 @@ int main(int argc, char** args) {
     engine->cancelfn = cancelfn;
     engine->solvedfn = solvedfn;
 
+    if (sockpath) {
+        int rtn = engine_server_run(engine, sockpath);
+        engine_free(engine);
+        sl_free2(strings);
+        sl_free2(inds);
+        return rtn;
+    }
+
     i = optind;
     while (1) {
 		char* jobfn;
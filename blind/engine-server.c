@@ -0,0 +1,321 @@
+/*
+ This file is part of the Astrometry.net suite.
+
+ The Astrometry.net suite is free software; you can redistribute
+ it and/or modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation, version 2.
+
+ The Astrometry.net suite is distributed in the hope that it will be
+ useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with the Astrometry.net suite ; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "engine-server.h"
+#include "engine.h"
+#include "ioutils.h"
+#include "log.h"
+#include "errors.h"
+#include "tic.h"
+
+#define STATUS_PREFIX "#status "
+
+static volatile sig_atomic_t server_quit = 0;
+
+static void server_sighandler(int sig) {
+	server_quit = 1;
+}
+
+static int make_address(const char* sockpath, struct sockaddr_un* addr) {
+	memset(addr, 0, sizeof(struct sockaddr_un));
+	if (strlen(sockpath) >= sizeof(addr->sun_path)) {
+		ERROR("Socket path \"%s\" is too long", sockpath);
+		return -1;
+	}
+	addr->sun_family = AF_UNIX;
+	strcpy(addr->sun_path, sockpath);
+	return 0;
+}
+
+static int run_one_job(engine_t* engine, FILE* fid, const char* dir,
+					   int loglevel, const char* axyfn) {
+	char* jobfn;
+	job_t* job;
+	int oldlevel;
+	FILE* oldlog;
+	double t0;
+	int rtn = 0;
+	index_cache_stats_t cachestats;
+
+	memset(&cachestats, 0, sizeof(index_cache_stats_t));
+	t0 = timenow();
+	if (dir)
+		jobfn = resolve_path(axyfn, dir);
+	else
+		jobfn = strdup(axyfn);
+	logmsg("Running job \"%s\"...\n", jobfn);
+
+	// Send this job's log messages (and errors) to the client.
+	oldlevel = log_get_level();
+	oldlog = log_get_fid();
+	if (loglevel >= 0)
+		log_set_level(loglevel);
+	log_to(fid);
+	errors_log_to(fid);
+
+	job = engine_read_job_file(engine, jobfn);
+	if (!job) {
+		ERROR("Failed to read job file \"%s\"", jobfn);
+		rtn = -1;
+	} else {
+		if (dir)
+			job_set_base_dir(job, dir);
+		if (engine_run_job(engine, job)) {
+			logerr("Failed to run_job()\n");
+			rtn = -1;
+		}
+		cachestats = job->index_cache_stats;
+		job_free(job);
+	}
+	fflush(fid);
+
+	errors_log_to(stderr);
+	log_to(oldlog);
+	log_set_level(oldlevel);
+
+	logmsg("Job \"%s\" %s after %g seconds.\n", jobfn,
+		   (rtn ? "failed" : "finished"), timenow() - t0);
+	if (cachestats.hits || cachestats.misses)
+		logmsg("  index cache: %i hits, %i misses, %i unloaded; "
+			   "%g seconds loading indexes\n", cachestats.hits,
+			   cachestats.misses, cachestats.evictions, cachestats.load_time);
+	free(jobfn);
+	return rtn;
+}
+
+// Returns TRUE if the server should shut down.
+static anbool handle_client(engine_t* engine, int fd) {
+	FILE* fin;
+	FILE* fid;
+	char line[4096];
+	char* dir = NULL;
+	char* axyfn = NULL;
+	int loglevel = -1;
+	anbool quit = FALSE;
+	int status = -1;
+
+	// (separate streams for reading and writing the socket)
+	fin = fdopen(fd, "rb");
+	if (!fin) {
+		SYSERROR("Failed to fdopen client socket");
+		close(fd);
+		return FALSE;
+	}
+	fid = fdopen(dup(fd), "wb");
+	if (!fid) {
+		SYSERROR("Failed to fdopen client socket");
+		fclose(fin);
+		return FALSE;
+	}
+	while (fgets(line, sizeof(line), fin)) {
+		char* nextword;
+		int len = strlen(line);
+		while (len && (line[len-1] == '\n' || line[len-1] == '\r'))
+			line[--len] = '\0';
+		if (is_word(line, "dir ", &nextword)) {
+			free(dir);
+			dir = strdup(nextword);
+		} else if (is_word(line, "verbose ", &nextword)) {
+			loglevel = atoi(nextword);
+		} else if (is_word(line, "solve ", &nextword)) {
+			axyfn = strdup(nextword);
+			break;
+		} else if (streq(line, "quit")) {
+			quit = TRUE;
+			break;
+		} else {
+			logmsg("Didn't understand request line \"%s\"\n", line);
+			fprintf(fid, "Didn't understand request line \"%s\"\n", line);
+			break;
+		}
+	}
+
+	if (quit) {
+		logmsg("Received \"quit\" request.\n");
+		status = 0;
+	} else if (axyfn)
+		status = run_one_job(engine, fid, dir, loglevel, axyfn);
+
+	fprintf(fid, STATUS_PREFIX "%i\n", status);
+	if (fclose(fid))
+		SYSERROR("Failed to close client socket");
+	fclose(fin);
+	free(dir);
+	free(axyfn);
+	return quit;
+}
+
+int engine_server_run(engine_t* engine, const char* sockpath) {
+	struct sockaddr_un addr;
+	struct sigaction sa;
+	struct stat st;
+	int sock;
+
+	if (make_address(sockpath, &addr))
+		return -1;
+
+	// Remove a socket left over from a previous server.
+	if (!stat(sockpath, &st) && S_ISSOCK(st.st_mode)) {
+		int s = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (s != -1 && !connect(s, (struct sockaddr*)&addr, sizeof(addr))) {
+			ERROR("Another server is already listening on \"%s\"", sockpath);
+			close(s);
+			return -1;
+		}
+		if (s != -1)
+			close(s);
+		logverb("Removing stale socket \"%s\"\n", sockpath);
+		unlink(sockpath);
+	}
+
+	sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock == -1) {
+		SYSERROR("Failed to create socket");
+		return -1;
+	}
+	if (bind(sock, (struct sockaddr*)&addr, sizeof(addr))) {
+		SYSERROR("Failed to bind socket \"%s\"", sockpath);
+		close(sock);
+		return -1;
+	}
+	if (listen(sock, 16)) {
+		SYSERROR("Failed to listen on socket \"%s\"", sockpath);
+		close(sock);
+		unlink(sockpath);
+		return -1;
+	}
+
+	// Let accept() be interrupted so we can clean up the socket.
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = server_sighandler;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	// Clients that go away shouldn't kill us.
+	signal(SIGPIPE, SIG_IGN);
+
+	logmsg("Listening for jobs on \"%s\"...\n", sockpath);
+	while (!server_quit) {
+		int fd = accept(sock, NULL, NULL);
+		if (fd == -1) {
+			if (errno == EINTR)
+				continue;
+			SYSERROR("Failed to accept connection on socket \"%s\"", sockpath);
+			break;
+		}
+		if (handle_client(engine, fd))
+			break;
+	}
+	logmsg("Shutting down server on \"%s\".\n", sockpath);
+	close(sock);
+	unlink(sockpath);
+	return 0;
+}
+
+static FILE* connect_to_server(const char* sockpath) {
+	struct sockaddr_un addr;
+	FILE* fid;
+	int sock;
+
+	if (make_address(sockpath, &addr))
+		return NULL;
+	sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock == -1) {
+		SYSERROR("Failed to create socket");
+		return NULL;
+	}
+	if (connect(sock, (struct sockaddr*)&addr, sizeof(addr))) {
+		SYSERROR("Failed to connect to engine server on \"%s\"", sockpath);
+		close(sock);
+		return NULL;
+	}
+	fid = fdopen(sock, "r+b");
+	if (!fid) {
+		SYSERROR("Failed to fdopen socket");
+		close(sock);
+		return NULL;
+	}
+	return fid;
+}
+
+// Copies the server's messages to "logto" and returns its status.
+static int read_replies(FILE* fid, FILE* logto) {
+	char line[4096];
+	anbool linestart = TRUE;
+	while (fgets(line, sizeof(line), fid)) {
+		int len = strlen(line);
+		if (linestart && starts_with(line, STATUS_PREFIX))
+			return atoi(line + strlen(STATUS_PREFIX));
+		if (logto)
+			fputs(line, logto);
+		linestart = (len && line[len-1] == '\n');
+	}
+	ERROR("Lost connection to the engine server");
+	return -1;
+}
+
+int engine_client_run_job(const char* sockpath, const char* axyfn,
+                          int loglevel, FILE* logto) {
+	FILE* fid;
+	char* cwd;
+	int rtn;
+
+	fid = connect_to_server(sockpath);
+	if (!fid)
+		return -1;
+	cwd = getcwd(NULL, 0);
+	if (cwd) {
+		fprintf(fid, "dir %s\n", cwd);
+		free(cwd);
+	}
+	fprintf(fid, "verbose %i\n", loglevel);
+	fprintf(fid, "solve %s\n", axyfn);
+	if (fflush(fid)) {
+		SYSERROR("Failed to send job to the engine server");
+		fclose(fid);
+		return -1;
+	}
+	rtn = read_replies(fid, logto);
+	if (logto)
+		fflush(logto);
+	fclose(fid);
+	return rtn;
+}
+
+int engine_client_quit(const char* sockpath) {
+	FILE* fid;
+	int rtn;
+	fid = connect_to_server(sockpath);
+	if (!fid)
+		return -1;
+	fprintf(fid, "quit\n");
+	fflush(fid);
+	rtn = read_replies(fid, NULL);
+	fclose(fid);
+	return rtn;
+}
@@ -0,0 +1,63 @@
+/*
+ This file is part of the Astrometry.net suite.
+
+ The Astrometry.net suite is free software; you can redistribute
+ it and/or modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation, version 2.
+
+ The Astrometry.net suite is distributed in the hope that it will be
+ useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with the Astrometry.net suite ; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#ifndef ENGINE_SERVER_H
+#define ENGINE_SERVER_H
+
+#include "engine.h"
+
+/**
+ A long-running engine that keeps its indexes loaded and accepts jobs
+ over a Unix-domain socket, so that each job doesn't have to re-read
+ the config file and re-open the indexes.
+
+ The protocol is line-based.  The client connects and sends:
+
+   dir <directory>        (optional) relative paths are relative to this
+   verbose <log level>    (optional) log level for this job
+   solve <axy filename>   run this job
+
+ or just "quit" to shut the server down.  While the job runs, the
+ server sends back the engine's log messages; the last line is
+ "#status <n>", where n is zero if the job ran (whether or not it
+ solved) and nonzero if it failed.  Jobs are run one at a time, in the
+ order they connect; each one uses the engine's "nthreads" threads.
+ */
+
+/**
+ Listens on the Unix-domain socket "sockpath" and runs the jobs that
+ arrive, until a "quit" request or SIGINT/SIGTERM arrives.
+ */
+int engine_server_run(engine_t* engine, const char* sockpath);
+
+/**
+ Asks the server listening on "sockpath" to run the job in the given
+ augmented xylist file, copying its log messages to "logto".  Relative
+ paths are resolved against the current directory.
+
+ Returns the job's status (zero if it ran), or -1 if the server couldn't
+ be reached or the connection was lost.
+ */
+int engine_client_run_job(const char* sockpath, const char* axyfn,
+                          int loglevel, FILE* logto);
+
+/**
+ Asks the server listening on "sockpath" to shut down.
+ */
+int engine_client_quit(const char* sockpath);
+
+#endif
@@ -35,6 +35,7 @@
 #include <getopt.h>
 #include <dirent.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include "ioutils.h"
 #include "bl.h"
@@ -54,6 +55,28 @@
 #include "sip-utils.h"
 #include "multiindex.h"
 
+// Cache state of one of the engine's indexes (see "index_cache_bytes").
+typedef struct {
+	// owned by the engine, with only its metadata loaded?
+	anbool cacheable;
+	// loaded by the cache (and counted in "index_cache_used")?
+	anbool loaded;
+	// size of its files; 0 if not known yet.
+	int64_t bytes;
+	// value of "index_cache_clock" when it was last used, and its
+	// "lastused" as of the last job before that which used it (0 if it
+	// hasn't been).  A job uses an index once per run, so all of one
+	// job's uses count as one.
+	int64_t lastused;
+	int64_t prevused;
+	// value of "index_cache_job" when it was last used.
+	int64_t lastjob;
+} index_cache_entry_t;
+
+// Held while the cache loads or unloads an index, and while the RA,Dec
+// prefetch thread looks at one.
+static pthread_mutex_t index_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 void engine_add_search_path(engine_t* engine, char* path) {
     sl_append(engine->index_paths, path);
 }
@@ -83,6 +106,7 @@ char* engine_find_index(engine_t* engine, char* name) {
 
 int engine_autoindex_search_paths(engine_t* engine) {
     int i;
+    sl* addinds = sl_new(16);
     // Search the paths specified and add any indexes that are found.
     for (i=0; i<sl_size(engine->index_paths); i++) {
         char* path = sl_get(engine->index_paths, i);
@@ -136,11 +160,12 @@ int engine_autoindex_search_paths(engine_t* engine) {
         for (j=sl_size(tryinds)-1; j>=0; j--) {
             char* path = sl_get(tryinds, j);
             logverb("Trying to add index \"%s\".\n", path);
-            if (engine_add_index(engine, path))
-                logmsg("Failed to add index \"%s\".\n", path);
+            sl_append(addinds, path);
         }
         sl_free2(tryinds);
     }
+    engine_add_indexes(engine, addinds);
+    sl_free2(addinds);
     return 0;
 }
 
@@ -159,6 +184,12 @@ static int add_index(engine_t* engine, index_t* ind) {
     }
 
 	pl_append(engine->indexes, ind);
+	index_catalog_add(engine->catalog, ind, pl_size(engine->indexes) - 1);
+	{
+		index_cache_entry_t entry;
+		memset(&entry, 0, sizeof(index_cache_entry_t));
+		bl_append(engine->index_cache, &entry);
+	}
 
     // <= smallest we've seen?
 	if (ind->index_scale_lower < engine->sizesmallest) {
@@ -180,44 +211,145 @@ static int add_index(engine_t* engine, index_t* ind) {
 	return 0;
 }
 
-int engine_add_index(engine_t* engine, char* path) {
+static index_t* load_index(engine_t* engine, const char* path) {
+	index_t* ind;
+	double t0;
+	t0 = timenow();
+	ind = index_load(path, engine->inparallel ? 0 : INDEX_ONLY_LOAD_METADATA, NULL);
+	debug("index_load(\"%s\") took %g ms\n", path, 1000 * (timenow() - t0));
+	if (!ind) {
+		ERROR("Failed to load index from path %s", path);
+		return NULL;
+	}
+	if (engine->inparallel)
+		index_set_mmap_policy(ind, &engine->mmap_policy);
+	return ind;
+}
+
+static int add_loaded_index(engine_t* engine, const char* path, index_t* ind) {
     int k;
-    index_t* ind = NULL;
     char* quadpath = index_get_quad_filename(path);
     char* base = basename_safe(quadpath);
-	double t0;
     free(quadpath);
 
     // check that an index with the same filename hasn't already been added.
     for (k=0; k<pl_size(engine->indexes); k++) {
-		ind = pl_get(engine->indexes, k);
+		index_t* m = pl_get(engine->indexes, k);
         // ind->indexname is a path to the quad filename; strip off directory component.
-        char* mbase = basename_safe(ind->indexname);
+        char* mbase = basename_safe(m->indexname);
         anbool eq = streq(base, mbase);
         free(mbase);
         if (eq) {
-            logmsg("Warning: we've already seen an index with the same name: \"%s\".  Adding it anyway...\n", ind->indexname);
+            logmsg("Warning: we've already seen an index with the same name: \"%s\".  Adding it anyway...\n", m->indexname);
             //free(base);
             //return 0;
         }
     }
     free(base);
 
-	t0 = timenow();
-	ind = index_load(path, engine->inparallel ? 0 : INDEX_ONLY_LOAD_METADATA, NULL);
-	debug("index_load(\"%s\") took %g ms\n", path, 1000 * (timenow() - t0));
-	if (!ind) {
-		ERROR("Failed to load index from path %s", path);
-		return -1;
-	}
 	if (add_index(engine, ind)) {
 		ERROR("Failed to add index \"%s\"", path);
 		return -1;
 	}
+	if (!engine->inparallel) {
+		// only its metadata are loaded, so it can be cached.
+		index_cache_entry_t* entry = bl_access(engine->index_cache,
+											   bl_size(engine->index_cache) - 1);
+		entry->cacheable = TRUE;
+	}
 	pl_append(engine->free_indexes, ind);
     return 0;
 }
 
+int engine_add_index(engine_t* engine, char* path) {
+	index_t* ind = load_index(engine, path);
+	if (!ind)
+		return -1;
+	return add_loaded_index(engine, path, ind);
+}
+
+// Shared by the threads loading a list of indexes.
+struct index_loader {
+	engine_t* engine;
+	sl* paths;
+	index_t** loaded;
+	int next;
+	pthread_mutex_t lock;
+};
+typedef struct index_loader index_loader_t;
+
+static void* index_loader_thread(void* arg) {
+	index_loader_t* loader = arg;
+	while (1) {
+		int i;
+		pthread_mutex_lock(&loader->lock);
+		i = loader->next++;
+		pthread_mutex_unlock(&loader->lock);
+		if (i >= sl_size(loader->paths))
+			break;
+		loader->loaded[i] = load_index(loader->engine, sl_get(loader->paths, i));
+	}
+	return NULL;
+}
+
+int engine_add_indexes(engine_t* engine, sl* paths) {
+	index_loader_t loader;
+	pthread_t* threads;
+	int N = sl_size(paths);
+	int nthreads;
+	int nfailed = 0;
+	int i;
+	double t0;
+
+	nthreads = MIN(MAX(engine->nthreads, 1), N);
+	if (nthreads <= 1) {
+		for (i=0; i<N; i++) {
+			char* path = sl_get(paths, i);
+			if (engine_add_index(engine, path)) {
+				logmsg("Failed to add index \"%s\".\n", path);
+				nfailed++;
+			}
+		}
+		return nfailed;
+	}
+
+	t0 = timenow();
+	memset(&loader, 0, sizeof(index_loader_t));
+	loader.engine = engine;
+	loader.paths = paths;
+	loader.loaded = calloc(N, sizeof(index_t*));
+	pthread_mutex_init(&loader.lock, NULL);
+
+	// this thread is one of the loaders.
+	threads = calloc(nthreads, sizeof(pthread_t));
+	for (i=1; i<nthreads; i++) {
+		if (pthread_create(threads + i, NULL, index_loader_thread, &loader)) {
+			SYSERROR("Failed to create index-loading thread %i; using %i threads", i, i);
+			nthreads = i;
+			break;
+		}
+	}
+	index_loader_thread(&loader);
+	for (i=1; i<nthreads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	pthread_mutex_destroy(&loader.lock);
+	logverb("Loaded %i indexes in %g s using %i threads\n", N,
+			timenow() - t0, nthreads);
+
+	// add them in order, so the result doesn't depend on the loading order.
+	for (i=0; i<N; i++) {
+		char* path = sl_get(paths, i);
+		if (!loader.loaded[i] ||
+			add_loaded_index(engine, path, loader.loaded[i])) {
+			logmsg("Failed to add index \"%s\".\n", path);
+			nfailed++;
+		}
+	}
+	free(loader.loaded);
+	return nfailed;
+}
+
 static void add_index_to_blind(engine_t* engine, blind_t* bp,
                                int i) {
 	index_t* index;
@@ -229,6 +361,152 @@ static void add_index_to_blind(engine_t* engine, blind_t* bp,
     }
 }
 
+static index_cache_entry_t* cache_entry(engine_t* engine, int i) {
+	return bl_access(engine->index_cache, i);
+}
+
+static void cache_unload(engine_t* engine, int i) {
+	index_cache_entry_t* entry = cache_entry(engine, i);
+	index_t* index = pl_get(engine->indexes, i);
+	logverb("Unloading cached index %s\n", index->indexname);
+	pthread_mutex_lock(&index_cache_mutex);
+	index_unload(index);
+	pthread_mutex_unlock(&index_cache_mutex);
+	entry->loaded = FALSE;
+	engine->index_cache_used -= entry->bytes;
+	engine->index_cache_stats.evictions++;
+}
+
+/*
+ Should index cache entry "a" be unloaded before "b"?  This is "LRU-2",
+ by job: the one whose use by an earlier job was longer ago goes
+ first, so indexes that have only been used by one job (eg, for a field
+ in some other part of the sky) are unloaded before the ones that are
+ used over and over; among those, the least-recently-used goes first.
+ */
+static anbool cache_colder(const index_cache_entry_t* a,
+						   const index_cache_entry_t* b) {
+	if (a->prevused != b->prevused)
+		return (a->prevused < b->prevused);
+	return (a->lastused < b->lastused);
+}
+
+/*
+ Makes room for "bytes" more in the cache by unloading the coldest
+ indexes, except those used since "since".  Returns 0 if there's room.
+ */
+static int cache_make_room(engine_t* engine, int64_t bytes, int64_t since) {
+	while (engine->index_cache_used + bytes > engine->index_cache_bytes) {
+		int i, coldest = -1;
+		for (i=0; i<bl_size(engine->index_cache); i++) {
+			index_cache_entry_t* entry = cache_entry(engine, i);
+			if (!entry->loaded || entry->lastused > since)
+				continue;
+			if (coldest == -1 ||
+				cache_colder(entry, cache_entry(engine, coldest)))
+				coldest = i;
+		}
+		if (coldest == -1)
+			return -1;
+		cache_unload(engine, coldest);
+	}
+	return 0;
+}
+
+/*
+ Loads the indexes in "list" for a run, keeping them loaded (within
+ the cache's budget) for later runs.  Indexes that don't fit, or fail
+ to load, are added to "byname", to be loaded by blind one at a time
+ (and closed after each), as without the cache.  Returns 0 on success,
+ or -1 (having loaded nothing) if they should all be loaded by blind
+ (eg, the cache is disabled, or some index isn't one we can load).
+ */
+static int cache_load_indexes(engine_t* engine, il* list, il* byname) {
+	int64_t since;
+	int k;
+
+	if (engine->inparallel || engine->index_cache_bytes <= 0)
+		return -1;
+	for (k=0; k<il_size(list); k++)
+		if (!cache_entry(engine, il_get(list, k))->cacheable)
+			return -1;
+
+	since = engine->index_cache_clock;
+	for (k=0; k<il_size(list); k++) {
+		int i = il_get(list, k);
+		index_cache_entry_t* entry = cache_entry(engine, i);
+		index_t* index = pl_get(engine->indexes, i);
+		double t0;
+
+		if (entry->lastjob != engine->index_cache_job) {
+			entry->prevused = entry->lastused;
+			entry->lastjob = engine->index_cache_job;
+		}
+		entry->lastused = ++engine->index_cache_clock;
+		if (entry->loaded) {
+			debug("Index %s is cached\n", index->indexname);
+			engine->index_cache_stats.hits++;
+			continue;
+		}
+		engine->index_cache_stats.misses++;
+		if (!entry->bytes) {
+			entry->bytes = index_get_file_size(index);
+			if (entry->bytes < 0)
+				entry->bytes = 0;
+		}
+		if (!entry->bytes ||
+			entry->bytes > engine->index_cache_bytes ||
+			cache_make_room(engine, entry->bytes, since)) {
+			logverb("No room to cache index %s (%.1f MB)\n", index->indexname,
+					entry->bytes / (1024. * 1024.));
+			il_append(byname, i);
+			continue;
+		}
+		t0 = timenow();
+		pthread_mutex_lock(&index_cache_mutex);
+		if (index_reload(index)) {
+			ERROR("Failed to load index %s", index->indexname);
+			index_unload(index);
+			pthread_mutex_unlock(&index_cache_mutex);
+			il_append(byname, i);
+			continue;
+		}
+		pthread_mutex_unlock(&index_cache_mutex);
+		index_set_mmap_policy(index, &engine->mmap_policy);
+		// (the maps stay valid; don't hold on to file descriptors for
+		// each of the cached indexes)
+		index_close_fds(index);
+		t0 = timenow() - t0;
+		engine->index_cache_stats.load_time += t0;
+		engine->index_cache_stats.bytes_loaded += entry->bytes;
+		logverb("Loaded index %s (%.1f MB) in %g ms\n", index->indexname,
+				entry->bytes / (1024. * 1024.), 1000 * t0);
+		entry->loaded = TRUE;
+		engine->index_cache_used += entry->bytes;
+	}
+	return 0;
+}
+
+// Logs what the index cache did since "before".
+static void cache_log_stats(engine_t* engine,
+							const index_cache_stats_t* before,
+							index_cache_stats_t* diff) {
+	const index_cache_stats_t* now = &engine->index_cache_stats;
+	diff->hits = now->hits - before->hits;
+	diff->misses = now->misses - before->misses;
+	diff->evictions = now->evictions - before->evictions;
+	diff->load_time = now->load_time - before->load_time;
+	diff->bytes_loaded = now->bytes_loaded - before->bytes_loaded;
+	if (!(diff->hits || diff->misses))
+		return;
+	logmsg("Index cache: %i hits, %i misses (%.1f MB loaded in %g s), "
+		   "%i unloaded; %.1f of %.1f MB in use\n",
+		   diff->hits, diff->misses, diff->bytes_loaded / (1024. * 1024.),
+		   diff->load_time, diff->evictions,
+		   engine->index_cache_used / (1024. * 1024.),
+		   engine->index_cache_bytes / (1024. * 1024.));
+}
+
 int engine_parse_config_file(engine_t* engine, const char* fn) {
 	FILE* fconf;
     int rtn;
@@ -242,9 +520,38 @@ int engine_parse_config_file(engine_t* engine, const char* fn) {
     return rtn;
 }
 
+// Parses "<codes|quads|stars|all> <advice>", eg "codes willneed".
+static int parse_madvise(index_mmap_policy_t* policy, const char* str) {
+	char* advstr;
+	int advice = -1;
+
+	advstr = strchr(str, ' ');
+	if (advstr)
+		advice = fitsbin_advice_from_string(advstr + strspn(advstr, " "));
+	if (advice == -1) {
+		ERROR("Failed to parse index_madvise \"%s\": expected \"<codes|quads|stars|all> "
+			  "<normal|random|sequential|willneed|hugepage>\"", str);
+		return -1;
+	}
+	if (starts_with(str, "codes "))
+		policy->codes = advice;
+	else if (starts_with(str, "quads "))
+		policy->quads = advice;
+	else if (starts_with(str, "stars "))
+		policy->stars = advice;
+	else if (starts_with(str, "all "))
+		policy->codes = policy->quads = policy->stars = advice;
+	else {
+		ERROR("Failed to parse index_madvise \"%s\": unknown index part", str);
+		return -1;
+	}
+	return 0;
+}
+
 int engine_parse_config_file_stream(engine_t* engine, FILE* fconf) {
     sl* indices = sl_new(16);
     sl* mindices = sl_new(16);
+    sl* paths = sl_new(16);
     anbool auto_index = FALSE;
     int i;
     int rtn = 0;
@@ -292,6 +599,19 @@ int engine_parse_config_file_stream(engine_t* engine, FILE* fconf) {
 			engine->maxwidth = atof(nextword);
 		} else if (is_word(line, "cpulimit ", &nextword)) {
 			engine->cpulimit = atof(nextword);
+		} else if (is_word(line, "nthreads ", &nextword)) {
+			engine->nthreads = atoi(nextword);
+		} else if (is_word(line, "index_madvise ", &nextword)) {
+			if (parse_madvise(&engine->mmap_policy, nextword)) {
+				rtn = -1;
+				goto done;
+			}
+		} else if (streq(line, "index_mlock") ||
+				   is_word(line, "index_mlock ", &nextword)) {
+			engine->mmap_policy.lock = TRUE;
+		} else if (is_word(line, "index_cache ", &nextword)) {
+			// in megabytes
+			engine->index_cache_bytes = (int64_t)(atof(nextword) * 1024 * 1024);
 		} else if (is_word(line, "depths ", &nextword)) {
             if (parse_depth_string(engine->default_depths, nextword)) {
                 rtn = -1;
@@ -318,10 +638,9 @@ int engine_parse_config_file_stream(engine_t* engine, FILE* fconf) {
             rtn = -1;
             goto done;
         }
-        if (engine_add_index(engine, path))
-            logmsg("Failed to add index \"%s\".\n", path);
-		free(path);
+        sl_append_nocopy(paths, path);
     }
+    engine_add_indexes(engine, paths);
 
     for (i=0; i<sl_size(mindices); i++) {
         char* ind = sl_get(mindices, i);
@@ -391,6 +710,7 @@ int engine_parse_config_file_stream(engine_t* engine, FILE* fconf) {
  done:
     sl_free2(indices);
     sl_free2(mindices);
+    sl_free2(paths);
 	return rtn;
 }
 
@@ -420,29 +740,140 @@ static double job_imageh(job_t* job) {
     return job->bp.solver.field_maxy;
 }
 
+/*
+ For the "j"-th scale range of this job, gets the range of pixel
+ scales (arcsec per pixel) and the range of quad sizes (arcsec) that
+ could be found in the field.
+ */
+static void job_get_scale_range(engine_t* engine, job_t* job, int j,
+								double* p_app_min, double* p_app_max,
+								double* p_fmin, double* p_fmax) {
+	blind_t* bp = &(job->bp);
+	double app_min, app_max;
+	double quadsize_min;
+
+	// arcsec per pixel range
+	app_min = dl_get(job->scales, j * 2);
+	app_max = dl_get(job->scales, j * 2 + 1);
+	if (app_min == 0.0)
+		app_min = deg2arcsec(engine->minwidth) / job_imagew(job);
+	if (app_max == 0.0)
+		app_max = deg2arcsec(engine->maxwidth) / job_imagew(job);
+
+	// minimum quad size to try (in pixels)
+	quadsize_min = bp->quad_size_fraction_lo *
+		MIN(job_imagew(job), job_imageh(job));
+
+	// range of quad sizes that could be found in the field,
+	// in arcsec.
+	// the hypotenuse...
+	*p_fmax = bp->quad_size_fraction_hi *
+		hypot(job_imagew(job), job_imageh(job)) * app_max;
+	*p_fmin = quadsize_min * app_min;
+	*p_app_min = app_min;
+	*p_app_max = app_max;
+}
+
+/*
+ With an RA,Dec hint, only a small region of each index's star kdtree
+ is going to be searched.  This thread asks the kernel to read those
+ pages in while the solver gets going, so that the first searches
+ don't wait on random page faults.
+ */
+struct radec_prefetch {
+	pthread_t thread;
+	engine_t* engine;
+	job_t* job;
+	// indices into engine->indexes
+	il* indexes;
+};
+typedef struct radec_prefetch radec_prefetch_t;
+
+static void* radec_prefetch_thread(void* arg) {
+	radec_prefetch_t* pf = arg;
+	job_t* job = pf->job;
+	double t0 = timenow();
+	int i;
+	for (i=0; i<il_size(pf->indexes); i++) {
+		index_t* index = pl_get(pf->engine->indexes, il_get(pf->indexes, i));
+		int n;
+		// (the index cache may be loading or unloading it)
+		pthread_mutex_lock(&index_cache_mutex);
+		n = index_prefetch_radec(index, job->ra_center, job->dec_center,
+								 job->search_radius);
+		pthread_mutex_unlock(&index_cache_mutex);
+		if (n > 0)
+			logverb("Prefetching %i stars of index %s\n", n, index->indexname);
+	}
+	logverb("Prefetching stars near RA,Dec (%g,%g) took %g ms\n",
+			job->ra_center, job->dec_center, 1000 * (timenow() - t0));
+	return NULL;
+}
+
+// Starts prefetching the indexes the job could use; returns 0 if started.
+static int start_radec_prefetch(engine_t* engine, job_t* job,
+								radec_prefetch_t* pf) {
+	il* found;
+	int j, k;
+	pf->engine = engine;
+	pf->job = job;
+	pf->indexes = il_new(16);
+	found = il_new(16);
+	for (j=0; j<dl_size(job->scales) / 2; j++) {
+		double app_min, app_max, fmin, fmax;
+		job_get_scale_range(engine, job, j, &app_min, &app_max, &fmin, &fmax);
+		index_catalog_search(engine->catalog, job->ra_center, job->dec_center,
+							 job->search_radius, fmin, fmax, found);
+	}
+	for (k=0; k<il_size(found); k++)
+		il_insert_unique_ascending(pf->indexes, il_get(found, k));
+	il_free(found);
+	if (!il_size(pf->indexes) ||
+		pthread_create(&pf->thread, NULL, radec_prefetch_thread, pf)) {
+		if (il_size(pf->indexes))
+			SYSERROR("Failed to create thread to prefetch indexes");
+		il_free(pf->indexes);
+		return -1;
+	}
+	return 0;
+}
+
+static void finish_radec_prefetch(radec_prefetch_t* pf) {
+	pthread_join(pf->thread, NULL);
+	il_free(pf->indexes);
+}
+
 int engine_run_job(engine_t* engine, job_t* job) {
     blind_t* bp = &(job->bp);
     solver_t* sp = &(bp->solver);
     
     int i;
-    double app_min_default;
-    double app_max_default;
     anbool solved = FALSE;
+	radec_prefetch_t prefetch;
+	anbool prefetching = FALSE;
+	// indexes for a run that the cache leaves to blind.
+	il* byname = il_new(16);
+	index_cache_stats_t cachestats = engine->index_cache_stats;
+
+	engine->index_cache_job++;
 
     if (blind_is_run_obsolete(bp, sp)) {
         goto finish;
     }
 
-    app_min_default = deg2arcsec(engine->minwidth) / job_imagew(job);
-    app_max_default = deg2arcsec(engine->maxwidth) / job_imagew(job);
-
     if (engine->inparallel)
         bp->indexes_inparallel = TRUE;
 
+    if (engine->nthreads > 1)
+        sp->nthreads = engine->nthreads;
+
+    bp->index_mmap_policy = engine->mmap_policy;
+
 	if (job->use_radec_center) {
 		logmsg("Only searching for solutions within %g degrees of RA,Dec (%g,%g)\n",
 			   job->search_radius, job->ra_center, job->dec_center);
 		solver_set_radec(sp, job->ra_center, job->dec_center, job->search_radius);
+		prefetching = (start_radec_prefetch(engine, job, &prefetch) == 0);
 	}
 
     for (i=0; i<il_size(job->depths)/2; i++) {
@@ -466,14 +897,9 @@ int engine_run_job(engine_t* engine, job_t* job) {
 			double app_max, app_min;
             int k;
             il* indexlist;
+			il* runlist;
 
-			// arcsec per pixel range
-			app_min = dl_get(job->scales, j * 2);
-			app_max = dl_get(job->scales, j * 2 + 1);
-            if (app_min == 0.0)
-                app_min = app_min_default;
-            if (app_max == 0.0)
-                app_max = app_max_default;
+			job_get_scale_range(engine, job, j, &app_min, &app_max, &fmin, &fmax);
             sp->funits_lower = app_min;
             sp->funits_upper = app_max;
 
@@ -485,20 +911,23 @@ int engine_run_job(engine_t* engine, job_t* job) {
             sp->quadsize_min = bp->quad_size_fraction_lo *
                 MIN(job_imagew(job), job_imageh(job));
 
-			// range of quad sizes that could be found in the field,
-			// in arcsec.
-            // the hypotenuse...
-			fmax = bp->quad_size_fraction_hi *
-                hypot(job_imagew(job), job_imageh(job)) * app_max;
-			fmin = sp->quadsize_min * app_min;
-
 			// Select the indices that should be checked.
             indexlist = il_new(16);
-			for (k = 0; k < pl_size(engine->indexes); k++) {
-				index_t* index = pl_get(engine->indexes, k);
-                if (!index_overlaps_scale_range(index, fmin, fmax))
-                    continue;
-                il_append(indexlist, k);
+			if (job->use_radec_center) {
+				// (only those near the RA,Dec; the rest aren't looked at.)
+				index_catalog_search(engine->catalog, job->ra_center,
+									 job->dec_center, job->search_radius,
+									 fmin, fmax, indexlist);
+				logverb("%i of %i indexes are within %g degrees of (RA,Dec) = (%g,%g) and the scale range\n",
+						il_size(indexlist), pl_size(engine->indexes),
+						job->search_radius, job->ra_center, job->dec_center);
+			} else {
+				for (k = 0; k < pl_size(engine->indexes); k++) {
+					index_t* index = pl_get(engine->indexes, k);
+					if (!index_overlaps_scale_range(index, fmin, fmax))
+						continue;
+					il_append(indexlist, k);
+				}
 			}
 
 			// Use the (list of) smallest or largest indices if no other one fits.
@@ -509,11 +938,13 @@ int engine_run_job(engine_t* engine, job_t* job) {
                 } else if (fmax < engine->sizesmallest) {
                     list = engine->ismallest;
                 } else {
-                    assert(0);
+                    assert(job->use_radec_center);
                 }
-                il_append_list(indexlist, list);
+				if (list)
+					il_append_list(indexlist, list);
             }
 
+			runlist = il_new(16);
             for (k=0; k<il_size(indexlist); k++) {
                 int ii = il_get(indexlist, k);
 				index_t* index = pl_get(engine->indexes, ii);
@@ -525,11 +956,26 @@ int engine_run_job(engine_t* engine, job_t* job) {
                             index->indexname, job->search_radius, job->ra_center, job->dec_center);
 					continue;
 				}
-				add_index_to_blind(engine, bp, ii);
+				il_append(runlist, ii);
             }
-
             il_free(indexlist);
 
+			if (cache_load_indexes(engine, runlist, byname) == 0) {
+				for (k=0; k<il_size(runlist); k++) {
+					int ii = il_get(runlist, k);
+					index_t* index = pl_get(engine->indexes, ii);
+					if (il_contains(byname, ii))
+						blind_add_index(bp, index->indexname);
+					else
+						blind_add_loaded_index(bp, index);
+				}
+				il_remove_all(byname);
+			} else {
+				for (k=0; k<il_size(runlist); k++)
+					add_index_to_blind(engine, bp, il_get(runlist, k));
+			}
+			il_free(runlist);
+
             logverb("Running blind solver:\n");
             blind_log_run_parameters(bp);
 
@@ -551,12 +997,17 @@ int engine_run_job(engine_t* engine, job_t* job) {
             break;
 	}
 
+	if (prefetching)
+		finish_radec_prefetch(&prefetch);
+
 	logverb("cx<=dx constraints: %i\n", sp->num_cxdx_skipped);
 	logverb("meanx constraints: %i\n", sp->num_meanx_skipped);
 	logverb("RA,Dec constraints: %i\n", sp->num_radec_skipped);
 	logverb("AB scale constraints: %i\n", sp->num_abscale_skipped);
 
  finish:
+	cache_log_stats(engine, &cachestats, &job->index_cache_stats);
+	il_free(byname);
     solver_cleanup(sp);
     blind_cleanup(bp);
 	return 0;
@@ -638,6 +1089,7 @@ static anbool parse_job_from_qfits_header(const qfits_header* hdr, job_t* job) {
 
 	sp->verify_uniformize = qfits_header_getboolean(hdr, "ANVERUNI", sp->verify_uniformize);
 	sp->verify_dedup = qfits_header_getboolean(hdr, "ANVERDUP", sp->verify_dedup);
+	sp->verify_early_reject = qfits_header_getboolean(hdr, "ANVERREJ", sp->verify_early_reject);
 
     val = qfits_header_getdouble(hdr, "ANPOSERR", 0.0);
     if (val > 0.0)
@@ -918,6 +1370,8 @@ engine_t* engine_new() {
     engine->indexes = pl_new(16);
     engine->free_indexes = pl_new(16);
     engine->free_mindexes = pl_new(16);
+	engine->catalog = index_catalog_new();
+	engine->index_cache = bl_new(16, sizeof(index_cache_entry_t));
 	engine->ismallest = il_new(4);
 	engine->ibiggest = il_new(4);
 	engine->default_depths = il_new(4);
@@ -950,6 +1404,9 @@ void engine_free(engine_t* engine) {
         pl_free(engine->free_mindexes);
     }
 	pl_free(engine->indexes);
+	index_catalog_free(engine->catalog);
+	if (engine->index_cache)
+		bl_free(engine->index_cache);
     if (engine->ismallest)
         il_free(engine->ismallest);
     if (engine->ibiggest)
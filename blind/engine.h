@@ -25,6 +25,20 @@
 #include "bl.h"
 #include "an-bool.h"
 #include "index.h"
+#include "index-catalog.h"
+
+// What the index cache (see "index_cache_bytes") did.
+typedef struct {
+	// uses of indexes that were in the cache, and that weren't.
+	int hits;
+	int misses;
+	// indexes unloaded to make room.
+	int evictions;
+	// time spent loading indexes into the cache (in seconds), and the
+	// bytes of index files loaded.
+	double load_time;
+	int64_t bytes_loaded;
+} index_cache_stats_t;
 
 struct engine {
     // search paths (directories)
@@ -49,6 +63,29 @@ struct engine {
 	double minwidth;
 	double maxwidth;
     float cpulimit;
+	// number of threads for each solver_run() (see solver_t.nthreads),
+	// and for loading indexes.
+	int nthreads;
+	// madvise/mlock policy for the indexes.
+	index_mmap_policy_t mmap_policy;
+	// "indexes", by healpix tile; for jobs with an RA,Dec hint, only the
+	// tiles near that position are looked at.
+	index_catalog_t* catalog;
+	// If non-zero (and "inparallel" is not set), the indexes that are
+	// used are kept loaded between runs, up to this many bytes of index
+	// files; the least recently and frequently used ones are unloaded
+	// to make room.
+	int64_t index_cache_bytes;
+	// one "index_cache_entry_t" (see engine.c) per element of "indexes".
+	bl* index_cache;
+	// bytes of index files loaded by the cache.
+	int64_t index_cache_used;
+	// counts index uses, for finding the least-recently-used.
+	int64_t index_cache_clock;
+	// counts jobs, so that the cache can tell one job's uses from another's.
+	int64_t index_cache_job;
+	// since the engine started.
+	index_cache_stats_t index_cache_stats;
     char* cancelfn;
     char* solvedfn;
 };
@@ -62,6 +99,8 @@ struct job_t {
     double dec_center;
     double search_radius;
     anbool use_radec_center;
+	// what the engine's index cache did for this job.
+	index_cache_stats_t index_cache_stats;
     blind_t bp;
 };
 typedef struct job_t job_t;
@@ -71,6 +110,9 @@ void engine_add_search_path(engine_t* engine, char* path);
 char* engine_find_index(engine_t*, char* name);
 // note that "path" must be a full path name.
 int engine_add_index(engine_t* engine, char* path);
+// loads the indexes at the given (full) paths, using "nthreads" threads,
+// and adds them in order.  Returns the number that failed.
+int engine_add_indexes(engine_t* engine, sl* paths);
 // look in all the search path directories for index files.
 int engine_autoindex_search_paths(engine_t* engine);
 int engine_parse_config_file_stream(engine_t* engine, FILE* fconf);
@@ -31,7 +31,7 @@
 #include "errors.h"
 #include "ioutils.h"
 
-static const char* OPTIONS = "hi:Oo:8Hd:D:ve:B:S:M:s:p:P:bU:g:C:m:a:G:w:L:";
+static const char* OPTIONS = "hi:Oo:8Hd:D:ve:B:S:M:s:p:P:bU:g:C:m:a:G:w:L:t:f";
 
 static void printHelp() {
 	fprintf(stderr,
@@ -55,8 +55,10 @@ static void printHelp() {
 			"   [-a <saddle-sigmas>]: set \"saddle\" level joining peaks (default %g sigmas)\n"
 			"   [-P <image plane>]: pull out a single plane of a multi-color image (default: first plane)\n"
 			"   [-b]: don't do (median-based) background subtraction\n"
+			"   [-f]: for float images, use a median filter at every pixel (ctmf) for the background, rather than interpolated medians on a grid\n"
 			"   [-G <background>]: subtract this 'global' background value; implies -b\n"
 			"   [-m]: set maximum extended object size for deblending (default %i pixels)\n"
+			"   [-t <threads>]: use this many threads (the results are the same)\n"
 			"\n"
 			"   [-S <background-subtracted image>]: save background-subtracted image to this filename (FITS float image)\n"
 			"   [-B <background image>]: save background image to filename\n"
@@ -102,6 +104,12 @@ int main(int argc, char *argv[]) {
 		case 'L':
 			params->Lorder = atoi(optarg);
 			break;
+		case 't':
+			params->nthreads = atoi(optarg);
+			break;
+		case 'f':
+			params->bgmethod = SIMPLEXY_BG_CTMF;
+			break;
 		case 'w':
 			params->dpsf = atof(optarg);
 			break;
@@ -105,7 +105,10 @@ int main(int argc, char *argv[]) {
         exit(-1);
     }
 
-    fitstable_next_extension(table);
+    if (fitstable_next_extension(table)) {
+        ERROR("Failed to finish quad extension");
+        exit(-1);
+    }
     fitstable_clear_table(table);
 
     // write star RA,Dec s.
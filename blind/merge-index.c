@@ -21,6 +21,8 @@
 #include <stdio.h>
 #include <math.h>
 #include <string.h>
+#include <stdint.h>
+#include <sys/param.h>
 
 #include "quadfile.h"
 #include "codekd.h"
@@ -31,8 +33,8 @@
 #include "ioutils.h"
 #include "log.h"
 
-int merge_index(quadfile* quad, codetree* code, startree_t* star,
-				const char* indexfn) {
+static int write_index(quadfile* quad, codetree* code, startree_t* star,
+					   anbool pack, int packblock, const char* indexfn) {
     FILE* fout;
 	fitstable_t* tag = NULL;
 
@@ -42,13 +44,24 @@ int merge_index(quadfile* quad, codetree* code, startree_t* star,
         return -1;
     }
 
-	if (quadfile_write_header_to(quad, fout)) {
-		ERROR("Failed to write quadfile header to index file %s", indexfn);
-		return -1;
-	}
-	if (quadfile_write_all_quads_to(quad, fout)) {
-		ERROR("Failed to write quads to index file %s", indexfn);
-		return -1;
+	if (pack) {
+		size_t nbytes;
+		if (quadfile_write_packed_to(quad, packblock, fout, &nbytes)) {
+			ERROR("Failed to write packed quads to index file %s", indexfn);
+			return -1;
+		}
+		logverb("Packed %i quads into %zu bytes (%.2f bytes per quad, vs %i unpacked)\n",
+				quadfile_nquads(quad), nbytes, (double)nbytes / MAX(1, quadfile_nquads(quad)),
+				(int)(quadfile_dimquads(quad) * sizeof(uint32_t)));
+	} else {
+		if (quadfile_write_header_to(quad, fout)) {
+			ERROR("Failed to write quadfile header to index file %s", indexfn);
+			return -1;
+		}
+		if (quadfile_write_all_quads_to(quad, fout)) {
+			ERROR("Failed to write quads to index file %s", indexfn);
+			return -1;
+		}
 	}
 	if (fits_pad_file(fout)) {
 		ERROR("Failed to pad index file %s", indexfn);
@@ -93,6 +106,16 @@ int merge_index(quadfile* quad, codetree* code, startree_t* star,
 	return 0;
 }
 
+int merge_index(quadfile* quad, codetree* code, startree_t* star,
+				const char* indexfn) {
+	return write_index(quad, code, star, FALSE, 0, indexfn);
+}
+
+int merge_index_packed(quadfile* quad, codetree* code, startree_t* star,
+					   int packblock, const char* indexfn) {
+	return write_index(quad, code, star, TRUE, packblock, indexfn);
+}
+
 int merge_index_open_files(const char* quadfn, const char* ckdtfn, const char* skdtfn,
 						   quadfile** quad, codetree** code, startree_t** star) {
 	logmsg("Reading code tree from %s ...\n", ckdtfn);
@@ -35,4 +35,12 @@ int merge_index_open_files(const char* quadfn, const char* ckdtfn, const char* s
 int merge_index(quadfile* quads, codetree* codekd, startree_t* starkd,
 				const char* indexfn);
 
+/**
+ Like merge_index(), but writes the quads in the packed format (see
+ quadfile_write_packed_to()), with "packblock" quads per block (0 for
+ the default).
+ */
+int merge_index_packed(quadfile* quads, codetree* codekd, startree_t* starkd,
+					   int packblock, const char* indexfn);
+
 #endif
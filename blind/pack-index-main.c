@@ -0,0 +1,89 @@
+/*
+  This file is part of the Astrometry.net suite.
+
+  The Astrometry.net suite is free software; you can redistribute
+  it and/or modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation, version 2.
+
+  The Astrometry.net suite is distributed in the hope that it will be
+  useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with the Astrometry.net suite ; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+
+#include "pack-index.h"
+#include "fitsioutils.h"
+#include "boilerplate.h"
+#include "log.h"
+
+#define OPTIONS "hvi:o:b:"
+
+static void printHelp(char* progname) {
+	boilerplate_help_header(stdout);
+	printf("\nUsage: %s\n"
+           "   -i <input-index-filename>\n"
+           "   -o <output-index-filename>\n"
+           "   [-b <quads-per-block>]: packing block size (default %i)\n"
+           "   [-v]: verbose\n"
+		   "\n"
+		   "Writes a compact copy of an index: the quads' star IDs are\n"
+		   "bit-packed, and the codes are quantized to 16 bits.\n"
+		   "\n", progname, QUADFILE_DEFAULT_PACK_BLOCK);
+}
+
+extern char *optarg;
+extern int optind, opterr, optopt;
+
+int main(int argc, char **args) {
+	int argchar;
+	char* progname = args[0];
+	char* infn = NULL;
+	char* outfn = NULL;
+	int packblock = 0;
+	int loglvl = LOG_MSG;
+
+	while ((argchar = getopt (argc, args, OPTIONS)) != -1)
+		switch (argchar) {
+		case 'i':
+			infn = optarg;
+			break;
+		case 'o':
+			outfn = optarg;
+			break;
+		case 'b':
+			packblock = atoi(optarg);
+			break;
+		case 'v':
+			loglvl++;
+			break;
+		case '?':
+			fprintf(stderr, "Unknown option `-%c'.\n", optopt);
+		case 'h':
+			printHelp(progname);
+			return 0;
+		default:
+			return -1;
+		}
+
+	if (!(infn && outfn) || packblock < 0) {
+		printHelp(progname);
+		fprintf(stderr, "\nYou must specify the input and output filenames (-i, -o)\n");
+		exit(-1);
+	}
+	log_init(loglvl);
+	fits_use_error_system();
+
+	if (pack_index_files(infn, outfn, packblock, args, argc)) {
+		exit(-1);
+	}
+	return 0;
+}
@@ -0,0 +1,222 @@
+/*
+  This file is part of the Astrometry.net suite.
+
+  The Astrometry.net suite is free software; you can redistribute
+  it and/or modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation, version 2.
+
+  The Astrometry.net suite is distributed in the hope that it will be
+  useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with the Astrometry.net suite ; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "pack-index.h"
+#include "merge-index.h"
+#include "quadfile.h"
+#include "codekd.h"
+#include "starkd.h"
+#include "kdtree.h"
+#include "starutil.h"
+#include "fitsioutils.h"
+#include "boilerplate.h"
+#include "errors.h"
+#include "log.h"
+
+static void add_history(qfits_header* hdr, char** args, int argc) {
+	boilerplate_add_fits_headers(hdr);
+	qfits_header_add(hdr, "HISTORY", "This file was created by the program \"pack-index\".", NULL, NULL);
+	qfits_header_add(hdr, "HISTORY", "pack-index command line:", NULL, NULL);
+	fits_add_args(hdr, args, argc);
+	qfits_header_add(hdr, "HISTORY", "(end of pack-index command line)", NULL, NULL);
+}
+
+/*
+ Rebuilds the code kdtree with 16-bit data, and writes the quads in
+ the new tree's order (so that, as usual, the tree doesn't need a
+ permutation array).
+ */
+static int requantize_codes(index_t* index, codetree** p_codeout,
+							quadfile** p_quadout, double* p_maxerr,
+							char** args, int argc) {
+	codetree* codein = index->codekd;
+	quadfile* quadin = index->quads;
+	kdtree_t* kdin = codein->tree;
+	qfits_header* inhdr = codetree_header(codein);
+	qfits_header* hdr;
+	int N = kdtree_n(kdin);
+	int D = kdin->ndim;
+	int Nleaf = qfits_header_getint(inhdr, "NLEAF", 25);
+	double low[D], high[D];
+	double maxerr = 0.0;
+	double* codes;
+	codetree* codeout;
+	quadfile* quadout;
+	kdtree_t* kd;
+	anbool circ;
+	int i, d;
+
+	logmsg("Quantizing %i codes to 16 bits...\n", N);
+	codes = malloc((size_t)N * D * sizeof(double));
+	if (!codes) {
+		SYSERROR("Failed to allocate %i codes", N);
+		return -1;
+	}
+	kdtree_copy_data_double(kdin, 0, N, codes);
+
+	codeout = codetree_new();
+	kd = kdtree_new(N, D, Nleaf);
+	circ = qfits_header_getboolean(inhdr, "CIRCLE", 0);
+	for (d=0; d<D; d++) {
+		if (circ) {
+			low [d] = 0.5 - M_SQRT1_2;
+			high[d] = 0.5 + M_SQRT1_2;
+		} else {
+			low [d] = 0.0;
+			high[d] = 1.0;
+		}
+	}
+	kdtree_set_limits(kd, low, high);
+	kd = kdtree_build(kd, codes, N, D, Nleaf, KDTT_DSS, KD_BUILD_SPLIT);
+	if (!kd) {
+		ERROR("Failed to build 16-bit code kdtree");
+		free(codes);
+		codetree_close(codeout);
+		return -1;
+	}
+	kd->name = strdup(CODETREE_NAME);
+	codeout->tree = kd;
+
+	// (the 16-bit tree's data are a copy, in tree order; kd->perm
+	// gives the index into "codes" of each.)
+	for (i=0; i<N; i++) {
+		double q[D];
+		kdtree_copy_data_double(kd, i, 1, q);
+		for (d=0; d<D; d++)
+			maxerr = MAX(maxerr, fabs(q[d] - codes[(size_t)kd->perm[i] * D + d]));
+	}
+	free(codes);
+	logverb("Largest code quantization error: %g (bound %g)\n",
+			maxerr, 0.5 * kd->invscale);
+
+	quadout = quadfile_open_in_memory();
+	quadout->healpix = quadin->healpix;
+	quadout->hpnside = quadin->hpnside;
+	quadout->indexid = quadin->indexid;
+	quadout->numstars = quadin->numstars;
+	quadout->dimquads = quadin->dimquads;
+	quadout->index_scale_upper = quadin->index_scale_upper;
+	quadout->index_scale_lower = quadin->index_scale_lower;
+	hdr = quadfile_get_header(quadout);
+	fits_copy_all_headers(quadfile_get_header(quadin), hdr, "HISTORY");
+	fits_copy_header(quadfile_get_header(quadin), hdr, "CXDX");
+	fits_copy_header(quadfile_get_header(quadin), hdr, "CXDXLT1");
+	fits_copy_header(quadfile_get_header(quadin), hdr, "CIRCLE");
+	fits_copy_header(quadfile_get_header(quadin), hdr, "ALLSKY");
+	if (quadfile_write_header(quadout)) {
+		ERROR("Failed to write quadfile header");
+		goto bailout;
+	}
+	for (i=0; i<N; i++) {
+		unsigned int stars[DQMAX];
+		// the quad that was at position perm[i] of the input tree.
+		int quadid = kdtree_permute(kdin, kd->perm[i]);
+		if (quadfile_get_stars(quadin, quadid, stars) ||
+			quadfile_write_quad(quadout, stars)) {
+			ERROR("Failed to copy quad %i", quadid);
+			goto bailout;
+		}
+	}
+	if (quadfile_switch_to_reading(quadout)) {
+		ERROR("Failed to switch reordered quads to reading");
+		goto bailout;
+	}
+	free(kd->perm);
+	kd->perm = NULL;
+
+	hdr = codetree_header(codeout);
+	fits_header_add_int(hdr, "NLEAF", Nleaf, "Target number of points in leaves.");
+	fits_copy_header(inhdr, hdr, "INDEXID");
+	fits_copy_header(inhdr, hdr, "HEALPIX");
+	fits_copy_header(inhdr, hdr, "ALLSKY");
+	fits_copy_header(inhdr, hdr, "HPNSIDE");
+	fits_copy_header(inhdr, hdr, "CXDX");
+	fits_copy_header(inhdr, hdr, "CXDXLT1");
+	fits_copy_header(inhdr, hdr, "CIRCLE");
+	add_history(hdr, args, argc);
+	qfits_header_add(hdr, "HISTORY", "** pack-index: history from input ckdt:", NULL, NULL);
+	fits_copy_all_headers(inhdr, hdr, "HISTORY");
+	qfits_header_add(hdr, "HISTORY", "** pack-index: end of history from input ckdt.", NULL, NULL);
+
+	*p_codeout = codeout;
+	*p_quadout = quadout;
+	*p_maxerr = maxerr;
+	return 0;
+
+ bailout:
+	quadfile_close(quadout);
+	kdtree_free(codeout->tree);
+	codeout->tree = NULL;
+	codetree_close(codeout);
+	return -1;
+}
+
+int pack_index(index_t* index, int packblock, const char* outfn,
+			   double* p_maxerr, char** args, int argc) {
+	codetree* codekd = index->codekd;
+	quadfile* quads = index->quads;
+	double maxerr = 0.0;
+	int rtn;
+
+	if (kdtree_datatype(codekd->tree) != KDT_DATA_U16) {
+		if (requantize_codes(index, &codekd, &quads, &maxerr, args, argc))
+			return -1;
+	} else
+		logmsg("Codes are already 16-bit.\n");
+	add_history(quadfile_get_header(quads), args, argc);
+
+	if (p_maxerr)
+		*p_maxerr = maxerr;
+
+	rtn = merge_index_packed(quads, codekd, index->starkd, packblock, outfn);
+
+	if (codekd != index->codekd) {
+		kdtree_free(codekd->tree);
+		codekd->tree = NULL;
+		codetree_close(codekd);
+		quadfile_close(quads);
+	}
+	return rtn;
+}
+
+int pack_index_files(const char* infn, const char* outfn, int packblock,
+					 char** args, int argc) {
+	index_t* index;
+	double maxerr;
+	int rtn;
+
+	logmsg("Reading index %s...\n", infn);
+	index = index_load(infn, 0, NULL);
+	if (!index) {
+		ERROR("Failed to read index \"%s\"", infn);
+		return -1;
+	}
+	if (quadfile_is_packed(index->quads))
+		logmsg("(the quads are already packed; they will be re-packed.)\n");
+
+	logmsg("Writing packed index to %s...\n", outfn);
+	rtn = pack_index(index, packblock, outfn, &maxerr, args, argc);
+	if (!rtn)
+		logmsg("Largest code quantization error: %g\n", maxerr);
+	index_free(index);
+	return rtn;
+}
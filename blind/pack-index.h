@@ -0,0 +1,39 @@
+/*
+  This file is part of the Astrometry.net suite.
+
+  The Astrometry.net suite is free software; you can redistribute
+  it and/or modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation, version 2.
+
+  The Astrometry.net suite is distributed in the hope that it will be
+  useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with the Astrometry.net suite ; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+#ifndef PACK_INDEX_H
+#define PACK_INDEX_H
+
+#include "index.h"
+
+/**
+ Writes a compact copy of the given index: the quads are packed (see
+ quadfile_write_packed_to()), and the codes are quantized to 16 bits
+ (if they aren't already), which reorders the quads.  The result is a
+ single-file index that index_load() reads like any other.
+
+ "packblock" is the number of quads per packed block (0 for the
+ default).  The largest change made to any code coordinate by the
+ quantization (0 if the codes were already 16-bit) is returned in
+ "p_maxerr", if non-NULL.
+ */
+int pack_index(index_t* index, int packblock, const char* outfn,
+			   double* p_maxerr, char** args, int argc);
+
+int pack_index_files(const char* infn, const char* outfn, int packblock,
+					 char** args, int argc);
+
+#endif
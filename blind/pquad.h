@@ -19,6 +19,10 @@
 #ifndef PQUAD_H
 #define PQUAD_H
 
+#include <stdint.h>
+
+#include "an-bool.h"
+
 /**
  This file is just required for testing purposes (of solver.c)
  */
@@ -32,10 +36,23 @@ struct potential_quad
 	double costheta, sintheta;
 	// (field pixel noise / quad scale in pixels)^2
 	double rel_field_noise2;
-	anbool* inbox;
+	// bitset: which stars are eligible to be star C, D, ...
+	uint32_t* inbox;
 	int ninbox;
 	double* xy;
 };
 typedef struct potential_quad pquad;
 
+static inline anbool pquad_inbox_get(const pquad* pq, int i) {
+	return (pq->inbox[i >> 5] >> (i & 31)) & 1;
+}
+
+static inline void pquad_inbox_set(pquad* pq, int i) {
+	pq->inbox[i >> 5] |= ((uint32_t)1 << (i & 31));
+}
+
+static inline void pquad_inbox_clear(pquad* pq, int i) {
+	pq->inbox[i >> 5] &= ~((uint32_t)1 << (i & 31));
+}
+
 #endif
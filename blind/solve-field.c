@@ -53,6 +53,7 @@
 #include "wcs-rd2xy.h"
 #include "new-wcs.h"
 #include "scamp.h"
+#include "engine-server.h"
 
 static an_option_t options[] = {
 	{'h', "help",		   no_argument, NULL,
@@ -70,6 +71,8 @@ static an_option_t options[] = {
      "use this config file for the \"astrometry-engine\" program"},
 	{'(', "batch",  no_argument, NULL,
 	 "run astrometry-engine once, rather than once per input file"},
+	{'\x8a', "engine-socket", required_argument, "socket",
+	 "send the jobs to the \"astrometry-engine --listen\" server on this Unix-domain socket, rather than running astrometry-engine"},
 	{'f', "files-on-stdin", no_argument, NULL,
      "read filenames to solve on stdin, one per line"},
 	{'p', "no-plots",       no_argument, NULL,
@@ -532,6 +535,17 @@ static void run_engine(sl* engineargs) {
 	fflush(NULL);
 }
 
+static void run_engine_client(const char* sockpath, const char* axyfn,
+							  int loglvl) {
+	logmsg("Solving (with the engine server on %s)...\n", sockpath);
+	fflush(NULL);
+	if (engine_client_run_job(sockpath, axyfn, loglvl, stdout)) {
+		ERROR("engine server failed to run job \"%s\"", axyfn);
+		exit(-1);
+	}
+	fflush(NULL);
+}
+
 struct solve_field_args {
 	char* newfitsfn;
 	char* indxylsfn;
@@ -738,6 +752,7 @@ int main(int argc, char** args) {
     char* index_xyls;
 	anbool just_augment = FALSE;
 	anbool engine_batch = FALSE;
+	char* enginesock = NULL;
 	bl* batchaxy = NULL;
 	bl* batchsf = NULL;
 	sl* outfiles;
@@ -834,6 +849,9 @@ int main(int argc, char** args) {
 		case '(':
 			engine_batch = TRUE;
 			break;
+		case '\x8a':
+			enginesock = optarg;
+			break;
 		case '@':
 			just_augment = TRUE;
 			break;
@@ -1277,7 +1295,10 @@ int main(int argc, char** args) {
 			axy->wcs_last_mod = 0;
 
 		if (!engine_batch) {
-			run_engine(engineargs);
+			if (enginesock)
+				run_engine_client(enginesock, axy->outfn, loglvl);
+			else
+				run_engine(engineargs);
 			after_solved(axy, sf, makeplots, me, verbose,
 						 axy->tempdir, tempdirs, tempfiles, plotscale, bgfn);
 		} else {
@@ -1307,7 +1328,13 @@ int main(int argc, char** args) {
 	}
 
 	if (engine_batch) {
-		run_engine(engineargs);
+		if (enginesock) {
+			for (i=0; i<bl_size(batchaxy); i++) {
+				augment_xylist_t* axy = bl_access(batchaxy, i);
+				run_engine_client(enginesock, axy->outfn, loglvl);
+			}
+		} else
+			run_engine(engineargs);
 		for (i=0; i<bl_size(batchaxy); i++) {
 			augment_xylist_t* axy = bl_access(batchaxy, i);
 			solve_field_args_t* sf = bl_access(batchsf, i);
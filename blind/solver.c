@@ -25,6 +25,7 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <stdarg.h>
+#include <pthread.h>
 
 #include "ioutils.h"
 #include "mathutil.h"
@@ -259,6 +260,7 @@ void solver_log_params(const solver_t* sp) {
   logverb("  Log stoplooking threshold: %g\n", sp->logratio_stoplooking);
   logverb("  Maxquads %i\n", sp->maxquads);
   logverb("  Maxmatches %i\n", sp->maxmatches);
+  logverb("  Threads %i\n", MAX(1, sp->nthreads));
   logverb("  Set CRPIX? %s", sp->set_crpix ? "yes" : "no\n");
   if (sp->set_crpix) {
     if (sp->set_crpix_center)
@@ -381,6 +383,7 @@ void solver_reset_counters(solver_t* s) {
 	s->num_radec_skipped = 0;
 	s->num_abscale_skipped = 0;
 	s->num_verified = 0;
+	memset(s->num_verify_stage, 0, sizeof(s->num_verify_stage));
 }
 
 double solver_field_width(const solver_t* s) {
@@ -533,17 +536,45 @@ static void try_all_codes(const pquad* pq,
                           const int* fieldstars, int dimquad,
                           solver_t* solver, double tol2);
 
+/*
+ The codes of all the valid permutations of a quad's stars (for both
+ parities and both orderings of stars A,B) are collected, then looked up
+ in the code tree with a single batched search.
+ */
+// parities x orderings of AB x permutations of CDE (3! for DQMAX = 5)
+#define CODE_BATCH_MAX (2 * 2 * 6)
+
+struct code_batch {
+	int n;
+	double codes[CODE_BATCH_MAX * DCMAX];
+	int stars[CODE_BATCH_MAX][DQMAX];
+	anbool parity[CODE_BATCH_MAX];
+};
+typedef struct code_batch code_batch_t;
+
 static void try_all_codes_2(const int* fieldstars, int dimquad,
                             const double* code, solver_t* solver,
-                            anbool current_parity, double tol2);
+                            anbool current_parity, code_batch_t* batch);
 
 static void try_permutations(const int* origstars, int dimquad,
 							 const double* origcode,
 							 solver_t* solver, anbool current_parity,
-							 double tol2,
 							 int* stars, double* code,
 							 int slot, anbool* placed,
-							 kdtree_qres_t** presult);
+							 code_batch_t* batch);
+
+static void search_codes(solver_t* solver, const code_batch_t* batch,
+						 int dimquad, double tol2);
+
+static void free_code_results(solver_t* sp) {
+	int i;
+	if (!sp->code_results)
+		return;
+	for (i=0; i<CODE_BATCH_MAX; i++)
+		kdtree_free_query(sp->code_results[i]);
+	free(sp->code_results);
+	sp->code_results = NULL;
+}
 
 static void resolve_matches(kdtree_qres_t* krez, const double *field,
                             const int* fstars, int dimquads,
@@ -551,6 +582,144 @@ static void resolve_matches(kdtree_qres_t* krez, const double *field,
 
 static int solver_handle_hit(solver_t* sp, MatchObj* mo, sip_t* sip, anbool fake_match);
 
+static void solver_verify_match(solver_t* sp, MatchObj* mo, sip_t* sip,
+								anbool fake_match, double* p_verified_logodds);
+
+static int solver_accept_match(solver_t* sp, MatchObj* mo, sip_t* sip,
+							   double verified_logodds);
+
+static anbool solver_quitting(const solver_t* sp);
+
+/*
+ Storage for the "pquad"s of a field.  The pquad structs for the AB pairs
+ live in one flat triangular array (pair A<B is element B*(B-1)/2 + A).
+ The "inbox" bitsets and rotated "xy" coordinates are only needed for
+ pairs that pass the scale check; they are carved out of big chunks, each
+ of which holds the inbox bitsets of "pairs_per_chunk" pairs followed by
+ their xy arrays.  The chunks and pquad array are never freed between
+ fields, so after the first field this does no per-pair allocation.
+ */
+#define PQUAD_CHUNK_BYTES (4 * 1024 * 1024)
+
+struct pquad_store_t {
+	pquad* pquads;
+	size_t npquads;
+	int numxy;
+	// words per inbox bitset
+	int inboxwords;
+	int pairs_per_chunk;
+	// number of inbox/xy slices handed out for this field.
+	int nslices;
+	pl* chunks;
+	size_t peak_bytes;
+	// init_pquad() runs in the worker threads.
+	pthread_mutex_t lock;
+};
+typedef struct pquad_store_t pquad_store_t;
+
+static pquad_store_t* pquad_store_new() {
+	pquad_store_t* ps = calloc(1, sizeof(pquad_store_t));
+	ps->chunks = pl_new(16);
+	pthread_mutex_init(&ps->lock, NULL);
+	return ps;
+}
+
+static void pquad_store_free(pquad_store_t* ps) {
+	int i;
+	if (!ps)
+		return;
+	for (i=0; i<pl_size(ps->chunks); i++)
+		free(pl_get(ps->chunks, i));
+	pl_free(ps->chunks);
+	free(ps->pquads);
+	pthread_mutex_destroy(&ps->lock);
+	free(ps);
+}
+
+static size_t pquad_store_bytes(const pquad_store_t* ps) {
+	return ps->npquads * sizeof(pquad) +
+		(size_t)pl_size(ps->chunks) * PQUAD_CHUNK_BYTES;
+}
+
+// Bytes of the store used by the current field.
+static size_t pquad_store_used_bytes(const pquad_store_t* ps) {
+	int numxy = ps->numxy;
+	return (size_t)numxy * (numxy-1) / 2 * sizeof(pquad) +
+		(size_t)ps->nslices * (ps->inboxwords * sizeof(uint32_t) +
+							   numxy * 2 * sizeof(double));
+}
+
+/*
+ Gets the store ready for a field with "numxy" stars.  All previous
+ slices are released.
+ */
+static int pquad_store_reset(pquad_store_t* ps, int numxy) {
+	size_t N = (size_t)numxy * (numxy-1) / 2;
+	size_t slicebytes;
+	if (N > ps->npquads) {
+		pquad* newpq = realloc(ps->pquads, N * sizeof(pquad));
+		if (!newpq) {
+			SYSERROR("Failed to allocate %zu pquads", N);
+			return -1;
+		}
+		ps->pquads = newpq;
+		ps->npquads = N;
+	}
+	ps->numxy = numxy;
+	ps->inboxwords = (numxy + 31) / 32;
+	slicebytes = ps->inboxwords * sizeof(uint32_t) + numxy * 2 * sizeof(double);
+	// (leave room to align the xy arrays)
+	ps->pairs_per_chunk = (PQUAD_CHUNK_BYTES - sizeof(double)) / slicebytes;
+	ps->nslices = 0;
+	ps->peak_bytes = MAX(ps->peak_bytes, pquad_store_bytes(ps));
+	return 0;
+}
+
+static inline pquad* pquad_store_get(pquad_store_t* ps, int A, int B) {
+	assert(A < B);
+	return ps->pquads + (size_t)B * (B-1) / 2 + A;
+}
+
+/*
+ Gives "pq" inbox and xy arrays, with stars [0, ninbox) in the box.
+ */
+static int pquad_store_alloc(pquad_store_t* ps, pquad* pq, int ninbox) {
+	int slice, k, i;
+	char* chunk;
+	size_t xyoffset;
+
+	pthread_mutex_lock(&ps->lock);
+	slice = ps->nslices++;
+	k = slice / ps->pairs_per_chunk;
+	if (k == pl_size(ps->chunks)) {
+		chunk = malloc(PQUAD_CHUNK_BYTES);
+		if (!chunk) {
+			ps->nslices--;
+			pthread_mutex_unlock(&ps->lock);
+			SYSERROR("Failed to allocate pquad store chunk");
+			return -1;
+		}
+		pl_append(ps->chunks, chunk);
+		ps->peak_bytes = MAX(ps->peak_bytes, pquad_store_bytes(ps));
+	} else
+		chunk = pl_get(ps->chunks, k);
+	pthread_mutex_unlock(&ps->lock);
+
+	slice %= ps->pairs_per_chunk;
+	xyoffset = ps->pairs_per_chunk * ps->inboxwords * sizeof(uint32_t);
+	xyoffset = (xyoffset + sizeof(double) - 1) / sizeof(double) * sizeof(double);
+	pq->inbox = (uint32_t*)chunk + (size_t)slice * ps->inboxwords;
+	pq->xy = (double*)(chunk + xyoffset) + (size_t)slice * ps->numxy * 2;
+
+	// set bits [0, ninbox)
+	for (i=0; i<ps->inboxwords; i++) {
+		int nbits = MIN(32, MAX(0, ninbox - 32*i));
+		pq->inbox[i] = (nbits == 32) ? 0xffffffff : (((uint32_t)1 << nbits) - 1);
+	}
+	pq->ninbox = ninbox;
+	return 0;
+}
+
 static void check_scale(pquad* pq, solver_t* s) {
 	double dx, dy;
 	dx = field_getx(s, pq->fieldB) - field_getx(s, pq->fieldA);
@@ -576,7 +745,7 @@ static void check_inbox(pquad* pq, int start, solver_t* solver) {
 		double r;
 		double Cx, Cy, xxtmp;
 		double tol = solver->codetol;
-		if (!pq->inbox[i])
+		if (!pquad_inbox_get(pq, i))
 			continue;
 		field_getxy(solver, i, &Cx, &Cy);
 		Cx -= Ax;
@@ -593,7 +762,7 @@ static void check_inbox(pquad* pq, int start, solver_t* solver) {
 		// x^2-x + y^2-y           <=   sqrt(2)*codetol + codetol^2
 		r = (Cx * Cx - Cx) + (Cy * Cy - Cy);
 		if (r > (tol * (M_SQRT2 + tol))) {
-			pq->inbox[i] = FALSE;
+			pquad_inbox_clear(pq, i);
 			continue;
 		}
 		setx(pq->xy, i, Cx);
@@ -606,7 +775,7 @@ static void print_inbox(pquad* pq) {
 	int i;
 	debug("[ ");
 	for (i = 0; i < pq->ninbox; i++) {
-		if (pq->inbox[i])
+		if (pquad_inbox_get(pq, i))
 			debug("%i ", i);
 	}
 	debug("] (n %i)\n", pq->ninbox);
@@ -645,12 +814,19 @@ void solver_preprocess_field(solver_t* solver) {
 
 	solver->vf->do_uniformize = solver->verify_uniformize;
 	solver->vf->do_dedup = solver->verify_dedup;
+	if (solver->verify_early_reject)
+		// Below this, a match is neither printed, tuned, nor kept.
+		solver->vf->logodds_reject = MIN(solver->logratio_toprint,
+										 MIN(solver->logratio_tokeep,
+											 solver->logratio_totune));
 }
 
 void solver_free_field(solver_t* solver) {
 	if (solver->vf)
 		verify_field_free(solver->vf);
 	solver->vf = NULL;
+	verify_scratch_free(solver->vscratch);
+	solver->vscratch = NULL;
 }
 
 starxy_t* solver_get_field(solver_t* solver) {
@@ -700,9 +876,9 @@ static void add_stars(const pquad* pq, int* field, int fieldoffset,
     // it's required because try_all_codes needs to know which field stars
     // were used to create the quad (which are stored in the "f" array)
     for (f[adding]=bottom; f[adding]<fieldtop; f[adding]++) {
-        if (!pq->inbox[f[adding]])
+        if (!pquad_inbox_get(pq, f[adding]))
             continue;
-        if (unlikely(solver->quit_now))
+        if (unlikely(solver_quitting(solver)))
             return;
 
         // If we've hit the end of the recursion (we're adding the last star),
@@ -719,6 +895,519 @@ static void add_stars(const pquad* pq, int* field, int fieldoffset,
 }
 
 
+/*
+ Initializes the "pquad" struct for the AB pair with the new star
+ ("newpoint") on the diagonal (star B): checks the scale, and which of
+ the stars up to "newpoint" are in the box.
+ */
+static void init_pquad(solver_t* solver, pquad_store_t* ps,
+					   int fieldA, int newpoint) {
+	pquad* pq = pquad_store_get(ps, fieldA, newpoint);
+	pq->fieldA = fieldA;
+	pq->fieldB = newpoint;
+	debug("  trying A=%i, B=%i\n", fieldA, newpoint);
+	check_scale(pq, solver);
+	if (!pq->scale_ok) {
+		debug("    bad scale for A=%i, B=%i\n", fieldA, newpoint);
+		return;
+	}
+	// initialize the "inbox" array:
+	// -try all stars up to "newpoint"...
+	if (pquad_store_alloc(ps, pq, newpoint + 1)) {
+		pq->scale_ok = FALSE;
+		return;
+	}
+	// -except A and B.
+	pquad_inbox_clear(pq, fieldA);
+	pquad_inbox_clear(pq, newpoint);
+	check_inbox(pq, 0, solver);
+	debug("    inbox(A=%i, B=%i): ", fieldA, newpoint);
+	print_inbox(pq);
+}
+
+/*
+ Tries all quads from index number "indexnum" that have the new star
+ on the diagonal (star B) and "fieldA" as star A.
+ */
+static void try_quads_diagonal(solver_t* solver, pquad_store_t* ps,
+							   const double* minAB2s, const double* maxAB2s,
+							   int indexnum, int fieldA, int newpoint) {
+	int field[DQMAX];
+	pquad* pq = pquad_store_get(ps, fieldA, newpoint);
+	index_t* index = pl_get(solver->indexes, indexnum);
+	int dimquads;
+	double tol2;
+
+	set_index(solver, index);
+	if (!pq->scale_ok)
+		return;
+	if ((pq->scale < minAB2s[indexnum]) ||
+		(pq->scale > maxAB2s[indexnum]))
+		return;
+	dimquads = index_dimquads(index);
+	field[A] = fieldA;
+	field[B] = newpoint;
+	// set code tolerance for this index and AB pair...
+	solver->rel_field_noise2 = pq->rel_field_noise2;
+	tol2 = get_tolerance(solver);
+	// Now look at all sets of (C, D, ...) stars (subject to field[C] < field[D] < ...)
+	// ("dimquads - 2" because we've set stars A and B at this point)
+	add_stars(pq, field, C, dimquads-2, 0, newpoint, dimquads, solver, tol2);
+}
+
+/*
+ Tries all quads (from all indexes) that have the new star off the
+ diagonal (star C) and "fieldA" as star A.
+ */
+static void try_quads_offdiagonal(solver_t* solver, pquad_store_t* ps,
+								  const double* minAB2s, const double* maxAB2s,
+								  int fieldA, int newpoint) {
+	int field[DQMAX];
+	int i;
+	double tol2;
+
+	field[A] = fieldA;
+	field[C] = newpoint;
+	// (in this loop field[C] > field[D])
+	for (field[B] = field[A] + 1; field[B] < newpoint; field[B]++) {
+		// grab the "pquad" for this AB combo
+		pquad* pq = pquad_store_get(ps, field[A], field[B]);
+		if (!pq->scale_ok) {
+			debug("  bad scale for A=%i, B=%i\n", field[A], field[B]);
+			continue;
+		}
+		// test if this C is in the box:
+		pquad_inbox_set(pq, field[C]);
+		pq->ninbox = field[C] + 1;
+		check_inbox(pq, field[C], solver);
+		if (!pquad_inbox_get(pq, field[C])) {
+			debug("  C is not in the box for A=%i, B=%i\n", field[A], field[B]);
+			continue;
+		}
+		debug("  C is in the box for A=%i, B=%i\n", field[A], field[B]);
+		debug("    box now:");
+		print_inbox(pq);
+		debug("\n");
+
+		solver->rel_field_noise2 = pq->rel_field_noise2;
+
+		for (i = 0; i < pl_size(solver->indexes); i++) {
+			int dimquads;
+			index_t* index = pl_get(solver->indexes, i);
+			if ((pq->scale < minAB2s[i]) ||
+				(pq->scale > maxAB2s[i]))
+				continue;
+			set_index(solver, index);
+			dimquads = index_dimquads(index);
+
+			tol2 = get_tolerance(solver);
+
+			if (dimquads > 3) {
+				// ("dimquads - 3" because we've set stars A, B, and C at this point)
+				add_stars(pq, field, D, dimquads-3, 0, newpoint, dimquads, solver, tol2);
+			} else {
+				TRY_ALL_CODES(pq, field, dimquads, solver, tol2);
+			}
+			if (solver_quitting(solver))
+				return;
+		}
+	}
+}
+
+/*
+ Gives our caller a chance to cancel us midway.  The callback returns
+ how long to wait before calling again; zero means cancel.
+
+ Returns TRUE if we've been cancelled.
+ */
+static anbool check_timer(solver_t* solver, time_t* next_timer_callback_time) {
+	time_t delay;
+	time_t now;
+	if (!solver->timer_callback)
+		return FALSE;
+	now = time(NULL);
+	if (now <= *next_timer_callback_time)
+		return FALSE;
+	update_timeused(solver);
+	delay = solver->timer_callback(solver->userdata);
+	if (delay == 0) // Canceled
+		return TRUE;
+	*next_timer_callback_time = now + delay;
+	return FALSE;
+}
+
+/*
+ Multi-threaded solving.
+
+ Each time we consider a new star, the work is split into "items" that
+ are handed out to a pool of workers.  Each worker has a private copy of
+ the solver_t (so it has its own current index, noise estimates,
+ counters and code-tree query buffer).  The items are numbered in the
+ order that the single-threaded search would visit them:
+
+   [0, Nindexes * newpoint): new star on the diagonal; index-major,
+      then star A;
+   [Nindexes * newpoint, (Nindexes + 1) * newpoint): new star off the
+      diagonal; star A.
+
+ Workers verify the matches they find, but don't accept them; they
+ stash them (tagged with the item number) and the calling thread sorts
+ them and calls solver_accept_match() (and thus the record-match
+ callback) in the same order as the single-threaded search would.  When
+ a worker finds a match that could solve the field, items after it are
+ not started; if it turns out not to solve, the search resumes from the
+ next item.
+ */
+enum {
+	SOLVER_PHASE_INIT,
+	SOLVER_PHASE_SEARCH
+};
+
+struct solver_hit_t {
+	// position in the single-threaded search order.
+	int item;
+	int seq;
+	index_t* index;
+	double verified_logodds;
+	MatchObj mo;
+};
+typedef struct solver_hit_t solver_hit_t;
+
+struct solver_pool_t;
+
+struct solver_worker_t {
+	// this worker's private copy of the solver.
+	solver_t solver;
+	struct solver_pool_t* pool;
+	pthread_t thread;
+	// the item being processed, and the number of hits found in it so far.
+	int item;
+	int seq;
+	// solver_hit_t structs.
+	bl* hits;
+};
+typedef struct solver_worker_t solver_worker_t;
+
+struct solver_pool_t {
+	solver_t* solver;
+	int nworkers;
+	// workers[0] runs in the calling thread.
+	solver_worker_t* workers;
+
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t finished;
+	// incremented each time a batch of items is handed out.
+	int generation;
+	// number of worker threads still working on the current batch.
+	int nrunning;
+	anbool shutdown;
+
+	int phase;
+	int newpoint;
+	int nextitem;
+	int nitems;
+	// items after this one are not started.
+	int cutoff;
+	// the timer callback cancelled us.
+	anbool cancelled;
+	time_t next_timer_callback_time;
+
+	pquad_store_t* pqstore;
+	const double* minAB2s;
+	const double* maxAB2s;
+};
+typedef struct solver_pool_t solver_pool_t;
+
+static anbool solver_quitting(const solver_t* sp) {
+	const solver_worker_t* w;
+	if (sp->quit_now)
+		return TRUE;
+	w = sp->worker;
+	if (!w)
+		return FALSE;
+	return (w->pool->cancelled || w->pool->solver->quit_now ||
+			w->item > w->pool->cutoff);
+}
+
+// Moves the counters from "from" into "to".
+static void move_counters(solver_t* to, solver_t* from) {
+	int i;
+	to->numtries += from->numtries;
+	to->nummatches += from->nummatches;
+	to->numscaleok += from->numscaleok;
+	to->num_cxdx_skipped += from->num_cxdx_skipped;
+	to->num_meanx_skipped += from->num_meanx_skipped;
+	to->num_radec_skipped += from->num_radec_skipped;
+	to->num_abscale_skipped += from->num_abscale_skipped;
+	for (i=0; i<4; i++) {
+		to->num_verify_stage[i] += from->num_verify_stage[i];
+		from->num_verify_stage[i] = 0;
+	}
+	from->numtries = 0;
+	from->nummatches = 0;
+	from->numscaleok = 0;
+	from->num_cxdx_skipped = 0;
+	from->num_meanx_skipped = 0;
+	from->num_radec_skipped = 0;
+	from->num_abscale_skipped = 0;
+}
+
+static void worker_add_hit(solver_worker_t* w, MatchObj* mo,
+						   double verified_logodds) {
+	solver_pool_t* pool = w->pool;
+	solver_hit_t hit;
+	hit.item = w->item;
+	hit.seq = w->seq++;
+	hit.index = w->solver.index;
+	hit.verified_logodds = verified_logodds;
+	memcpy(&hit.mo, mo, sizeof(MatchObj));
+	bl_append(w->hits, &hit);
+
+	// Could this match solve the field?  If so, don't start any items
+	// that come after it.
+	if (mo->logodds >= pool->solver->logratio_tokeep) {
+		pthread_mutex_lock(&pool->lock);
+		if (w->item < pool->cutoff)
+			pool->cutoff = w->item;
+		pthread_mutex_unlock(&pool->lock);
+	}
+}
+
+static void worker_do_item(solver_worker_t* w, int item) {
+	solver_pool_t* pool = w->pool;
+	solver_t* sp = &(w->solver);
+	int newpoint = pool->newpoint;
+	int ndiag;
+
+	w->item = item;
+	w->seq = 0;
+	if (pool->phase == SOLVER_PHASE_INIT) {
+		init_pquad(sp, pool->pqstore, item, newpoint);
+		return;
+	}
+	ndiag = pl_size(sp->indexes) * newpoint;
+	if (item < ndiag)
+		try_quads_diagonal(sp, pool->pqstore, pool->minAB2s, pool->maxAB2s,
+						   item / newpoint, item % newpoint, newpoint);
+	else
+		try_quads_offdiagonal(sp, pool->pqstore, pool->minAB2s, pool->maxAB2s,
+							  item - ndiag, newpoint);
+}
+
+static void worker_run_items(solver_worker_t* w) {
+	solver_pool_t* pool = w->pool;
+	while (1) {
+		int item;
+		anbool stop;
+		pthread_mutex_lock(&pool->lock);
+		item = pool->nextitem++;
+		stop = (item >= pool->nitems || item > pool->cutoff ||
+				pool->cancelled || pool->solver->quit_now);
+		pthread_mutex_unlock(&pool->lock);
+		if (stop)
+			break;
+		// The caller's callbacks are only called from the calling thread.
+		if (w == pool->workers &&
+			check_timer(pool->solver, &pool->next_timer_callback_time)) {
+			pool->cancelled = TRUE;
+			break;
+		}
+		worker_do_item(w, item);
+	}
+	// (so that solver_quitting() doesn't look at a stale item)
+	w->item = -1;
+}
+
+static void* worker_thread(void* arg) {
+	solver_worker_t* w = arg;
+	solver_pool_t* pool = w->pool;
+	int generation = 0;
+	while (1) {
+		pthread_mutex_lock(&pool->lock);
+		while (!pool->shutdown && pool->generation == generation)
+			pthread_cond_wait(&pool->start, &pool->lock);
+		if (pool->shutdown) {
+			pthread_mutex_unlock(&pool->lock);
+			break;
+		}
+		generation = pool->generation;
+		pthread_mutex_unlock(&pool->lock);
+
+		worker_run_items(w);
+
+		pthread_mutex_lock(&pool->lock);
+		pool->nrunning--;
+		if (pool->nrunning == 0)
+			pthread_cond_signal(&pool->finished);
+		pthread_mutex_unlock(&pool->lock);
+	}
+	return NULL;
+}
+
+static solver_pool_t* solver_pool_new(solver_t* solver, int nthreads,
+									  pquad_store_t* pqstore,
+									  const double* minAB2s,
+									  const double* maxAB2s,
+									  time_t next_timer_callback_time) {
+	solver_pool_t* pool;
+	int i;
+
+	pool = calloc(1, sizeof(solver_pool_t));
+	pool->solver = solver;
+	pool->pqstore = pqstore;
+	pool->minAB2s = minAB2s;
+	pool->maxAB2s = maxAB2s;
+	pool->next_timer_callback_time = next_timer_callback_time;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->start, NULL);
+	pthread_cond_init(&pool->finished, NULL);
+
+	pool->workers = calloc(nthreads, sizeof(solver_worker_t));
+	for (i=0; i<nthreads; i++) {
+		solver_worker_t* w = pool->workers + i;
+		memcpy(&(w->solver), solver, sizeof(solver_t));
+		solver_reset_counters(&(w->solver));
+		w->solver.num_meanx_skipped = 0;
+		w->solver.worker = w;
+		w->solver.code_results = NULL;
+		w->solver.vscratch = NULL;
+		w->pool = pool;
+		w->item = -1;
+		w->hits = bl_new(16, sizeof(solver_hit_t));
+		pool->nworkers++;
+		if (i == 0)
+			continue;
+		if (pthread_create(&w->thread, NULL, worker_thread, w)) {
+			SYSERROR("Failed to create solver thread %i; using %i threads", i, i);
+			bl_free(w->hits);
+			pool->nworkers--;
+			break;
+		}
+	}
+	logverb("Solver: using %i threads\n", pool->nworkers);
+	return pool;
+}
+
+static void solver_pool_free(solver_pool_t* pool) {
+	int i;
+	pthread_mutex_lock(&pool->lock);
+	pool->shutdown = TRUE;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+	for (i=0; i<pool->nworkers; i++) {
+		solver_worker_t* w = pool->workers + i;
+		if (i)
+			pthread_join(w->thread, NULL);
+		free_code_results(&(w->solver));
+		verify_scratch_free(w->solver.vscratch);
+		bl_free(w->hits);
+	}
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->start);
+	pthread_cond_destroy(&pool->finished);
+	free(pool->workers);
+	free(pool);
+}
+
+// Runs items [first, nitems) of the given phase on all workers.
+static void solver_pool_run(solver_pool_t* pool, int phase, int newpoint,
+							int first, int nitems) {
+	pthread_mutex_lock(&pool->lock);
+	pool->phase = phase;
+	pool->newpoint = newpoint;
+	pool->nextitem = first;
+	pool->nitems = nitems;
+	pool->cutoff = nitems;
+	pool->nrunning = pool->nworkers - 1;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+
+	worker_run_items(pool->workers);
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->nrunning > 0)
+		pthread_cond_wait(&pool->finished, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+static int compare_hits(const void* v1, const void* v2) {
+	const solver_hit_t* h1 = *(const solver_hit_t**)v1;
+	const solver_hit_t* h2 = *(const solver_hit_t**)v2;
+	if (h1->item != h2->item)
+		return (h1->item < h2->item) ? -1 : 1;
+	if (h1->seq != h2->seq)
+		return (h1->seq < h2->seq) ? -1 : 1;
+	return 0;
+}
+
+/*
+ Accepts (in order) the matches the workers found in items up to the
+ cutoff; matches in later items are discarded since those items will be
+ searched again.
+ */
+static void solver_pool_merge(solver_pool_t* pool) {
+	solver_t* sp = pool->solver;
+	solver_hit_t** hits;
+	int i, j, N;
+
+	N = 0;
+	for (i=0; i<pool->nworkers; i++) {
+		move_counters(sp, &(pool->workers[i].solver));
+		N += bl_size(pool->workers[i].hits);
+	}
+	if (!N)
+		return;
+	hits = malloc(N * sizeof(solver_hit_t*));
+	N = 0;
+	for (i=0; i<pool->nworkers; i++) {
+		bl* list = pool->workers[i].hits;
+		for (j=0; j<bl_size(list); j++)
+			hits[N++] = bl_access(list, j);
+	}
+	qsort(hits, N, sizeof(solver_hit_t*), compare_hits);
+
+	for (i=0; i<N; i++) {
+		solver_hit_t* hit = hits[i];
+		if (sp->quit_now || hit->item > pool->cutoff) {
+			verify_free_matchobj(&hit->mo);
+			continue;
+		}
+		set_index(sp, hit->index);
+		hit->mo.quads_tried = sp->numtries;
+		hit->mo.quads_matched = sp->nummatches;
+		hit->mo.quads_scaleok = sp->numscaleok;
+		if (solver_accept_match(sp, &hit->mo, NULL, hit->verified_logodds))
+			sp->quit_now = TRUE;
+	}
+	free(hits);
+	for (i=0; i<pool->nworkers; i++)
+		bl_remove_all(pool->workers[i].hits);
+}
+
+/*
+ Tries all quads involving the new star "newpoint", using all workers.
+ */
+static void solver_pool_try_newpoint(solver_pool_t* pool, int newpoint) {
+	solver_t* sp = pool->solver;
+	int first, nitems;
+
+	solver_pool_run(pool, SOLVER_PHASE_INIT, newpoint, 0, newpoint);
+	if (pool->cancelled)
+		return;
+
+	nitems = (pl_size(sp->indexes) + 1) * newpoint;
+	first = 0;
+	while (first < nitems) {
+		solver_pool_run(pool, SOLVER_PHASE_SEARCH, newpoint, first, nitems);
+		solver_pool_merge(pool);
+		if (sp->quit_now || pool->cancelled)
+			return;
+		first = pool->cutoff + 1;
+	}
+}
+
 // The real deal
 void solver_run(solver_t* solver) {
 	int numxy, newpoint;
@@ -726,10 +1415,10 @@ void solver_run(solver_t* solver) {
 	double usertime, systime;
 	// first timer callback is called after 1 second
 	time_t next_timer_callback_time = time(NULL) + 1;
-	pquad* pquads;
+	pquad_store_t* ps;
 	int num_indexes;
-    double tol2;
     int field[DQMAX];
+	solver_pool_t* pool = NULL;
 
 	get_resource_stats(&usertime, &systime, NULL);
 
@@ -791,18 +1480,18 @@ void solver_run(solver_t* solver) {
 		 MIN(M_PI, arcsec2rad(field_diag * solver->funits_upper)) ...
 		 */
 
-		pquads = calloc(numxy * numxy, sizeof(pquad));
+		if (!solver->pqstore)
+			solver->pqstore = pquad_store_new();
+		ps = solver->pqstore;
+		if (pquad_store_reset(ps, numxy))
+			return;
 
 		/* We maintain an array of "potential quads" (pquad) structs, where
-		 * each struct corresponds to one choice of stars A and B; the struct
-		 * at index (B * numxy + A) holds information about quads that could be
-		 * created using stars A,B.
-		 *
-		 * (We only use the above-diagonal elements of this 2D array because
-		 * A<B.)
+		 * each struct corresponds to one choice of stars A and B; see
+		 * pquad_store_get().
 		 *
 		 * For each AB pair, we cache the scale and the rotation parameters,
-		 * and we keep an array "inbox" of length "numxy" of booleans, one for
+		 * and we keep a bitset "inbox" of length "numxy", one bit for
 		 * each star, which say whether that star is eligible to be star C or D
 		 * of a quad with AB at the corners.  (Obviously A and B aren't
 		 * eligible).
@@ -818,7 +1507,7 @@ void solver_run(solver_t* solver) {
 			debug("startobj > 0; priming pquad arrays.\n");
 			for (field[B] = 0; field[B] < solver->startobj; field[B]++) {
 				for (field[A] = 0; field[A] < field[B]; field[A]++) {
-					pquad* pq = pquads + field[B] * numxy + field[A];
+					pquad* pq = pquad_store_get(ps, field[A], field[B]);
 					pq->fieldA = field[A];
 					pq->fieldB = field[B];
 					debug("trying A=%i, B=%i\n", field[A], field[B]);
@@ -827,12 +1516,12 @@ void solver_run(solver_t* solver) {
 						debug("  bad scale for A=%i, B=%i\n", field[A], field[B]);
 						continue;
 					}
-					pq->xy = malloc(numxy * 2 * sizeof(double));
-					pq->inbox = malloc(numxy * sizeof(anbool));
-					memset(pq->inbox, TRUE, solver->startobj);
-					pq->ninbox = solver->startobj;
-					pq->inbox[field[A]] = FALSE;
-					pq->inbox[field[B]] = FALSE;
+					if (pquad_store_alloc(ps, pq, solver->startobj)) {
+						pq->scale_ok = FALSE;
+						continue;
+					}
+					pquad_inbox_clear(pq, field[A]);
+					pquad_inbox_clear(pq, field[B]);
 					check_inbox(pq, 0, solver);
 					debug("  inbox(A=%i, B=%i): ", field[A], field[B]);
 					print_inbox(pq);
@@ -850,133 +1539,50 @@ void solver_run(solver_t* solver) {
 		 * scale is acceptable, computing the transformation to code
 		 * coordinates, and deciding which C,D stars are in the circle.
 		 */
+		if (solver->nthreads > 1)
+			pool = solver_pool_new(solver, solver->nthreads, ps, minAB2s,
+								   maxAB2s, next_timer_callback_time);
+
 		for (newpoint = solver->startobj; newpoint < numxy; newpoint++) {
 
 			debug("Trying newpoint=%i\n", newpoint);
 
-			// Give our caller a chance to cancel us midway. The callback
-			// returns how long to wait before calling again.
-
-			if (solver->timer_callback) {
-				time_t delay;
-                time_t now = time(NULL);
-				if (now > next_timer_callback_time) {
-					update_timeused(solver);
-					delay = solver->timer_callback(solver->userdata);
-					if (delay == 0) // Canceled
-						break;
-					next_timer_callback_time = now + delay;
-				}
-			}
+			// Give our caller a chance to cancel us midway.
+			if (check_timer(solver, pool ? &pool->next_timer_callback_time :
+							&next_timer_callback_time))
+				break;
 
 			solver->last_examined_object = newpoint;
-			// quads with the new star on the diagonal:
-			field[B] = newpoint;
 			debug("Trying quads with B=%i\n", newpoint);
-	
-            // first do an index-independent scale check...
-            for (field[A] = 0; field[A] < newpoint; field[A]++) {
-				// initialize the "pquad" struct for this AB combo.
-				pquad* pq = pquads + field[B] * numxy + field[A];
-				pq->fieldA = field[A];
-				pq->fieldB = field[B];
-				debug("  trying A=%i, B=%i\n", field[A], field[B]);
-				check_scale(pq, solver);
-				if (!pq->scale_ok) {
-					debug("    bad scale for A=%i, B=%i\n", field[A], field[B]);
-					continue;
-				}
-				// initialize the "inbox" array:
-				pq->inbox = malloc(numxy * sizeof(anbool));
-				pq->xy = malloc(numxy * 2 * sizeof(double));
-				// -try all stars up to "newpoint"...
-				assert(sizeof(anbool) == 1);
-				memset(pq->inbox, TRUE, newpoint + 1);
-				pq->ninbox = newpoint + 1;
-				// -except A and B.
-				pq->inbox[field[A]] = FALSE;
-				pq->inbox[field[B]] = FALSE;
-				check_inbox(pq, 0, solver);
-				debug("    inbox(A=%i, B=%i): ", field[A], field[B]);
-				print_inbox(pq);
-            }
-
-            // Now iterate through the different indices
-            for (i = 0; i < num_indexes; i++) {
-                index_t* index = pl_get(solver->indexes, i);
-                int dimquads;
-                set_index(solver, index);
-                dimquads = index_dimquads(index);
-                for (field[A] = 0; field[A] < newpoint; field[A]++) {
-                    // initialize the "pquad" struct for this AB combo.
-                    pquad* pq = pquads + field[B] * numxy + field[A];
-					if (!pq->scale_ok)
-						continue;
-                    if ((pq->scale < minAB2s[i]) ||
-                        (pq->scale > maxAB2s[i]))
-                        continue;
-                    // set code tolerance for this index and AB pair...
-                    solver->rel_field_noise2 = pq->rel_field_noise2;
-                    tol2 = get_tolerance(solver);
-					// Now look at all sets of (C, D, ...) stars (subject to field[C] < field[D] < ...)
-                    // ("dimquads - 2" because we've set stars A and B at this point)
-                    add_stars(pq, field, C, dimquads-2, 0, newpoint, dimquads, solver, tol2);
-                    if (solver->quit_now)
-                        goto quitnow;
-				}
-			}
 
-			if (solver->quit_now)
-				goto quitnow;
-
-			// Now try building quads with the new star not on the diagonal:
-			field[C] = newpoint;
-            // (in this loop field[C] > field[D])
-			debug("Trying quads with C=%i\n", newpoint);
-			for (field[A] = 0; field[A] < newpoint; field[A]++) {
-				for (field[B] = field[A] + 1; field[B] < newpoint; field[B]++) {
-					// grab the "pquad" for this AB combo
-					pquad* pq = pquads + field[B] * numxy + field[A];
-					if (!pq->scale_ok) {
-						debug("  bad scale for A=%i, B=%i\n", field[A], field[B]);
-						continue;
-					}
-					// test if this C is in the box:
-					pq->inbox[field[C]] = TRUE;
-					pq->ninbox = field[C] + 1;
-					check_inbox(pq, field[C], solver);
-					if (!pq->inbox[field[C]]) {
-						debug("  C is not in the box for A=%i, B=%i\n", field[A], field[B]);
-						continue;
-					}
-					debug("  C is in the box for A=%i, B=%i\n", field[A], field[B]);
-                    debug("    box now:");
-					print_inbox(pq);
-					debug("\n");
-
-                    solver->rel_field_noise2 = pq->rel_field_noise2;
-
-					for (i = 0; i < pl_size(solver->indexes); i++) {
-                        int dimquads;
-						index_t* index = pl_get(solver->indexes, i);
-						if ((pq->scale < minAB2s[i]) ||
-					        (pq->scale > maxAB2s[i]))
-							continue;
-                        set_index(solver, index);
-						dimquads = index_dimquads(index);
-
-                        tol2 = get_tolerance(solver);
-
-						if (dimquads > 3) {
-							// ("dimquads - 3" because we've set stars A, B, and C at this point)
-							add_stars(pq, field, D, dimquads-3, 0, newpoint, dimquads, solver, tol2);
-						} else {
-							TRY_ALL_CODES(pq, field, dimquads, solver, tol2);
-						}
+			if (pool) {
+				solver_pool_try_newpoint(pool, newpoint);
+				if (solver->quit_now || pool->cancelled)
+					goto quitnow;
+			} else {
+				// quads with the new star on the diagonal:
+				// first do an index-independent scale check...
+				for (field[A] = 0; field[A] < newpoint; field[A]++)
+					init_pquad(solver, ps, field[A], newpoint);
+
+				// Now iterate through the different indices
+				for (i = 0; i < num_indexes; i++) {
+					for (field[A] = 0; field[A] < newpoint; field[A]++) {
+						try_quads_diagonal(solver, ps, minAB2s, maxAB2s,
+										   i, field[A], newpoint);
 						if (solver->quit_now)
-                            goto quitnow;
+							goto quitnow;
 					}
 				}
+
+				// Now try building quads with the new star not on the diagonal:
+				debug("Trying quads with C=%i\n", newpoint);
+				for (field[A] = 0; field[A] < newpoint; field[A]++) {
+					try_quads_offdiagonal(solver, ps, minAB2s, maxAB2s,
+										  field[A], newpoint);
+					if (solver->quit_now)
+						goto quitnow;
+				}
 			}
 			logverb("object %u of %u: %i quads tried, %i matched.\n",
 				   newpoint + 1, numxy, solver->numtries, solver->nummatches);
@@ -988,12 +1594,11 @@ void solver_run(solver_t* solver) {
 		}
 
 	quitnow:
-		for (i = 0; i < (numxy*numxy); i++) {
-			pquad* pq = pquads + i;
-			free(pq->inbox);
-			free(pq->xy);
-		}
-		free(pquads);
+		if (pool)
+			solver_pool_free(pool);
+		logverb("Pquad store: %i AB pairs in use, %.1f MB (peak %.1f MB)\n",
+				ps->nslices, pquad_store_used_bytes(ps) * 1e-6,
+				ps->peak_bytes * 1e-6);
 	}
 }
 
@@ -1007,9 +1612,11 @@ static void try_all_codes(const pquad* pq,
     int dimcode = (dimquad - 2) * 2;
     double code[DCMAX];
     double flipcode[DCMAX];
+    code_batch_t batch;
     int i;
 
     solver->numtries++;
+    batch.n = 0;
 
     debug("  trying quad [");
 	for (i=0; i<dimquad; i++) {
@@ -1030,7 +1637,7 @@ static void try_all_codes(const pquad* pq,
 			debug("%s%g", (i?", ":""), code[i]);
 		debug("].\n");
 
-		try_all_codes_2(fieldstars, dimquad, code, solver, FALSE, tol2);
+		try_all_codes_2(fieldstars, dimquad, code, solver, FALSE, &batch);
 	}
 	if (solver->parity == PARITY_FLIP ||
 	        solver->parity == PARITY_BOTH) {
@@ -1042,8 +1649,10 @@ static void try_all_codes(const pquad* pq,
 			debug("%s%g", (i?", ":""), flipcode[i]);
 		debug("].\n");
 
-		try_all_codes_2(fieldstars, dimquad, flipcode, solver, TRUE, tol2);
+		try_all_codes_2(fieldstars, dimquad, flipcode, solver, TRUE, &batch);
 	}
+
+	search_codes(solver, &batch, dimquad, tol2);
 }
 
 /**
@@ -1052,9 +1661,8 @@ static void try_all_codes(const pquad* pq,
  */
 static void try_all_codes_2(const int* fieldstars, int dimquad,
                             const double* code, solver_t* solver,
-                            anbool current_parity, double tol2) {
+                            anbool current_parity, code_batch_t* batch) {
 	int i;
-	kdtree_qres_t* result = NULL;
     int dimcode = (dimquad - 2) * 2;
 	int stars[DQMAX];
 	double flipcode[DCMAX];
@@ -1070,9 +1678,7 @@ static void try_all_codes_2(const int* fieldstars, int dimquad,
 		placed[i] = FALSE;
 
 	try_permutations(fieldstars, dimquad, code, solver, current_parity,
-					 tol2, stars, NULL, 0, placed, &result);
-	if (unlikely(solver->quit_now))
-		goto bailout;
+					 stars, NULL, 0, placed, batch);
 
 	// Flipped:
 	stars[0] = fieldstars[1];
@@ -1085,10 +1691,7 @@ static void try_all_codes_2(const int* fieldstars, int dimquad,
 		placed[i] = FALSE;
 
 	try_permutations(fieldstars, dimquad, flipcode, solver, current_parity,
-					 tol2, stars, NULL, 0, placed, &result);
-
-bailout:
-	kdtree_free_query(result);
+					 stars, NULL, 0, placed, batch);
 }
 
 /**
@@ -1098,13 +1701,10 @@ bailout:
 static void try_permutations(const int* origstars, int dimquad,
 							 const double* origcode,
 							 solver_t* solver, anbool current_parity,
-							 double tol2,
 							 int* stars, double* code,
 							 int slot, anbool* placed,
-							 kdtree_qres_t** presult) {
+							 code_batch_t* batch) {
 	int i;
-	int options = KD_OPTIONS_SMALL_RADIUS | KD_OPTIONS_COMPUTE_DISTS |
-		KD_OPTIONS_NO_RESIZE_RESULTS | KD_OPTIONS_USE_SPLIT;
 	double mycode[DCMAX];
 	int Nstars = dimquad - NBACK;
 	int lastslot = dimquad - NBACK - 1;
@@ -1119,8 +1719,8 @@ static void try_permutations(const int* origstars, int dimquad,
 	 "origcode").
 
 	 For example, if "dimquad" is 5, and "origstars" contains
-	 A,B,C,D,E, we want to call "resolve_matches" with the following
-	 combinations in "stars":
+	 A,B,C,D,E, we want to add the following combinations in "stars"
+	 to the batch of codes to search for:
 
 	 AB CDE
 	 AB CED
@@ -1136,6 +1736,11 @@ static void try_permutations(const int* origstars, int dimquad,
 	 elements are already filled by stars A and B.
 	 */
 
+	// (this also lets the compiler see that "mycode" is big enough.)
+	assert(Nstars <= DQMAX - NBACK);
+	if (Nstars > DQMAX - NBACK)
+		return;
+
 	if (code == NULL)
 		code = mycode;
 
@@ -1184,8 +1789,8 @@ static void try_permutations(const int* origstars, int dimquad,
 		if (slot < lastslot) {
 			placed[i] = TRUE;
 			try_permutations(origstars, dimquad, origcode, solver,
-							 current_parity, tol2, stars, code, 
-							 slot+1, placed, presult);
+							 current_parity, stars, code,
+							 slot+1, placed, batch);
 			placed[i] = FALSE;
 
 		} else {
@@ -1194,25 +1799,52 @@ static void try_permutations(const int* origstars, int dimquad,
 				continue;
 #endif
 				
-			// Search with the code we've built.
-			*presult = kdtree_rangesearch_options_reuse
-                (solver->index->codekd->tree, *presult, code, tol2, options);
-			//debug("      trying ABCD = [%i %i %i %i]: %i results.\n",
-            //fstars[A], fstars[B], fstars[C], fstars[D], result->nres);
-
-			if ((*presult)->nres) {
-				double pixvals[DQMAX*2];
-				int j;
-				for (j=0; j<dimquad; j++) {
-					setx(pixvals, j, field_getx(solver, stars[j]));
-					sety(pixvals, j, field_gety(solver, stars[j]));
-				}
-				resolve_matches(*presult, pixvals, stars, dimquad, solver,
-                                current_parity);
+			// Queue up the code we've built.
+			assert(batch->n < CODE_BATCH_MAX);
+			memcpy(batch->codes + batch->n * 2 * Nstars, code,
+				   2 * Nstars * sizeof(double));
+			memcpy(batch->stars[batch->n], stars, dimquad * sizeof(int));
+			batch->parity[batch->n] = current_parity;
+			batch->n++;
+		}
+	}
+}
+
+/**
+ Searches the code tree for all the codes in "batch" at once, then
+ resolves the matches in the order the codes were added.
+ */
+static void search_codes(solver_t* solver, const code_batch_t* batch,
+						 int dimquad, double tol2) {
+	int options = KD_OPTIONS_SMALL_RADIUS | KD_OPTIONS_COMPUTE_DISTS |
+		KD_OPTIONS_NO_RESIZE_RESULTS | KD_OPTIONS_USE_SPLIT;
+	int i, j;
+
+	if (!batch->n)
+		return;
+	if (!solver->code_results)
+		solver->code_results = calloc(CODE_BATCH_MAX, sizeof(kdtree_qres_t*));
+	if (kdtree_rangesearch_batch(solver->index->codekd->tree,
+								 solver->code_results, batch->codes,
+								 batch->n, tol2, options)) {
+		ERROR("Code-tree search failed");
+		return;
+	}
+	for (i=0; i<batch->n; i++) {
+		kdtree_qres_t* res = solver->code_results[i];
+		//debug("      trying ABCD = [%i %i %i %i]: %i results.\n",
+		//fstars[A], fstars[B], fstars[C], fstars[D], res->nres);
+		if (res->nres) {
+			double pixvals[DQMAX*2];
+			for (j=0; j<dimquad; j++) {
+				setx(pixvals, j, field_getx(solver, batch->stars[i][j]));
+				sety(pixvals, j, field_gety(solver, batch->stars[i][j]));
 			}
-			if (unlikely(solver->quit_now))
-				return;
+			resolve_matches(res, pixvals, batch->stars[i], dimquad, solver,
+							batch->parity[i]);
 		}
+		if (unlikely(solver_quitting(solver)))
+			return;
 	}
 }
 
@@ -1312,7 +1944,7 @@ static void resolve_matches(kdtree_qres_t* krez, const double *field,
 		if (solver_handle_hit(solver, &mo, NULL, FALSE))
 			solver->quit_now = TRUE;
 
-		if (unlikely(solver->quit_now))
+		if (unlikely(solver_quitting(solver)))
 			return;
 	}
 }
@@ -1323,9 +1955,25 @@ void solver_inject_match(solver_t* solver, MatchObj* mo, sip_t* sip) {
 
 static int solver_handle_hit(solver_t* sp, MatchObj* mo, sip_t* sip,
                              anbool fake_match) {
+	double verified_logodds;
+	solver_verify_match(sp, mo, sip, fake_match, &verified_logodds);
+	if (sp->worker) {
+		// the calling thread will accept it in due course.
+		worker_add_hit(sp->worker, mo, verified_logodds);
+		return FALSE;
+	}
+	return solver_accept_match(sp, mo, sip, verified_logodds);
+}
+
+/*
+ Runs verification (and tune-up) on a match.  This only reads the
+ solver, so it is safe to call from worker threads.
+ */
+static void solver_verify_match(solver_t* sp, MatchObj* mo, sip_t* sip,
+								anbool fake_match, double* p_verified_logodds) {
 	double match_distance_in_pixels2;
-    anbool solved;
 	double logaccept;
+	int stage;
 
 	mo->indexid = sp->index->indexid;
 	mo->healpix = sp->index->healpix;
@@ -1339,18 +1987,17 @@ static int solver_handle_hit(solver_t* sp, MatchObj* mo, sip_t* sip,
 
 	logaccept = MIN(sp->logratio_tokeep, sp->logratio_totune);
 
-	verify_hit(sp->index->starkd, sp->index->cutnside,
-			   mo, sip, sp->vf, match_distance_in_pixels2,
-	           sp->distractor_ratio, sp->field_maxx, sp->field_maxy,
-	           sp->logratio_bail_threshold, logaccept,
-			   sp->logratio_stoplooking,
-			   sp->distance_from_quad_bonus, fake_match);
-	mo->nverified = sp->num_verified++;
+	if (!sp->vscratch)
+		sp->vscratch = verify_scratch_new();
 
-	if (mo->logodds >= sp->best_logodds) {
-		sp->best_logodds = mo->logodds;
-		logverb("Got a new best match: logodds %g.\n", mo->logodds);
-	}
+	stage = verify_hit_reuse(sp->vscratch, sp->index->starkd, sp->index->cutnside,
+							 mo, sip, sp->vf, match_distance_in_pixels2,
+							 sp->distractor_ratio, sp->field_maxx, sp->field_maxy,
+							 sp->logratio_bail_threshold, logaccept,
+							 sp->logratio_stoplooking,
+							 sp->distance_from_quad_bonus, fake_match);
+	sp->num_verify_stage[stage]++;
+	*p_verified_logodds = mo->logodds;
 
 	if (mo->logodds >= sp->logratio_totune &&
         mo->logodds < sp->logratio_tokeep) {
@@ -1363,19 +2010,35 @@ static int solver_handle_hit(solver_t* sp, MatchObj* mo, sip_t* sip,
 		// Since we tuned up this solution, we can't just accept the
 		// resulting log-odds at face value.
 		if (!fake_match) {
-			verify_hit(sp->index->starkd, sp->index->cutnside,
-					   mo, mo->sip, sp->vf, match_distance_in_pixels2,
-					   sp->distractor_ratio,
-					   sp->field_maxx, sp->field_maxy,
-					   sp->logratio_bail_threshold,
-					   sp->logratio_tokeep,
-					   sp->logratio_stoplooking,
-					   sp->distance_from_quad_bonus,
-					   fake_match);
+			verify_hit_reuse(sp->vscratch, sp->index->starkd, sp->index->cutnside,
+							 mo, mo->sip, sp->vf, match_distance_in_pixels2,
+							 sp->distractor_ratio,
+							 sp->field_maxx, sp->field_maxy,
+							 sp->logratio_bail_threshold,
+							 sp->logratio_tokeep,
+							 sp->logratio_stoplooking,
+							 sp->distance_from_quad_bonus,
+							 fake_match);
 			logverb("Checking tuned result: logodds = %g (%g)\n",
                     mo->logodds, exp(mo->logodds));
 		}
 	}
+}
+
+/*
+ Records a verified match: updates the best match, calls the
+ record-match callback, etc.  Returns TRUE if the field is solved.
+ */
+static int solver_accept_match(solver_t* sp, MatchObj* mo, sip_t* sip,
+							   double verified_logodds) {
+    anbool solved;
+
+	mo->nverified = sp->num_verified++;
+
+	if (verified_logodds >= sp->best_logodds) {
+		sp->best_logodds = verified_logodds;
+		logverb("Got a new best match: logodds %g.\n", verified_logodds);
+	}
 
 	if (mo->logodds < sp->logratio_toprint)
 		return FALSE;
@@ -1567,6 +2230,7 @@ void solver_set_default_values(solver_t* solver) {
     solver->verify_pix = DEFAULT_VERIFY_PIX;
 	solver->verify_uniformize = TRUE;
 	solver->verify_dedup = TRUE;
+	solver->verify_early_reject = TRUE;
 	solver->distance_from_quad_bonus = TRUE;
 	solver->tweak_aborder = DEFAULT_TWEAK_ABORDER;
 	solver->tweak_abporder = DEFAULT_TWEAK_ABPORDER;
@@ -1579,6 +2243,9 @@ void solver_clear_indexes(solver_t* solver) {
 
 void solver_cleanup(solver_t* solver) {
 	solver_free_field(solver);
+	pquad_store_free(solver->pqstore);
+	solver->pqstore = NULL;
+	free_code_results(solver);
 	pl_free(solver->indexes);
     solver->indexes = NULL;
 	if (solver->have_best_match) {
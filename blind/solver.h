@@ -50,6 +50,8 @@ enum {
 #define DEFAULT_BAIL_THRESHOLD 1e-100
 
 struct verify_field_t;
+struct solver_worker_t;
+struct pquad_store_t;
 struct solver_t {
 
 	// FIELDS REQUIRED FROM THE CALLER BEFORE CALLING SOLVER_RUN
@@ -86,6 +88,9 @@ struct solver_t {
 
 	anbool verify_uniformize;
 	anbool verify_dedup;
+	// Give up verifying a match as soon as an upper bound on its
+	// log-odds shows it can't be printed, tuned, or kept?
+	anbool verify_early_reject;
 
 	anbool do_tweak;
 
@@ -150,6 +155,12 @@ struct solver_t {
 	// calling again.  The parameter is "userdata".
 	time_t (*timer_callback)(void*);
 
+	// Number of threads to use in solver_run().  Zero or one means run
+	// in the calling thread only.  The callbacks above are always called
+	// from the calling thread, and matches are passed to them in the same
+	// order as in the single-threaded search.
+	int nthreads;
+
 	// FIELDS THAT AFFECT THE RUNNING SOLVER ON CALLBACK
 	// =================================================
 
@@ -175,6 +186,10 @@ struct solver_t {
 	int num_abscale_skipped;
 	// The number of times we ran verification on a quad.
 	int num_verified;
+	// The number of matches that staged verification rejected at each
+	// stage (indexed by VERIFY_REJECTED_*); [0] counts the matches that
+	// were fully verified.
+	int num_verify_stage[4];
 
 	// INTERNAL PARAMETERS; DO NOT MODIFY
 	// ==================================
@@ -218,6 +233,21 @@ struct solver_t {
 
 	// Cached data about this field, for verify_hit().
 	verify_field_t* vf;
+
+	// Scratch space for verify_hit_reuse(), kept for the life of the
+	// field (each worker thread has its own).
+	verify_scratch_t* vscratch;
+
+	// Storage for the AB-pair "pquad"s; kept across fields (and runs)
+	// until solver_cleanup().
+	struct pquad_store_t* pqstore;
+
+	// Reused results of the batched code-tree searches.
+	kdtree_qres_t** code_results;
+
+	// Non-NULL in the private copies of the solver used by solver_run()'s
+	// worker threads.
+	struct solver_worker_t* worker;
 };
 typedef struct solver_t solver_t;
 
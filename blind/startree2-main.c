@@ -29,7 +29,7 @@
 #include "log.h"
 #include "fitsioutils.h"
 
-const char* OPTIONS = "hvL:d:t:bsSci:o:R:D:";
+const char* OPTIONS = "hvL:d:t:bsSci:o:R:D:k:V";
 
 void printHelp(char* progname) {
 	boilerplate_help_header(stdout);
@@ -43,7 +43,9 @@ void printHelp(char* progname) {
 		   "    [-t  <tree type>]:  {double,float,u32,u16}, default u32.\n"
 		   "    [-d  <data type>]:  {double,float,u32,u16}, default u32.\n"
 		   "    [-S]: include separate splitdim array\n"
+		   "    [-V]: store the nodes in van Emde Boas order (fewer page faults when mmapped)\n"
 		   "    [-c]: run kdtree_check on the resulting tree\n"
+		   "    [-k <threads>]: number of threads for building the kdtree (default 1)\n"
 		   "    [-v]: +verbose\n"
 		   "\n", progname);
 }
@@ -109,6 +111,12 @@ int main(int argc, char *argv[]) {
 		case 'S':
 			buildopts |= KD_BUILD_SPLITDIM;
 			break;
+		case 'V':
+			buildopts |= KD_BUILD_VEB;
+			break;
+		case 'k':
+			kdtree_set_build_threads(atoi(optarg));
+			break;
 		case 'v':
 			loglvl++;
 			break;
@@ -111,8 +111,8 @@ startree_t* startree_build(fitstable_t* intable,
 		datatype = KDT_DATA_U32;
 	if (!treetype)
 		treetype = KDT_TREE_U32;
-	if (!buildopts)
-		buildopts = KD_BUILD_SPLIT;
+	if (!(buildopts & (KD_BUILD_BBOX | KD_BUILD_SPLIT)))
+		buildopts |= KD_BUILD_SPLIT;
 	if (!Nleaf)
 		Nleaf = 25;
 
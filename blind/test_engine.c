@@ -0,0 +1,138 @@
+#include <stddef.h>
+
+#include "cutest.h"
+
+/*
+ The index cache is private to engine.c, so it's tested by including
+ engine.c, with the functions that would load and unload real index
+ files swapped for ones that just count.
+ */
+#define index_reload          fake_index_reload
+#define index_unload          fake_index_unload
+#define index_get_file_size   fake_index_get_file_size
+#define index_close_fds       fake_index_close_fds
+#define index_set_mmap_policy fake_index_set_mmap_policy
+#include "engine.c"
+
+#define NFAKE 4
+static index_t fakes[NFAKE];
+static int nreloads[NFAKE];
+// index that fails to load, or -1.
+static int failreload;
+
+int fake_index_reload(index_t* index) {
+	nreloads[index - fakes]++;
+	return (index - fakes == failreload) ? -1 : 0;
+}
+void fake_index_unload(index_t* index) {}
+int64_t fake_index_get_file_size(const index_t* index) {
+	return 1;
+}
+int fake_index_close_fds(index_t* index) {
+	return 0;
+}
+int fake_index_set_mmap_policy(index_t* index, const index_mmap_policy_t* policy) {
+	return 0;
+}
+
+// One job, with "nruns" runs of the one index "i".
+static void run_job(CuTest* ct, engine_t* engine, int i, int nruns) {
+	il* list = il_new(4);
+	il* byname = il_new(4);
+	int k;
+	engine->index_cache_job++;
+	il_append(list, i);
+	for (k=0; k<nruns; k++) {
+		CuAssertIntEquals(ct, 0, cache_load_indexes(engine, list, byname));
+		CuAssertIntEquals(ct, 0, il_size(byname));
+	}
+	il_free(list);
+	il_free(byname);
+}
+
+// An engine with NFAKE indexes of one byte each, and room for two.
+static engine_t* fake_engine() {
+	engine_t* engine = engine_new();
+	int i;
+	memset(fakes, 0, sizeof(fakes));
+	memset(nreloads, 0, sizeof(nreloads));
+	failreload = -1;
+	for (i=0; i<NFAKE; i++) {
+		index_cache_entry_t entry;
+		memset(&entry, 0, sizeof(index_cache_entry_t));
+		entry.cacheable = TRUE;
+		fakes[i].indexname = "fake";
+		pl_append(engine->indexes, fakes + i);
+		bl_append(engine->index_cache, &entry);
+	}
+	engine->index_cache_bytes = 2;
+	return engine;
+}
+
+void test_index_cache_lru2(CuTest* ct) {
+	engine_t* engine = fake_engine();
+
+	// index 0 is used by two jobs...
+	run_job(ct, engine, 0, 1);
+	run_job(ct, engine, 0, 1);
+	// ... and index 1 by one job, but in many runs (eg, one per depth
+	// and scale); that's still just one use.
+	run_job(ct, engine, 1, 10);
+	CuAssertIntEquals(ct, 1, nreloads[0]);
+	CuAssertIntEquals(ct, 1, nreloads[1]);
+
+	// so index 1 goes to make room for index 2.
+	run_job(ct, engine, 2, 1);
+	CuAssertIntEquals(ct, TRUE,  cache_entry(engine, 0)->loaded);
+	CuAssertIntEquals(ct, FALSE, cache_entry(engine, 1)->loaded);
+	CuAssertIntEquals(ct, TRUE,  cache_entry(engine, 2)->loaded);
+	CuAssertIntEquals(ct, 1, (int)engine->index_cache_stats.evictions);
+
+	// and index 0 still isn't the coldest.
+	run_job(ct, engine, 3, 1);
+	CuAssertIntEquals(ct, TRUE,  cache_entry(engine, 0)->loaded);
+	CuAssertIntEquals(ct, FALSE, cache_entry(engine, 2)->loaded);
+	CuAssertIntEquals(ct, 1, nreloads[0]);
+
+	engine_free(engine);
+}
+
+void test_index_cache_byname(CuTest* ct) {
+	engine_t* engine = fake_engine();
+	il* list = il_new(4);
+	il* byname = il_new(4);
+	int i;
+
+	// all four used in one run: two fit, and the rest are left to
+	// blind, without being loaded here.
+	engine->index_cache_job++;
+	for (i=0; i<NFAKE; i++)
+		il_append(list, i);
+	CuAssertIntEquals(ct, 0, cache_load_indexes(engine, list, byname));
+	CuAssertIntEquals(ct, 2, il_size(byname));
+	CuAssertIntEquals(ct, 2, il_get(byname, 0));
+	CuAssertIntEquals(ct, 3, il_get(byname, 1));
+	for (i=0; i<NFAKE; i++) {
+		CuAssertIntEquals(ct, i < 2, cache_entry(engine, i)->loaded);
+		CuAssertIntEquals(ct, i < 2, nreloads[i]);
+	}
+	CuAssertIntEquals(ct, 2, (int)engine->index_cache_used);
+	il_remove_all(byname);
+
+	// one that fails to load is left to blind too; the others stay cached.
+	engine->index_cache_job++;
+	il_remove_all(list);
+	il_append(list, 0);
+	il_append(list, 2);
+	failreload = 2;
+	CuAssertIntEquals(ct, 0, cache_load_indexes(engine, list, byname));
+	CuAssertIntEquals(ct, 1, il_size(byname));
+	CuAssertIntEquals(ct, 2, il_get(byname, 0));
+	CuAssertIntEquals(ct, TRUE,  cache_entry(engine, 0)->loaded);
+	CuAssertIntEquals(ct, FALSE, cache_entry(engine, 2)->loaded);
+	CuAssertIntEquals(ct, 1, (int)engine->index_cache_used);
+
+	il_free(list);
+	il_free(byname);
+	engine_free(engine);
+}
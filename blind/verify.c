@@ -50,6 +50,9 @@
 
 #define dlog(lev, fmt, ...) data_log(DATALOG_MASK_VERIFY, lev, fmt, ##__VA_ARGS__)
 
+// Number of reference stars in the first stage of verify_early_reject().
+#define VERIFY_REJECT_NSAMPLE 10
+
 // avoid functions with 50 arguments...
 struct verify_s {
 	const sip_t* wcs;
@@ -72,10 +75,151 @@ struct verify_s {
 	// temp storage
 	int* tbadguys;
 
+	// Radius-of-relevance state, from verify_apply_ror_refs():
+	// quad center and radius**2 (pixels),
+	double qc[2];
+	double Q2;
+	// RoR**2,
+	double ror2;
+	// uniformization grid, and which cells are within the RoR (if
+	// "goodbins_valid"),
+	int uni_nw, uni_nh;
+	anbool* goodbins;
+	anbool goodbins_valid;
+	// and the effective area of the field.
+	double effA;
+
+	// Scratch arrays for verify_hit(), grown as needed by the
+	// verify_reserve_*() functions.  If "keep" is set (this is a
+	// verify_scratch_t), they are kept from call to call; otherwise
+	// they're freed when verify_hit() returns.
+	anbool keep;
+	// NRall-sized arrays: refperm, refstarid, refxy, badguys, and
+	int NRcap;
+	int* sweep;
+	double* gains;
+	// NTall-sized arrays: testperm, testsigma, tbadguys, and
+	int NTcap;
+	anbool* keepers;
+	int* binids;
+	int* binstars;
+	// uniformization-grid-sized arrays: goodbins, and
+	int nbincap;
+	int* bincounts;
+	int* binstart;
+	// kdtree query results,
+	kdtree_qres_t* refres;
+	kdtree_qres_t* dedupres;
+	// and real_verify_star_lists() scratch (only if "keep" is set).
+	double* refcopy;
+	int* rmatches;
+	double* rprobs;
+	int* theta;
+	double* allodds;
+	kdtree_t* rtree;
+	int rtreecap;
 };
 typedef struct verify_s verify_t;
 
-static anbool* verify_deduplicate_field_stars(verify_t* v, const verify_field_t* vf, double nsigmas);
+static void verify_deduplicate_field_stars(verify_t* v, const verify_field_t* vf, double nsigmas);
+static void uniformize_field(const double* xy, int* perm, int N,
+							 double fieldW, double fieldH,
+							 int nw, int nh,
+							 int* bincounts, int* binstart,
+							 int* binstars, int* binids);
+
+static void verify_reserve_refs(verify_t* v, int N) {
+	if (N <= v->NRcap)
+		return;
+	v->NRcap = MAX(N, 2 * v->NRcap);
+	N = v->NRcap;
+	v->refperm   = realloc(v->refperm,   N * sizeof(int));
+	v->refstarid = realloc(v->refstarid, N * sizeof(int));
+	v->refxy     = realloc(v->refxy,     N * 2 * sizeof(double));
+	v->badguys   = realloc(v->badguys,   N * sizeof(int));
+	v->sweep     = realloc(v->sweep,     N * sizeof(int));
+	v->gains     = realloc(v->gains,     N * sizeof(double));
+	if (v->keep) {
+		v->refcopy  = realloc(v->refcopy,  N * 2 * sizeof(double));
+		v->rmatches = realloc(v->rmatches, N * sizeof(int));
+		v->rprobs   = realloc(v->rprobs,   N * sizeof(double));
+	}
+}
+
+static void verify_reserve_tests(verify_t* v, int N) {
+	if (N <= v->NTcap)
+		return;
+	v->NTcap = MAX(N, 2 * v->NTcap);
+	N = v->NTcap;
+	v->testperm  = realloc(v->testperm,  N * sizeof(int));
+	v->testsigma = realloc(v->testsigma, N * sizeof(double));
+	v->tbadguys  = realloc(v->tbadguys,  N * sizeof(int));
+	v->keepers   = realloc(v->keepers,   N * sizeof(anbool));
+	v->binids    = realloc(v->binids,    N * sizeof(int));
+	v->binstars  = realloc(v->binstars,  N * sizeof(int));
+	if (v->keep) {
+		v->theta   = realloc(v->theta,   N * sizeof(int));
+		v->allodds = realloc(v->allodds, N * sizeof(double));
+	}
+}
+
+static void verify_reserve_bins(verify_t* v, int N) {
+	if (N <= v->nbincap)
+		return;
+	v->nbincap = MAX(N, 2 * v->nbincap);
+	N = v->nbincap;
+	v->goodbins  = realloc(v->goodbins,  N * sizeof(anbool));
+	v->bincounts = realloc(v->bincounts, N * sizeof(int));
+	v->binstart  = realloc(v->binstart,  N * sizeof(int));
+}
+
+static void verify_free_scratch(verify_t* v) {
+	free(v->refperm);
+	free(v->refstarid);
+	free(v->refxy);
+	free(v->badguys);
+	free(v->sweep);
+	free(v->gains);
+	free(v->testperm);
+	free(v->testsigma);
+	free(v->tbadguys);
+	free(v->keepers);
+	free(v->binids);
+	free(v->binstars);
+	free(v->goodbins);
+	free(v->bincounts);
+	free(v->binstart);
+	if (v->refres)
+		kdtree_free_query(v->refres);
+	if (v->dedupres)
+		kdtree_free_query(v->dedupres);
+	free(v->refcopy);
+	free(v->rmatches);
+	free(v->rprobs);
+	free(v->theta);
+	free(v->allodds);
+	kdtree_free(v->rtree);
+	memset(v, 0, sizeof(verify_t));
+}
+
+verify_scratch_t* verify_scratch_new() {
+	verify_t* v = calloc(1, sizeof(verify_t));
+	v->keep = TRUE;
+	return v;
+}
+
+void verify_scratch_free(verify_scratch_t* v) {
+	if (!v)
+		return;
+	verify_free_scratch(v);
+	free(v);
+}
+
+static void* copy_array(const void* p, size_t sz) {
+	void* c = malloc(sz);
+	memcpy(c, p, sz);
+	return c;
+}
 
 verify_field_t* verify_field_preprocess(const starxy_t* fieldxy) {
     verify_field_t* vf;
@@ -104,6 +248,7 @@ verify_field_t* verify_field_preprocess(const starxy_t* fieldxy) {
 	vf->do_uniformize = TRUE;
 	vf->do_dedup = TRUE;
 	vf->do_ror = TRUE;
+	vf->logodds_reject = -HUGE_VAL;
 
     return vf;
 }
@@ -121,15 +266,14 @@ static double get_sigma2_at_radius(double verify_pix2, double r2, double quadr2)
 	return verify_pix2 * (1.0 + r2/quadr2);
 }
 
-static double* compute_sigma2s(const verify_field_t* vf,
-							   const double* xy, int NF,
-							   const double* qc, double Q2,
-							   double verify_pix2, anbool do_gamma) {
-	double* sigma2s;
+static void compute_sigma2s_into(const verify_field_t* vf,
+								 const double* xy, int NF,
+								 const double* qc, double Q2,
+								 double verify_pix2, anbool do_gamma,
+								 double* sigma2s) {
     int i;
 	double R2;
 
-    sigma2s = malloc(NF * sizeof(double));
 	if (!do_gamma) {
 		for (i=0; i<NF; i++)
             sigma2s[i] = verify_pix2;
@@ -149,6 +293,14 @@ static double* compute_sigma2s(const verify_field_t* vf,
             sigma2s[i] = get_sigma2_at_radius(verify_pix2, R2, Q2);
         }
 	}
+}
+
+static double* compute_sigma2s(const verify_field_t* vf,
+							   const double* xy, int NF,
+							   const double* qc, double Q2,
+							   double verify_pix2, anbool do_gamma) {
+	double* sigma2s = malloc(NF * sizeof(double));
+	compute_sigma2s_into(vf, xy, NF, qc, Q2, verify_pix2, do_gamma, sigma2s);
 	return sigma2s;
 }
 
@@ -200,13 +352,17 @@ static void verify_get_test_stars(verify_t* v, const verify_field_t* vf, MatchOb
 	anbool* keepers = NULL;
 	int i;
 	int ibad=0, igood=0;
+	double qc[2];
+	double Q2 = 0;
 
 	v->NTall = starxy_n(vf->field);
 	v->testxy = vf->xy;
 	v->NT = v->NTall;
-	v->testsigma = verify_compute_sigma2s(vf, mo, pix2, do_gamma);
-	v->testperm = permutation_init(NULL, v->NTall);
-	v->tbadguys = malloc(v->NTall * sizeof(int));
+	verify_reserve_tests(v, v->NTall);
+	if (do_gamma)
+		verify_get_quad_center(vf, mo, qc, &Q2);
+	compute_sigma2s_into(vf, NULL, v->NTall, qc, Q2, pix2, do_gamma, v->testsigma);
+	permutation_init(v->testperm, v->NTall);
 
 	if (DEBUGVERIFY) {
 		debug2("start:\n");
@@ -220,7 +376,8 @@ static void verify_get_test_stars(verify_t* v, const verify_field_t* vf, MatchOb
 		// -- this requires the match scale
 		// -- can perhaps discretize dedup to nearest power-of-sqrt(2) pixel radius and cache it.
 		// -- we can compute sigma much later
-		keepers = verify_deduplicate_field_stars(v, vf, 1.0);
+		verify_deduplicate_field_stars(v, vf, 1.0);
+		keepers = v->keepers;
 
 		// Remove test quad stars.  Do this after deduplication so we
 		// don't end up with (duplicate) test stars near the quad stars.
@@ -277,7 +434,6 @@ static void verify_get_test_stars(verify_t* v, const verify_field_t* vf, MatchOb
 	v->NT = igood;
 	// remember the bad guys
 	memcpy(v->testperm + igood, v->tbadguys, ibad * sizeof(int));
-	free(keepers);
 
 	if (DEBUGVERIFY) {
 		debug2("after dedup and removing quad:\n");
@@ -292,24 +448,120 @@ double verify_get_ror2(double Q2, double area,
 	return Q2 * MAX(1, (area*(1 - distractors) / (4. * M_PI * NR * pix2) - 1));
 }
 
-static void verify_apply_ror(verify_t* v,
-							 int index_cutnside,
-							 MatchObj* mo,
-							 const verify_field_t* vf,
-							 double pix2,
-							 double distractors,
-							 double fieldW,
-							 double fieldH,
-							 anbool do_gamma, anbool fake_match,
-							 double* p_effA,
-							 int* p_uninw, int* p_uninh) {
+/*
+ Applies radius-of-relevance filtering to the reference stars.  This
+ depends only on the quad and the reference stars, so it can be done
+ before we look at the test stars at all; see verify_apply_ror_tests()
+ for the second half.
+ */
+static void verify_apply_ror_refs(verify_t* v,
+								  int index_cutnside,
+								  MatchObj* mo,
+								  const verify_field_t* vf,
+								  double pix2,
+								  double distractors,
+								  double fieldW,
+								  double fieldH,
+								  anbool fake_match) {
+	int i;
+	int igood, ibad;
+	anbool binned;
+
+	v->effA = fieldW * fieldH;
+	v->uni_nw = v->uni_nh = 0;
+	v->Q2 = 0;
+	v->ror2 = 0;
+	v->goodbins_valid = FALSE;
+
+	if (!fake_match)
+		verify_get_quad_center(vf, mo, v->qc, &v->Q2);
+
+	// -get uniformization scale.
+	if (vf->do_uniformize) {
+		verify_get_uniformize_scale(index_cutnside, mo->scale, fieldW, fieldH, &v->uni_nw, &v->uni_nh);
+		debug2("uniformizing into %i x %i blocks.\n", v->uni_nw, v->uni_nh);
+	}
+	if (vf->do_ror && !fake_match) {
+		int Ngoodbins;
+
+		debug2("Quad radius = %g\n", sqrt(v->Q2));
+		v->ror2 = verify_get_ror2(v->Q2, fieldW*fieldH, distractors, v->NR, pix2);
+		debug2("(strong) Radius of relevance is %.1f\n", sqrt(v->ror2));
+
+		if (!v->uni_nw)
+			verify_get_uniformize_scale(index_cutnside, mo->scale, fieldW, fieldH, &v->uni_nw, &v->uni_nh);
+		verify_reserve_bins(v, v->uni_nw * v->uni_nh);
+		// If the test stars will be uniformized, we cut whole bins;
+		// otherwise we cut at the RoR.
+		binned = (vf->do_uniformize && (v->uni_nw > 1 || v->uni_nh > 1));
+		Ngoodbins = 0;
+		for (i=0; i<(v->uni_nw * v->uni_nh); i++) {
+			// (as in verify_uniformize_bin_centers())
+			double bxy[2];
+			bxy[0] = ((i % v->uni_nw) + 0.5) * fieldW / (double)v->uni_nw;
+			bxy[1] = ((i / v->uni_nw) + 0.5) * fieldH / (double)v->uni_nh;
+			v->goodbins[i] = (distsq(bxy, v->qc, 2) < v->ror2);
+			if (v->goodbins[i])
+				Ngoodbins++;
+		}
+		v->goodbins_valid = binned;
+		debug2("%i/%i bins are relevant.\n", Ngoodbins, v->uni_nw*v->uni_nh);
+
+		// Effective area: A * proportion of good bins.
+		v->effA *= Ngoodbins / (double)(v->uni_nw * v->uni_nh);
+
+		// Remove reference stars in bad bins.
+		igood = ibad = 0;
+		if (v->goodbins_valid) {
+			for (i=0; i<v->NR; i++) {
+				int ri = v->refperm[i];
+				int binid = get_xy_bin(v->refxy + 2*ri, fieldW, fieldH, v->uni_nw, v->uni_nh);
+				if (v->goodbins[binid]) {
+					v->refperm[igood] = ri;
+					igood++;
+				} else {
+					v->badguys[ibad] = ri;
+					ibad++;
+				}
+			}
+		} else {
+			for (i=0; i<v->NR; i++) {
+				int ri = v->refperm[i];
+				if (distsq(v->qc, v->refxy + 2*ri, 2) < v->ror2) {
+					v->refperm[igood] = ri;
+					igood++;
+				} else {
+					v->badguys[ibad] = ri;
+					ibad++;
+				}
+			}
+		}
+		// remember the bad guys
+		memcpy(v->refperm + igood, v->badguys, ibad * sizeof(int));
+		v->NR = igood;
+		debug2("After removing irrelevant ref stars: %i ref stars.\n", v->NR);
+
+		// New ROR is...
+		debug2("ROR changed from %g to %g\n", sqrt(v->ror2),
+			   sqrt(verify_get_ror2(v->Q2, v->effA, distractors, v->NR, pix2)));
+	}
+}
+
+/*
+ Collects the test stars, uniformizes them, and removes the ones
+ outside the radius of relevance found by verify_apply_ror_refs().
+ */
+static void verify_apply_ror_tests(verify_t* v,
+								   MatchObj* mo,
+								   const verify_field_t* vf,
+								   double pix2,
+								   double fieldW,
+								   double fieldH,
+								   anbool do_gamma, anbool fake_match) {
 	int i;
-	int uni_nw = 0, uni_nh = 0;
-	double effA = fieldW * fieldH;
-	double qc[2], Q2=0;
 	int igood, ibad;
 	int* binids = NULL;
-	double* bincenters = NULL;
+	anbool binned;
 
 	// If we're verifying an existing WCS solution, then don't increase the variance
 	// away from the center of the matched quad.
@@ -320,52 +572,28 @@ static void verify_apply_ror(verify_t* v,
 	debug2("Number of test stars: %i\n", v->NT);
 	debug2("Number of reference stars: %i\n", v->NR);
 
-	if (!fake_match)
-		verify_get_quad_center(vf, mo, qc, &Q2);
-
 	// Uniformize test stars
 	// FIXME - can do this (possibly at several scales) in preprocessing.
-	if (vf->do_uniformize) {
-		// -get uniformization scale.
-		verify_get_uniformize_scale(index_cutnside, mo->scale, fieldW, fieldH, &uni_nw, &uni_nh);
-		debug2("uniformizing into %i x %i blocks.\n", uni_nw, uni_nh);
-
-		// uniformize!
-		if (uni_nw > 1 || uni_nh > 1) {
-			verify_uniformize_field(vf->xy, v->testperm, v->NT, fieldW, fieldH, uni_nw, uni_nh, NULL, &binids);
-			bincenters = verify_uniformize_bin_centers(fieldW, fieldH, uni_nw, uni_nh);
-
-			if (DEBUGVERIFY) {
-				debug2("after uniformizing:\n");
-				print_test_perm(v);
-				debug2("\n");
-			}
+	binned = (vf->do_uniformize && (v->uni_nw > 1 || v->uni_nh > 1));
+	if (binned) {
+		verify_reserve_bins(v, v->uni_nw * v->uni_nh);
+		binids = v->binids;
+		uniformize_field(vf->xy, v->testperm, v->NT, fieldW, fieldH, v->uni_nw, v->uni_nh,
+						 v->bincounts, v->binstart, v->binstars, binids);
+		if (DEBUGVERIFY) {
+			debug2("after uniformizing:\n");
+			print_test_perm(v);
+			debug2("\n");
 		}
 	}
 	if (vf->do_ror && !fake_match) {
-		anbool* goodbins = NULL;
-		int Ngoodbins;
-		double ror2;
-
-		debug2("Quad radius = %g\n", sqrt(Q2));
-		ror2 = verify_get_ror2(Q2, fieldW*fieldH, distractors, v->NR, pix2);
-		debug2("(strong) Radius of relevance is %.1f\n", sqrt(ror2));
-
-		if (binids) {
-			assert(uni_nw);
-			goodbins = malloc(uni_nw * uni_nh * sizeof(anbool));
-			Ngoodbins = 0;
-			for (i=0; i<(uni_nw * uni_nh); i++) {
-				double binr2 = distsq(bincenters + 2*i, qc, 2);
-				goodbins[i] = (binr2 < ror2);
-				if (goodbins[i])
-					Ngoodbins++;
-			}
+		igood = ibad = 0;
+		if (v->goodbins_valid) {
+			assert(binned);
 			// Remove test stars in irrelevant bins...
-			igood = ibad = 0;
 			for (i=0; i<v->NT; i++) {
 				int ti = v->testperm[i];
-				if (goodbins[binids[i]]) {
+				if (v->goodbins[binids[i]]) {
 					v->testperm[igood] = ti;
 					igood++;
 				} else {
@@ -375,11 +603,10 @@ static void verify_apply_ror(verify_t* v,
 			}
 		} else {
 			// Remove test stars outside the RoR.
-			igood = ibad = 0;
 			for (i=0; i<v->NT; i++) {
 				int ti = v->testperm[i];
-				double r2 = distsq(qc, vf->xy + 2*ti, 2);
-				if (r2 < ror2) {
+				double r2 = distsq(v->qc, vf->xy + 2*ti, 2);
+				if (r2 < v->ror2) {
 					v->testperm[igood] = ti;
 					igood++;
 				} else {
@@ -387,78 +614,90 @@ static void verify_apply_ror(verify_t* v,
 					ibad++;
 				}
 			}
-			// Count good bins to find effective area... (ugh)
-			assert(!bincenters);
-			if (!uni_nw)
-				verify_get_uniformize_scale(index_cutnside, mo->scale, fieldW, fieldH, &uni_nw, &uni_nh);
-			bincenters = verify_uniformize_bin_centers(fieldW, fieldH, uni_nw, uni_nh);
-			Ngoodbins = 0;
-			for (i=0; i<(uni_nw * uni_nh); i++) {
-				double binr2 = distsq(bincenters + 2*i, qc, 2);
-				if (binr2 < ror2)
-					Ngoodbins++;
-			}
 		}
-
 		v->NT = igood;
 		memcpy(v->testperm + igood, v->tbadguys, ibad * sizeof(int));
-		debug2("After removing %i/%i irrelevant bins: %i test stars.\n", (uni_nw*uni_nh)-Ngoodbins, uni_nw*uni_nh, v->NT);
+		debug2("After removing irrelevant bins: %i test stars.\n", v->NT);
 
 		if (DEBUGVERIFY) {
 			debug2("after applying RoR:\n");
 			print_test_perm(v);
 			debug2("\n");
 		}
+	}
+}
 
-		// Effective area: A * proportion of good bins.
-		effA *= Ngoodbins / (double)(uni_nw * uni_nh);
+/*
+ Staged verification: before collecting the test stars, compute an
+ upper bound on the log-odds that real_verify_star_lists() could
+ produce, and return the stage at which it fell below "logreject" (or
+ zero if it never did).
+
+ Each match of a test star (with positional variance sigma2) to a
+ reference star adds at most
+   log((1-distractors) * effA / (2 pi sigma2 NR))
+ to the log-odds, and distractors and conflicts never add anything,
+ so the log-odds is at most the sum over reference stars of that
+ (if positive).  A test star within 5 sigma of a reference star must
+ lie within a range of distances from the quad center, which bounds
+ its sigma2 when "do_gamma" is on.  We first use these bounds alone,
+ then drop the reference stars that have no field star close enough
+ to match them, starting with a sample of the first few reference
+ stars (in sweep order, so they're spread across the field).
+ */
+static int verify_early_reject(verify_t* v, const verify_field_t* vf,
+							   double pix2, double distractors,
+							   anbool do_gamma, double logreject) {
+	double* gains;
+	double logC, s5, Q, bound;
+	int i;
 
-		// Remove reference stars in bad bins.
-		igood = ibad = 0;
-		if (goodbins) {
-			assert(uni_nw);
-			for (i=0; i<v->NR; i++) {
-				int ri = v->refperm[i];
-				int binid = get_xy_bin(v->refxy + 2*ri, fieldW, fieldH, uni_nw, uni_nh);
-				if (goodbins[binid]) {
-					v->refperm[igood] = ri;
-					igood++;
-				} else {
-					v->badguys[ibad] = ri;
-					ibad++;
-				}
-			}
-		} else {
-			for (i=0; i<v->NR; i++) {
-				int ri = v->refperm[i];
-				if (distsq(qc, v->refxy + 2*ri, 2) < ror2) {
-					v->refperm[igood] = ri;
-					igood++;
-				} else {
-					v->badguys[ibad] = ri;
-					ibad++;
-				}
-			}
-		}
-		// remember the bad guys
-		memcpy(v->refperm + igood, v->badguys, ibad * sizeof(int));
-		v->NR = igood;
-		debug2("After removing irrelevant ref stars: %i ref stars.\n", v->NR);
+	logC = log((1.0 - distractors) * v->effA / (2.0 * M_PI * v->NR));
+	s5 = 5.0 * sqrt(pix2);
+	Q = sqrt(v->Q2);
 
-		// New ROR is...
-		debug2("ROR changed from %g to %g\n", sqrt(ror2),
-			   sqrt(verify_get_ror2(Q2, effA, distractors, v->NR, pix2)));
+	gains = v->gains;
+	bound = 0.0;
+	for (i=0; i<v->NR; i++) {
+		double sig2 = pix2;
+		if (do_gamma) {
+			double r = sqrt(distsq(v->qc, v->refxy + 2*v->refperm[i], 2));
+			// closest to the quad center a matching test star can be
+			double rlo = MAX(0.0, (r - s5) / (1.0 + s5 / Q));
+			sig2 = get_sigma2_at_radius(pix2, rlo*rlo, v->Q2);
+		}
+		gains[i] = MAX(0.0, logC - log(sig2));
+		bound += gains[i];
+	}
+	debug2("Log-odds bound after RoR: %g\n", bound);
+	if (bound < logreject)
+		return VERIFY_REJECTED_ROR;
 
-		free(goodbins);
+	for (i=0; i<v->NR; i++) {
+		double sig2 = pix2;
+		const double* rxy = v->refxy + 2*v->refperm[i];
+		if (gains[i] == 0.0)
+			continue;
+		if (do_gamma) {
+			double r, rhi;
+			if (s5 >= Q)
+				// tiny quad: we can't bound sigma2 from above.
+				continue;
+			r = sqrt(distsq(v->qc, rxy, 2));
+			// farthest from the quad center a matching test star can be
+			rhi = (r + s5) / (1.0 - s5 / Q);
+			sig2 = get_sigma2_at_radius(pix2, rhi*rhi, v->Q2);
+		}
+		if (kdtree_nearest_neighbour_within(vf->ftree, rxy, 25.0 * sig2, NULL) != -1)
+			continue;
+		bound -= gains[i];
+		if (bound < logreject) {
+			debug2("Log-odds bound %g after %i reference stars\n", bound, i+1);
+			return (i < VERIFY_REJECT_NSAMPLE) ?
+				VERIFY_REJECTED_SAMPLE : VERIFY_REJECTED_REFS;
+		}
 	}
-	free(bincenters);
-	free(binids);
-
-	*p_effA = effA;
-	if (p_uninw)
-		*p_uninw = uni_nw;
-	if (p_uninh)
-		*p_uninh = uni_nh;
+	return 0;
 }
 
 static double real_verify_star_lists(verify_t* v,
@@ -494,9 +733,18 @@ static double real_verify_star_lists(verify_t* v,
 		return -HUGE_VAL;
 	}
 
+	// (with a verify_scratch_t, all the arrays here come from it.)
+	if (v->keep) {
+		verify_reserve_refs(v, v->NR);
+		verify_reserve_tests(v, v->NT);
+	}
+
 	// Build a tree out of the index stars in pixel space...
 	// kdtree scrambles the data array so make a copy first.
-	refcopy = malloc(2 * v->NR * sizeof(double));
+	if (v->keep)
+		refcopy = v->refcopy;
+	else
+		refcopy = malloc(2 * v->NR * sizeof(double));
 	// we must pack/unpermute the refxys; remember this packing order in "rperm".
 	// we borrow storage for "rperm"...
 	if (!v->badguys)
@@ -508,18 +756,36 @@ static double real_verify_star_lists(verify_t* v,
 		refcopy[2*i+0] = v->refxy[2*ri+0];
 		refcopy[2*i+1] = v->refxy[2*ri+1];
 	}
-	rtree = kdtree_build(NULL, refcopy, v->NR, 2, Nleaf, KDTT_DOUBLE, KD_BUILD_SPLIT);
+	if (!v->keep)
+		rtree = kdtree_build(NULL, refcopy, v->NR, 2, Nleaf, KDTT_DOUBLE, KD_BUILD_SPLIT);
+	else if (v->rtree && v->NR <= v->rtreecap)
+		rtree = kdtree_rebuild(v->rtree, refcopy, v->NR, 2, Nleaf, KDTT_DOUBLE, KD_BUILD_SPLIT);
+	else {
+		kdtree_free(v->rtree);
+		rtree = kdtree_build(NULL, refcopy, v->NR, 2, Nleaf, KDTT_DOUBLE, KD_BUILD_SPLIT);
+		v->rtree = rtree;
+		v->rtreecap = v->NR;
+	}
 
-	rmatches = malloc(v->NR * sizeof(int));
+	if (v->keep) {
+		rmatches = v->rmatches;
+		rprobs = v->rprobs;
+	} else {
+		rmatches = malloc(v->NR * sizeof(int));
+		rprobs = malloc(v->NR * sizeof(double));
+	}
 	for (i=0; i<v->NR; i++)
 		rmatches[i] = -1;
-
-	rprobs = malloc(v->NR * sizeof(double));
 	for (i=0; i<v->NR; i++)
 		rprobs[i] = -HUGE_VAL;
 
-	if (p_logodds || data_log_passes(DATALOG_MASK_VERIFY, DLOG_ODDS))
-		all_logodds = calloc(v->NT, sizeof(double));
+	if (p_logodds || data_log_passes(DATALOG_MASK_VERIFY, DLOG_ODDS)) {
+		if (v->keep) {
+			all_logodds = v->allodds;
+			memset(all_logodds, 0, v->NT * sizeof(double));
+		} else
+			all_logodds = calloc(v->NT, sizeof(double));
+	}
 	if (p_logodds)
 		*p_logodds = all_logodds;
 	
@@ -528,7 +794,10 @@ static double real_verify_star_lists(verify_t* v,
 	if (p_istopped)
 		*p_istopped = -1;
 
-	theta = malloc(v->NT * sizeof(int));
+	if (v->keep)
+		theta = v->theta;
+	else
+		theta = malloc(v->NT * sizeof(int));
 
 	logbg = log(1.0 / effective_area);
 
@@ -764,12 +1033,8 @@ static double real_verify_star_lists(verify_t* v,
 		 */
 	}
 
-	free(rmatches);
-
 	if (p_theta)
 		*p_theta = theta;
-	else
-		free(theta);
 
 	if (p_besti)
 		*p_besti = besti;
@@ -777,13 +1042,16 @@ static double real_verify_star_lists(verify_t* v,
 	if (p_worstlogodds)
 		*p_worstlogodds = bestworstlogodds;
 
-	if (all_logodds && !*p_logodds)
-		free(all_logodds);
-
-	free(rprobs);
-
-	kdtree_free(rtree);
-	free(refcopy);
+	if (!v->keep) {
+		free(rmatches);
+		if (!p_theta)
+			free(theta);
+		if (all_logodds && !*p_logodds)
+			free(all_logodds);
+		free(rprobs);
+		kdtree_free(rtree);
+		free(refcopy);
+	}
 
 	return bestlogodds;
 }
@@ -867,17 +1135,17 @@ void verify_get_index_stars(const double* fieldcenter, double fieldr2,
  distance from the matched quad), then they are not very useful for verification.
  We filter out field stars within sigma of each other, taking only the brightest.
 
- Returns an array indicating which field stars should be kept.
+ Fills v->keepers, indicating which field stars should be kept.
  */
-static anbool* verify_deduplicate_field_stars(verify_t* v, const verify_field_t* vf, double nsigmas) {
-    anbool* keepers = NULL;
+static void verify_deduplicate_field_stars(verify_t* v, const verify_field_t* vf, double nsigmas) {
+    anbool* keepers = v->keepers;
     int i, j, ti;
-    kdtree_qres_t* res = NULL;
+    kdtree_qres_t* res = v->dedupres;
 	double nsig2 = nsigmas*nsigmas;
 	int options = KD_OPTIONS_NO_RESIZE_RESULTS | KD_OPTIONS_SMALL_RADIUS;
 
 	// default to FALSE
-    keepers = calloc(v->NTall, sizeof(anbool));
+	memset(keepers, 0, v->NTall * sizeof(anbool));
     for (i=0; i<v->NT; i++) {
 		ti = v->testperm[i];
 		keepers[ti] = TRUE;
@@ -903,8 +1171,7 @@ static anbool* verify_deduplicate_field_stars(verify_t* v, const verify_field_t*
             }
         }
     }
-	kdtree_free_query(res);
-	return keepers;
+	v->dedupres = res;
 }
 
 void verify_get_quad_center(const verify_field_t* vf, const MatchObj* mo, double* centerpix,
@@ -933,72 +1200,80 @@ void verify_get_uniformize_scale(int cutnside, double scale, int W, int H, int*
 		*cutnh = MAX(1, (int)round(H / cutpix));
 }
 
-void verify_uniformize_field(const double* xy,
-							 int* perm,
-							 int N,
+/*
+ Reorders "perm" so that it takes one star from each bin in turn.
+ "bincounts" and "binstart" have nw*nh elements and "binstars" and
+ "binids" have N; on return, "bincounts" holds the bin occupancies
+ and "binids" the bin of each element of "perm".
+ */
+static void uniformize_field(const double* xy, int* perm, int N,
 							 double fieldW, double fieldH,
 							 int nw, int nh,
-							 int** p_bincounts,
-							 int** p_binids) {
-	il** lists;
-	int i,j,k,p;
-	int* bincounts = NULL;
-	int* binids = NULL;
+							 int* bincounts, int* binstart,
+							 int* binstars, int* binids) {
+	int i, k, p, b;
+	int nbins = nw * nh;
 
-	if (p_binids) {
-		binids = malloc(N * sizeof(int));
-		*p_binids = binids;
-	}
-
-	lists = malloc(nw * nh * sizeof(il*));
-	for (i=0; i<(nw*nh); i++)
-		lists[i] = il_new(16);
-
-	// put the stars in the appropriate bins.
+	// put the stars in the appropriate bins, keeping their order.
+	memset(bincounts, 0, nbins * sizeof(int));
 	debug2("Test star bins:\n");
 	for (i=0; i<N; i++) {
-		int ind;
-		int bin;
-		ind = perm[i];
-		bin = get_xy_bin(xy + 2*ind, fieldW, fieldH, nw, nh);
-		debug2("%i ", bin);
-		il_append(lists[bin], ind);
+		b = get_xy_bin(xy + 2*perm[i], fieldW, fieldH, nw, nh);
+		debug2("%i ", b);
+		binids[i] = b;
+		bincounts[b]++;
 	}
 	debug2("\n");
-
-	if (p_bincounts) {
-		// note the bin occupancies.
-		bincounts = malloc(nw * nh * sizeof(int));
-		for (i=0; i<(nw*nh); i++) {
-			bincounts[i] = il_size(lists[i]);
-			//logverb("bin %i has %i stars\n", i, bincounts[i]);
-		}
-		*p_bincounts = bincounts;
+	p = 0;
+	for (b=0; b<nbins; b++) {
+		binstart[b] = p;
+		p += bincounts[b];
 	}
+	for (i=0; i<N; i++)
+		binstars[binstart[binids[i]]++] = perm[i];
+	for (b=0; b<nbins; b++)
+		binstart[b] -= bincounts[b];
 
 	// make sweeps through the bins, grabbing one star from each.
 	p=0;
 	for (k=0;; k++) {
-		for (j=0; j<nh; j++) {
-			for (i=0; i<nw; i++) {
-				int binid = j*nw + i;
-				il* lst = lists[binid];
-				if (k >= il_size(lst))
-					continue;
-				perm[p] = il_get(lst, k);
-				if (binids)
-					binids[p] = binid;
-				p++;
-			}
+		for (b=0; b<nbins; b++) {
+			if (k >= bincounts[b])
+				continue;
+			perm[p] = binstars[binstart[b] + k];
+			binids[p] = b;
+			p++;
 		}
 		if (p == N)
 			break;
 	}
 	assert(p == N);
+}
 
-	for (i=0; i<(nw*nh); i++)
-		il_free(lists[i]);
-	free(lists);
+void verify_uniformize_field(const double* xy,
+							 int* perm,
+							 int N,
+							 double fieldW, double fieldH,
+							 int nw, int nh,
+							 int** p_bincounts,
+							 int** p_binids) {
+	int* bincounts = malloc(nw * nh * sizeof(int));
+	int* binstart = malloc(nw * nh * sizeof(int));
+	int* binstars = malloc(N * sizeof(int));
+	int* binids = malloc(N * sizeof(int));
+
+	uniformize_field(xy, perm, N, fieldW, fieldH, nw, nh,
+					 bincounts, binstart, binstars, binids);
+	free(binstart);
+	free(binstars);
+	if (p_bincounts)
+		*p_bincounts = bincounts;
+	else
+		free(bincounts);
+	if (p_binids)
+		*p_binids = binids;
+	else
+		free(binids);
 }
 
 double* verify_uniformize_bin_centers(double fieldW, double fieldH,
@@ -1230,13 +1505,26 @@ void verify_count_hits(int* theta, int besti, int* p_nmatch, int* p_nconflict, i
 }
 
 
-void verify_hit(const startree_t* skdt, int index_cutnside, MatchObj* mo,
+int verify_hit(const startree_t* skdt, int index_cutnside, MatchObj* mo,
 				const sip_t* sip, const verify_field_t* vf,
                 double pix2, double distractors,
                 double fieldW, double fieldH,
                 double logbail, double logaccept, double logstoplooking,
                 anbool do_gamma, anbool fake_match) {
+	return verify_hit_reuse(NULL, skdt, index_cutnside, mo, sip, vf, pix2,
+							distractors, fieldW, fieldH, logbail, logaccept,
+							logstoplooking, do_gamma, fake_match);
+}
+
+int verify_hit_reuse(verify_scratch_t* vs,
+					 const startree_t* skdt, int index_cutnside, MatchObj* mo,
+					 const sip_t* sip, const verify_field_t* vf,
+					 double pix2, double distractors,
+					 double fieldW, double fieldH,
+					 double logbail, double logaccept, double logstoplooking,
+					 anbool do_gamma, anbool fake_match) {
 	int i,j;
+	int rejected = 0;
 	double* fieldcenter;
 	double fieldr2;
 	double effA, K, worst;
@@ -1248,7 +1536,7 @@ void verify_hit(const startree_t* skdt, int index_cutnside, MatchObj* mo,
 	double* refxyz = NULL;
 	int* sweep = NULL;
 	verify_t the_v;
-	verify_t* v = &the_v;
+	verify_t* v;
 	int NRimage;
 	int ibailed, istopped;
 
@@ -1256,7 +1544,14 @@ void verify_hit(const startree_t* skdt, int index_cutnside, MatchObj* mo,
 	assert(isfinite(logaccept));
 	assert(isfinite(logbail));
 
-	memset(v, 0, sizeof(verify_t));
+	if (vs) {
+		v = vs;
+		v->NR = v->NRall = v->NT = v->NTall = 0;
+		v->testxy = NULL;
+	} else {
+		v = &the_v;
+		memset(v, 0, sizeof(verify_t));
+	}
 
 	if (sip)
 		v->wcs = sip;
@@ -1303,17 +1598,23 @@ void verify_hit(const startree_t* skdt, int index_cutnside, MatchObj* mo,
 	 */
 	assert(skdt->sweep);
 	// Find all index stars within the bounding circle of the field.
-	startree_search_for(skdt, fieldcenter, fieldr2, &refxyz, NULL, &v->refstarid, &v->NRall);
+	// (this is startree_search_for(), keeping the results.)
+	v->refres = kdtree_rangesearch_options_reuse(skdt->tree, v->refres, fieldcenter, fieldr2,
+												 KD_OPTIONS_SMALL_RADIUS | KD_OPTIONS_RETURN_POINTS |
+												 KD_OPTIONS_NO_RESIZE_RESULTS);
+	v->NRall = (v->refres ? v->refres->nres : 0);
 	debug2("%i reference stars in the bounding circle\n", v->NRall);
-	if (!refxyz) {
+	if (!v->NRall) {
 		// no stars in range.
 		logverb("No reference stars in the bounding circle\n");
 		goto bailout;
 	}
 	//logverb("Found %i reference stars in the bounding circle\n", v->NRall);
+	refxyz = v->refres->results.d;
+	verify_reserve_refs(v, v->NRall);
+	for (i=0; i<v->NRall; i++)
+		v->refstarid[i] = v->refres->inds[i];
 	// Find index stars within the rectangular field.
-	v->refxy = malloc(v->NRall * 2 * sizeof(double));
-	v->refperm = malloc(v->NRall * sizeof(int));
 	igood = 0;
 	for (i=0; i<v->NRall; i++) {
 		if (!sip_xyzarr2pixelxy(v->wcs, refxyz+i*3, v->refxy+i*2, v->refxy+i*2 +1) ||
@@ -1338,21 +1639,17 @@ void verify_hit(const startree_t* skdt, int index_cutnside, MatchObj* mo,
 	// bottom "NRimage" of the "refperm" array will be accessed in the
 	// permuted_sort below, so none of
 	// the elements between NRimage and NRall will be touched.)
-	sweep = malloc(v->NRall * sizeof(int));
+	sweep = v->sweep;
 	for (i=0; i<v->NRall; i++)
 		sweep[i] = skdt->sweep[v->refstarid[i]];
 	// Note here that we're passing in an existing permutation array; it
 	// gets re-permuted during this call.
 	permuted_sort(sweep, sizeof(int), compare_ints_asc, v->refperm, v->NR);
-	free(sweep);
-	sweep = NULL;
 	debug2("Found %i reference stars.\n", v->NR);
 
 	// "refstarids" are indices into the star kdtree and could be used to
 	// retrieve "tag-along" data with, eg, startree_get_data_column().
 
-	v->badguys = malloc(v->NR * sizeof(int));
-
 	// remove reference stars that are part of the quad.
 	if (!fake_match) {
 		ibad = 0;
@@ -1390,14 +1687,21 @@ void verify_hit(const startree_t* skdt, int index_cutnside, MatchObj* mo,
 	// and image radius.
 
 	if (!fake_match) {
-		verify_apply_ror(v, index_cutnside, mo,
-						 vf, pix2, distractors, fieldW, fieldH,
-						 do_gamma, fake_match,
-						 &effA, NULL, NULL);
+		verify_apply_ror_refs(v, index_cutnside, mo, vf, pix2, distractors,
+							  fieldW, fieldH, fake_match);
 		if (!v->NR) {
 			logerr("After applying ROR, NR = 0!\n");
 			goto bailout;
 		}
+		if (isfinite(vf->logodds_reject)) {
+			rejected = verify_early_reject(v, vf, pix2, distractors, do_gamma,
+										   MIN(vf->logodds_reject, logaccept));
+			if (rejected)
+				goto bailout;
+		}
+		verify_apply_ror_tests(v, mo, vf, pix2, fieldW, fieldH,
+							   do_gamma, fake_match);
+		effA = v->effA;
 	} else {
 		verify_get_test_stars(v, vf, mo, pix2, do_gamma, fake_match);
 		effA = fieldW * fieldH;
@@ -1478,30 +1782,22 @@ void verify_hit(const startree_t* skdt, int index_cutnside, MatchObj* mo,
 
 		mo->theta = etheta;
 		mo->matchodds = eodds;
-		mo->refxyz = refxyz;
-		refxyz = NULL;
-		mo->refxy = v->refxy;
-		v->refxy = NULL;
-		mo->refstarid = v->refstarid;
-		v->refstarid = NULL;
-		mo->testperm = v->testperm;
-		v->testperm = NULL;
+		// (these all belong to "v")
+		mo->refxyz = copy_array(refxyz, v->NRall * 3 * sizeof(double));
+		mo->refxy = copy_array(v->refxy, v->NRall * 2 * sizeof(double));
+		mo->refstarid = copy_array(v->refstarid, v->NRall * sizeof(int));
+		mo->testperm = copy_array(v->testperm, v->NTall * sizeof(int));
 
 		matchobj_compute_derived(mo);
 	}
 
  cleanup:
-	free(refxyz);
-	free(theta);
-	free(allodds);
-	free(v->testperm);
-    free(v->testsigma);
-    free(v->tbadguys);
-	free(v->refperm);
-	free(v->refxy);
-    free(v->refstarid);
-	free(v->badguys);
-	return;
+	if (!v->keep) {
+		free(theta);
+		free(allodds);
+		verify_free_scratch(v);
+	}
+	return rejected;
 
  bailout:
 	set_null_mo(mo);
@@ -42,6 +42,9 @@ struct verify_field_t {
 	anbool do_dedup;
 	// apply radius-of-relevance filtering
 	anbool do_ror;
+	// staged verification: give up on a match as soon as an upper
+	// bound on its log-odds falls below this (-HUGE_VAL: never).
+	double logodds_reject;
 };
 typedef struct verify_field_t verify_field_t;
 
@@ -60,6 +63,18 @@ verify_field_t* verify_field_preprocess(const starxy_t* fieldxy);
  */
 void verify_field_free(verify_field_t* vf);
 
+/*
+ Scratch space for verify_hit_reuse(): the working arrays and the
+ reference-star kdtree are kept from call to call (and grown as
+ needed) rather than being allocated and freed for every match.  Each
+ thread needs its own.
+ */
+typedef struct verify_s verify_scratch_t;
+
+verify_scratch_t* verify_scratch_new();
+
+void verify_scratch_free(verify_scratch_t* vs);
+
 
 
 
@@ -102,8 +117,13 @@ void verify_wcs(const startree_t* skdt,
   -logodds
   -corr_field
   -corr_index
+
+  Returns zero if the match was fully verified, or one of the
+  VERIFY_REJECTED_* values below if staged verification (see
+  verify_field_t.logodds_reject) gave up on it early; in that case
+  "logodds" is set to -HUGE_VAL.
  */
-void verify_hit(const startree_t* skdt,
+int verify_hit(const startree_t* skdt,
 				int index_cutnside,
 				// input/output param.
                 MatchObj* mo,
@@ -119,6 +139,25 @@ void verify_hit(const startree_t* skdt,
                 anbool distance_from_quad_bonus,
                 anbool fake_match);
 
+/*
+ Like verify_hit(), but uses (and keeps) the arrays in "vs".
+ */
+int verify_hit_reuse(verify_scratch_t* vs,
+					 const startree_t* skdt,
+					 int index_cutnside,
+					 MatchObj* mo,
+					 const sip_t* sip,
+					 const verify_field_t* vf,
+					 double verify_pix2,
+					 double distractors,
+					 double fieldW,
+					 double fieldH,
+					 double logratio_tobail,
+					 double logratio_toaccept,
+					 double logratio_tostoplooking,
+					 anbool distance_from_quad_bonus,
+					 anbool fake_match);
+
 // Distractor
 #define THETA_DISTRACTOR -1
 // Conflict
@@ -130,6 +169,14 @@ void verify_hit(const startree_t* skdt,
 // Not examined because the stop-looking threshold was reached.
 #define THETA_STOPPEDLOOKING -5
 
+// Stages at which staged verification can reject a match:
+// the log-odds bound after radius-of-relevance filtering,
+#define VERIFY_REJECTED_ROR 1
+// after checking a sample of the reference stars for nearby field stars,
+#define VERIFY_REJECTED_SAMPLE 2
+// after checking all the reference stars.
+#define VERIFY_REJECTED_REFS 3
+
 /*
  void verify_apply_ror(double* refxy, int* starids, int* p_NR,
  int index_cutnside,
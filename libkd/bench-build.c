@@ -0,0 +1,161 @@
+/*
+  This file is part of libkd.
+
+  libkd is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 2.
+
+  libkd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with libkd; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ Times kdtree_build() on synthetic data with one thread and with
+ several, and checks that the trees are identical.
+ */
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "kdtree.h"
+#include "mathutil.h"
+#include "tic.h"
+
+static void printHelp(char* progname) {
+	printf("\nUsage: %s [options]\n"
+		   "     [-N <points>]: number of points (default 10000000; eg, 100000000 for\n"
+		   "                    a Gaia-sized star tree)\n"
+		   "     [-D <dims>]: dimensionality (default 3)\n"
+		   "     [-l <Nleaf>]: points per leaf (default 25)\n"
+		   "     [-t <threads>]: number of threads; repeat to time several (default 4)\n"
+		   "     [-s]: skip the one-thread build (and the comparison)\n"
+		   "\n", progname);
+}
+
+extern char *optarg;
+extern int optind, opterr, optopt;
+
+static const char* OPTIONS = "hN:D:l:t:s";
+
+static int same(const void* a, const void* b, size_t sz) {
+	if (!a || !b)
+		return (a == b);
+	return (memcmp(a, b, sz) == 0);
+}
+
+static kdtree_t* timed_build(const double* data, double* tdata, int N, int D,
+							 int Nleaf, int treetype, int options,
+							 int nthreads, double* t) {
+	kdtree_t* kd;
+	// (kdtree_build permutes the data, so make a fresh copy)
+	memcpy(tdata, data, (size_t)N * D * sizeof(double));
+	kdtree_set_build_threads(nthreads);
+	*t = timenow();
+	kd = kdtree_build(NULL, tdata, N, D, Nleaf, treetype, options);
+	*t = timenow() - *t;
+	if (!kd) {
+		fprintf(stderr, "Failed to build tree\n");
+		exit(-1);
+	}
+	return kd;
+}
+
+int main(int argc, char** args) {
+	int argchar;
+	char* progname = args[0];
+	int N = 10000000;
+	int D = 3;
+	int Nleaf = 25;
+	int threads[16];
+	int nthreads = 0;
+	anbool serial = TRUE;
+	int treetypes[] = { KDTT_DOUBLE, KDTT_DUU, KDTT_DSS };
+	const char* names[] = { "ddd (bb)", "duu (bb)", "dss (split)" };
+	int options[] = { KD_BUILD_BBOX, KD_BUILD_BBOX,
+					  KD_BUILD_SPLIT | KD_BUILD_SPLITDIM };
+	double* data;
+	double* data1;
+	double* data2;
+	size_t i;
+	int t, j;
+
+	while ((argchar = getopt(argc, args, OPTIONS)) != -1)
+		switch (argchar) {
+		case 'N':
+			N = atoi(optarg);
+			break;
+		case 'D':
+			D = atoi(optarg);
+			break;
+		case 'l':
+			Nleaf = atoi(optarg);
+			break;
+		case 't':
+			if (nthreads < sizeof(threads)/sizeof(int))
+				threads[nthreads++] = atoi(optarg);
+			break;
+		case 's':
+			serial = FALSE;
+			break;
+		case 'h':
+		default:
+			printHelp(progname);
+			exit(-1);
+		}
+	if (!nthreads)
+		threads[nthreads++] = 4;
+
+	srand(0);
+	data  = malloc((size_t)N * D * sizeof(double));
+	data1 = malloc((size_t)N * D * sizeof(double));
+	data2 = malloc((size_t)N * D * sizeof(double));
+	if (!data || !data1 || !data2) {
+		fprintf(stderr, "Failed to allocate %i points\n", N);
+		exit(-1);
+	}
+	for (i=0; i<(size_t)N*D; i++)
+		data[i] = uniform_sample(0, 1);
+
+	for (t=0; t<sizeof(treetypes)/sizeof(int); t++) {
+		kdtree_t* kd1 = NULL;
+		double t1 = 0.0;
+
+		printf("%s: %i points, %i dims, Nleaf %i\n", names[t], N, D, Nleaf);
+		if (serial) {
+			kd1 = timed_build(data, data1, N, D, Nleaf, treetypes[t], options[t],
+							  1, &t1);
+			printf("  1 thread  : %8.3f s\n", t1);
+		}
+		for (j=0; j<nthreads; j++) {
+			kdtree_t* kd2;
+			double t2;
+			kd2 = timed_build(data, data2, N, D, Nleaf, treetypes[t], options[t],
+							  threads[j], &t2);
+			printf("  %i threads: %8.3f s", threads[j], t2);
+			if (kd1) {
+				printf(" (x%.2f)", (t2 > 0 ? t1 / t2 : 0.0));
+				if (!(same(kd1->data.any, kd2->data.any, kdtree_sizeof_data(kd1)) &&
+					  same(kd1->perm, kd2->perm, kdtree_sizeof_perm(kd1)) &&
+					  same(kd1->lr, kd2->lr, kdtree_sizeof_lr(kd1)) &&
+					  same(kd1->bb.any, kd2->bb.any, kdtree_sizeof_bb(kd1)) &&
+					  same(kd1->split.any, kd2->split.any, kdtree_sizeof_split(kd1)) &&
+					  same(kd1->splitdim, kd2->splitdim, kdtree_sizeof_splitdim(kd1))))
+					printf("\n  WARNING: tree differs from the one-thread tree!");
+			}
+			printf("\n");
+			kdtree_free(kd2);
+		}
+		kdtree_free(kd1);
+	}
+	free(data);
+	free(data1);
+	free(data2);
+	return 0;
+}
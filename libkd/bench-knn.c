@@ -0,0 +1,193 @@
+/*
+  This file is part of libkd.
+
+  libkd is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 2.
+
+  libkd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with libkd; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ Times kdtree_knn() against the usual way of emulating it: range
+ searches with a growing radius until there are enough results.
+ */
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <sys/param.h>
+
+#include "kdtree.h"
+#include "mathutil.h"
+#include "tic.h"
+
+static void printHelp(char* progname) {
+	printf("\nUsage: %s [options]\n"
+		   "     [-N <points>]: number of points (default 1000000)\n"
+		   "     [-Q <queries>]: number of queries (default 100000)\n"
+		   "     [-D <dims>]: dimensionality (default 3)\n"
+		   "     [-k <neighbours>]: number of neighbours (default 8)\n"
+		   "     [-l <Nleaf>]: points per leaf (default 25)\n"
+		   "     [-t <threads>]: threads for kdtree_knn_batch (default 4)\n"
+		   "\n", progname);
+}
+
+extern char *optarg;
+extern int optind, opterr, optopt;
+
+static const char* OPTIONS = "hN:Q:D:k:l:t:";
+
+// Range search with a growing radius until there are "k" results.
+static int knn_by_rangesearch(const kdtree_t* kd, const double* query,
+							  int k, double r2, int* inds, double* d2s) {
+	kdtree_qres_t* res;
+	int i, n;
+	while (1) {
+		res = kdtree_rangesearch_options(kd, query, r2,
+										 KD_OPTIONS_COMPUTE_DISTS |
+										 KD_OPTIONS_SORT_DISTS);
+		if (res->nres >= k || res->nres == kdtree_n(kd))
+			break;
+		kdtree_free_query(res);
+		r2 *= 4.0;
+	}
+	n = MIN(k, res->nres);
+	for (i=0; i<n; i++) {
+		inds[i] = res->inds[i];
+		d2s[i] = res->sdists[i];
+	}
+	kdtree_free_query(res);
+	return n;
+}
+
+int main(int argc, char** args) {
+	int argchar;
+	char* progname = args[0];
+	int N = 1000000;
+	int Q = 100000;
+	int D = 3;
+	int K = 8;
+	int Nleaf = 25;
+	int nthreads = 4;
+	int treetypes[] = { KDTT_DOUBLE, KDTT_DUU, KDTT_DSS };
+	const char* names[] = { "ddd (bb)", "duu (bb)", "dss (split)" };
+	int options[] = { KD_BUILD_BBOX, KD_BUILD_BBOX, KD_BUILD_SPLIT };
+	double* data;
+	double* queries;
+	int* inds;
+	double* d2s;
+	int* counts;
+	double r2;
+	size_t i;
+	int t, q;
+
+	while ((argchar = getopt(argc, args, OPTIONS)) != -1)
+		switch (argchar) {
+		case 'N':
+			N = atoi(optarg);
+			break;
+		case 'Q':
+			Q = atoi(optarg);
+			break;
+		case 'D':
+			D = atoi(optarg);
+			break;
+		case 'k':
+			K = atoi(optarg);
+			break;
+		case 'l':
+			Nleaf = atoi(optarg);
+			break;
+		case 't':
+			nthreads = atoi(optarg);
+			break;
+		case 'h':
+		default:
+			printHelp(progname);
+			exit(-1);
+		}
+
+	srand(0);
+	data = malloc((size_t)N * D * sizeof(double));
+	queries = malloc((size_t)Q * D * sizeof(double));
+	inds = malloc((size_t)Q * K * sizeof(int));
+	d2s = malloc((size_t)Q * K * sizeof(double));
+	counts = malloc((size_t)Q * sizeof(int));
+	if (!data || !queries || !inds || !d2s || !counts) {
+		fprintf(stderr, "Failed to allocate %i points and %i queries\n", N, Q);
+		exit(-1);
+	}
+	for (i=0; i<(size_t)Q*D; i++)
+		queries[i] = uniform_sample(0, 1);
+	// starting radius for the emulation: about the expected distance to
+	// the k-th neighbour, so that it usually takes one or two searches.
+	r2 = pow((double)K / (double)N, 2.0 / (double)D);
+
+	for (t=0; t<sizeof(treetypes)/sizeof(int); t++) {
+		kdtree_t* kd;
+		double t0, trs, tknn, tbatch;
+		int nbad = 0;
+
+		for (i=0; i<(size_t)N*D; i++)
+			data[i] = uniform_sample(0, 1);
+		kd = kdtree_build(NULL, data, N, D, Nleaf, treetypes[t], options[t]);
+		if (!kd) {
+			fprintf(stderr, "Failed to build tree\n");
+			exit(-1);
+		}
+		printf("%s: %i points, %i queries, %i dims, k = %i\n",
+			   names[t], N, Q, D, K);
+
+		t0 = timenow();
+		for (q=0; q<Q; q++)
+			counts[q] = knn_by_rangesearch(kd, queries + (size_t)q*D, K, r2,
+										   inds + (size_t)q*K, d2s + (size_t)q*K);
+		trs = timenow() - t0;
+		printf("  range search : %8.3f s\n", trs);
+
+		t0 = timenow();
+		for (q=0; q<Q; q++) {
+			int myinds[K];
+			double myd2s[K];
+			int j, n;
+			n = kdtree_knn(kd, queries + (size_t)q*D, K, HUGE_VAL, myinds, myd2s);
+			if (n != counts[q]) {
+				nbad++;
+				continue;
+			}
+			// (the emulation doesn't break ties by index, so compare distances)
+			for (j=0; j<n; j++)
+				if (myd2s[j] != d2s[(size_t)q*K + j]) {
+					nbad++;
+					break;
+				}
+		}
+		tknn = timenow() - t0;
+		printf("  kdtree_knn   : %8.3f s (x%.2f)\n", tknn,
+			   (tknn > 0 ? trs / tknn : 0.0));
+
+		t0 = timenow();
+		kdtree_knn_batch(kd, queries, Q, K, HUGE_VAL, inds, d2s, counts, nthreads);
+		tbatch = timenow() - t0;
+		printf("  batch, %i thr: %8.3f s (x%.2f)\n", nthreads, tbatch,
+			   (tbatch > 0 ? trs / tbatch : 0.0));
+		if (nbad)
+			printf("  WARNING: %i queries differ from the range-search results!\n", nbad);
+		kdtree_free(kd);
+	}
+	free(data);
+	free(queries);
+	free(inds);
+	free(d2s);
+	free(counts);
+	return 0;
+}
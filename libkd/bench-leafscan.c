@@ -0,0 +1,213 @@
+/*
+  This file is part of libkd.
+
+  libkd is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 2.
+
+  libkd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with libkd; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ Times range searches (and nearest-neighbour searches) using each of
+ the leaf-scan instruction sets the CPU supports, on trees read from
+ index or kdtree files, or on synthetic trees of each type.
+ */
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+
+#include "kdtree.h"
+#include "kdtree_fits_io.h"
+#include "kdtree_leafscan.h"
+#include "mathutil.h"
+#include "tic.h"
+
+static void printHelp(char* progname) {
+	printf("\nUsage: %s [options] [<index-or-kdtree-filename> ...]\n"
+		   "     [-t <tree-name>]: tree to read (eg, \"codes\" or \"stars\"; default: the first)\n"
+		   "     [-q <queries>]: number of queries (default 100000)\n"
+		   "     [-r <radius>]: search radius (default 0.01)\n"
+		   "     [-N <points>]: number of points in the synthetic trees (default 1000000)\n"
+		   "     [-D <dims>]: dimensionality of the synthetic trees (default 4)\n"
+		   "     [-l <Nleaf>]: points per leaf in the synthetic trees (default 25)\n"
+		   "\n"
+		   "If no files are given, synthetic trees of each type are built.\n"
+		   "\n", progname);
+}
+
+extern char *optarg;
+extern int optind, opterr, optopt;
+
+static const char* OPTIONS = "ht:q:r:N:D:l:";
+
+static void bench(kdtree_t* kd, const char* name, int Q, double radius) {
+	int D = kd->ndim;
+	int N = kdtree_n(kd);
+	anbool isfloat = (kdtree_exttype(kd) == KDT_EXT_FLOAT);
+	double* dq;
+	float* fq;
+	double r2 = radius * radius;
+	int options;
+	int level, maxlevel;
+	int i, d;
+	double t0 = 0.0;
+	long nres0 = -1;
+	long nn0 = -1;
+
+	options = KD_OPTIONS_SMALL_RADIUS | KD_OPTIONS_COMPUTE_DISTS;
+	if (!kd->bb.any)
+		options |= KD_OPTIONS_USE_SPLIT;
+
+	// Queries: data points, jittered by about the search radius.
+	dq = malloc(Q * D * sizeof(double));
+	fq = malloc(Q * D * sizeof(float));
+	for (i=0; i<Q; i++) {
+		kdtree_copy_data_double(kd, (int)uniform_sample(0, N-1), 1, dq + i*D);
+		for (d=0; d<D; d++) {
+			dq[i*D + d] += gaussian_sample(0, radius);
+			fq[i*D + d] = dq[i*D + d];
+		}
+	}
+
+	printf("%s: %i points, %i dims, %i nodes, type %s/%s/%s\n", name, N, D,
+		   kd->nnodes,
+		   kdtree_kdtype_to_string(kdtree_exttype(kd)),
+		   kdtree_kdtype_to_string(kdtree_datatype(kd)),
+		   kdtree_kdtype_to_string(kdtree_treetype(kd)));
+
+	maxlevel = kdtree_leafscan_max_simd();
+	for (level=KD_SIMD_NONE; level<=maxlevel; level++) {
+		kdtree_qres_t* res = NULL;
+		long nres = 0;
+		long nnsum = 0;
+		double t, tnn;
+
+		kdtree_leafscan_set_simd(level);
+
+		t = timenow();
+		for (i=0; i<Q; i++) {
+			void* q = (isfloat ? (void*)(fq + i*D) : (void*)(dq + i*D));
+			res = kdtree_rangesearch_options_reuse(kd, res, q, r2, options);
+			nres += res->nres;
+		}
+		t = timenow() - t;
+		kdtree_free_query(res);
+
+		tnn = timenow();
+		for (i=0; i<Q; i++) {
+			void* q = (isfloat ? (void*)(fq + i*D) : (void*)(dq + i*D));
+			double bestd2;
+			nnsum += kdtree_nearest_neighbour(kd, q, &bestd2);
+		}
+		tnn = timenow() - tnn;
+
+		if (level == KD_SIMD_NONE) {
+			t0 = t;
+			nres0 = nres;
+			nn0 = nnsum;
+		}
+		printf("  %-5s: rangesearch %8.3f s (%.2f us/query, x%.2f), %li results;"
+			   " nn %8.3f s\n",
+			   kdtree_leafscan_simd_name(level), t, 1e6 * t / Q,
+			   (t > 0 ? t0 / t : 0.0), nres, tnn);
+		if (nres != nres0 || nnsum != nn0)
+			printf("  WARNING: results differ from plain C!\n");
+	}
+	kdtree_leafscan_set_simd(maxlevel);
+	free(dq);
+	free(fq);
+}
+
+int main(int argc, char** args) {
+	int argchar;
+	char* progname = args[0];
+	char* treename = NULL;
+	int Q = 100000;
+	double radius = 0.01;
+	int N = 1000000;
+	int D = 4;
+	int Nleaf = 25;
+
+	while ((argchar = getopt(argc, args, OPTIONS)) != -1)
+		switch (argchar) {
+		case 't':
+			treename = optarg;
+			break;
+		case 'q':
+			Q = atoi(optarg);
+			break;
+		case 'r':
+			radius = atof(optarg);
+			break;
+		case 'N':
+			N = atoi(optarg);
+			break;
+		case 'D':
+			D = atoi(optarg);
+			break;
+		case 'l':
+			Nleaf = atoi(optarg);
+			break;
+		case 'h':
+		default:
+			printHelp(progname);
+			exit(-1);
+		}
+
+	printf("Best leaf-scan instruction set: %s\n",
+		   kdtree_leafscan_simd_name(kdtree_leafscan_max_simd()));
+
+	srand(0);
+
+	if (optind < argc) {
+		for (; optind<argc; optind++) {
+			char* fn = args[optind];
+			kdtree_t* kd = kdtree_fits_read(fn, treename, NULL);
+			if (!kd) {
+				fprintf(stderr, "Failed to read kdtree from file %s\n", fn);
+				exit(-1);
+			}
+			bench(kd, fn, Q, radius);
+			kdtree_fits_close(kd);
+		}
+	} else {
+		int treetypes[] = { KDTT_DOUBLE, KDTT_FLOAT, KDTT_DUU, KDTT_DSS };
+		const char* names[] = { "ddd (bb)", "fff (bb)", "duu (bb)", "dss (split)" };
+		int options[] = { KD_BUILD_BBOX, KD_BUILD_BBOX, KD_BUILD_BBOX,
+						  KD_BUILD_SPLIT };
+		double* data;
+		float* fdata;
+		int i, t;
+
+		data = malloc(N * D * sizeof(double));
+		fdata = malloc(N * D * sizeof(float));
+		for (t=0; t<sizeof(treetypes)/sizeof(int); t++) {
+			kdtree_t* kd;
+			void* tdata;
+			// (kdtree_build permutes the data, so make a fresh copy)
+			for (i=0; i<N*D; i++)
+				fdata[i] = data[i] = uniform_sample(0, 1);
+			tdata = (treetypes[t] == KDTT_FLOAT ? (void*)fdata : (void*)data);
+			kd = kdtree_build(NULL, tdata, N, D, Nleaf, treetypes[t], options[t]);
+			if (!kd) {
+				fprintf(stderr, "Failed to build %s tree\n", names[t]);
+				exit(-1);
+			}
+			bench(kd, names[t], Q, radius);
+			kdtree_free(kd);
+		}
+		free(data);
+		free(fdata);
+	}
+	return 0;
+}
@@ -0,0 +1,172 @@
+/*
+  This file is part of libkd.
+
+  libkd is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 2.
+
+  libkd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with libkd; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ Writes the same tree with its nodes in the usual (heap) order and in
+ van Emde Boas order, evicts each file from the page cache, and counts
+ the page faults that nearest-neighbour queries on the mmapped tree
+ take.
+ */
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "kdtree.h"
+#include "kdtree_fits_io.h"
+#include "mathutil.h"
+#include "tic.h"
+
+static void printHelp(char* progname) {
+	printf("\nUsage: %s [options]\n"
+		   "     [-N <points>]: number of points (default 4000000)\n"
+		   "     [-Q <queries>]: number of queries (default 1000)\n"
+		   "     [-D <dims>]: dimensionality (default 3)\n"
+		   "     [-l <Nleaf>]: points per leaf (default 25)\n"
+		   "     [-d <dir>]: directory for the tree files (default /tmp)\n"
+		   "\n", progname);
+}
+
+extern char *optarg;
+extern int optind, opterr, optopt;
+
+static const char* OPTIONS = "hN:Q:D:l:d:";
+
+// Drops the file's pages from the page cache.
+static void evict(const char* fn) {
+	int fd = open(fn, O_RDONLY);
+	if (fd == -1) {
+		fprintf(stderr, "Failed to open %s\n", fn);
+		exit(-1);
+	}
+	fdatasync(fd);
+	if (posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED))
+		fprintf(stderr, "Warning: posix_fadvise failed; the cache may not be cold\n");
+	close(fd);
+}
+
+static void run_queries(const char* fn, const double* queries, int Q, int D,
+						const char* name) {
+	struct rusage r0, r1;
+	kdtree_t* kd;
+	double t0;
+	long majflt, minflt;
+	int q;
+
+	evict(fn);
+	kd = kdtree_fits_read(fn, NULL, NULL);
+	if (!kd) {
+		fprintf(stderr, "Failed to read tree from %s\n", fn);
+		exit(-1);
+	}
+	getrusage(RUSAGE_SELF, &r0);
+	t0 = timenow();
+	for (q=0; q<Q; q++) {
+		double d2;
+		kdtree_nearest_neighbour(kd, queries + (size_t)q*D, &d2);
+	}
+	t0 = timenow() - t0;
+	getrusage(RUSAGE_SELF, &r1);
+	majflt = r1.ru_majflt - r0.ru_majflt;
+	minflt = r1.ru_minflt - r0.ru_minflt;
+	printf("  %-5s: %8.3f ms/query, page faults per query: %.2f major, %.2f minor\n",
+		   name, 1000.0 * t0 / Q, majflt / (double)Q, minflt / (double)Q);
+	kdtree_fits_close(kd);
+}
+
+int main(int argc, char** args) {
+	int argchar;
+	char* progname = args[0];
+	int N = 4000000;
+	int Q = 1000;
+	int D = 3;
+	int Nleaf = 25;
+	char* dir = "/tmp";
+	int treetypes[] = { KDTT_DOUBLE, KDTT_DSS };
+	const char* names[] = { "ddd (bb)", "dss (split)" };
+	int options[] = { KD_BUILD_BBOX, KD_BUILD_SPLIT };
+	char heapfn[1024], vebfn[1024];
+	double* data;
+	double* queries;
+	size_t i;
+	int t;
+
+	while ((argchar = getopt(argc, args, OPTIONS)) != -1)
+		switch (argchar) {
+		case 'N':
+			N = atoi(optarg);
+			break;
+		case 'Q':
+			Q = atoi(optarg);
+			break;
+		case 'D':
+			D = atoi(optarg);
+			break;
+		case 'l':
+			Nleaf = atoi(optarg);
+			break;
+		case 'd':
+			dir = optarg;
+			break;
+		case 'h':
+		default:
+			printHelp(progname);
+			exit(-1);
+		}
+
+	srand(0);
+	data = malloc((size_t)N * D * sizeof(double));
+	queries = malloc((size_t)Q * D * sizeof(double));
+	if (!data || !queries) {
+		fprintf(stderr, "Failed to allocate %i points\n", N);
+		exit(-1);
+	}
+	for (i=0; i<(size_t)Q*D; i++)
+		queries[i] = uniform_sample(0, 1);
+	snprintf(heapfn, sizeof(heapfn), "%s/bench-veb-heap-%i.kd", dir, (int)getpid());
+	snprintf(vebfn,  sizeof(vebfn),  "%s/bench-veb-veb-%i.kd",  dir, (int)getpid());
+
+	for (t=0; t<sizeof(treetypes)/sizeof(int); t++) {
+		kdtree_t* kd;
+		printf("%s: %i points, %i queries, %i dims, Nleaf %i\n",
+			   names[t], N, Q, D, Nleaf);
+		// (kdtree_build permutes the data, so build the same tree twice)
+		for (i=0; i<(size_t)N*D; i++)
+			data[i] = uniform_sample(0, 1);
+		kd = kdtree_build(NULL, data, N, D, Nleaf, treetypes[t], options[t]);
+		if (!kd || kdtree_fits_write(kd, heapfn, NULL)) {
+			fprintf(stderr, "Failed to build or write tree\n");
+			exit(-1);
+		}
+		if (kdtree_make_veb(kd) || kdtree_fits_write(kd, vebfn, NULL)) {
+			fprintf(stderr, "Failed to write van Emde Boas tree\n");
+			exit(-1);
+		}
+		kdtree_free(kd);
+
+		run_queries(heapfn, queries, Q, D, "heap");
+		run_queries(vebfn,  queries, Q, D, "vEB");
+		unlink(heapfn);
+		unlink(vebfn);
+	}
+	free(data);
+	free(queries);
+	return 0;
+}
@@ -16,9 +16,43 @@
   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
 */
 
+#include <stdlib.h>
+#include <sys/param.h>
+
 #include "dualtree.h"
 #include "bl.h"
 
+/*
+ Appends to "childnodes" and "leaves" the children of the search nodes
+ in "nodes" that the decision function accepts for query node "ynode".
+ */
+static void expand_nodes(kdtree_t* xtree, kdtree_t* ytree,
+						 il* nodes, il* leaves, il* childnodes,
+						 int ynode, dualtree_callbacks* callbacks) {
+	decision_function decision = callbacks->decision;
+	void* decision_extra = callbacks->decision_extra;
+	int i, N;
+
+	N = il_size(nodes);
+	for (i=0; i<N; i++) {
+		int child1, child2;
+		int xnode = il_get(nodes, i);
+		if (!decision(decision_extra, xtree, xnode, ytree, ynode))
+			continue;
+
+		child1 = KD_CHILD_LEFT(xnode);
+		child2 = KD_CHILD_RIGHT(xnode);
+
+		if (KD_IS_LEAF(xtree, child1)) {
+			il_append(leaves, child1);
+			il_append(leaves, child2);
+		} else {
+			il_append(childnodes, child1);
+			il_append(childnodes, child2);
+		}
+	}
+}
+
 /*
  At each step of the recursion, we have a query node ("ynode") and a
  list of candidate search nodes ("nodes" and "leaves" in the "xtree").
@@ -52,8 +86,6 @@ static void dualtree_recurse(kdtree_t* xtree, kdtree_t* ytree,
 	//    everything after it when we're done.
 	int leafmarker;
 	il* childnodes;
-	decision_function decision;
-	void* decision_extra;
 	int i, N;
 
 	// if the query node is a leaf...
@@ -105,28 +137,7 @@ static void dualtree_recurse(kdtree_t* xtree, kdtree_t* ytree,
 
 	leafmarker = il_size(leaves);
 	childnodes = il_new(32);
-	decision = callbacks->decision;
-	decision_extra = callbacks->decision_extra;
-
-
-	N = il_size(nodes);
-	for (i=0; i<N; i++) {
-		int child1, child2;
-		int xnode = il_get(nodes, i);
-		if (!decision(decision_extra, xtree, xnode, ytree, ynode))
-			continue;
-
-		child1 = KD_CHILD_LEFT(xnode);
-		child2 = KD_CHILD_RIGHT(xnode);
-
-		if (KD_IS_LEAF(xtree, child1)) {
-			il_append(leaves, child1);
-			il_append(leaves, child2);
-		} else {
-			il_append(childnodes, child1);
-			il_append(childnodes, child2);
-		}
-	}
+	expand_nodes(xtree, ytree, nodes, leaves, childnodes, ynode, callbacks);
 
 	//printf("dualtree: start left child of y node %i is %i\n", ynode, KD_CHILD_LEFT(ynode));
 	// recurse on the Y children!
@@ -161,3 +172,72 @@ void dualtree_search(kdtree_t* xtree, kdtree_t* ytree,
 	il_free(leaves);
 }
 
+
+/*
+ Like dualtree_recurse(), but instead of going all the way down, it
+ stops after "depth" levels (or where dualtree_recurse() would make its
+ callbacks) and records the query node and its search lists as a task.
+ */
+static void split_recurse(kdtree_t* xtree, kdtree_t* ytree,
+						  il* nodes, il* leaves, int ynode, int depth,
+						  dualtree_callbacks* callbacks, bl* tasks) {
+	int leafmarker;
+	il* childnodes;
+
+	if (depth == 0 || KD_IS_LEAF(ytree, ynode) || !il_size(nodes)) {
+		dualtree_task task;
+		task.querynode = ynode;
+		task.nodes = il_dupe(nodes);
+		task.leaves = il_dupe(leaves);
+		bl_append(tasks, &task);
+		return;
+	}
+
+	leafmarker = il_size(leaves);
+	childnodes = il_new(32);
+	expand_nodes(xtree, ytree, nodes, leaves, childnodes, ynode, callbacks);
+	split_recurse(xtree, ytree, childnodes, leaves, KD_CHILD_LEFT(ynode),
+				  depth-1, callbacks, tasks);
+	split_recurse(xtree, ytree, childnodes, leaves, KD_CHILD_RIGHT(ynode),
+				  depth-1, callbacks, tasks);
+	il_remove_index_range(leaves, leafmarker, il_size(leaves)-leafmarker);
+	il_free(childnodes);
+}
+
+int dualtree_split(kdtree_t* xtree, kdtree_t* ytree,
+				   dualtree_callbacks* callbacks, int depth,
+				   dualtree_task** p_tasks) {
+	il* nodes = il_new(32);
+	il* leaves = il_new(32);
+	bl* tasks = bl_new(256, sizeof(dualtree_task));
+	int ntasks;
+
+	if (KD_IS_LEAF(xtree, 0))
+		il_append(leaves, 0);
+	else
+		il_append(nodes, 0);
+	split_recurse(xtree, ytree, nodes, leaves, 0, depth, callbacks, tasks);
+
+	ntasks = bl_size(tasks);
+	*p_tasks = malloc(MAX(1, ntasks) * sizeof(dualtree_task));
+	bl_copy(tasks, 0, ntasks, *p_tasks);
+	bl_free(tasks);
+	il_free(nodes);
+	il_free(leaves);
+	return ntasks;
+}
+
+void dualtree_run_task(kdtree_t* xtree, kdtree_t* ytree,
+					   dualtree_task* task, dualtree_callbacks* callbacks) {
+	dualtree_recurse(xtree, ytree, task->nodes, task->leaves,
+					 task->querynode, callbacks);
+}
+
+void dualtree_free_tasks(dualtree_task* tasks, int ntasks) {
+	int i;
+	for (i=0; i<ntasks; i++) {
+		il_free(tasks[i].nodes);
+		il_free(tasks[i].leaves);
+	}
+	free(tasks);
+}
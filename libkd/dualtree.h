@@ -38,6 +38,7 @@
 
 #include "starutil.h"
 #include "kdtree.h"
+#include "bl.h"
 
 typedef anbool (*decision_function)(void* extra, kdtree_t* searchtree, int searchnode,
 								  kdtree_t* querytree, int querynode);
@@ -61,4 +62,34 @@ typedef struct dualtree_callbacks dualtree_callbacks;
 void dualtree_search(kdtree_t* search, kdtree_t* query,
 					 dualtree_callbacks* callbacks);
 
+/*
+ A piece of a dual-tree search: a query node and the search nodes
+ (and leaves) that it has to be checked against.
+ */
+struct dualtree_task {
+	int querynode;
+	il* nodes;
+	il* leaves;
+};
+typedef struct dualtree_task dualtree_task;
+
+/*
+ Splits a dual-tree search into independent tasks, by running the
+ "decision" callback over the top "depth" levels of the query tree.
+ Running the tasks with dualtree_run_task(), in order, makes the same
+ callbacks as dualtree_search() does, in the same order; but the tasks
+ can also be run in parallel (each with its own callbacks).
+
+ Returns the number of tasks, and the array of tasks in "p_tasks";
+ free it with dualtree_free_tasks().
+ */
+int dualtree_split(kdtree_t* search, kdtree_t* query,
+				   dualtree_callbacks* callbacks, int depth,
+				   dualtree_task** p_tasks);
+
+void dualtree_run_task(kdtree_t* search, kdtree_t* query,
+					   dualtree_task* task, dualtree_callbacks* callbacks);
+
+void dualtree_free_tasks(dualtree_task* tasks, int ntasks);
+
 
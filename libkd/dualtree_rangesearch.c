@@ -17,10 +17,14 @@
 */
 
 #include <string.h>
+#include <stdlib.h>
+#include <sys/param.h>
+#include <pthread.h>
 
 #include "dualtree_rangesearch.h"
 #include "dualtree.h"
 #include "mathutil.h"
+#include "bl.h"
 
 double RANGESEARCH_NO_LIMIT = 1.12345e308;
 
@@ -63,23 +67,24 @@ static double mydistsq(void* v1, void* v2, int D) {
     return distsq((double*)v1, (double*)v2, D);
 }
 
-void dualtree_rangesearch(kdtree_t* xtree, kdtree_t* ytree,
-						  double mindist, double maxdist,
-						  anbool notself,
-						  dist2_function distsquared,
-						  result_callback callback,
-						  void* param,
-						  progress_callback progress,
-						  void* progress_param) {
-    // dual-tree search callback functions
+static void setup_search(kdtree_t* xtree, kdtree_t* ytree,
+						 double mindist, double maxdist,
+						 anbool notself,
+						 dist2_function distsquared,
+						 result_callback callback,
+						 void* param,
+						 progress_callback progress,
+						 void* progress_param,
+						 dualtree_callbacks* pcallbacks,
+						 rs_params* pparams) {
     dualtree_callbacks callbacks;
     rs_params params;
 
     memset(&callbacks, 0, sizeof(dualtree_callbacks));
     callbacks.decision = rs_within_range;
-    callbacks.decision_extra = &params;
+    callbacks.decision_extra = pparams;
     callbacks.result = rs_handle_result;
-    callbacks.result_extra = &params;
+    callbacks.result_extra = pparams;
 
     // set search params
 	memset(&params, 0, sizeof(params));
@@ -117,13 +122,188 @@ void dualtree_rangesearch(kdtree_t* xtree, kdtree_t* ytree,
 	params.ytree = ytree;
 	if (progress) {
 		callbacks.start_results = rs_start_results;
-		callbacks.start_extra = &params;
+		callbacks.start_extra = pparams;
 		params.user_progress = progress;
 		params.user_progress_param = progress_param;
 		params.ydone = 0;
 	}
 
-	dualtree_search(xtree, ytree, &callbacks);
+	*pcallbacks = callbacks;
+	*pparams = params;
+}
+
+void dualtree_rangesearch(kdtree_t* xtree, kdtree_t* ytree,
+						  double mindist, double maxdist,
+						  anbool notself,
+						  dist2_function distsquared,
+						  result_callback callback,
+						  void* param,
+						  progress_callback progress,
+						  void* progress_param) {
+	dualtree_rangesearch_threaded(xtree, ytree, mindist, maxdist, notself,
+								  distsquared, callback, param,
+								  progress, progress_param, 1);
+}
+
+// One task's results, waiting to be handed to the user's callback.
+struct rs_task {
+	dualtree_task* task;
+	il* xinds;
+	il* yinds;
+	dl* dist2s;
+	int ydone;
+	anbool done;
+};
+
+struct rs_pool {
+	kdtree_t* xtree;
+	kdtree_t* ytree;
+	// templates for each task's callbacks and params.
+	dualtree_callbacks* callbacks;
+	rs_params* params;
+
+	struct rs_task* tasks;
+	int ntasks;
+	// the next task to start.
+	int next;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+
+static void rs_buffer_result(void* extra, int xind, int yind, double dist2) {
+	struct rs_task* t = extra;
+	il_append(t->xinds, xind);
+	il_append(t->yinds, yind);
+	dl_append(t->dist2s, dist2);
+}
+
+static void rs_buffer_progress(void* extra, int ydone) {
+	struct rs_task* t = extra;
+	t->ydone = ydone;
+}
+
+static void* rs_worker(void* v) {
+	struct rs_pool* pool = v;
+	while (1) {
+		struct rs_task* t;
+		dualtree_callbacks callbacks;
+		rs_params params;
+
+		pthread_mutex_lock(&pool->mutex);
+		if (pool->next == pool->ntasks) {
+			pthread_mutex_unlock(&pool->mutex);
+			break;
+		}
+		t = pool->tasks + pool->next;
+		pool->next++;
+		pthread_mutex_unlock(&pool->mutex);
+
+		params = *pool->params;
+		params.user_callback = rs_buffer_result;
+		params.user_callback_param = t;
+		if (params.user_progress) {
+			params.user_progress = rs_buffer_progress;
+			params.user_progress_param = t;
+		}
+		callbacks = *pool->callbacks;
+		callbacks.decision_extra = &params;
+		callbacks.result_extra = &params;
+		if (callbacks.start_results)
+			callbacks.start_extra = &params;
+
+		t->xinds = il_new(256);
+		t->yinds = il_new(256);
+		t->dist2s = dl_new(256);
+		dualtree_run_task(pool->xtree, pool->ytree, t->task, &callbacks);
+
+		pthread_mutex_lock(&pool->mutex);
+		t->done = TRUE;
+		pthread_cond_broadcast(&pool->cond);
+		pthread_mutex_unlock(&pool->mutex);
+	}
+	return NULL;
+}
+
+void dualtree_rangesearch_threaded(kdtree_t* xtree, kdtree_t* ytree,
+								   double mindist, double maxdist,
+								   anbool notself,
+								   dist2_function distsquared,
+								   result_callback callback,
+								   void* param,
+								   progress_callback progress,
+								   void* progress_param,
+								   int nthreads) {
+    dualtree_callbacks callbacks;
+    rs_params params;
+	struct rs_pool pool;
+	dualtree_task* dtasks;
+	pthread_t threads[MAX(1, nthreads)];
+	int nstarted;
+	int depth;
+	int ydone;
+	int i, j;
+
+	setup_search(xtree, ytree, mindist, maxdist, notself, distsquared,
+				 callback, param, progress, progress_param,
+				 &callbacks, &params);
+
+	if (nthreads <= 1) {
+		dualtree_search(xtree, ytree, &callbacks);
+		return;
+	}
+
+	// Split into about 16 tasks per thread, to balance the load.
+	for (depth=0; (1 << depth) < 16 * nthreads; depth++);
+
+	memset(&pool, 0, sizeof(pool));
+	pool.xtree = xtree;
+	pool.ytree = ytree;
+	pool.callbacks = &callbacks;
+	pool.params = &params;
+	pool.ntasks = dualtree_split(xtree, ytree, &callbacks, depth, &dtasks);
+	pool.tasks = calloc(MAX(1, pool.ntasks), sizeof(struct rs_task));
+	for (i=0; i<pool.ntasks; i++)
+		pool.tasks[i].task = dtasks + i;
+	pthread_mutex_init(&pool.mutex, NULL);
+	pthread_cond_init(&pool.cond, NULL);
+
+	nstarted = 0;
+	for (i=0; i<nthreads; i++) {
+		if (pthread_create(threads + nstarted, NULL, rs_worker, &pool))
+			break;
+		nstarted++;
+	}
+	if (!nstarted)
+		// do it ourselves.
+		rs_worker(&pool);
+
+	// Hand the results to the callback, in order, as the tasks finish.
+	ydone = 0;
+	for (i=0; i<pool.ntasks; i++) {
+		struct rs_task* t = pool.tasks + i;
+		pthread_mutex_lock(&pool.mutex);
+		while (!t->done)
+			pthread_cond_wait(&pool.cond, &pool.mutex);
+		pthread_mutex_unlock(&pool.mutex);
+
+		for (j=0; j<il_size(t->xinds); j++)
+			callback(param, il_get(t->xinds, j), il_get(t->yinds, j),
+					 dl_get(t->dist2s, j));
+		ydone += t->ydone;
+		if (progress)
+			progress(progress_param, ydone);
+		il_free(t->xinds);
+		il_free(t->yinds);
+		dl_free(t->dist2s);
+	}
+
+	for (i=0; i<nstarted; i++)
+		pthread_join(threads[i], NULL);
+	pthread_mutex_destroy(&pool.mutex);
+	pthread_cond_destroy(&pool.cond);
+	free(pool.tasks);
+	dualtree_free_tasks(dtasks, pool.ntasks);
 }
 
 static void rs_start_results(void* vparams,
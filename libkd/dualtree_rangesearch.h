@@ -41,6 +41,24 @@ void dualtree_rangesearch(kdtree_t* xtree, kdtree_t* ytree,
 						  progress_callback progress,
 						  void* progress_param);
 
+/*
+ Like dualtree_rangesearch(), but the search is split into tasks
+ (see dualtree_split()) that are run by "nthreads" threads.  Each task
+ collects its results in its own buffer; the buffers are handed to
+ "callback" in the calling thread, in the order that
+ dualtree_rangesearch() would produce them, so the callback needn't be
+ thread-safe.  "progress" is called after each task's results.
+ */
+void dualtree_rangesearch_threaded(kdtree_t* xtree, kdtree_t* ytree,
+								   double mindist, double maxdist,
+								   anbool notself,
+								   dist2_function distsquared,
+								   result_callback callback,
+								   void* param,
+								   progress_callback progress,
+								   void* progress_param,
+								   int nthreads);
+
 /*
  void dualtree_rangecount(kdtree_t* x, kdtree_t* y,
  double mindist, double maxdist,
@@ -28,3 +28,5 @@ typedef double dtype;
 #define DTYPE_M d
 
 #define DTYPE_KDT_DATA  KDT_DATA_DOUBLE
+
+#define DTYPE_LEAFSCAN kdtree_leafscan_d
@@ -28,3 +28,5 @@ typedef float dtype;
 #define DTYPE_M f
 
 #define DTYPE_KDT_DATA  KDT_DATA_FLOAT
+
+#define DTYPE_LEAFSCAN kdtree_leafscan_f
@@ -29,3 +29,5 @@ typedef u16 dtype;
 
 #define DTYPE_KDT_DATA  KDT_DATA_U16
 
+
+#define DTYPE_LEAFSCAN kdtree_leafscan_s
@@ -28,3 +28,5 @@ typedef u32 dtype;
 #define DTYPE_M u
 
 #define DTYPE_KDT_DATA  KDT_DATA_U32
+
+#define DTYPE_LEAFSCAN kdtree_leafscan_u
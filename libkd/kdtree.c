@@ -21,6 +21,10 @@
 #include <assert.h>
 #include <string.h>
 #include <math.h>
+#include <sys/param.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <stdint.h>
 
 #include "kdtree.h"
 #include "kdtree_internal.h"
@@ -30,6 +34,7 @@
 #include "an-fls.h"
 #include "errors.h"
 #include "log.h"
+#include "bl.h"
 
 void kdtree_print(kdtree_t* kd) {
 	printf("kdtree:\n");
@@ -218,15 +223,18 @@ int kdtree_get_level(const kdtree_t* kd, int nodeid) {
 
 int kdtree_get_splitdim(const kdtree_t* kd, int nodeid) {
     u32 tmpsplit;
+    size_t i = nodeid;
     if (kd->splitdim)
         return kd->splitdim[nodeid];
+    if (kd->nodeslot)
+        i = (size_t)kd->nodeslot[nodeid] * kd->nodestride;
 
     switch (kdtree_treetype(kd)) {
     case KDT_TREE_U32:
-        tmpsplit = kd->split.u[nodeid];
+        tmpsplit = kd->split.u[i];
         break;
     case KDT_TREE_U16:
-        tmpsplit = kd->split.s[nodeid];
+        tmpsplit = kd->split.s[i];
         break;
     default:
         return -1;
@@ -395,6 +403,118 @@ kdtree_t* kdtree_new(int N, int D, int Nleaf) {
 	return kd;
 }
 
+kdtree_t* kdtree_rebuild(kdtree_t* kd, void *data, int N, int D, int Nleaf,
+						 int treetype, unsigned int options) {
+	int maxlevel = kdtree_compute_levels(N, Nleaf);
+	kd->nlevels = maxlevel;
+	kd->ndata = N;
+	kd->ndim = D;
+	kd->nnodes = (1 << maxlevel) - 1;
+	kd->nbottom = 1 << (maxlevel - 1);
+	kd->ninterior = kd->nbottom - 1;
+	if (kd->converted_data) {
+		FREE(kd->data.any);
+		kd->converted_data = FALSE;
+		FREE(kd->minval);
+		FREE(kd->maxval);
+		kd->minval = kd->maxval = NULL;
+	}
+	kd->data.any = NULL;
+	if (kd->nodeslot) {
+		// the van Emde Boas layout depends on the size of the tree, so
+		// start again.
+		FREE(kd->bb.any ? kd->bb.any : kd->split.any);
+		FREE(kd->nodeslot);
+		kd->bb.any = kd->split.any = NULL;
+		kd->nodeslot = NULL;
+	}
+	return kdtree_build(kd, data, N, D, Nleaf, treetype, options);
+}
+
+// Lays out the subtree of "height" levels below node "root".
+static void veb_layout(int32_t* slots, int root, int height, int* pos) {
+	int top, bottom;
+	int j, first;
+	if (height == 1) {
+		slots[root] = (*pos)++;
+		return;
+	}
+	bottom = height / 2;
+	top = height - bottom;
+	veb_layout(slots, root, top, pos);
+	// the subtrees hanging below the top part, left to right.
+	first = ((root + 1) << top) - 1;
+	for (j=0; j<(1 << top); j++)
+		veb_layout(slots, first + j, bottom, pos);
+}
+
+int32_t* kdtree_veb_slots(int nnodes) {
+	int32_t* slots;
+	int pos = 0;
+	slots = MALLOC(nnodes * sizeof(int32_t));
+	if (!slots) {
+		SYSERROR("Failed to allocate van Emde Boas slots for %i nodes", nnodes);
+		return NULL;
+	}
+	veb_layout(slots, 0, kdtree_nnodes_to_nlevels(nnodes), &pos);
+	assert(pos == nnodes);
+	return slots;
+}
+
+int kdtree_make_veb(kdtree_t* kd) {
+	size_t tsz = get_tree_size(kd->treetype);
+	int nbb = (kd->bb.any ? 2 * kd->ndim : 0);
+	int nsplit = (kd->split.any ? 1 : 0);
+	size_t recsize = (nbb + nsplit) * tsz;
+	char* block;
+	int i;
+
+	if (kd->nodeslot)
+		return 0;
+	if (kd->nodes || !recsize) {
+		ERROR("Only trees with bounding boxes or splitting planes can be put in van Emde Boas order");
+		return -1;
+	}
+	if (nbb && kd->n_bb && kd->n_bb != kd->nnodes) {
+		ERROR("Tree has %i bounding boxes, not %i", kd->n_bb, kd->nnodes);
+		return -1;
+	}
+	block = CALLOC(kd->nnodes, recsize);
+	if (!block) {
+		SYSERROR("Failed to allocate van Emde Boas nodes");
+		return -1;
+	}
+	kd->nodeslot = kdtree_veb_slots(kd->nnodes);
+	if (!kd->nodeslot) {
+		FREE(block);
+		return -1;
+	}
+	for (i=0; i<kd->nnodes; i++) {
+		char* rec = block + (size_t)kd->nodeslot[i] * recsize;
+		if (nbb)
+			memcpy(rec, (char*)kd->bb.any + (size_t)i * nbb * tsz, nbb * tsz);
+		// (leaves have no split)
+		if (nsplit && i < kd->ninterior)
+			memcpy(rec + nbb * tsz, (char*)kd->split.any + i * tsz, tsz);
+	}
+	FREE(kd->bb.any);
+	FREE(kd->split.any);
+	kd->bb.any = (nbb ? block : NULL);
+	kd->split.any = (nsplit ? block + nbb * tsz : NULL);
+	kd->nodestride = nbb + nsplit;
+	return 0;
+}
+
+static int build_threads = 1;
+
+void kdtree_set_build_threads(int nthreads) {
+	build_threads = MAX(1, nthreads);
+}
+
+int kdtree_get_build_threads(void) {
+	return build_threads;
+}
+
 void kdtree_set_limits(kdtree_t* kd, double* low, double* high) {
 	int D = kd->ndim;
 	if (!kd->minval) {
@@ -571,8 +691,14 @@ void kdtree_free(kdtree_t *kd) {
 	FREE(kd->nodes);
 	FREE(kd->lr);
 	FREE(kd->perm);
-	FREE(kd->bb.any);
-	FREE(kd->split.any);
+	if (kd->nodeslot) {
+		// (bb and split share one block)
+		FREE(kd->bb.any ? kd->bb.any : kd->split.any);
+		FREE(kd->nodeslot);
+	} else {
+		FREE(kd->bb.any);
+		FREE(kd->split.any);
+	}
 	FREE(kd->splitdim);
 	if (kd->converted_data)
 		FREE(kd->data.any);
@@ -582,6 +708,61 @@ void kdtree_free(kdtree_t *kd) {
 	FREE(kd);
 }
 
+// Appends a node's points to a list of (L, R) ranges, merging adjacent ones.
+static void add_node_range(const kdtree_t* kd, int node, void* extra) {
+	il* ranges = extra;
+	int L = kdtree_left(kd, node);
+	int R = kdtree_right(kd, node);
+	int n = il_size(ranges);
+	if (L > R)
+		return;
+	// (nodes_contained visits nodes from left to right)
+	if (n && il_get(ranges, n-1) + 1 >= L) {
+		if (R > il_get(ranges, n-1))
+			il_set(ranges, n-1, R);
+		return;
+	}
+	il_append(ranges, L);
+	il_append(ranges, R);
+}
+
+// madvise(WILLNEED)s rows [L, R] of an array with rows of "rowsize" bytes.
+static int willneed_rows(const void* base, size_t rowsize, int L, int R) {
+	size_t pagesize = sysconf(_SC_PAGESIZE);
+	uintptr_t lo = (uintptr_t)base + (size_t)L * rowsize;
+	uintptr_t hi = (uintptr_t)base + (size_t)(R+1) * rowsize;
+	lo -= (lo % pagesize);
+	if (madvise((void*)lo, hi - lo, MADV_WILLNEED)) {
+		SYSERROR("madvise(WILLNEED) failed");
+		return -1;
+	}
+	return 0;
+}
+
+int kdtree_prefetch_box(const kdtree_t* kd, const void* querylow,
+						const void* queryhi) {
+	il* ranges = il_new(256);
+	size_t datarow = get_data_size(kd->treetype) * kd->ndim;
+	int i, n = 0;
+	int rtn = 0;
+
+	kdtree_nodes_contained(kd, querylow, queryhi, add_node_range,
+						   add_node_range, ranges);
+	for (i=0; i<il_size(ranges); i+=2) {
+		int L = il_get(ranges, i);
+		int R = il_get(ranges, i+1);
+		n += R + 1 - L;
+		if (kd->data.any && willneed_rows(kd->data.any, datarow, L, R))
+			rtn = -1;
+		if (kd->perm && willneed_rows(kd->perm, sizeof(u32), L, R))
+			rtn = -1;
+		if (rtn)
+			break;
+	}
+	il_free(ranges);
+	return (rtn ? -1 : n);
+}
+
 int kdtree_nearest_neighbour(const kdtree_t* kd, const void* pt, double* p_mindist2) {
 	return kdtree_nearest_neighbour_within(kd, pt, HUGE_VAL, p_mindist2);
 }
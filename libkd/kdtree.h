@@ -73,6 +73,9 @@ enum kd_build_options {
     KD_BUILD_LINEAR_LR     = 0x10,
     // DEBUG
     KD_BUILD_FORCE_SORT    = 0x20,
+    /* Store the bounding boxes and splitting planes interleaved, one
+     record per node, in van Emde Boas order: see kdtree_make_veb(). */
+    KD_BUILD_VEB           = 0x40,
     
 };
 
@@ -164,6 +167,9 @@ struct kdtree_funcs {
 
     void  (*nearest_neighbour_internal)(const kdtree_t* kd, const void* query, double* bestd2, int* pbest);
 	kdtree_qres_t* (*rangesearch)(const kdtree_t* kd, kdtree_qres_t* res, const void* pt, double maxd2, int options);
+	int (*rangesearch_batch)(const kdtree_t* kd, kdtree_qres_t** res, const void* pts, int npts, double maxd2, int options);
+	int (*knn)(const kdtree_t* kd, const void* query, int k, double maxd2, int* inds, double* d2s);
+	int (*knn_batch)(const kdtree_t* kd, const void* pts, int npts, int k, double maxd2, int* inds, double* d2s, int* counts, int nthreads);
 
     void (*nodes_contained)(const kdtree_t* kd,
                             const void* querylow, const void* queryhi,
@@ -232,6 +238,15 @@ struct kdtree {
 	/* Split dimension for floating-point types (x ninterior) */
 	u8* splitdim;
 
+	/* If non-NULL, the tree is in van Emde Boas order (see
+	   kdtree_make_veb): the bounding box and split of node i are
+	   interleaved in a record of "nodestride" ttypes, starting
+	   nodeslot[i] records from the start of the block.  "bb" (and
+	   "split") then point into the first record and can't be indexed
+	   directly.  (nnodes) */
+	int32_t* nodeslot;
+	int nodestride;
+
 	/* bitmasks for the split dimension and location. */
 	u8 dimbits;
 	u32 dimmask;
@@ -433,7 +448,8 @@ int kdtree_nearest_neighbour_within(const kdtree_t* kd, const void *pt,
  * overlap with the query.  (In other words, all nodes that overlap
  * the query, without recursing down to leaf nodes unnecessarily.)
  * Calls one of two callbacks for fully-contained and
- * partly-contained nodes.
+ * partly-contained nodes.  For trees without bounding boxes, a node's
+ * extent is the box its ancestors' splitting planes confine it to.
  */
 void kdtree_nodes_contained(const kdtree_t* kd,
 							const void* querylow, const void* queryhi,
@@ -441,6 +457,18 @@ void kdtree_nodes_contained(const kdtree_t* kd,
 							void (*callback_overlap)(const kdtree_t* kd, int node, void* extra),
 							void* cb_extra);
 
+/*
+ * Asks the kernel to start reading in (madvise(MADV_WILLNEED)) the
+ * data -- and permutation array, if any -- of the points in the nodes
+ * that overlap the given query rectangle (see kdtree_nodes_contained).
+ * This is for warming the page cache for a memory-mapped tree before
+ * searching a known region of it.
+ *
+ * Returns the number of points, or -1 on error.
+ */
+int kdtree_prefetch_box(const kdtree_t* kd, const void* querylow,
+						const void* queryhi);
+
 #define KD_IS_LEAF(kd, i)       ((i) >= ((kd)->ninterior))
 #define KD_IS_LEFT_CHILD(i)    ((i) & 1)
 #define KD_PARENT(i)     (((i)-1)/2)
@@ -562,6 +590,50 @@ kdtree_t* KDFUNC(kdtree_build)
 	 (kdtree_t* kd, void *data, int N, int D, int Nleaf,
 	  int treetype, unsigned int options);
 
+/*
+ Rearranges the bounding boxes and splitting planes of a tree built by
+ kdtree_build() so that each node's bounding box and split are stored
+ together, in van Emde Boas order: the top half of the levels of the
+ tree come first, then each of the subtrees hanging below them, each
+ laid out the same way, recursively.  A search from the root to a leaf
+ then touches about log(levels) pages rather than one or more per
+ level, which matters when the tree is mmapped from a file that isn't
+ in the page cache.  Searches work the same way on either layout, and
+ kdtree_fits_write() and kdtree_fits_read() keep it.
+
+ (The same as building with KD_BUILD_VEB.)
+
+ Returns 0 on success.
+ */
+int kdtree_make_veb(kdtree_t* kd);
+
+/*
+ Returns the van Emde Boas record number of each node of a complete
+ tree with "nnodes" nodes (see kdtree_make_veb).
+ */
+int32_t* kdtree_veb_slots(int nnodes);
+
+/*
+ Rebuilds a tree that was built by kdtree_build() (or
+ kdtree_rebuild()), with new data, reusing its arrays rather than
+ allocating new ones.  This is for building many small trees in a
+ row.  "D", "Nleaf", "treetype", and "options" must be the same as
+ when the tree was first built, and "N" must be no larger than it was
+ then.  If the data were converted (eg, to integers), the limits are
+ recomputed.
+ */
+kdtree_t* kdtree_rebuild(kdtree_t* kd, void *data, int N, int D, int Nleaf,
+						 int treetype, unsigned int options);
+
+/*
+ Sets the number of threads kdtree_build() uses for large trees
+ (default 1).  The tree is the same whatever the number of threads.
+ This is a process-wide setting.
+ */
+void kdtree_set_build_threads(int nthreads);
+
+int kdtree_get_build_threads(void);
+
 /* Range seach for a single point.
 
  kdtree_rangesearch()
@@ -603,6 +675,46 @@ kdtree_qres_t* KDFUNC(kdtree_rangesearch_options)(const kdtree_t *kd, const void
  */
 kdtree_qres_t* KDFUNC(kdtree_rangesearch_options_reuse)(const kdtree_t *kd, kdtree_qres_t* res, const void *pt, double maxd2, int options);
 
+/*
+ Range search for "npts" query points with the same radius, walking the
+ tree once rather than once per point; useful for many small searches.
+
+ "pts" holds the query points one after another (npts * D values of the
+ tree's external type).  "res" is an array of "npts" results; NULL
+ elements are allocated, non-NULL elements are reused (as in
+ kdtree_rangesearch_options_reuse).  Each query point gets the same
+ results, in the same order, as kdtree_rangesearch_options would give.
+ (KD_OPTIONS_SPLIT_PRECHECK and KD_OPTIONS_L1_PRECHECK are ignored.)
+
+ Returns 0 on success.
+ */
+int KDFUNC(kdtree_rangesearch_batch)(const kdtree_t *kd, kdtree_qres_t** res, const void *pts, int npts, double maxd2, int options);
+
+/*
+ Finds the "k" nearest neighbours of "pt" that are within distance-
+ squared "maxd2" (use HUGE_VAL for no limit).
+
+ Writes the tree-order indices and distances-squared of the neighbours
+ into "inds" and "d2s" (each of size "k"), nearest first; points at
+ equal distances are in index order.  Use kdtree_permute() to get the
+ original indices.
+
+ Returns the number of neighbours found (less than "k" if there aren't
+ enough within "maxd2").
+ */
+int KDFUNC(kdtree_knn)(const kdtree_t *kd, const void *pt, int k, double maxd2, int* inds, double* d2s);
+
+/*
+ kdtree_knn for "npts" query points (npts * D values of the tree's
+ external type, one after another), split among "nthreads" threads.
+
+ The results for query "i" are in inds[i*k ...] and d2s[i*k ...], and
+ their number is in counts[i].
+
+ Returns 0 on success.
+ */
+int KDFUNC(kdtree_knn_batch)(const kdtree_t *kd, const void *pts, int npts, int k, double maxd2, int* inds, double* d2s, int* counts, int nthreads);
+
 #if !defined(KD_DIM)
 #undef KD_DIM_GENERIC
 #endif
@@ -38,6 +38,8 @@ kdtree_t* KDFUNC(kdtree_build)
 
 	if (kd) {
 		kd->treetype = treetype;
+		if ((options & KD_BUILD_VEB) && kdtree_make_veb(kd))
+			return NULL;
 	}
 	return kd;
 }
@@ -66,4 +68,23 @@ kdtree_qres_t* KDFUNC(kdtree_rangesearch_options_reuse)
     return kd->fun.rangesearch(kd, res, pt, maxd2, options);
 }
 
+int KDFUNC(kdtree_rangesearch_batch)
+	 (const kdtree_t *kd, kdtree_qres_t** res, const void *pts, int npts, double maxd2, int options) {
+    assert(kd->fun.rangesearch_batch);
+    return kd->fun.rangesearch_batch(kd, res, pts, npts, maxd2, options);
+}
+
+int KDFUNC(kdtree_knn)
+	 (const kdtree_t *kd, const void *pt, int k, double maxd2, int* inds, double* d2s) {
+    assert(kd->fun.knn);
+    return kd->fun.knn(kd, pt, k, maxd2, inds, d2s);
+}
+
+int KDFUNC(kdtree_knn_batch)
+	 (const kdtree_t *kd, const void *pts, int npts, int k, double maxd2,
+	  int* inds, double* d2s, int* counts, int nthreads) {
+    assert(kd->fun.knn_batch);
+    return kd->fun.knn_batch(kd, pts, npts, k, maxd2, inds, d2s, counts, nthreads);
+}
+
 
@@ -45,7 +45,8 @@ int kdtree_fits_column_is_kdtree(char* columnname) {
         starts_with(columnname, KD_STR_SPLIT) ||
         starts_with(columnname, KD_STR_SPLITDIM) ||
         starts_with(columnname, KD_STR_DATA ) ||
-        starts_with(columnname, KD_STR_RANGE);
+        starts_with(columnname, KD_STR_RANGE) ||
+        starts_with(columnname, KD_STR_VEB);
 }
 
 static int is_tree_header_ok(qfits_header* header, int* ndim, int* ndata,
@@ -412,6 +413,7 @@ int kdtree_fits_close(kdtree_t* kd) {
     // multiple kdtrees from one file...  reference count??
 	if (kd->io)
         kdtree_fits_io_close(kd->io);
+    FREE(kd->nodeslot);
     FREE(kd->name);
 	FREE(kd);
     return 0;
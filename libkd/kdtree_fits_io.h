@@ -141,6 +141,7 @@ int kdtree_fits_append_tree_flipped(kdtree_fits_t* io, const kdtree_t* kd,
 #define KD_STR_SPLITDIM  "kdtree_splitdim"
 #define KD_STR_DATA      "kdtree_data"
 #define KD_STR_RANGE     "kdtree_range"
+#define KD_STR_VEB       "kdtree_veb"
 
 // is the given column name one of the above strings?
 int kdtree_fits_column_is_kdtree(char* columnname);
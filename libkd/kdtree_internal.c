@@ -21,10 +21,13 @@
 #include <math.h>
 #include <string.h>
 #include <sys/param.h>
+#include <pthread.h>
 
+#include "os-features.h"
 #include "kdtree.h"
 #include "kdtree_internal.h"
 #include "kdtree_mem.h"
+#include "kdtree_leafscan.h"
 #include "keywords.h"
 #include "errors.h"
 
@@ -142,14 +145,21 @@
 // Which function do we use for rounding?
 #define KD_ROUND rint
 
+// Offset of node i's record in a van Emde Boas tree (see kdtree_make_veb)
+#define VEB_RECORD(kd, i) ((size_t)(kd)->nodeslot[i] * (size_t)(kd)->nodestride)
+
 // Get the low corner of the bounding box
-#define LOW_HR( kd, D, i) ((kd)->bb.TTYPE + (2*(i)*(D)))
+#define LOW_HR( kd, D, i) (unlikely((kd)->nodeslot) ?				\
+						   (kd)->bb.TTYPE + VEB_RECORD(kd, i) :		\
+						   (kd)->bb.TTYPE + (2*(i)*(D)))
 
 // Get the high corner of the bounding box
-#define HIGH_HR(kd, D, i) ((kd)->bb.TTYPE + ((2*(i)+1)*(D)))
+#define HIGH_HR(kd, D, i) (LOW_HR(kd, D, i) + (D))
 
 // Get the splitting-plane position
-#define KD_SPLIT(kd, i) ((kd)->split.TTYPE + (i))
+#define KD_SPLIT(kd, i) (unlikely((kd)->nodeslot) ?					\
+						 (kd)->split.TTYPE + VEB_RECORD(kd, i) :	\
+						 (kd)->split.TTYPE + (i))
 
 // Get a pointer to the 'i'-th data point.
 #define KD_DATA(kd, D, i) ((kd)->data.DTYPE + ((D)*(i)))
@@ -550,6 +560,35 @@ anbool add_result(const kdtree_t* kd, kdtree_qres_t* res, double sdist,
 	return TRUE;
 }
 
+// Number of points handed to the leaf-scan kernel at a time.
+#define LEAFSCAN_CHUNK 64
+
+/*
+ Adds the points L to R (inclusive) that are within distance-squared
+ "maxd2" of "query" to "res", using the (vectorized) leaf-scan kernels.
+ Returns FALSE if the results couldn't be enlarged.
+ */
+static anbool leafscan_add_results(const kdtree_t* kd, const etype* query,
+								   int L, int R, int D, double maxd2,
+								   kdtree_qres_t* res,
+								   anbool do_dists, anbool do_points) {
+	int inds[LEAFSCAN_CHUNK];
+	double d2s[LEAFSCAN_CHUNK];
+	int i, j, n;
+	for (i=L; i<=R; i+=LEAFSCAN_CHUNK) {
+		n = DTYPE_LEAFSCAN(query, KD_DATA(kd, D, i), MIN(LEAFSCAN_CHUNK, R+1-i),
+						   D, kd->minval, kd->invscale, maxd2, inds, d2s);
+		for (j=0; j<n; j++) {
+			int k = i + inds[j];
+			if (!add_result(kd, res, do_dists ? d2s[j] : HUGE_VAL,
+							KD_PERM(kd, k), KD_DATA(kd, D, k),
+							D, do_dists, do_points))
+				return FALSE;
+		}
+	}
+	return TRUE;
+}
+
 /*
   Can the query be represented as a ttype?
 
@@ -972,6 +1011,26 @@ void MANGLE(kdtree_nn)(const kdtree_t* kd, const void* vquery,
 			dtype* data;
 			L = kdtree_left(kd, nodeid);
 			R = kdtree_right(kd, nodeid);
+			if (!kd->fun.nn_point && !kd->fun.nn_new_best) {
+				// No per-point hooks: let the leaf-scan kernel find the
+				// candidates, then update the best point in order.
+				int inds[LEAFSCAN_CHUNK];
+				double d2s[LEAFSCAN_CHUNK];
+				int j, n;
+				for (i=L; i<=R; i+=LEAFSCAN_CHUNK) {
+					n = DTYPE_LEAFSCAN(query, KD_DATA(kd, D, i),
+									   MIN(LEAFSCAN_CHUNK, R+1-i), D,
+									   kd->minval, kd->invscale, bestd2,
+									   inds, d2s);
+					for (j=0; j<n; j++) {
+						if (d2s[j] > bestd2)
+							continue;
+						ibest = i + inds[j];
+						bestd2 = d2s[j];
+					}
+				}
+				continue;
+			}
 			for (i=L; i<=R; i++) {
 				anbool bailedout = FALSE;
 				double dsqd;
@@ -1038,6 +1097,286 @@ void MANGLE(kdtree_nn)(const kdtree_t* kd, const void* vquery,
 }
 
 
+/*
+ The k-nearest-neighbour results are kept in a max-heap, ordered by
+ distance and then by index, so that ties are broken the same way
+ whatever order the points are visited in.
+ */
+static inline anbool knn_before(double d2a, int ia, double d2b, int ib) {
+	return (d2a < d2b) || (d2a == d2b && ia < ib);
+}
+
+static inline void knn_swap(int* inds, double* d2s, int i, int j) {
+	int tmpi = inds[i];
+	double tmpd = d2s[i];
+	inds[i] = inds[j];
+	d2s[i] = d2s[j];
+	inds[j] = tmpi;
+	d2s[j] = tmpd;
+}
+
+static void knn_sift_down(int* inds, double* d2s, int N, int i) {
+	while (1) {
+		int c = 2*i + 1;
+		if (c >= N)
+			break;
+		if (c+1 < N && knn_before(d2s[c], inds[c], d2s[c+1], inds[c+1]))
+			c++;
+		if (!knn_before(d2s[i], inds[i], d2s[c], inds[c]))
+			break;
+		knn_swap(inds, d2s, i, c);
+		i = c;
+	}
+}
+
+// Adds point "ind", at distance-squared "d2", to the heap of "*pn"
+// (at most "k") results.
+static void knn_add(int* inds, double* d2s, int k, int* pn,
+					int ind, double d2) {
+	int i = *pn;
+	if (i < k) {
+		inds[i] = ind;
+		d2s[i] = d2;
+		(*pn)++;
+		while (i > 0) {
+			int parent = (i-1)/2;
+			if (!knn_before(d2s[parent], inds[parent], d2s[i], inds[i]))
+				break;
+			knn_swap(inds, d2s, i, parent);
+			i = parent;
+		}
+		return;
+	}
+	if (!knn_before(d2, ind, d2s[0], inds[0]))
+		return;
+	inds[0] = ind;
+	d2s[0] = d2;
+	knn_sift_down(inds, d2s, k, 0);
+}
+
+int MANGLE(kdtree_knn)(const kdtree_t* kd, const void* vquery, int k,
+					   double maxd2, int* inds, double* d2s) {
+	int nodestack[100];
+	double dist2stack[100];
+	int stackpos = 0;
+	int D;
+	const etype* query = vquery;
+	// the k-th best distance so far (or the limit).
+	double bestd2 = maxd2;
+	int n = 0;
+	int i;
+
+	if (!kd) {
+		WARNING("kdtree_knn: null tree!\n");
+		return 0;
+	}
+	if (k <= 0)
+		return 0;
+
+#if defined(KD_DIM)
+	assert(kd->ndim == KD_DIM);
+	D = KD_DIM;
+#else
+	D = kd->ndim;
+#endif
+
+	// This is kdtree_nn_bb() or the split-plane search of kdtree_nn(),
+	// except that the pruning distance is the k-th best so far.
+
+	// queue root.
+	nodestack[0] = 0;
+	dist2stack[0] = 0.0;
+
+	while (stackpos >= 0) {
+		int nodeid;
+
+		if (dist2stack[stackpos] > bestd2) {
+			// pruned!
+			stackpos--;
+			continue;
+		}
+		nodeid = nodestack[stackpos];
+		stackpos--;
+
+		if (KD_IS_LEAF(kd, nodeid)) {
+			int L, R;
+			L = kdtree_left(kd, nodeid);
+			R = kdtree_right(kd, nodeid);
+			for (i=L; i<=R; i++) {
+				anbool bailedout = FALSE;
+				double dsqd;
+				dist2_bailout(kd, query, KD_DATA(kd, D, i), D, bestd2,
+							  &bailedout, &dsqd);
+				if (bailedout)
+					continue;
+				knn_add(inds, d2s, k, &n, i, dsqd);
+				if (n == k)
+					bestd2 = d2s[0];
+			}
+			continue;
+		}
+
+		if (!kd->split.any) {
+			// Bounding boxes: stack the children by their distance.
+			double childd2[2];
+			double firstd2, secondd2;
+			int firstid, secondid;
+			int child;
+
+			for (child=0; child<2; child++) {
+				int childid = (child ? KD_CHILD_RIGHT(nodeid) : KD_CHILD_LEFT(nodeid));
+				ttype *tlo=NULL, *thi=NULL;
+				double dist2 = 0.0;
+				int d;
+				bboxes(kd, childid, &tlo, &thi, D);
+				for (d=0; d<D; d++) {
+					etype bblo, bbhi;
+					bblo = POINT_TE(kd, d, tlo[d]);
+					if (query[d] < bblo) {
+						dist2 += (bblo - query[d])*(bblo - query[d]);
+					} else {
+						bbhi = POINT_TE(kd, d, thi[d]);
+						if (query[d] > bbhi)
+							dist2 += (query[d] - bbhi)*(query[d] - bbhi);
+						else
+							continue;
+					}
+					if (dist2 > bestd2)
+						break;
+				}
+				childd2[child] = (dist2 > bestd2 ? HUGE_VAL : dist2);
+			}
+
+			if (childd2[0] <= childd2[1]) {
+				firstd2 = childd2[0];
+				secondd2 = childd2[1];
+				firstid = KD_CHILD_LEFT(nodeid);
+				secondid = KD_CHILD_RIGHT(nodeid);
+			} else {
+				firstd2 = childd2[1];
+				secondd2 = childd2[0];
+				firstid = KD_CHILD_RIGHT(nodeid);
+				secondid = KD_CHILD_LEFT(nodeid);
+			}
+			if (firstd2 == HUGE_VAL)
+				continue;
+			// it's a stack, so put the "second" one on first.
+			if (secondd2 != HUGE_VAL) {
+				stackpos++;
+				nodestack[stackpos] = secondid;
+				dist2stack[stackpos] = secondd2;
+			}
+			stackpos++;
+			nodestack[stackpos] = firstid;
+			dist2stack[stackpos] = firstd2;
+
+		} else {
+			// Splitting planes: stack the far child (if it's within
+			// range) and then the near child.
+			ttype split;
+			int dim;
+			etype rsplit;
+			double del, fard2;
+			int nearchild, farchild;
+
+			split = *KD_SPLIT(kd, nodeid);
+			if (kd->splitdim) {
+				dim = kd->splitdim[nodeid];
+			} else {
+				// packed int
+				bigint tmpsplit = split;
+				dim = tmpsplit & kd->dimmask;
+				split = tmpsplit & kd->splitmask;
+			}
+			rsplit = POINT_TE(kd, dim, split);
+			del = query[dim] - rsplit;
+			fard2 = del*del;
+			if (query[dim] < rsplit) {
+				nearchild = KD_CHILD_LEFT (nodeid);
+				farchild  = KD_CHILD_RIGHT(nodeid);
+			} else {
+				nearchild = KD_CHILD_RIGHT(nodeid);
+				farchild  = KD_CHILD_LEFT (nodeid);
+			}
+			if (fard2 <= bestd2) {
+				stackpos++;
+				nodestack[stackpos] = farchild;
+				dist2stack[stackpos] = fard2;
+			}
+			stackpos++;
+			nodestack[stackpos] = nearchild;
+			dist2stack[stackpos] = 0.0;
+		}
+	}
+
+	// Heap-sort the results into increasing order.
+	for (i=n-1; i>0; i--) {
+		knn_swap(inds, d2s, 0, i);
+		knn_sift_down(inds, d2s, i, 0);
+	}
+	return n;
+}
+
+struct knn_batch {
+	const kdtree_t* kd;
+	const etype* pts;
+	int k;
+	double maxd2;
+	int* inds;
+	double* d2s;
+	int* counts;
+	// this thread's queries.
+	int start;
+	int end;
+	pthread_t thread;
+	anbool running;
+};
+
+static void* knn_batch_thread(void* v) {
+	struct knn_batch* b = v;
+	int D = b->kd->ndim;
+	int q;
+	for (q=b->start; q<b->end; q++)
+		b->counts[q] = MANGLE(kdtree_knn)(b->kd, b->pts + (size_t)q * D, b->k,
+										  b->maxd2, b->inds + (size_t)q * b->k,
+										  b->d2s + (size_t)q * b->k);
+	return NULL;
+}
+
+int MANGLE(kdtree_knn_batch)(const kdtree_t* kd, const void* vpts, int npts,
+							 int k, double maxd2, int* inds, double* d2s,
+							 int* counts, int nthreads) {
+	int i;
+	nthreads = MAX(1, MIN(nthreads, npts));
+	{
+		struct knn_batch batches[nthreads];
+		for (i=0; i<nthreads; i++) {
+			struct knn_batch* b = batches + i;
+			b->kd = kd;
+			b->pts = vpts;
+			b->k = k;
+			b->maxd2 = maxd2;
+			b->inds = inds;
+			b->d2s = d2s;
+			b->counts = counts;
+			b->start = (int)((int64_t)npts * i / nthreads);
+			b->end = (int)((int64_t)npts * (i+1) / nthreads);
+			// (the first batch is done in this thread)
+			b->running = (i > 0) &&
+				(pthread_create(&b->thread, NULL, knn_batch_thread, b) == 0);
+		}
+		for (i=0; i<nthreads; i++) {
+			struct knn_batch* b = batches + i;
+			if (b->running)
+				pthread_join(b->thread, NULL);
+			else
+				knn_batch_thread(b);
+		}
+	}
+	return 0;
+}
+
+
 kdtree_qres_t* MANGLE(kdtree_rangesearch_options)
      (const kdtree_t* kd, kdtree_qres_t* res, const void* vquery,
       double maxd2, int options)
@@ -1203,36 +1542,11 @@ kdtree_qres_t* MANGLE(kdtree_rangesearch_options)
 		stackpos--;
 
 		if (KD_IS_LEAF(kd, nodeid)) {
-			dtype* data;
 			L = kdtree_left(kd, nodeid);
 			R = kdtree_right(kd, nodeid);
-
-			if (do_dists) {
-				for (i=L; i<=R; i++) {
-					anbool bailedout = FALSE;
-					double dsqd;
-					data = KD_DATA(kd, D, i);
-					// FIXME benchmark dist2 vs dist2_bailout.
-
-					// HACK - should do "use_dtype", just like "use_ttype".
-					dist2_bailout(kd, query, data, D, maxd2, &bailedout, &dsqd);
-					if (bailedout)
-						continue;
-					if (!add_result(kd, res, dsqd, KD_PERM(kd, i), data,
-                                    D, do_dists, do_points))
-						return NULL;
-				}
-			} else {
-				for (i=L; i<=R; i++) {
-					data = KD_DATA(kd, D, i);
-					// HACK - should do "use_dtype", just like "use_ttype".
-					if (dist2_exceeds(kd, query, data, D, maxd2))
-						continue;
-					if (!add_result(kd, res, HUGE_VAL, KD_PERM(kd, i), data,
-                                    D, do_dists, do_points))
-						return NULL;
-				}
-			}
+			if (!leafscan_add_results(kd, query, L, R, D, maxd2, res,
+									  do_dists, do_points))
+				return NULL;
 			continue;
 		}
 
@@ -1253,7 +1567,7 @@ kdtree_qres_t* MANGLE(kdtree_rangesearch_options)
 				if (kd->splitdim)
 					pdim = kd->splitdim[KD_PARENT(nodeid)];
 				else {
-					pdim = kd->split.TTYPE[KD_PARENT(nodeid)];
+					pdim = *KD_SPLIT(kd, KD_PARENT(nodeid));
 					pdim &= kd->dimmask;
 				}
 				if (TTYPE_INTEGER && use_tquery) {
@@ -1421,6 +1735,294 @@ kdtree_qres_t* MANGLE(kdtree_rangesearch_options)
 	return res;
 }
 
+/*
+ Range search for up to 64 queries at once: walks the tree once, carrying
+ along a bitmask of the queries that can reach each node.
+
+ Each query visits the nodes it would visit in
+ kdtree_rangesearch_options(), in the same order, so it gets the same
+ results in the same order.  In bounding-box trees the order doesn't
+ depend on the query (right child first).  In splitting-plane trees each
+ query visits the "far" child (if it's in range) and then the "near"
+ child; queries whose near child is the left child visit the right child
+ before the left child, and the others visit it after.
+ */
+static int MANGLE(rangesearch_batch_64)
+	 (const kdtree_t* kd, kdtree_qres_t** results, const etype* queries,
+	  int nq, double maxd2, int options) {
+	int D = DIMENSION(kd);
+	int nstack = 3 * kd->nlevels + 1;
+	int nodestack[nstack];
+	uint64_t maskstack[nstack];
+	int stackpos = 0;
+	anbool do_dists;
+	anbool do_points = TRUE;
+	anbool do_wholenode_check;
+	anbool use_bboxes = FALSE;
+	double maxdist;
+	ttype tlinf = 0;
+	ttype tl2 = 0;
+	bigttype bigtl2 = 0;
+	double dtl2 = 0.0, dtlinf = 0.0;
+	ttype tquery[nq * D];
+	anbool use_tsplit[nq];
+	anbool use_tmath[nq];
+	anbool use_bigtmath[nq];
+	int q;
+
+	do_dists = options & KD_OPTIONS_COMPUTE_DISTS;
+	do_wholenode_check = !(options & KD_OPTIONS_SMALL_RADIUS);
+
+	if (!kd->split.any)
+		use_bboxes = TRUE;
+	else if (kd->bb.any && !(options & KD_OPTIONS_USE_SPLIT))
+		use_bboxes = TRUE;
+	assert(use_bboxes || kd->splitdim || TTYPE_INTEGER);
+
+	maxdist = sqrt(maxd2);
+
+	if (TTYPE_INTEGER) {
+		dtl2   = DIST2_ET(kd, maxd2, );
+		dtlinf = DIST_ET(kd, maxdist, );
+		tlinf  = ceil(dtlinf);
+		bigtl2 = ceil(dtl2);
+		tl2    = bigtl2;
+	}
+
+	for (q=0; q<nq; q++) {
+		kdtree_qres_t* res = results[q];
+		anbool use_tquery = FALSE;
+		use_tsplit[q] = use_tmath[q] = use_bigtmath[q] = FALSE;
+		if (TTYPE_INTEGER && kd->split.any)
+			use_tquery = ttype_query(kd, queries + q*D, tquery + q*D);
+		use_tsplit[q] = use_tquery && (dtlinf < TTYPE_MAX);
+		if (TTYPE_INTEGER && use_tquery && (kd->bb.any || kd->nodes)) {
+			if (dtl2 < TTYPE_MAX)
+				use_tmath[q] = TRUE;
+			else if (dtl2 < BIGTTYPE_MAX &&
+					 !(options & KD_OPTIONS_NO_BIG_INT_MATH))
+				use_bigtmath[q] = TRUE;
+		}
+
+		if (res) {
+			if (!res->capacity)
+				resize_results(res, KDTREE_MAX_RESULTS, D, do_dists, do_points);
+			else
+				resize_results(res, res->capacity, D, do_dists, do_points);
+			res->nres = 0;
+		} else {
+			res = CALLOC(1, sizeof(kdtree_qres_t));
+			if (!res) {
+				SYSERROR("Failed to allocate kdtree_qres_t struct");
+				return -1;
+			}
+			resize_results(res, KDTREE_MAX_RESULTS, D, do_dists, do_points);
+			results[q] = res;
+		}
+	}
+
+	// queue root.
+	nodestack[0] = 0;
+	maskstack[0] = (nq == 64) ? ~(uint64_t)0 : (((uint64_t)1 << nq) - 1);
+
+	while (stackpos >= 0) {
+		int nodeid;
+		uint64_t mask;
+		int i;
+		int dim = -1;
+		int L, R;
+
+		nodeid = nodestack[stackpos];
+		mask = maskstack[stackpos];
+		stackpos--;
+
+		if (KD_IS_LEAF(kd, nodeid)) {
+			L = kdtree_left(kd, nodeid);
+			R = kdtree_right(kd, nodeid);
+			for (q=0; q<nq; q++) {
+				const etype* query = queries + q*D;
+				kdtree_qres_t* res = results[q];
+				if (!(mask & ((uint64_t)1 << q)))
+					continue;
+				if (!leafscan_add_results(kd, query, L, R, D, maxd2, res,
+										  do_dists, do_points))
+					return -1;
+			}
+			continue;
+		}
+
+		if (kd->splitdim)
+			dim = kd->splitdim[nodeid];
+
+		if (use_bboxes) {
+			ttype *tlo=NULL, *thi=NULL;
+			etype bblo[D], bbhi[D];
+			anbool have_ebb = FALSE;
+
+			bboxes(kd, nodeid, &tlo, &thi, D);
+			assert(tlo && thi);
+
+			for (q=0; q<nq; q++) {
+				const etype* query = queries + q*D;
+				const ttype* tq = tquery + q*D;
+				uint64_t bit = (uint64_t)1 << q;
+				anbool wholenode;
+				if (!(mask & bit))
+					continue;
+				if (TTYPE_INTEGER && use_tmath[q]) {
+					if (bb_point_mindist2_exceeds_ttype(tlo, thi, tq, D, tl2)) {
+						mask &= ~bit;
+						continue;
+					}
+					wholenode = do_wholenode_check &&
+						!bb_point_maxdist2_exceeds_ttype(tlo, thi, tq, D, tl2);
+				} else if (TTYPE_INTEGER && use_bigtmath[q]) {
+					if (bb_point_mindist2_exceeds_bigttype(tlo, thi, tq, D, bigtl2)) {
+						mask &= ~bit;
+						continue;
+					}
+					wholenode = do_wholenode_check &&
+						!bb_point_maxdist2_exceeds_bigttype(tlo, thi, tq, D, bigtl2);
+				} else {
+					if (!have_ebb) {
+						int d;
+						for (d=0; d<D; d++) {
+							bblo[d] = POINT_TE(kd, d, tlo[d]);
+							bbhi[d] = POINT_TE(kd, d, thi[d]);
+						}
+						have_ebb = TRUE;
+					}
+					if (bb_point_mindist2_exceeds(bblo, bbhi, query, D, maxd2)) {
+						mask &= ~bit;
+						continue;
+					}
+					wholenode = do_wholenode_check &&
+						!bb_point_maxdist2_exceeds(bblo, bbhi, query, D, maxd2);
+				}
+				if (wholenode) {
+					kdtree_qres_t* res = results[q];
+					L = kdtree_left(kd, nodeid);
+					R = kdtree_right(kd, nodeid);
+					for (i=L; i<=R; i++) {
+						double dsqd = HUGE_VAL;
+						if (do_dists)
+							dsqd = dist2(kd, query, KD_DATA(kd, D, i), D);
+						if (!add_result(kd, res, dsqd, KD_PERM(kd, i),
+										KD_DATA(kd, D, i), D,
+										do_dists, do_points))
+							return -1;
+					}
+					mask &= ~bit;
+				}
+			}
+			if (!mask)
+				continue;
+			stackpos++;
+			nodestack[stackpos] = KD_CHILD_LEFT(nodeid);
+			maskstack[stackpos] = mask;
+			stackpos++;
+			nodestack[stackpos] = KD_CHILD_RIGHT(nodeid);
+			maskstack[stackpos] = mask;
+
+		} else {
+			// use_splits.
+			ttype split;
+			dtype rsplit;
+			// queries whose near child is the left / right child, and
+			// those whose far child is in range.
+			uint64_t nearleft = 0, nearright = 0;
+			uint64_t farleft = 0, farright = 0;
+
+			split = *KD_SPLIT(kd, nodeid);
+			if (!kd->splitdim && TTYPE_INTEGER) {
+				bigint tmpsplit;
+				tmpsplit = split;
+				dim = tmpsplit & kd->dimmask;
+				split = tmpsplit & kd->splitmask;
+			}
+			rsplit = POINT_TE(kd, dim, split);
+
+			for (q=0; q<nq; q++) {
+				const etype* query = queries + q*D;
+				uint64_t bit = (uint64_t)1 << q;
+				if (!(mask & bit))
+					continue;
+				if (TTYPE_INTEGER && use_tsplit[q]) {
+					const ttype* tq = tquery + q*D;
+					if (tq[dim] < split) {
+						nearleft |= bit;
+						if (split - tq[dim] <= tlinf)
+							farright |= bit;
+					} else {
+						nearright |= bit;
+						if (tq[dim] - split <= tlinf)
+							farleft |= bit;
+					}
+				} else {
+					if (query[dim] < rsplit) {
+						nearleft |= bit;
+						if (rsplit - query[dim] <= maxdist)
+							farright |= bit;
+					} else {
+						nearright |= bit;
+						if (query[dim] - rsplit <= maxdist)
+							farleft |= bit;
+					}
+				}
+			}
+			// (pushed in reverse order)
+			if (nearright) {
+				stackpos++;
+				nodestack[stackpos] = KD_CHILD_RIGHT(nodeid);
+				maskstack[stackpos] = nearright;
+			}
+			if (nearleft | farleft) {
+				stackpos++;
+				nodestack[stackpos] = KD_CHILD_LEFT(nodeid);
+				maskstack[stackpos] = nearleft | farleft;
+			}
+			if (farright) {
+				stackpos++;
+				nodestack[stackpos] = KD_CHILD_RIGHT(nodeid);
+				maskstack[stackpos] = farright;
+			}
+		}
+	}
+
+	for (q=0; q<nq; q++) {
+		if (!(options & KD_OPTIONS_NO_RESIZE_RESULTS))
+			resize_results(results[q], results[q]->nres, D, do_dists, do_points);
+		if (options & KD_OPTIONS_SORT_DISTS)
+			kdtree_qsort_results(results[q], kd->ndim);
+	}
+	return 0;
+}
+
+int MANGLE(kdtree_rangesearch_batch)
+	 (const kdtree_t* kd, kdtree_qres_t** results, const void* vqueries,
+	  int nq, double maxd2, int options) {
+	const etype* queries = vqueries;
+	int D = (kd ? kd->ndim : 0);
+	int i;
+
+	if (!kd || !queries || nq < 0)
+		return -1;
+#if defined(KD_DIM)
+	assert(kd->ndim == KD_DIM);
+	D = KD_DIM;
+#endif
+	if (options & KD_OPTIONS_SORT_DISTS)
+		// gotta compute 'em if ya wanna sort 'em!
+		options |= KD_OPTIONS_COMPUTE_DISTS;
+
+	for (i=0; i<nq; i+=64) {
+		if (MANGLE(rangesearch_batch_64)(kd, results + i, queries + i*D,
+										 MIN(64, nq - i), maxd2, options))
+			return -1;
+	}
+	return 0;
+}
+
 
 static void* get_data(const kdtree_t* kd, int i) {
 	return KD_DATA(kd, kd->ndim, i);
@@ -1450,17 +2052,23 @@ static void copy_data_double(const kdtree_t* kd, int start, int N,
 #endif
 }
 
-static dtype* kdqsort_arr;
-static int kdqsort_D;
+// (kdtree_build() can run in several threads at once, so the sort
+// is reentrant.)
+struct kdqsort_token {
+	dtype* arr;
+	int D;
+};
 
-static int kdqsort_compare(const void* v1, const void* v2)
+static int QSORT_COMPARISON_FUNCTION(kdqsort_compare, void* vtoken,
+									 const void* v1, const void* v2)
 {
+	struct kdqsort_token* token = vtoken;
 	int i1, i2;
 	dtype val1, val2;
 	i1 = *((int*)v1);
 	i2 = *((int*)v2);
-	val1 = kdqsort_arr[i1 * kdqsort_D];
-	val2 = kdqsort_arr[i2 * kdqsort_D];
+	val1 = token->arr[i1 * token->D];
+	val2 = token->arr[i2 * token->D];
 	if (val1 < val2)
 		return -1;
 	else if (val1 > val2)
@@ -1474,6 +2082,7 @@ static int kdtree_qsort(dtype *arr, unsigned int *parr, int l, int r, int D, int
 	int i, j, N;
 	dtype* tmparr;
 	int* tmpparr;
+	struct kdqsort_token token;
 
 	N = r - l + 1;
 	permute = MALLOC(N * sizeof(int));
@@ -1483,10 +2092,10 @@ static int kdtree_qsort(dtype *arr, unsigned int *parr, int l, int r, int D, int
 	}
 	for (i = 0; i < N; i++)
 		permute[i] = i;
-	kdqsort_arr = arr + l * D + d;
-	kdqsort_D = D;
+	token.arr = arr + l * D + d;
+	token.D = D;
 
-	qsort(permute, N, sizeof(int), kdqsort_compare);
+	QSORT_R(permute, N, sizeof(int), &token, kdqsort_compare);
 
 	// permute the data one dimension at a time...
 	tmparr = MALLOC(N * sizeof(dtype));
@@ -2126,8 +2735,9 @@ static void compute_bb(const dtype* data, int D, int N, dtype* lo, dtype* hi) {
     }
 }
 
-static void save_bb(kdtree_t* kd, int i, const dtype* lo, const dtype* hi) {
-    int D = kd->ndim;
+// "D" is the caller's dimension (KD_DIM, when it's a constant), which
+// is also the size of "lo" and "hi".
+static inline void save_bb(kdtree_t* kd, int D, int i, const dtype* lo, const dtype* hi) {
     int d;
     for (d=0; d<D; d++) {
         (LOW_HR (kd, D, i))[d] = POINT_DT(kd, d, lo[d], floor);
@@ -2139,18 +2749,517 @@ static int needs_data_conversion() {
     return DTYPE_INTEGER && !ETYPE_INTEGER;
 }
 
-kdtree_t* MANGLE(kdtree_build)
-	 (kdtree_t* kd, etype* indata, int N, int D, int Nleaf, unsigned int options) {
-	int i;
+// Trees with fewer points than this are always built in one thread.
+#define BUILD_THREAD_MIN 100000
+// Nodes with at least this many points get their bounding box
+// computed by several threads.
+#define BB_THREAD_MIN (1 << 18)
+
+struct bb_chunk {
+	const dtype* data;
+	int D;
+	int N;
+	dtype lo[KDTREE_MAX_DIM];
+	dtype hi[KDTREE_MAX_DIM];
+	pthread_t thread;
+	anbool running;
+};
+
+static void* bb_thread(void* v) {
+	struct bb_chunk* c = v;
+	compute_bb(c->data, c->D, c->N, c->lo, c->hi);
+	return NULL;
+}
+
+/*
+ Like compute_bb(), but splits the points between "nthreads" threads.
+ The chunks are combined in order, so the result is the same.
+ */
+static void compute_bb_threaded(const dtype* data, int D, int N,
+								dtype* lo, dtype* hi, int nthreads) {
+	struct bb_chunk chunks[nthreads];
+	int i, d, start;
+
+	if (nthreads <= 1 || N < BB_THREAD_MIN) {
+		compute_bb(data, D, N, lo, hi);
+		return;
+	}
+	start = 0;
+	for (i=0; i<nthreads; i++) {
+		struct bb_chunk* c = chunks + i;
+		int end = (int)((int64_t)N * (i+1) / nthreads);
+		c->data = data + (size_t)start * D;
+		c->D = D;
+		c->N = end - start;
+		start = end;
+		// (chunk 0 is done in this thread)
+		c->running = (i > 0) &&
+			(pthread_create(&c->thread, NULL, bb_thread, c) == 0);
+	}
+	for (i=0; i<nthreads; i++) {
+		struct bb_chunk* c = chunks + i;
+		if (c->running)
+			pthread_join(c->thread, NULL);
+		else
+			bb_thread(c);
+	}
+	for (d=0; d<D; d++) {
+		lo[d] = chunks[0].lo[d];
+		hi[d] = chunks[0].hi[d];
+	}
+	for (i=1; i<nthreads; i++)
+		for (d=0; d<D; d++) {
+			if (chunks[i].hi[d] > hi[d]) hi[d] = chunks[i].hi[d];
+			if (chunks[i].lo[d] < lo[d]) lo[d] = chunks[i].lo[d];
+		}
+}
+
+/*
+ Splits interior node "i", which owns data points [left, right]: saves
+ its bounding box and splitting plane, and partitions its points.
+ Returns "m", the first point of the right child (so the left child
+ owns [left, m-1] and the right child [m, right]), or -1 on error.
+
+ Only the node's own entries and points are touched, so disjoint
+ subtrees can be built by different threads.
+ */
+static int build_node(kdtree_t* kd, int i, int left, int right,
+					  unsigned int options, int nthreads) {
+#if defined(KD_DIM)
+	// let the compiler know that D is a constant...
+	int D = KD_DIM;
+#else
+	int D = kd->ndim;
+#endif
+	dtype* data = kd->data.DTYPE;
+	dtype hi[D], lo[D];
+	unsigned int d;
+	dtype maxrange;
+	ttype s;
+	int dim = 0;
+	int m;
+	dtype qsplit = 0;
 	int xx;
+
+	if (left >= right) {
+		//debug("Empty node %i: left=right=%i\n", i, left);
+		if (options & KD_BUILD_BBOX) {
+			dtype nullbb[D];
+			for (d=0; d<D; d++)
+				nullbb[d] = 0;
+			save_bb(kd, D, i, nullbb, nullbb);
+		}
+		if (kd->splitdim)
+			kd->splitdim[i] = 0;
+		// both children get [left, right]'s R pointer.
+		return right + 1;
+	}
+
+	/* More sanity */
+	assert(0 <= left);
+	assert(left <= right);
+	assert(right < kd->ndata);
+
+	/* Find the bounding-box for this node. */
+	compute_bb_threaded(KD_DATA(kd, D, left), D, right - left + 1, lo, hi,
+						nthreads);
+
+	if (options & KD_BUILD_BBOX)
+		save_bb(kd, D, i, lo, hi);
+
+	/* Split along dimension with largest range */
+	maxrange = DTYPE_MIN;
+	for (d=0; d<D; d++)
+		if ((hi[d] - lo[d]) >= maxrange) {
+			maxrange = hi[d] - lo[d];
+			dim = d;
+		}
+	d = dim;
+	assert (d < D);
+
+	if ((options & KD_BUILD_FORCE_SORT) ||
+            (TTYPE_INTEGER && !(options & KD_BUILD_SPLITDIM))) {
+            
+            /* We're packing dimension and split location into an int. */
+
+		/* Sort the data. */
+
+		/* Because the nature of the inttree is to bin the split
+		 * planes, we have to be careful. Here, we MUST sort instead
+		 * of merely partitioning, because we may not be able to
+		 * properly represent the median as a split plane. Imagine the
+		 * following on the dtype line: 
+		 *
+		 *    |P P   | P M  | P    |P     |  PP |  ------> X
+		 *           1      2
+		 * The |'s are possible split positions. If M is selected to
+		 * split on, we actually cannot select the split 1 or 2
+		 * immediately, because if we selected 2, then M would be on
+		 * the wrong side (the medians always go to the right) and we
+		 * can't select 1 because then P would be on the wrong side.
+		 * So, the solution is to try split 2, and if point M-1 is on
+		 * the correct side, great. Otherwise, we have to move shift
+		 * point M-1 into the right side and only then chose plane 1. */
+
+
+		/* FIXME but qsort allocates a 2nd perm array GAH */
+		if (kdtree_qsort(data, kd->perm, left, right, D, dim)) {
+			ERROR("kdtree_qsort failed");
+			return -1;
+		}
+		m = (1+left+right)/2;
+
+		/* Make sure sort works */
+		for(xx=left; xx<=right-1; xx++) { 
+			assert(data[D*xx+d] <= data[D*(xx+1)+d]);
+		}
+
+		/* Encode split dimension and value. */
+		/* "s" is the location of the splitting plane in the "tree"
+		   data type. */
+		s = POINT_DT(kd, d, data[D*m+d], KD_ROUND);
+
+		if (kd->split.any) {
+			/* If we are using the "split" array to store both the
+			   splitting plane and the splitting dimension, then we
+			   truncate a few bits from "s" here. */
+			bigint tmps = s;
+			tmps &= kd->splitmask;
+			assert((tmps & kd->dimmask) == 0);
+			s = tmps;
+		}
+		/* "qsplit" is the location of the splitting plane in the "data"
+		   type. */
+		qsplit = POINT_TD(kd, d, s);
+
+		/* Play games to make sure we properly partition the data */
+		while (m < right && data[D*m+d] < qsplit) m++;
+		while (left < m  && qsplit < data[D*(m-1)+d]) m--;
+
+		/* Even more sanity */
+		assert(m >= -1);
+		assert(left <= m);
+		assert(m <= right);
+		for (xx=left; m && xx<=m-1; xx++)
+			assert(data[D*xx+d] <= qsplit);
+		for (xx=m; xx<=right; xx++)
+			assert(qsplit <= data[D*xx+d]);
+
+	} else {
+            /* "m-1" becomes R of the left child;
+             "m" becomes L of the right child. */
+            if (kd->has_linear_lr) {
+                m = kdtree_left(kd, KD_CHILD_RIGHT(i));
+            } else {
+                /* Pivot the data at the median */
+                m = (left + right + 1) / 2;
+            }
+            assert(m >= left);
+            assert(m <= right);
+		kdtree_quickselect_partition(data, kd->perm, left, right, D, dim, m);
+
+		s = POINT_DT(kd, d, data[D*m+d], KD_ROUND);
+
+		assert(m != 0);
+		assert(left <= (m-1));
+		assert(m <= right);
+		for (xx=left; xx<=m-1; xx++)
+			assert(data[D*xx+d] <= data[D*m+d]);
+		for (xx=left; xx<=m-1; xx++)
+			assert(data[D*xx+d] <= s);
+		for (xx=m; xx<=right; xx++)
+			assert(data[D*m+d] <= data[D*xx+d]);
+		for (xx=m; xx<=right; xx++)
+			assert(s <= data[D*xx+d]);
+	}
+
+	if (kd->split.any) {
+		if (kd->splitdim)
+			*KD_SPLIT(kd, i) = s;
+		else {
+			bigint tmps = s;
+			*KD_SPLIT(kd, i) = tmps | dim;
+		}
+	}
+	if (kd->splitdim)
+		kd->splitdim[i] = dim;
+	return m;
+}
+
+/*
+ Builds the whole tree, level by level, in this thread.
+ */
+static int build_serial(kdtree_t* kd, int maxlevel, unsigned int options) {
+	int D = kd->ndim;
+	int N = kd->ndata;
+	int i;
 	int lnext, level;
+
+	/* Use the lr array as a stack while building. In place in your face! */
+	kd->lr[0] = N - 1;
+	lnext = 1;
+	level = 0;
+
+	/* And in one shot, make the kdtree. Because the lr pointers
+	 * are only stored for the bottom layer, we use the lr array as a
+	 * stack. At finish, it contains the r pointers for the bottom nodes.
+	 * The l pointer is simply +1 of the previous right pointer, or 0 if we
+	 * are at the first element of the lr array. */
+	for (i = 0; i < kd->ninterior; i++) {
+		int left, right;
+		unsigned int c;
+		int m;
+
+		/* Have we reached the next level in the tree? */
+		if (i == lnext) {
+			level++;
+			lnext = lnext * 2 + 1;
+		}
+
+		/* Since we're not storing the L pointers, we have to infer L */
+		if (i == (1<<level)-1) {
+			left = 0;
+		} else {
+			left = kd->lr[i-1] + 1;
+		}
+		right = kd->lr[i];
+
+		assert(right != (unsigned int)-1);
+
+		m = build_node(kd, i, left, right, options, 1);
+		if (m < 0)
+			return -1;
+
+		/* Store the R pointers for each child */
+		c = 2*i;
+		if (level == maxlevel - 2)
+			c -= kd->ninterior;
+
+		kd->lr[c+1] = m-1;
+		kd->lr[c+2] = right;
+
+        assert(c+2 < kd->nbottom);
+	}
+
+    if (options & KD_BUILD_BBOX) {
+        // Compute bounding boxes for leaf nodes.
+        dtype hi[D], lo[D];
+        int L, R = -1;
+        for (i=0; i<kd->nbottom; i++) {
+            L = R + 1;
+            R = kd->lr[i];
+            assert(L == kdtree_leaf_left(kd, i + kd->ninterior));
+            assert(R == kdtree_leaf_right(kd, i + kd->ninterior));
+            compute_bb(KD_DATA(kd, D, L), D, R - L + 1, lo, hi);
+            save_bb(kd, D, i + kd->ninterior, lo, hi);
+        }
+    }
+	return 0;
+}
+
+/*
+ Stores the R pointers (and bounding boxes) of the two leaf children of
+ node "i", which owns [left, right] and was split at "m".
+ */
+static void build_leaves(kdtree_t* kd, int i, int left, int m, int right,
+						 unsigned int options) {
+#if defined(KD_DIM)
+	int D = KD_DIM;
+#else
+	int D = kd->ndim;
+#endif
+	int c = 2*i - kd->ninterior;
+	kd->lr[c+1] = m-1;
+	kd->lr[c+2] = right;
+	if (options & KD_BUILD_BBOX) {
+		dtype hi[D], lo[D];
+		compute_bb(KD_DATA(kd, D, left), D, m - left, lo, hi);
+		save_bb(kd, D, KD_CHILD_LEFT(i), lo, hi);
+		compute_bb(KD_DATA(kd, D, m), D, right - m + 1, lo, hi);
+		save_bb(kd, D, KD_CHILD_RIGHT(i), lo, hi);
+	}
+}
+
+/*
+ Builds the subtree below interior node "i" (at "level"), depth-first,
+ in this thread.
+ */
+static int build_subtree(kdtree_t* kd, int i, int left, int right, int level,
+						 int maxlevel, unsigned int options) {
+	int m = build_node(kd, i, left, right, options, 1);
+	if (m < 0)
+		return -1;
+	if (level == maxlevel - 2) {
+		build_leaves(kd, i, left, m, right, options);
+		return 0;
+	}
+	if (build_subtree(kd, KD_CHILD_LEFT(i), left, m-1, level+1, maxlevel,
+					  options) ||
+		build_subtree(kd, KD_CHILD_RIGHT(i), m, right, level+1, maxlevel,
+					  options))
+		return -1;
+	return 0;
+}
+
+struct build_task {
+	int node;
+	int left;
+	int right;
+	int level;
+};
+
+/*
+ The threaded build: each thread splits a node, pushes its right child
+ onto the shared stack, and carries on with its left child.  Subtrees
+ of fewer than "tasksize" points are built by one thread.
+ */
+struct build_pool {
+	kdtree_t* kd;
+	unsigned int options;
 	int maxlevel;
-    dtype hi[D], lo[D];
-    dtype* data = NULL;
+	int nthreads;
+	int tasksize;
+
+	struct build_task* stack;
+	int nstack;
+	int stacksize;
+	// number of threads working on a task.
+	int nbusy;
+	anbool failed;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+
+static int push_task(struct build_pool* p, const struct build_task* t) {
+	int rtn = 0;
+	pthread_mutex_lock(&p->mutex);
+	if (p->nstack == p->stacksize) {
+		int newsize = MAX(16, 2 * p->stacksize);
+		struct build_task* newstack = realloc(p->stack, newsize * sizeof(struct build_task));
+		if (!newstack) {
+			SYSERROR("Failed to grow kdtree build task stack to %i", newsize);
+			rtn = -1;
+			goto done;
+		}
+		p->stack = newstack;
+		p->stacksize = newsize;
+	}
+	p->stack[p->nstack++] = *t;
+	pthread_cond_signal(&p->cond);
+ done:
+	pthread_mutex_unlock(&p->mutex);
+	return rtn;
+}
 
-	dtype nullbb[D];
-	for (i=0; i<D; i++)
-		nullbb[i] = 0;
+static int run_task(struct build_pool* p, struct build_task t) {
+	kdtree_t* kd = p->kd;
+	while (1) {
+		struct build_task right;
+		int m;
+		if (t.right - t.left + 1 < p->tasksize)
+			return build_subtree(kd, t.node, t.left, t.right, t.level,
+								 p->maxlevel, p->options);
+		// Near the root, most threads are idle: lend them to the
+		// bounding-box computation.
+		m = build_node(kd, t.node, t.left, t.right, p->options,
+					   MAX(1, p->nthreads >> t.level));
+		if (m < 0)
+			return -1;
+		if (t.level == p->maxlevel - 2) {
+			build_leaves(kd, t.node, t.left, m, t.right, p->options);
+			return 0;
+		}
+		right.node = KD_CHILD_RIGHT(t.node);
+		right.left = m;
+		right.right = t.right;
+		right.level = t.level + 1;
+		if (push_task(p, &right))
+			return -1;
+		t.node = KD_CHILD_LEFT(t.node);
+		t.right = m - 1;
+		t.level++;
+	}
+}
+
+static void* build_worker(void* v) {
+	struct build_pool* p = v;
+	pthread_mutex_lock(&p->mutex);
+	while (1) {
+		struct build_task t;
+		int rtn;
+		while (!p->nstack && p->nbusy && !p->failed)
+			pthread_cond_wait(&p->cond, &p->mutex);
+		// (if the stack is empty and nobody is busy, we're done.)
+		if (!p->nstack || p->failed)
+			break;
+		t = p->stack[--p->nstack];
+		p->nbusy++;
+		pthread_mutex_unlock(&p->mutex);
+
+		rtn = run_task(p, t);
+
+		pthread_mutex_lock(&p->mutex);
+		p->nbusy--;
+		if (rtn)
+			p->failed = TRUE;
+		if (!p->nbusy || p->failed)
+			pthread_cond_broadcast(&p->cond);
+	}
+	pthread_mutex_unlock(&p->mutex);
+	return NULL;
+}
+
+/*
+ Builds the whole tree with "nthreads" threads.  Every node is split
+ exactly as build_subtree() would split it, so the tree is identical to
+ the one built serially.
+ */
+static int build_threaded(kdtree_t* kd, int maxlevel, unsigned int options,
+						  int nthreads) {
+	struct build_pool pool;
+	struct build_task root;
+	pthread_t threads[nthreads];
+	anbool started[nthreads];
+	int i;
+
+	memset(&pool, 0, sizeof(pool));
+	pool.kd = kd;
+	pool.options = options;
+	pool.maxlevel = maxlevel;
+	pool.nthreads = nthreads;
+	// aim for a few dozen tasks per thread.
+	pool.tasksize = MAX(kd->ndata / (32 * nthreads), 1024);
+	pthread_mutex_init(&pool.mutex, NULL);
+	pthread_cond_init(&pool.cond, NULL);
+
+	root.node = 0;
+	root.left = 0;
+	root.right = kd->ndata - 1;
+	root.level = 0;
+	if (push_task(&pool, &root))
+		pool.failed = TRUE;
+
+	// (thread 0 is this one.)
+	for (i=1; i<nthreads; i++)
+		started[i] = (pthread_create(threads + i, NULL, build_worker, &pool) == 0);
+	build_worker(&pool);
+	for (i=1; i<nthreads; i++)
+		if (started[i])
+			pthread_join(threads[i], NULL);
+
+	pthread_mutex_destroy(&pool.mutex);
+	pthread_cond_destroy(&pool.cond);
+	free(pool.stack);
+	return (pool.failed ? -1 : 0);
+}
+
+kdtree_t* MANGLE(kdtree_build)
+	 (kdtree_t* kd, etype* indata, int N, int D, int Nleaf, unsigned int options) {
+	int i;
+	int maxlevel;
+	int nthreads;
+	int rtn;
 
 	maxlevel = kdtree_compute_levels(N, Nleaf);
 
@@ -2226,27 +3335,35 @@ kdtree_t* MANGLE(kdtree_build)
 		kd->invscale = 1.0 / kd->scale;
 	}
 
+	/* (The arrays are only allocated if they don't exist yet: see
+	 * kdtree_rebuild().) */
+
 	/* perm stores the permutation indexes. This gets shuffled around during
 	 * sorts to keep track of the original index. */
-	kd->perm = MALLOC(sizeof(u32) * N);
+	if (!kd->perm)
+		kd->perm = MALLOC(sizeof(u32) * N);
 	assert(kd->perm);
 	for (i = 0; i < N; i++)
 		kd->perm[i] = i;
 
-	kd->lr = MALLOC(kd->nbottom * sizeof(int32_t));
+	if (!kd->lr)
+		kd->lr = MALLOC(kd->nbottom * sizeof(int32_t));
 	assert(kd->lr);
 
 	if (options & KD_BUILD_BBOX) {
-		kd->bb.any = MALLOC(kd->nnodes * 2 * D * sizeof(ttype));
+		if (!kd->bb.any)
+			kd->bb.any = MALLOC(kd->nnodes * 2 * D * sizeof(ttype));
 		assert(kd->bb.any);
 	}
 	if (options & KD_BUILD_SPLIT) {
-		kd->split.any = MALLOC(kd->ninterior * sizeof(ttype));
+		if (!kd->split.any)
+			kd->split.any = MALLOC(kd->ninterior * sizeof(ttype));
 		assert(kd->split.any);
 	}
 	if (((options & KD_BUILD_SPLIT) && !TTYPE_INTEGER) ||
 		(options & KD_BUILD_SPLITDIM)) {
-		kd->splitdim = MALLOC(kd->ninterior * sizeof(u8));
+		if (!kd->splitdim)
+			kd->splitdim = MALLOC(kd->ninterior * sizeof(u8));
 		kd->splitmask = UINT32_MAX;
         kd->dimmask = 0;
 	} else if (options & KD_BUILD_SPLIT)
@@ -2255,214 +3372,19 @@ kdtree_t* MANGLE(kdtree_build)
     if (options & KD_BUILD_LINEAR_LR)
         kd->has_linear_lr = TRUE;
 
-	/* Use the lr array as a stack while building. In place in your face! */
-	kd->lr[0] = N - 1;
-	lnext = 1;
-	level = 0;
-
-    // shorthand
-    data = kd->data.DTYPE;
-
-	/* And in one shot, make the kdtree. Because the lr pointers
-	 * are only stored for the bottom layer, we use the lr array as a
-	 * stack. At finish, it contains the r pointers for the bottom nodes.
-	 * The l pointer is simply +1 of the previous right pointer, or 0 if we
-	 * are at the first element of the lr array. */
-	for (i = 0; i < kd->ninterior; i++) {
-		unsigned int d;
-		int left, right;
-		dtype maxrange;
-		ttype s;
-		unsigned int c;
-		int dim = 0;
-		int m;
-		dtype qsplit = 0;
-
-		/* Have we reached the next level in the tree? */
-		if (i == lnext) {
-			level++;
-			lnext = lnext * 2 + 1;
-		}
-
-		/* Since we're not storing the L pointers, we have to infer L */
-		if (i == (1<<level)-1) {
-			left = 0;
-		} else {
-			left = kd->lr[i-1] + 1;
-		}
-		right = kd->lr[i];
-
-		assert(right != (unsigned int)-1);
-
-		if (left >= right) {
-			//debug("Empty node %i: left=right=%i\n", i, left);
-			if (options & KD_BUILD_BBOX)
-				save_bb(kd, i, nullbb, nullbb);
-			if (kd->splitdim)
-				kd->splitdim[i] = 0;
-			c = 2*i;
-			if (level == maxlevel - 2)
-				c -= kd->ninterior;
-			kd->lr[c+1] = right;
-			kd->lr[c+2] = right;
-			continue;
-		}
-
-		/* More sanity */
-		assert(0 <= left);
-		assert(left <= right);
-		assert(right < N);
-
-		/* Find the bounding-box for this node. */
-        compute_bb(KD_DATA(kd, D, left), D, right - left + 1, lo, hi);
-
-		if (options & KD_BUILD_BBOX)
-            save_bb(kd, i, lo, hi);
-
-		/* Split along dimension with largest range */
-		maxrange = DTYPE_MIN;
-		for (d=0; d<D; d++)
-			if ((hi[d] - lo[d]) >= maxrange) {
-				maxrange = hi[d] - lo[d];
-				dim = d;
-			}
-		d = dim;
-		assert (d < D);
-
-		if ((options & KD_BUILD_FORCE_SORT) ||
-            (TTYPE_INTEGER && !(options & KD_BUILD_SPLITDIM))) {
-            
-            /* We're packing dimension and split location into an int. */
-
-			/* Sort the data. */
-
-			/* Because the nature of the inttree is to bin the split
-			 * planes, we have to be careful. Here, we MUST sort instead
-			 * of merely partitioning, because we may not be able to
-			 * properly represent the median as a split plane. Imagine the
-			 * following on the dtype line: 
-			 *
-			 *    |P P   | P M  | P    |P     |  PP |  ------> X
-			 *           1      2
-			 * The |'s are possible split positions. If M is selected to
-			 * split on, we actually cannot select the split 1 or 2
-			 * immediately, because if we selected 2, then M would be on
-			 * the wrong side (the medians always go to the right) and we
-			 * can't select 1 because then P would be on the wrong side.
-			 * So, the solution is to try split 2, and if point M-1 is on
-			 * the correct side, great. Otherwise, we have to move shift
-			 * point M-1 into the right side and only then chose plane 1. */
-
-
-			/* FIXME but qsort allocates a 2nd perm array GAH */
-			if (kdtree_qsort(data, kd->perm, left, right, D, dim)) {
-				ERROR("kdtree_qsort failed");
-				// FIXME: memleak mania!
-				return NULL;
-			}
-			m = (1+left+right)/2;
-
-			/* Make sure sort works */
-			for(xx=left; xx<=right-1; xx++) { 
-				assert(data[D*xx+d] <= data[D*(xx+1)+d]);
-			}
-
-			/* Encode split dimension and value. */
-			/* "s" is the location of the splitting plane in the "tree"
-			   data type. */
-			s = POINT_DT(kd, d, data[D*m+d], KD_ROUND);
-
-			if (kd->split.any) {
-				/* If we are using the "split" array to store both the
-				   splitting plane and the splitting dimension, then we
-				   truncate a few bits from "s" here. */
-				bigint tmps = s;
-				tmps &= kd->splitmask;
-				assert((tmps & kd->dimmask) == 0);
-				s = tmps;
-			}
-			/* "qsplit" is the location of the splitting plane in the "data"
-			   type. */
-			qsplit = POINT_TD(kd, d, s);
-
-			/* Play games to make sure we properly partition the data */
-			while (m < right && data[D*m+d] < qsplit) m++;
-			while (left < m  && qsplit < data[D*(m-1)+d]) m--;
-
-			/* Even more sanity */
-			assert(m >= -1);
-			assert(left <= m);
-			assert(m <= right);
-			for (xx=left; m && xx<=m-1; xx++)
-				assert(data[D*xx+d] <= qsplit);
-			for (xx=m; xx<=right; xx++)
-				assert(qsplit <= data[D*xx+d]);
-
-		} else {
-            /* "m-1" becomes R of the left child;
-             "m" becomes L of the right child. */
-            if (kd->has_linear_lr) {
-                m = kdtree_left(kd, KD_CHILD_RIGHT(i));
-            } else {
-                /* Pivot the data at the median */
-                m = (left + right + 1) / 2;
-            }
-            assert(m >= left);
-            assert(m <= right);
-			kdtree_quickselect_partition(data, kd->perm, left, right, D, dim, m);
-
-			s = POINT_DT(kd, d, data[D*m+d], KD_ROUND);
-
-			assert(m != 0);
-			assert(left <= (m-1));
-			assert(m <= right);
-			for (xx=left; xx<=m-1; xx++)
-				assert(data[D*xx+d] <= data[D*m+d]);
-			for (xx=left; xx<=m-1; xx++)
-				assert(data[D*xx+d] <= s);
-			for (xx=m; xx<=right; xx++)
-				assert(data[D*m+d] <= data[D*xx+d]);
-			for (xx=m; xx<=right; xx++)
-				assert(s <= data[D*xx+d]);
-		}
-
-		if (kd->split.any) {
-			if (kd->splitdim)
-				*KD_SPLIT(kd, i) = s;
-			else {
-				bigint tmps = s;
-				*KD_SPLIT(kd, i) = tmps | dim;
-			}
-		}
-		if (kd->splitdim)
-			kd->splitdim[i] = dim;
-
-		/* Store the R pointers for each child */
-		c = 2*i;
-		if (level == maxlevel - 2)
-			c -= kd->ninterior;
-
-		kd->lr[c+1] = m-1;
-		kd->lr[c+2] = right;
-
-        assert(c+2 < kd->nbottom);
-	}
+	nthreads = kdtree_get_build_threads();
+	if (nthreads > 1 && N >= BUILD_THREAD_MIN && kd->ninterior > 0)
+		rtn = build_threaded(kd, maxlevel, options, nthreads);
+	else
+		rtn = build_serial(kd, maxlevel, options);
+	if (rtn)
+		// FIXME: memleak mania!
+		return NULL;
 
 	for (i=0; i<kd->nbottom-1; i++)
 		assert(kd->lr[i] <= kd->lr[i+1]);
 
     if (options & KD_BUILD_BBOX) {
-        // Compute bounding boxes for leaf nodes.
-        int L, R = -1;
-        for (i=0; i<kd->nbottom; i++) {
-            L = R + 1;
-            R = kd->lr[i];
-            assert(L == kdtree_leaf_left(kd, i + kd->ninterior));
-            assert(R == kdtree_leaf_right(kd, i + kd->ninterior));
-            compute_bb(KD_DATA(kd, D, L), D, R - L + 1, lo, hi);
-            save_bb(kd, i + kd->ninterior, lo, hi);
-        }
-
         // check that it worked...
 #ifndef NDEBUG
         for (i=0; i<kd->nbottom; i++) {
@@ -2502,6 +3424,10 @@ void MANGLE(kdtree_fix_bounding_boxes)(kdtree_t* kd) {
     // bounding boxes up the levels of the tree...
     int i;
     int D = kd->ndim;
+	if (kd->nodeslot) {
+		ERROR("Can't add bounding boxes to a tree in van Emde Boas order");
+		return;
+	}
     kd->bb.any = MALLOC(kd->nnodes * sizeof(ttype) * D * 2);
     assert(kd->bb.any);
 	for (i=0; i<kd->nnodes; i++) {
@@ -2510,7 +3436,7 @@ void MANGLE(kdtree_fix_bounding_boxes)(kdtree_t* kd) {
         left = kdtree_left(kd, i);
         right = kdtree_right(kd, i);
         compute_bb(KD_DATA(kd, D, left), D, right - left + 1, lo, hi);
-        save_bb(kd, i, lo, hi);
+        save_bb(kd, D, i, lo, hi);
     }
 }
 
@@ -2811,14 +3737,20 @@ static anbool is_box_contained(const ttype* lo1, const ttype* hi1,
 	return TRUE;
 }
 
+/*
+ "plo" and "phi" are the box that the splitting planes above this node
+ confine it to; they're only used if the tree has no bounding boxes.
+ */
 static void nodes_contained_rec(const kdtree_t* kd,
 								int nodeid,
 								const ttype* qlo, const ttype* qhi,
 								void (*cb_contained)(const kdtree_t* kd, int node, void* extra),
 								void (*cb_overlap)(const kdtree_t* kd, int node, void* extra),
-								void* cb_extra) {
+								void* cb_extra,
+								const ttype* plo, const ttype* phi) {
 	ttype *tlo=NULL, *thi=NULL;
 	int D = kd->ndim;
+	anbool hasbb;
 
 	// leaf nodes don't have bounding boxes, so we have to do this check first!
 	if (KD_IS_LEAF(kd, nodeid)) {
@@ -2826,9 +3758,14 @@ static void nodes_contained_rec(const kdtree_t* kd,
 		return;
 	}
 
-	if (!bboxes(kd, nodeid, &tlo, &thi, D)) {
-		ERROR("Error: kdtree_nodes_contained: node %i doesn't have a bounding box", nodeid);
-		return;
+	hasbb = bboxes(kd, nodeid, &tlo, &thi, D);
+	if (!hasbb) {
+		if (!kd->split.any) {
+			ERROR("Error: kdtree_nodes_contained: node %i doesn't have a bounding box", nodeid);
+			return;
+		}
+		tlo = (ttype*)plo;
+		thi = (ttype*)phi;
 	}
 
 	if (!do_boxes_overlap(tlo, thi, qlo, qhi, D))
@@ -2839,10 +3776,34 @@ static void nodes_contained_rec(const kdtree_t* kd,
 		return;
 	}
 
-	nodes_contained_rec(kd,  KD_CHILD_LEFT(nodeid), qlo, qhi,
-						cb_contained, cb_overlap, cb_extra);
-	nodes_contained_rec(kd, KD_CHILD_RIGHT(nodeid), qlo, qhi,
-						cb_contained, cb_overlap, cb_extra);
+	if (hasbb) {
+		nodes_contained_rec(kd,  KD_CHILD_LEFT(nodeid), qlo, qhi,
+							cb_contained, cb_overlap, cb_extra, NULL, NULL);
+		nodes_contained_rec(kd, KD_CHILD_RIGHT(nodeid), qlo, qhi,
+							cb_contained, cb_overlap, cb_extra, NULL, NULL);
+	} else {
+		// the left child is below the splitting plane, the right above.
+		ttype split;
+		int dim;
+		ttype clo[D], chi[D];
+		split = *KD_SPLIT(kd, nodeid);
+		if (kd->splitdim) {
+			dim = kd->splitdim[nodeid];
+		} else {
+			bigint tmpsplit = split;
+			dim = tmpsplit & kd->dimmask;
+			split = tmpsplit & kd->splitmask;
+		}
+		memcpy(clo, plo, D * sizeof(ttype));
+		memcpy(chi, phi, D * sizeof(ttype));
+		chi[dim] = split;
+		nodes_contained_rec(kd,  KD_CHILD_LEFT(nodeid), qlo, qhi,
+							cb_contained, cb_overlap, cb_extra, clo, chi);
+		chi[dim] = phi[dim];
+		clo[dim] = split;
+		nodes_contained_rec(kd, KD_CHILD_RIGHT(nodeid), qlo, qhi,
+							cb_contained, cb_overlap, cb_extra, clo, chi);
+	}
 }
 
 void MANGLE(kdtree_nodes_contained)
@@ -2854,6 +3815,7 @@ void MANGLE(kdtree_nodes_contained)
 	int D = kd->ndim;
 	int d;
 	ttype qlo[D], qhi[D];
+	ttype rootlo[D], roothi[D];
 	const etype* querylow = vquerylow;
 	const etype* queryhi = vqueryhi;
 
@@ -2875,9 +3837,13 @@ void MANGLE(kdtree_nodes_contained)
             // query's high position is less than the tree's min: no overlap is possible.
             return;
         }
+		// (for split-only trees, the root holds everything)
+		rootlo[d] = TTYPE_MIN;
+		roothi[d] = TTYPE_MAX;
 	}
 
-	nodes_contained_rec(kd, 0, qlo, qhi, cb_contained, cb_overlap, cb_extra);
+	nodes_contained_rec(kd, 0, qlo, qhi, cb_contained, cb_overlap, cb_extra,
+						rootlo, roothi);
 }
 
 anbool MANGLE(kdtree_get_bboxes)(const kdtree_t* kd, int node,
@@ -2907,6 +3873,9 @@ void MANGLE(kdtree_update_funcs)(kdtree_t* kd) {
     kd->fun.fix_bounding_boxes = MANGLE(kdtree_fix_bounding_boxes);
 	kd->fun.nearest_neighbour_internal = MANGLE(kdtree_nn);
 	kd->fun.rangesearch = MANGLE(kdtree_rangesearch_options);
+	kd->fun.rangesearch_batch = MANGLE(kdtree_rangesearch_batch);
+	kd->fun.knn = MANGLE(kdtree_knn);
+	kd->fun.knn_batch = MANGLE(kdtree_knn_batch);
     kd->fun.nodes_contained = MANGLE(kdtree_nodes_contained);
 }
 
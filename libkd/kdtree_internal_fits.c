@@ -117,6 +117,38 @@ int MANGLE(kdtree_read_fits)(kdtree_fits_t* io, kdtree_t* kd) {
     if (kdtree_fits_read_chunk(io, &chunk) == 0) {
 		kd->splitdim = chunk.data;
     }
+    free(chunk.tablename);
+
+	// kd->bb and kd->split, interleaved in van Emde Boas order; the
+	// row size says which of them are there.
+    chunk.tablename = get_table_name(kd->name, KD_STR_VEB);
+    chunk.itemsize = 0;
+    chunk.nrows = kd->nnodes;
+    chunk.required = FALSE;
+    if (kdtree_fits_read_chunk(io, &chunk) == 0) {
+        int nbb = 2 * kd->ndim;
+        int stride = chunk.itemsize / sizeof(ttype);
+        if ((chunk.itemsize % sizeof(ttype)) ||
+            !(stride == 1 || stride == nbb || stride == nbb + 1)) {
+            ERROR("Table %s has rows of %i bytes; expected a bounding box "
+                  "and/or split of %i-byte elements", chunk.tablename,
+                  chunk.itemsize, (int)sizeof(ttype));
+            free(chunk.tablename);
+            return -1;
+        }
+        kd->nodeslot = kdtree_veb_slots(kd->nnodes);
+        if (!kd->nodeslot) {
+            free(chunk.tablename);
+            return -1;
+        }
+        kd->nodestride = stride;
+        if (stride != 1) {
+            kd->bb.any = chunk.data;
+            kd->n_bb = kd->nnodes;
+        }
+        if (stride != nbb)
+            kd->split.any = (ttype*)chunk.data + (stride == 1 ? 0 : nbb);
+    }
     free(chunk.tablename);
 
 	// kd->data
@@ -278,7 +310,32 @@ int MANGLE(kdtree_write_fits)(kdtree_fits_t* io, const kdtree_t* kd,
         free(chunk.tablename);
         fitsbin_chunk_reset(&chunk);
 	}
-	if (kd->bb.any) {
+	if (kd->nodeslot) {
+        chunk.tablename = get_table_name(kd->name, KD_STR_VEB);
+        chunk.itemsize = sizeof(ttype) * kd->nodestride;
+        chunk.nrows = kd->nnodes;
+        chunk.data = (kd->bb.any ? kd->bb.any : kd->split.any);
+        if (flip_endian)
+            wordsize = sizeof(ttype);
+        hdr = fitsbin_get_chunk_header(fb, &chunk);
+		fits_add_long_comment
+			(hdr, "The \"%s\" table contains the kdtree nodes in van Emde Boas "
+			 "order: the nodes in the top half of the levels of the tree, "
+			 "then each of the subtrees below them, each laid out the same "
+			 "way, recursively. "
+			 "Each node has %s%s%s, stored as %u-byte, native-endian %ss "
+			 "(leaf nodes have no splitting plane; it is zero).",
+			 chunk.tablename,
+			 (kd->bb.any ? "a bounding box (two points)" : ""),
+			 (kd->bb.any && kd->split.any ? " followed by " : ""),
+			 (kd->split.any ? "a splitting plane as in the split table" : ""),
+             (unsigned int)sizeof(ttype),
+			 kdtree_kdtype_to_string(kdtree_treetype(kd)));
+        WRITE_CHUNK();
+        free(chunk.tablename);
+        fitsbin_chunk_reset(&chunk);
+	}
+	if (kd->bb.any && !kd->nodeslot) {
         chunk.tablename = get_table_name(kd->name, KD_STR_BB);
         chunk.itemsize = sizeof(ttype) * kd->ndim * 2;
         chunk.nrows = kd->nnodes;
@@ -298,7 +355,7 @@ int MANGLE(kdtree_write_fits)(kdtree_fits_t* io, const kdtree_t* kd,
         free(chunk.tablename);
         fitsbin_chunk_reset(&chunk);
 	}
-	if (kd->split.any) {
+	if (kd->split.any && !kd->nodeslot) {
         chunk.tablename = get_table_name(kd->name, KD_STR_SPLIT);
         chunk.itemsize = sizeof(ttype);
         chunk.nrows = kd->ninterior;
@@ -0,0 +1,280 @@
+/*
+  This file is part of libkd.
+
+  libkd is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 2.
+
+  libkd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with libkd; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "kdtree_leafscan.h"
+
+/*
+ The SSE2 and AVX2 versions are compiled with "target" attributes, so
+ they get built whatever the -march flags are, and are only called if
+ the CPU we're running on supports them.
+ */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KD_LEAFSCAN_X86 1
+#include <immintrin.h>
+#else
+#define KD_LEAFSCAN_X86 0
+#endif
+
+/*
+ Plain C.  "DELTA" computes the difference (query - point) in
+ dimension "d", exactly as dist2_bailout() in kdtree_internal.c does.
+ */
+#define LEAFSCAN_PLAIN(name, qtype, ptype, DELTA)						\
+	static int name(const qtype* q, const ptype* pts, int N, int D,		\
+					const double* minval, double invscale, double maxd2, \
+					int* inds, double* d2s) {							\
+		int i, d, n = 0;												\
+		for (i=0; i<N; i++) {											\
+			const ptype* p = pts + (size_t)i * D;						\
+			double d2 = 0.0;											\
+			for (d=0; d<D; d++) {										\
+				double delta = DELTA;									\
+				d2 += delta * delta;									\
+				if (d2 > maxd2)											\
+					break;												\
+			}															\
+			if (d < D)													\
+				continue;												\
+			inds[n] = i;												\
+			d2s[n] = d2;												\
+			n++;														\
+		}																\
+		return n;														\
+	}
+
+LEAFSCAN_PLAIN(leafscan_d_plain, double, double, q[d] - p[d])
+LEAFSCAN_PLAIN(leafscan_f_plain, float, float, q[d] - p[d])
+LEAFSCAN_PLAIN(leafscan_u_plain, double, uint32_t,
+			   q[d] - (p[d] * invscale + minval[d]))
+LEAFSCAN_PLAIN(leafscan_s_plain, double, uint16_t,
+			   q[d] - (p[d] * invscale + minval[d]))
+
+#if KD_LEAFSCAN_X86
+
+/*
+ Vector versions: "W" points at a time, one lane per point, looping
+ over dimensions; "DELTA" sets "delta" to the (query - point) lanes for
+ dimension "d" of the points starting at "p".  The points in range are
+ those whose distance is not greater than maxd2 (so NaNs are kept, as
+ in the plain version).  The remaining N % W points are done in plain C.
+ */
+#define LEAFSCAN_VECTOR(name, isa, qtype, ptype, W, vtype,			\
+						SETZERO, SET1, ADD, MUL, NGTMASK, STORE,		\
+						SETUP, DELTA, PLAIN)							\
+	__attribute__((target(isa)))										\
+	static int name(const qtype* q, const ptype* pts, int N, int D,		\
+					const double* minval, double invscale, double maxd2, \
+					int* inds, double* d2s) {							\
+		int i, d, k, n = 0;												\
+		const vtype vmax = SET1(maxd2);									\
+		SETUP;															\
+		for (i=0; i+W<=N; i+=W) {										\
+			const ptype* p = pts + (size_t)i * D;						\
+			vtype acc = SETZERO();										\
+			double out[W];												\
+			int m;														\
+			for (d=0; d<D; d++) {										\
+				vtype delta;											\
+				DELTA;													\
+				acc = ADD(acc, MUL(delta, delta));						\
+			}															\
+			m = NGTMASK(acc, vmax);										\
+			if (!m)														\
+				continue;												\
+			STORE(out, acc);											\
+			for (k=0; k<W; k++) {										\
+				if (!(m & (1 << k)))									\
+					continue;											\
+				inds[n] = i + k;										\
+				d2s[n] = out[k];										\
+				n++;													\
+			}															\
+		}																\
+		if (i < N) {													\
+			int j, nt;													\
+			nt = PLAIN(q, pts + (size_t)i * D, N - i, D, minval, invscale, \
+					   maxd2, inds + n, d2s + n);						\
+			for (j=0; j<nt; j++)										\
+				inds[n + j] += i;										\
+			n += nt;													\
+		}																\
+		return n;														\
+	}
+
+// SSE2: two points at a time.
+#define SSE2_NGTMASK(a, b) _mm_movemask_pd(_mm_cmpngt_pd(a, b))
+
+LEAFSCAN_VECTOR(leafscan_d_sse2, "sse2", double, double, 2, __m128d,
+				_mm_setzero_pd, _mm_set1_pd, _mm_add_pd, _mm_mul_pd,
+				SSE2_NGTMASK, _mm_storeu_pd, ,
+				delta = _mm_sub_pd(_mm_set1_pd(q[d]),
+								   _mm_set_pd(p[D+d], p[d])),
+				leafscan_d_plain)
+
+LEAFSCAN_VECTOR(leafscan_f_sse2, "sse2", float, float, 2, __m128d,
+				_mm_setzero_pd, _mm_set1_pd, _mm_add_pd, _mm_mul_pd,
+				SSE2_NGTMASK, _mm_storeu_pd, ,
+				delta = _mm_cvtps_pd(_mm_sub_ps(_mm_set1_ps(q[d]),
+												_mm_set_ps(0, 0, p[D+d], p[d]))),
+				leafscan_f_plain)
+
+LEAFSCAN_VECTOR(leafscan_u_sse2, "sse2", double, uint32_t, 2, __m128d,
+				_mm_setzero_pd, _mm_set1_pd, _mm_add_pd, _mm_mul_pd,
+				SSE2_NGTMASK, _mm_storeu_pd,
+				const __m128d vscale = _mm_set1_pd(invscale),
+				delta = _mm_sub_pd(_mm_set1_pd(q[d]),
+								   _mm_add_pd(_mm_mul_pd(_mm_set_pd(p[D+d], p[d]),
+														 vscale),
+											  _mm_set1_pd(minval[d]))),
+				leafscan_u_plain)
+
+LEAFSCAN_VECTOR(leafscan_s_sse2, "sse2", double, uint16_t, 2, __m128d,
+				_mm_setzero_pd, _mm_set1_pd, _mm_add_pd, _mm_mul_pd,
+				SSE2_NGTMASK, _mm_storeu_pd,
+				const __m128d vscale = _mm_set1_pd(invscale),
+				delta = _mm_sub_pd(_mm_set1_pd(q[d]),
+								   _mm_add_pd(_mm_mul_pd(_mm_set_pd(p[D+d], p[d]),
+														 vscale),
+											  _mm_set1_pd(minval[d]))),
+				leafscan_s_plain)
+
+// AVX2: four points at a time.  (The lanes are loaded element by element:
+// with the points' dimensions interleaved, gathers turned out slower.)
+#define AVX2_NGTMASK(a, b) _mm256_movemask_pd(_mm256_cmp_pd(a, b, _CMP_NGT_UQ))
+
+// unsigned 32-bit ints to doubles.
+#define AVX2_U32_TO_PD(x)												\
+	_mm256_add_pd(_mm256_cvtepi32_pd(_mm_xor_si128(x, _mm_set1_epi32(INT32_MIN))), \
+				  _mm256_set1_pd(2147483648.0))
+
+LEAFSCAN_VECTOR(leafscan_d_avx2, "avx2", double, double, 4, __m256d,
+				_mm256_setzero_pd, _mm256_set1_pd, _mm256_add_pd, _mm256_mul_pd,
+				AVX2_NGTMASK, _mm256_storeu_pd, ,
+				delta = _mm256_sub_pd(_mm256_set1_pd(q[d]),
+									  _mm256_setr_pd(p[d], p[D+d], p[2*D+d], p[3*D+d])),
+				leafscan_d_plain)
+
+LEAFSCAN_VECTOR(leafscan_f_avx2, "avx2", float, float, 4, __m256d,
+				_mm256_setzero_pd, _mm256_set1_pd, _mm256_add_pd, _mm256_mul_pd,
+				AVX2_NGTMASK, _mm256_storeu_pd, ,
+				delta = _mm256_cvtps_pd(_mm_sub_ps(_mm_set1_ps(q[d]),
+												   _mm_setr_ps(p[d], p[D+d], p[2*D+d], p[3*D+d]))),
+				leafscan_f_plain)
+
+LEAFSCAN_VECTOR(leafscan_u_avx2, "avx2", double, uint32_t, 4, __m256d,
+				_mm256_setzero_pd, _mm256_set1_pd, _mm256_add_pd, _mm256_mul_pd,
+				AVX2_NGTMASK, _mm256_storeu_pd,
+				const __m256d vscale = _mm256_set1_pd(invscale),
+				delta = _mm256_sub_pd(_mm256_set1_pd(q[d]),
+									  _mm256_add_pd(_mm256_mul_pd(AVX2_U32_TO_PD(_mm_setr_epi32(p[d], p[D+d], p[2*D+d], p[3*D+d])),
+																  vscale),
+													_mm256_set1_pd(minval[d]))),
+				leafscan_u_plain)
+
+LEAFSCAN_VECTOR(leafscan_s_avx2, "avx2", double, uint16_t, 4, __m256d,
+				_mm256_setzero_pd, _mm256_set1_pd, _mm256_add_pd, _mm256_mul_pd,
+				AVX2_NGTMASK, _mm256_storeu_pd,
+				const __m256d vscale = _mm256_set1_pd(invscale),
+				delta = _mm256_sub_pd(_mm256_set1_pd(q[d]),
+									  _mm256_add_pd(_mm256_mul_pd(_mm256_cvtepi32_pd(_mm_setr_epi32(p[d], p[D+d], p[2*D+d], p[3*D+d])),
+																  vscale),
+													_mm256_set1_pd(minval[d]))),
+				leafscan_s_plain)
+
+#endif
+
+// -1: not yet checked.
+static int simd_level = -1;
+
+int kdtree_leafscan_max_simd(void) {
+#if KD_LEAFSCAN_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return KD_SIMD_AVX2;
+	if (__builtin_cpu_supports("sse2"))
+		return KD_SIMD_SSE2;
+#endif
+	return KD_SIMD_NONE;
+}
+
+void kdtree_leafscan_set_simd(int level) {
+	int maxlevel = kdtree_leafscan_max_simd();
+	if (level > maxlevel)
+		level = maxlevel;
+	if (level < KD_SIMD_NONE)
+		level = KD_SIMD_NONE;
+	simd_level = level;
+}
+
+int kdtree_leafscan_get_simd(void) {
+	if (simd_level < 0)
+		simd_level = kdtree_leafscan_max_simd();
+	return simd_level;
+}
+
+const char* kdtree_leafscan_simd_name(int level) {
+	switch (level) {
+	case KD_SIMD_AVX2:
+		return "AVX2";
+	case KD_SIMD_SSE2:
+		return "SSE2";
+	case KD_SIMD_NONE:
+		return "none";
+	}
+	return "unknown";
+}
+
+#if KD_LEAFSCAN_X86
+#define LEAFSCAN_DISPATCH(t, args)				\
+	switch (kdtree_leafscan_get_simd()) {		\
+	case KD_SIMD_AVX2:							\
+		return leafscan_ ## t ## _avx2 args;	\
+	case KD_SIMD_SSE2:							\
+		return leafscan_ ## t ## _sse2 args;	\
+	}											\
+	return leafscan_ ## t ## _plain args;
+#else
+#define LEAFSCAN_DISPATCH(t, args)				\
+	return leafscan_ ## t ## _plain args;
+#endif
+
+int kdtree_leafscan_d(const double* q, const double* pts, int N, int D,
+					  const double* minval, double invscale, double maxd2,
+					  int* inds, double* d2s) {
+	LEAFSCAN_DISPATCH(d, (q, pts, N, D, minval, invscale, maxd2, inds, d2s));
+}
+
+int kdtree_leafscan_f(const float* q, const float* pts, int N, int D,
+					  const double* minval, double invscale, double maxd2,
+					  int* inds, double* d2s) {
+	LEAFSCAN_DISPATCH(f, (q, pts, N, D, minval, invscale, maxd2, inds, d2s));
+}
+
+int kdtree_leafscan_u(const double* q, const uint32_t* pts, int N, int D,
+					  const double* minval, double invscale, double maxd2,
+					  int* inds, double* d2s) {
+	LEAFSCAN_DISPATCH(u, (q, pts, N, D, minval, invscale, maxd2, inds, d2s));
+}
+
+int kdtree_leafscan_s(const double* q, const uint16_t* pts, int N, int D,
+					  const double* minval, double invscale, double maxd2,
+					  int* inds, double* d2s) {
+	LEAFSCAN_DISPATCH(s, (q, pts, N, D, minval, invscale, maxd2, inds, d2s));
+}
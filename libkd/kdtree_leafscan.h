@@ -0,0 +1,79 @@
+/*
+  This file is part of libkd.
+
+  libkd is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 2.
+
+  libkd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with libkd; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef KDTREE_LEAFSCAN_H
+#define KDTREE_LEAFSCAN_H
+
+#include <stdint.h>
+
+/**
+ Leaf-scan kernels: find which of "N" consecutive "D"-dimensional points
+ are within distance-squared "maxd2" of the query point "q".
+
+ The indices (0 to N-1, in increasing order) of the points in range are
+ placed in "inds" and their distances-squared in "d2s"; the number of
+ points in range is returned.
+
+ There is one kernel per data type; each computes the distances as the
+ scalar code in kdtree_internal.c does (in the "external" type, summing
+ over dimensions in order), so the same points are found whichever
+ instruction set is used.  Integer data are converted to external
+ coordinates as (p * invscale + minval[d]); the "minval" and "invscale"
+ arguments are ignored for floating-point data.
+
+ The kernels use AVX2 or SSE2 if the CPU supports them (see
+ kdtree_leafscan_set_simd()), else plain C.
+ */
+int kdtree_leafscan_d(const double* q, const double* pts, int N, int D,
+					  const double* minval, double invscale, double maxd2,
+					  int* inds, double* d2s);
+
+int kdtree_leafscan_f(const float* q, const float* pts, int N, int D,
+					  const double* minval, double invscale, double maxd2,
+					  int* inds, double* d2s);
+
+int kdtree_leafscan_u(const double* q, const uint32_t* pts, int N, int D,
+					  const double* minval, double invscale, double maxd2,
+					  int* inds, double* d2s);
+
+int kdtree_leafscan_s(const double* q, const uint16_t* pts, int N, int D,
+					  const double* minval, double invscale, double maxd2,
+					  int* inds, double* d2s);
+
+enum kd_simd {
+	KD_SIMD_NONE = 0,
+	KD_SIMD_SSE2 = 1,
+	KD_SIMD_AVX2 = 2,
+};
+
+/**
+ Returns the best instruction set the CPU (and compiler) supports.
+ */
+int kdtree_leafscan_max_simd(void);
+
+/**
+ Limits the instruction set used by the leaf-scan kernels (eg, to
+ KD_SIMD_NONE for the plain-C versions); levels the CPU doesn't support
+ are clamped.  Mostly useful for testing and benchmarking.
+ */
+void kdtree_leafscan_set_simd(int level);
+
+int kdtree_leafscan_get_simd(void);
+
+const char* kdtree_leafscan_simd_name(int level);
+
+#endif
@@ -179,12 +179,14 @@ static PyObject* spherematch_match2(PyObject* self, PyObject* args) {
     PyObject* indlist;
 	anbool notself;
 	anbool permute;
+	int nthreads = 1;
 	
 	// So that ParseTuple("b") with a C "anbool" works
 	assert(sizeof(anbool) == sizeof(unsigned char));
 
-    if (!PyArg_ParseTuple(args, "lldbb", &p1, &p2, &rad, &notself, &permute)) {
-        PyErr_SetString(PyExc_ValueError, "spherematch_c.match: need five args: two kdtree identifiers (ints), search radius (float), notself (boolean), permuted (boolean)");
+    if (!PyArg_ParseTuple(args, "lldbb|i", &p1, &p2, &rad, &notself, &permute,
+                          &nthreads)) {
+        PyErr_SetString(PyExc_ValueError, "spherematch_c.match: need five args: two kdtree identifiers (ints), search radius (float), notself (boolean), permuted (boolean); and optionally the number of threads (int)");
         return NULL;
     }
     // Nasty!
@@ -200,9 +202,9 @@ static PyObject* spherematch_match2(PyObject* self, PyObject* args) {
     dtresults.indlist = indlist;
     dtresults.permute = permute;
 
-    dualtree_rangesearch(kd1, kd2, 0.0, rad, notself, NULL,
-                         callback_dualtree2, &dtresults,
-                         NULL, NULL);
+    dualtree_rangesearch_threaded(kd1, kd2, 0.0, rad, notself, NULL,
+                                  callback_dualtree2, &dtresults,
+                                  NULL, NULL, nthreads);
 
     // set empty slots to None, not NULL.
     for (i=0; i<N; i++) {
@@ -241,13 +243,15 @@ static PyObject* spherematch_match(PyObject* self, PyObject* args) {
     PyArrayObject* dists;
 	anbool notself;
 	anbool permute;
+	int nthreads = 1;
 	PyObject* rtn;
 	
 	// So that ParseTuple("b") with a C "anbool" works
 	assert(sizeof(anbool) == sizeof(unsigned char));
 
-    if (!PyArg_ParseTuple(args, "lldbb", &p1, &p2, &rad, &notself, &permute)) {
-        PyErr_SetString(PyExc_ValueError, "spherematch_c.match: need five args: two kdtree identifiers (ints), search radius (float), notself (boolean), permuted (boolean)");
+    if (!PyArg_ParseTuple(args, "lldbb|i", &p1, &p2, &rad, &notself, &permute,
+                          &nthreads)) {
+        PyErr_SetString(PyExc_ValueError, "spherematch_c.match: need five args: two kdtree identifiers (ints), search radius (float), notself (boolean), permuted (boolean); and optionally the number of threads (int)");
         return NULL;
     }
 	//printf("Notself = %i\n", (int)notself);
@@ -258,9 +262,9 @@ static PyObject* spherematch_match(PyObject* self, PyObject* args) {
     dtresults.inds1 = il_new(256);
     dtresults.inds2 = il_new(256);
     dtresults.dists = dl_new(256);
-    dualtree_rangesearch(kd1, kd2, 0.0, rad, notself, NULL,
-                         callback_dualtree, &dtresults,
-                         NULL, NULL);
+    dualtree_rangesearch_threaded(kd1, kd2, 0.0, rad, notself, NULL,
+                                  callback_dualtree, &dtresults,
+                                  NULL, NULL, nthreads);
 
     N = il_size(dtresults.inds1);
     dims[0] = N;
@@ -30,7 +30,7 @@ def match_xy(x1,y1, x2,y2, R, **kwargs):
     
 # Copied from "celestial.py" by Sjoert van Velzen.
 def match_radec(ra1, dec1, ra2, dec2, radius_in_deg, notself=False,
-                nearest=False, indexlist=False):
+                nearest=False, indexlist=False, nthreads=1):
     '''
     (m1,m2,d12) = match_radec(ra1,dec1, ra2,dec2, radius_in_deg)
 
@@ -51,6 +51,8 @@ def match_radec(ra1, dec1, ra2, dec2, radius_in_deg, notself=False,
 
     indexlist: returns a list of length len(ra1), containing None or a
     list of ints of matched points in ra2,dec2.  Returns this list.
+
+    nthreads: number of threads for the search (not used with "nearest").
         
     Returns:
 
@@ -75,7 +77,8 @@ def match_radec(ra1, dec1, ra2, dec2, radius_in_deg, notself=False,
         J = inds[I]
         d = distsq2deg(dists2[I])
     else:
-        X = match(xyz1, xyz2, r, notself=notself, indexlist=indexlist)
+        X = match(xyz1, xyz2, r, notself=notself, indexlist=indexlist,
+                  nthreads=nthreads)
         if indexlist:
             return X
         (inds,dists) = X
@@ -176,7 +179,8 @@ def _freetrees(kd1, kd2):
     if kd2 != kd1:
         spherematch_c.kdtree_free(kd2)
 
-def match(x1, x2, radius, notself=False, permuted=True, indexlist=False):
+def match(x1, x2, radius, notself=False, permuted=True, indexlist=False,
+          nthreads=1):
     '''
     (indices,dists) = match(x1, x2, radius):
     OR
@@ -203,6 +207,9 @@ def match(x1, x2, radius, notself=False, permuted=True, indexlist=False):
     element per data point in the first tree; that element is a python
     list containing the indices of points matched in the second tree.
 
+    "nthreads" is the number of threads to search with; the results are
+    the same (and in the same order) whatever the number of threads.
+
     The "indices" return value has a row for each match; the matched
     points are:
     x1[indices[:,0],:]
@@ -277,9 +284,11 @@ def match(x1, x2, radius, notself=False, permuted=True, indexlist=False):
     '''
     (kd1,kd2) = _buildtrees(x1, x2)
     if indexlist:
-        inds = spherematch_c.match2(kd1, kd2, radius, notself, permuted)
+        inds = spherematch_c.match2(kd1, kd2, radius, notself, permuted,
+                                    nthreads)
     else:
-        (inds,dists) = spherematch_c.match(kd1, kd2, radius, notself, permuted)
+        (inds,dists) = spherematch_c.match(kd1, kd2, radius, notself, permuted,
+                                           nthreads)
     _freetrees(kd1, kd2)
     if indexlist:
         return inds
@@ -353,7 +362,7 @@ def tree_close(kd):
     return spherematch_c.kdtree_close(kd)
     
 def trees_match(kd1, kd2, radius, nearest=False, notself=False,
-                permuted=True, count=False):
+                permuted=True, count=False, nthreads=1):
     '''
     Runs rangesearch or nearest-neighbour matching on given kdtrees.
 
@@ -366,6 +375,9 @@ def trees_match(kd1, kd2, radius, nearest=False, notself=False,
     as well as returning the nearest neighbor of each point in "kd1";
     the return value becomes I,J,d,counts , counts a numpy array of ints.
 
+    'nthreads' is the number of threads for the rangesearch (not used
+    with 'nearest').
+
     Returns (I, J, d), where
       I are indices into kd1
       J are indices into kd2
@@ -400,7 +412,8 @@ def trees_match(kd1, kd2, radius, nearest=False, notself=False,
         # J,I,d,[count]
         rtn = (rtn[1], rtn[0], distsq2deg(rtn[2]),) + rtn[3:]
     else:
-        (inds,dists) = spherematch_c.match(kd1, kd2, radius, notself, permuted)
+        (inds,dists) = spherematch_c.match(kd1, kd2, radius, notself, permuted,
+                                           nthreads)
         d = dist2deg(dists[:,0])
         I,J = inds[:,0], inds[:,1]
         rtn = (I,J,d)
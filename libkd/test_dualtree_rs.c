@@ -0,0 +1,121 @@
+/*
+  This file is part of the Astrometry.net suite.
+
+  The Astrometry.net suite is free software; you can redistribute
+  it and/or modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation, version 2.
+
+  The Astrometry.net suite is distributed in the hope that it will be
+  useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with the Astrometry.net suite ; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "cutest.h"
+
+#include "dualtree_rangesearch.h"
+#include "kdtree.h"
+#include "mathutil.h"
+#include "bl.h"
+
+struct rs_results {
+	il* xinds;
+	il* yinds;
+	dl* dist2s;
+	int ydone;
+};
+
+static void rs_callback(void* v, int xind, int yind, double dist2) {
+	struct rs_results* r = v;
+	il_append(r->xinds, xind);
+	il_append(r->yinds, yind);
+	dl_append(r->dist2s, dist2);
+}
+
+static void rs_progress(void* v, int ydone) {
+	struct rs_results* r = v;
+	r->ydone = ydone;
+}
+
+static void run_search(kdtree_t* xkd, kdtree_t* ykd, double rad,
+					   anbool notself, int nthreads, struct rs_results* r) {
+	r->xinds = il_new(256);
+	r->yinds = il_new(256);
+	r->dist2s = dl_new(256);
+	r->ydone = 0;
+	dualtree_rangesearch_threaded(xkd, ykd, RANGESEARCH_NO_LIMIT, rad,
+								  notself, NULL, rs_callback, r,
+								  rs_progress, r, nthreads);
+}
+
+static void free_results(struct rs_results* r) {
+	il_free(r->xinds);
+	il_free(r->yinds);
+	dl_free(r->dist2s);
+}
+
+static void check_threaded(CuTest* tc, kdtree_t* xkd, kdtree_t* ykd,
+						   double rad, anbool notself, int NY) {
+	struct rs_results r1, r2;
+	int i, N, nthreads;
+
+	run_search(xkd, ykd, rad, notself, 1, &r1);
+	CuAssertIntEquals(tc, NY, r1.ydone);
+	N = il_size(r1.xinds);
+	CuAssert(tc, "some matches", N > 0);
+
+	for (nthreads=2; nthreads<=5; nthreads+=3) {
+		run_search(xkd, ykd, rad, notself, nthreads, &r2);
+		CuAssertIntEquals(tc, NY, r2.ydone);
+		// same results, in the same order.
+		CuAssertIntEquals(tc, N, il_size(r2.xinds));
+		for (i=0; i<N; i++) {
+			CuAssertIntEquals(tc, il_get(r1.xinds, i), il_get(r2.xinds, i));
+			CuAssertIntEquals(tc, il_get(r1.yinds, i), il_get(r2.yinds, i));
+			CuAssertDblEquals(tc, dl_get(r1.dist2s, i), dl_get(r2.dist2s, i), 0.0);
+		}
+		free_results(&r2);
+	}
+	free_results(&r1);
+}
+
+void test_rs_threaded(CuTest* tc) {
+	int NX = 5000;
+	int NY = 4000;
+	int D = 3;
+	int Nleaf = 8;
+	double rad = 0.03;
+	double* xdata;
+	double* ydata;
+	kdtree_t* xkd;
+	kdtree_t* ykd;
+	int i;
+
+	srand(0);
+	xdata = malloc(NX * D * sizeof(double));
+	ydata = malloc(NY * D * sizeof(double));
+	for (i=0; i<NX*D; i++)
+		xdata[i] = rand() / (double)RAND_MAX;
+	for (i=0; i<NY*D; i++)
+		ydata[i] = rand() / (double)RAND_MAX;
+	xkd = kdtree_build(NULL, xdata, NX, D, Nleaf, KDTT_DOUBLE, KD_BUILD_BBOX);
+	ykd = kdtree_build(NULL, ydata, NY, D, Nleaf, KDTT_DOUBLE, KD_BUILD_BBOX);
+
+	check_threaded(tc, xkd, ykd, rad, FALSE, NY);
+	// matching a tree against itself
+	check_threaded(tc, xkd, xkd, rad, TRUE, NX);
+
+	kdtree_free(xkd);
+	kdtree_free(ykd);
+	free(xdata);
+	free(ydata);
+}
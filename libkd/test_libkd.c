@@ -26,6 +26,7 @@
 #include "errors.h"
 #include "cutest.h"
 #include "kdtree.h"
+#include "kdtree_leafscan.h"
 #include "mathutil.h"
 #include "an-fls.h"
 
@@ -449,6 +450,435 @@ void test_rs_split_dss(CuTest* tc) {
     run_test_rs(tc, KDTT_DSS, KD_BUILD_SPLIT, 1e-5);
 }
 
+// The batched range search must give exactly the same results, in the
+// same order, as one kdtree_rangesearch_options_reuse() per query.
+static void run_test_rs_batch(CuTest* tc, int treetype, int treeopts,
+                              int options) {
+    int N = 1000;
+    int D = 4;
+    int Nleaf = 10;
+    // (more than 64 to exercise the chunking)
+    int Q = 150;
+    double rad2 = 0.01;
+    double* data;
+    double* queries;
+    kdtree_t* kd;
+    kdtree_qres_t* res = NULL;
+    kdtree_qres_t** bres;
+    int i, q;
+
+    srand(0);
+    data = random_points_d(N, D);
+    kd = build_tree(tc, data, N, D, Nleaf, treetype, treeopts);
+    CuAssert(tc, "kd", kd != NULL);
+
+    // Some queries fall outside the data's bounding box.
+    queries = malloc(Q * D * sizeof(double));
+    for (i=0; i<Q*D; i++)
+        queries[i] = -0.1 + 1.2 * rand() / (double)RAND_MAX;
+
+    bres = calloc(Q, sizeof(kdtree_qres_t*));
+    CuAssertIntEquals(tc, 0, kdtree_rangesearch_batch(kd, bres, queries, Q,
+                                                      rad2, options));
+    // (and again, reusing the results)
+    CuAssertIntEquals(tc, 0, kdtree_rangesearch_batch(kd, bres, queries, Q,
+                                                      rad2, options));
+
+    for (q=0; q<Q; q++) {
+        res = kdtree_rangesearch_options_reuse(kd, res, queries + q*D, rad2,
+                                               options);
+        CuAssert(tc, "res", res != NULL);
+        CuAssertIntEquals(tc, res->nres, bres[q]->nres);
+        for (i=0; i<res->nres; i++) {
+            CuAssertIntEquals(tc, res->inds[i], bres[q]->inds[i]);
+            if (options & KD_OPTIONS_COMPUTE_DISTS)
+                CuAssertDblEquals(tc, res->sdists[i], bres[q]->sdists[i], 0.0);
+        }
+        kdtree_free_query(bres[q]);
+    }
+    kdtree_free_query(res);
+    free(bres);
+    free(queries);
+    kdtree_free(kd);
+    free(data);
+}
+
+void test_rs_batch_bb_ddd(CuTest* tc) {
+    run_test_rs_batch(tc, KDTT_DOUBLE, KD_BUILD_BBOX, KD_OPTIONS_COMPUTE_DISTS);
+}
+void test_rs_batch_split_ddd(CuTest* tc) {
+    run_test_rs_batch(tc, KDTT_DOUBLE, KD_BUILD_SPLIT | KD_BUILD_SPLITDIM,
+                      KD_OPTIONS_COMPUTE_DISTS);
+}
+void test_rs_batch_both_ddd(CuTest* tc) {
+    run_test_rs_batch(tc, KDTT_DOUBLE, KD_BUILD_BBOX | KD_BUILD_SPLIT,
+                      KD_OPTIONS_COMPUTE_DISTS | KD_OPTIONS_USE_SPLIT |
+                      KD_OPTIONS_SORT_DISTS);
+}
+void test_rs_batch_bb_duu(CuTest* tc) {
+    run_test_rs_batch(tc, KDTT_DUU, KD_BUILD_BBOX, 0);
+}
+void test_rs_batch_split_dss(CuTest* tc) {
+    // (the options the solver uses for code-tree searches)
+    run_test_rs_batch(tc, KDTT_DSS, KD_BUILD_SPLIT,
+                      KD_OPTIONS_SMALL_RADIUS | KD_OPTIONS_COMPUTE_DISTS |
+                      KD_OPTIONS_NO_RESIZE_RESULTS | KD_OPTIONS_USE_SPLIT);
+}
+void test_rs_batch_bb_dss(CuTest* tc) {
+    run_test_rs_batch(tc, KDTT_DSS, KD_BUILD_BBOX, KD_OPTIONS_COMPUTE_DISTS);
+}
+
+static void run_test_knn(CuTest* tc, int treetype, int treeopts) {
+    int N = 1000;
+    int D = 3;
+    int Nleaf = 10;
+    int Q = 50;
+    int K = 7;
+    double* data;
+    double* treedata;
+    double* queries;
+    kdtree_t* kd;
+    int inds[K];
+    double d2s[K];
+    int* binds;
+    double* bd2s;
+    int* bcounts;
+    int i, j, q;
+
+    srand(0);
+    data = random_points_d(N, D);
+    kd = build_tree(tc, data, N, D, Nleaf, treetype, treeopts);
+    CuAssert(tc, "kd", kd != NULL);
+    // (compare against the tree's own, possibly quantized, points)
+    treedata = malloc(N * D * sizeof(double));
+    kdtree_copy_data_double(kd, 0, N, treedata);
+
+    queries = malloc(Q * D * sizeof(double));
+    for (i=0; i<Q*D; i++)
+        queries[i] = -0.1 + 1.2 * rand() / (double)RAND_MAX;
+
+    for (q=0; q<Q; q++) {
+        // every few queries, use a radius limit that leaves fewer than K.
+        double maxd2 = (q % 3) ? HUGE_VAL : 0.002;
+        int n = kdtree_knn(kd, queries + q*D, K, maxd2, inds, d2s);
+        int nbrute = 0;
+        double lastd2 = -1.0;
+        int lasti = -1;
+        // brute force: repeatedly find the next-nearest point.
+        for (j=0; j<K; j++) {
+            double bestd2 = HUGE_VAL;
+            int besti = -1;
+            for (i=0; i<N; i++) {
+                double d2 = distsq(queries + q*D, treedata + i*D, D);
+                if (d2 > maxd2)
+                    continue;
+                if (d2 < lastd2 || (d2 == lastd2 && i <= lasti))
+                    continue;
+                if (d2 < bestd2) {
+                    bestd2 = d2;
+                    besti = i;
+                }
+            }
+            if (besti == -1)
+                break;
+            CuAssert(tc, "enough results", j < n);
+            CuAssertIntEquals(tc, besti, inds[j]);
+            CuAssertDblEquals(tc, bestd2, d2s[j], 1e-12);
+            lastd2 = bestd2;
+            lasti = besti;
+            nbrute++;
+        }
+        CuAssertIntEquals(tc, nbrute, n);
+        if (maxd2 == HUGE_VAL)
+            CuAssertIntEquals(tc, K, n);
+    }
+
+    // The batch version gives the same answers, with any number of threads.
+    binds = malloc(Q * K * sizeof(int));
+    bd2s = malloc(Q * K * sizeof(double));
+    bcounts = malloc(Q * sizeof(int));
+    for (j=1; j<=3; j+=2) {
+        CuAssertIntEquals(tc, 0, kdtree_knn_batch(kd, queries, Q, K, 0.01,
+                                                  binds, bd2s, bcounts, j));
+        for (q=0; q<Q; q++) {
+            int n = kdtree_knn(kd, queries + q*D, K, 0.01, inds, d2s);
+            CuAssertIntEquals(tc, n, bcounts[q]);
+            for (i=0; i<n; i++) {
+                CuAssertIntEquals(tc, inds[i], binds[q*K + i]);
+                CuAssertDblEquals(tc, d2s[i], bd2s[q*K + i], 0.0);
+            }
+        }
+    }
+
+    free(binds);
+    free(bd2s);
+    free(bcounts);
+    free(queries);
+    free(treedata);
+    kdtree_free(kd);
+    free(data);
+}
+
+void test_knn_bb_ddd(CuTest* tc) {
+    run_test_knn(tc, KDTT_DOUBLE, KD_BUILD_BBOX);
+}
+void test_knn_split_ddd(CuTest* tc) {
+    run_test_knn(tc, KDTT_DOUBLE, KD_BUILD_SPLIT | KD_BUILD_SPLITDIM);
+}
+void test_knn_bb_duu(CuTest* tc) {
+    run_test_knn(tc, KDTT_DUU, KD_BUILD_BBOX);
+}
+void test_knn_split_dss(CuTest* tc) {
+    run_test_knn(tc, KDTT_DSS, KD_BUILD_SPLIT);
+}
+
+static void run_test_veb(CuTest* tc, int treetype, int treeopts) {
+    int N = 1000;
+    int D = 3;
+    int Nleaf = 5;
+    int Q = 20;
+    int K = 5;
+    double* data;
+    double* data2;
+    kdtree_t* kd;
+    kdtree_t* kd2;
+    int i, q;
+
+    srand(0);
+    data = random_points_d(N, D);
+    data2 = malloc(N * D * sizeof(double));
+    memcpy(data2, data, N * D * sizeof(double));
+    kd  = build_tree(tc, data,  N, D, Nleaf, treetype, treeopts);
+    kd2 = build_tree(tc, data2, N, D, Nleaf, treetype, treeopts | KD_BUILD_VEB);
+    CuAssert(tc, "kd", kd != NULL);
+    CuAssert(tc, "kd2", kd2 != NULL);
+    CuAssertPtrEquals(tc, NULL, kd->nodeslot);
+    CuAssertPtrNotNull(tc, kd2->nodeslot);
+
+    // every node gets its own record.
+    {
+        char* used = calloc(kd2->nnodes, 1);
+        for (i=0; i<kd2->nnodes; i++) {
+            CuAssert(tc, "slot in range",
+                     kd2->nodeslot[i] >= 0 && kd2->nodeslot[i] < kd2->nnodes);
+            CuAssertIntEquals(tc, 0, used[kd2->nodeslot[i]]);
+            used[kd2->nodeslot[i]] = 1;
+        }
+        // (the root comes first)
+        CuAssertIntEquals(tc, 0, kd2->nodeslot[0]);
+        free(used);
+    }
+
+    // same nodes...
+    for (i=0; i<kd->nnodes; i++) {
+        double lo1[D], hi1[D], lo2[D], hi2[D];
+        CuAssertIntEquals(tc, kdtree_get_bboxes(kd, i, lo1, hi1),
+                          kdtree_get_bboxes(kd2, i, lo2, hi2));
+        if (kd->bb.any) {
+            CuAssert(tc, "lo", memcmp(lo1, lo2, sizeof(lo1)) == 0);
+            CuAssert(tc, "hi", memcmp(hi1, hi2, sizeof(hi1)) == 0);
+        }
+        if (kd->split.any && !KD_IS_LEAF(kd, i)) {
+            CuAssertDblEquals(tc, kdtree_get_splitval(kd, i),
+                              kdtree_get_splitval(kd2, i), 0.0);
+            CuAssertIntEquals(tc, kdtree_get_splitdim(kd, i),
+                              kdtree_get_splitdim(kd2, i));
+        }
+    }
+
+    // ... and the same search results.
+    for (q=0; q<Q; q++) {
+        double query[D];
+        kdtree_qres_t *res1, *res2;
+        int inds1[K], inds2[K];
+        double d2s1[K], d2s2[K];
+        double d2a, d2b;
+        int n;
+        for (i=0; i<D; i++)
+            query[i] = rand() / (double)RAND_MAX;
+        res1 = kdtree_rangesearch(kd,  query, 0.01);
+        res2 = kdtree_rangesearch(kd2, query, 0.01);
+        CuAssertIntEquals(tc, res1->nres, res2->nres);
+        for (i=0; i<res1->nres; i++)
+            CuAssertIntEquals(tc, res1->inds[i], res2->inds[i]);
+        kdtree_free_query(res1);
+        kdtree_free_query(res2);
+
+        CuAssertIntEquals(tc, kdtree_nearest_neighbour(kd, query, &d2a),
+                          kdtree_nearest_neighbour(kd2, query, &d2b));
+        CuAssertDblEquals(tc, d2a, d2b, 0.0);
+
+        n = kdtree_knn(kd, query, K, HUGE_VAL, inds1, d2s1);
+        CuAssertIntEquals(tc, n, kdtree_knn(kd2, query, K, HUGE_VAL, inds2, d2s2));
+        for (i=0; i<n; i++)
+            CuAssertIntEquals(tc, inds1[i], inds2[i]);
+    }
+
+    kdtree_free(kd);
+    kdtree_free(kd2);
+    free(data);
+    free(data2);
+}
+
+void test_veb_bb_ddd(CuTest* tc) {
+    run_test_veb(tc, KDTT_DOUBLE, KD_BUILD_BBOX);
+}
+void test_veb_split_ddd(CuTest* tc) {
+    run_test_veb(tc, KDTT_DOUBLE, KD_BUILD_SPLIT | KD_BUILD_SPLITDIM);
+}
+void test_veb_both_duu(CuTest* tc) {
+    run_test_veb(tc, KDTT_DUU, KD_BUILD_BBOX | KD_BUILD_SPLIT);
+}
+void test_veb_split_dss(CuTest* tc) {
+    run_test_veb(tc, KDTT_DSS, KD_BUILD_SPLIT);
+}
+
+static void mark_node(const kdtree_t* kd, int node, void* extra) {
+    char* marked = extra;
+    int i;
+    for (i=kdtree_left(kd, node); i<=kdtree_right(kd, node); i++)
+        marked[i]++;
+}
+
+static void run_test_nodes_contained(CuTest* tc, int treetype, int treeopts) {
+    int N = 2000;
+    int D = 3;
+    int Nleaf = 10;
+    double lo[] = { 0.2, 0.3, 0.1 };
+    double hi[] = { 0.5, 0.4, 0.6 };
+    double* data;
+    double* treedata;
+    char* marked;
+    kdtree_t* kd;
+    int i, d, nin = 0, nmarked = 0;
+
+    srand(0);
+    data = random_points_d(N, D);
+    kd = build_tree(tc, data, N, D, Nleaf, treetype, treeopts);
+    CuAssert(tc, "kd", kd != NULL);
+    treedata = malloc(N * D * sizeof(double));
+    kdtree_copy_data_double(kd, 0, N, treedata);
+
+    marked = calloc(N, 1);
+    kdtree_nodes_contained(kd, lo, hi, mark_node, mark_node, marked);
+    for (i=0; i<N; i++) {
+        anbool inside = TRUE;
+        // each point is reported at most once...
+        CuAssert(tc, "once", marked[i] <= 1);
+        for (d=0; d<D; d++)
+            if (treedata[i*D+d] < lo[d] || treedata[i*D+d] > hi[d])
+                inside = FALSE;
+        // ... and every point in the box is.
+        if (inside) {
+            CuAssertIntEquals(tc, 1, marked[i]);
+            nin++;
+        }
+        nmarked += marked[i];
+    }
+    CuAssert(tc, "some points in the box", nin > 0);
+    // (and not too many more)
+    CuAssert(tc, "pruned", nmarked < N / 2);
+    CuAssertIntEquals(tc, nmarked, kdtree_prefetch_box(kd, lo, hi));
+
+    free(marked);
+    free(treedata);
+    kdtree_free(kd);
+    free(data);
+}
+
+void test_nodes_contained_bb_ddd(CuTest* tc) {
+    run_test_nodes_contained(tc, KDTT_DOUBLE, KD_BUILD_BBOX);
+}
+void test_nodes_contained_split_ddd(CuTest* tc) {
+    run_test_nodes_contained(tc, KDTT_DOUBLE, KD_BUILD_SPLIT | KD_BUILD_SPLITDIM);
+}
+void test_nodes_contained_split_duu(CuTest* tc) {
+    run_test_nodes_contained(tc, KDTT_DUU, KD_BUILD_SPLIT);
+}
+
+static void check_leafscan(CuTest* tc, int n0, const int* inds0,
+                           const double* d2s0, int n, const int* inds,
+                           const double* d2s) {
+    int i;
+    CuAssertIntEquals(tc, n0, n);
+    for (i=0; i<n; i++) {
+        CuAssertIntEquals(tc, inds0[i], inds[i]);
+        CuAssertDblEquals(tc, d2s0[i], d2s[i], 1e-12);
+    }
+}
+
+static void run_test_leafscan(CuTest* tc, int D) {
+    // (not a multiple of the vector widths, to exercise the tails)
+    int N = 103;
+    double maxd2 = 0.05 * D;
+    double q[D], minval[D];
+    float fq[D];
+    double pd[N*D];
+    float pf[N*D];
+    uint32_t pu[N*D];
+    uint16_t ps[N*D];
+    double uscale = 1.0 / (double)UINT32_MAX;
+    double sscale = 1.0 / (double)UINT16_MAX;
+    int inds0[4][N], inds[N];
+    double d2s0[4][N], d2s[N];
+    int n0[4];
+    int i, level;
+
+    srand(0);
+    for (i=0; i<D; i++) {
+        minval[i] = -0.5;
+        q[i] = fq[i] = 0.5 * (rand() / (double)RAND_MAX) - 0.25;
+    }
+    // Integer data covering the full range (including values >= 2^31).
+    for (i=0; i<N*D; i++) {
+        pu[i] = (uint32_t)(UINT32_MAX * (rand() / (double)RAND_MAX));
+        ps[i] = (uint16_t)(UINT16_MAX * (rand() / (double)RAND_MAX));
+        pd[i] = pf[i] = rand() / (double)RAND_MAX - 0.5;
+    }
+
+    kdtree_leafscan_set_simd(KD_SIMD_NONE);
+    CuAssertIntEquals(tc, KD_SIMD_NONE, kdtree_leafscan_get_simd());
+    n0[0] = kdtree_leafscan_d(q, pd, N, D, NULL, 1.0, maxd2, inds0[0], d2s0[0]);
+    n0[1] = kdtree_leafscan_f(fq, pf, N, D, NULL, 1.0, maxd2, inds0[1], d2s0[1]);
+    n0[2] = kdtree_leafscan_u(q, pu, N, D, minval, uscale, maxd2, inds0[2], d2s0[2]);
+    n0[3] = kdtree_leafscan_s(q, ps, N, D, minval, sscale, maxd2, inds0[3], d2s0[3]);
+    for (i=0; i<4; i++) {
+        CuAssert(tc, "some in range", n0[i] > 0);
+        CuAssert(tc, "some out of range", n0[i] < N);
+    }
+    // Brute-force check of the plain versions.
+    for (i=0; i<n0[0]; i++) {
+        int d;
+        double d2 = 0.0;
+        for (d=0; d<D; d++)
+            d2 += (q[d] - pd[inds0[0][i]*D + d]) * (q[d] - pd[inds0[0][i]*D + d]);
+        CuAssertDblEquals(tc, d2, d2s0[0][i], 1e-12);
+        CuAssert(tc, "in range", d2 <= maxd2);
+    }
+
+    for (level=KD_SIMD_NONE+1; level<=kdtree_leafscan_max_simd(); level++) {
+        int n;
+        kdtree_leafscan_set_simd(level);
+        CuAssertIntEquals(tc, level, kdtree_leafscan_get_simd());
+        n = kdtree_leafscan_d(q, pd, N, D, NULL, 1.0, maxd2, inds, d2s);
+        check_leafscan(tc, n0[0], inds0[0], d2s0[0], n, inds, d2s);
+        n = kdtree_leafscan_f(fq, pf, N, D, NULL, 1.0, maxd2, inds, d2s);
+        check_leafscan(tc, n0[1], inds0[1], d2s0[1], n, inds, d2s);
+        n = kdtree_leafscan_u(q, pu, N, D, minval, uscale, maxd2, inds, d2s);
+        check_leafscan(tc, n0[2], inds0[2], d2s0[2], n, inds, d2s);
+        n = kdtree_leafscan_s(q, ps, N, D, minval, sscale, maxd2, inds, d2s);
+        check_leafscan(tc, n0[3], inds0[3], d2s0[3], n, inds, d2s);
+    }
+    kdtree_leafscan_set_simd(kdtree_leafscan_max_simd());
+}
+
+void test_leafscan_3(CuTest* tc) {
+    run_test_leafscan(tc, 3);
+}
+void test_leafscan_4(CuTest* tc) {
+    run_test_leafscan(tc, 4);
+}
+
 
 
 
@@ -544,3 +974,116 @@ void test_no_lr_with_ints(CuTest* tc) {
 	errors_free();
 }
 
+
+static void run_test_rebuild(CuTest* tc, int treetype, int treeopts) {
+    int N = 1000;
+    int Nleaf = 10;
+    int D = 2;
+    int sizes[] = { 1000, 300, 57, 999 };
+    kdtree_t* kd;
+    double* data;
+    double* treedata;
+    double query[D];
+    int i, j, q, d;
+
+    srand(0);
+    data = random_points_d(N, D);
+    treedata = malloc(N * D * sizeof(double));
+    memcpy(treedata, data, N * D * sizeof(double));
+    kd = build_tree(tc, treedata, N, D, Nleaf, treetype, treeopts);
+    CuAssert(tc, "kd", kd != NULL);
+    free(data);
+
+    for (j=0; j<sizeof(sizes)/sizeof(int); j++) {
+        int n = sizes[j];
+        data = random_points_d(n, D);
+        memcpy(treedata, data, n * D * sizeof(double));
+        kd = kdtree_rebuild(kd, treedata, n, D, Nleaf, treetype, treeopts);
+        CuAssert(tc, "kd", kd != NULL);
+        CuAssertIntEquals(tc, n, kdtree_n(kd));
+        CuAssertIntEquals(tc, 0, kdtree_check(kd));
+
+        for (q=0; q<10; q++) {
+            int ind, trueind = -1;
+            double d2, trued2 = HUGE_VAL;
+            for (d=0; d<D; d++)
+                query[d] = rand() / (double)RAND_MAX;
+            ind = kdtree_nearest_neighbour(kd, query, &d2);
+            for (i=0; i<n; i++) {
+                double dd2 = distsq(query, data + i*D, D);
+                if (dd2 < trued2) {
+                    trueind = i;
+                    trued2 = dd2;
+                }
+            }
+            CuAssertIntEquals(tc, trueind, kdtree_permute(kd, ind));
+        }
+        free(data);
+    }
+    kdtree_free(kd);
+    free(treedata);
+}
+
+void test_rebuild_ddd(CuTest* tc) {
+    run_test_rebuild(tc, KDTT_DOUBLE, KD_BUILD_SPLIT);
+}
+
+void test_rebuild_duu(CuTest* tc) {
+    run_test_rebuild(tc, KDTT_DUU, KD_BUILD_BBOX);
+}
+
+static void assert_same_array(CuTest* tc, const void* a, const void* b,
+                              size_t sz) {
+    CuAssertIntEquals(tc, a ? 1 : 0, b ? 1 : 0);
+    if (a)
+        CuAssertIntEquals(tc, 0, memcmp(a, b, sz));
+}
+
+static void run_test_threaded_build(CuTest* tc, int treetype, int treeopts) {
+    int N = 300000;
+    int D = 3;
+    int Nleaf = 10;
+    double* data1;
+    double* data2;
+    kdtree_t* kd1;
+    kdtree_t* kd2;
+
+    srand(0);
+    data1 = random_points_d(N, D);
+    // a few duplicates, to exercise the "equal" partition.
+    memcpy(data1, data1 + 1000 * D, 100 * D * sizeof(double));
+    data2 = malloc(N * D * sizeof(double));
+    memcpy(data2, data1, N * D * sizeof(double));
+
+    kdtree_set_build_threads(1);
+    kd1 = build_tree(tc, data1, N, D, Nleaf, treetype, treeopts);
+    kdtree_set_build_threads(4);
+    kd2 = build_tree(tc, data2, N, D, Nleaf, treetype, treeopts);
+    kdtree_set_build_threads(1);
+    CuAssert(tc, "kd1", kd1 != NULL);
+    CuAssert(tc, "kd2", kd2 != NULL);
+
+    assert_same_array(tc, kd1->data.any, kd2->data.any, kdtree_sizeof_data(kd1));
+    assert_same_array(tc, kd1->perm, kd2->perm, kdtree_sizeof_perm(kd1));
+    assert_same_array(tc, kd1->lr, kd2->lr, kdtree_sizeof_lr(kd1));
+    assert_same_array(tc, kd1->bb.any, kd2->bb.any, kdtree_sizeof_bb(kd1));
+    assert_same_array(tc, kd1->split.any, kd2->split.any, kdtree_sizeof_split(kd1));
+    assert_same_array(tc, kd1->splitdim, kd2->splitdim, kdtree_sizeof_splitdim(kd1));
+
+    kdtree_free(kd1);
+    kdtree_free(kd2);
+    free(data1);
+    free(data2);
+}
+
+void test_threaded_build_ddd(CuTest* tc) {
+    run_test_threaded_build(tc, KDTT_DOUBLE, KD_BUILD_BBOX | KD_BUILD_SPLIT);
+}
+
+void test_threaded_build_duu(CuTest* tc) {
+    run_test_threaded_build(tc, KDTT_DUU, KD_BUILD_BBOX);
+}
+
+void test_threaded_build_dss(CuTest* tc) {
+    run_test_threaded_build(tc, KDTT_DSS, KD_BUILD_SPLIT | KD_BUILD_SPLITDIM);
+}
@@ -115,6 +115,15 @@ static void assert_kdtrees_equal(CuTest* ct, const kdtree_t* kd, const kdtree_t*
         CuAssertPtrEquals(ct, NULL, kd2->bb.any);
     }
 
+    if (kd->nodeslot) {
+        CuAssertPtrNotNull(ct, kd2->nodeslot);
+        CuAssertIntEquals(ct, kd->nodestride, kd2->nodestride);
+        CuAssert(ct, "nodeslot equal", memcmp(kd->nodeslot, kd2->nodeslot,
+                                              kd->nnodes * sizeof(int32_t)) == 0);
+    } else {
+        CuAssertPtrEquals(ct, NULL, kd2->nodeslot);
+    }
+
     if (kd->nodes) {
         CuAssertPtrNotNull(ct, kd2->nodes);
         sz  = kdtree_sizeof_nodes(kd );
@@ -185,6 +194,46 @@ void test_read_write_single_tree_unnamed(CuTest* ct) {
     kdtree_fits_close(kd2);
 }
 
+void test_read_write_veb(CuTest* ct) {
+    kdtree_t* kd;
+    double * data;
+    int N = 1000;
+    int Nleaf = 5;
+    int D = 3;
+    char fn[1024];
+    int rtn;
+    kdtree_t* kd2;
+    int fd;
+    int i;
+    int opts[] = { KD_BUILD_SPLIT, KD_BUILD_BBOX, KD_BUILD_BBOX | KD_BUILD_SPLIT };
+
+    for (i=0; i<sizeof(opts)/sizeof(int); i++) {
+        data = random_points_d(N, D);
+        kd = build_tree(ct, data, N, D, Nleaf, KDTT_DSS, opts[i] | KD_BUILD_VEB);
+        CuAssertPtrNotNull(ct, kd->nodeslot);
+
+        sprintf(fn, "/tmp/test_libkd_io_veb.XXXXXX");
+        fd = mkstemp(fn);
+        if (fd == -1) {
+            fprintf(stderr, "Failed to generate a temp filename: %s\n", strerror(errno));
+            CuFail(ct, "mkstemp");
+        }
+        close(fd);
+
+        rtn = kdtree_fits_write(kd, fn, NULL);
+        CuAssertIntEquals(ct, 0, rtn);
+
+        kd2 = kdtree_fits_read(fn, NULL, NULL);
+        assert_kdtrees_equal(ct, kd, kd2);
+        CuAssertIntEquals(ct, 0, kdtree_check(kd2));
+
+        free(data);
+        kdtree_free(kd);
+        kdtree_fits_close(kd2);
+        unlink(fn);
+    }
+}
+
 void test_read_write_single_tree_named(CuTest* ct) {
     kdtree_t* kd;
     double * data;
@@ -6,6 +6,7 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <stdio.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -64,6 +65,42 @@ int fits_get_atom_size(tfits_type type) {
 	return atomsize;
 }
 
+/*
+ Loops for converting between the numeric types without scaling, with
+ the types known at compile time.  Integers are converted to integers
+ through an int64_t, so that K values are exact; conversions to or from
+ a floating-point type go through a double.  (memcpy because the data
+ need not be aligned.)
+ */
+#define CONVERT_LOOP(stype, dtype, vtype)                               \
+    for (i=0; i<N; i++) {                                               \
+        const char* s = src;                                            \
+        char* d = dest;                                                 \
+        for (j=0; j<arraysize; j++) {                                   \
+            stype sval;                                                 \
+            dtype dval;                                                 \
+            memcpy(&sval, s, sizeof(stype));                            \
+            dval = (dtype)(vtype)sval;                                  \
+            memcpy(d, &dval, sizeof(dtype));                            \
+            s += sizeof(stype);                                         \
+            d += sizeof(dtype);                                         \
+        }                                                               \
+        dest += deststride;                                             \
+        src  +=  srcstride;                                             \
+    }
+
+// "itype" is the type integer destinations go through.
+#define CONVERT_FROM(stype, itype)                                        \
+    switch (desttype) {                                                   \
+    case TFITS_BIN_TYPE_B: CONVERT_LOOP(stype, uint8_t, itype); return 0; \
+    case TFITS_BIN_TYPE_I: CONVERT_LOOP(stype, int16_t, itype); return 0; \
+    case TFITS_BIN_TYPE_J: CONVERT_LOOP(stype, int32_t, itype); return 0; \
+    case TFITS_BIN_TYPE_K: CONVERT_LOOP(stype, int64_t, itype); return 0; \
+    case TFITS_BIN_TYPE_E: CONVERT_LOOP(stype, float,  double); return 0; \
+    case TFITS_BIN_TYPE_D: CONVERT_LOOP(stype, double, double); return 0; \
+    default: break;                                                       \
+    }
+
 int fits_convert_data_2(void* vdest, int deststride, tfits_type desttype,
                         const void* vsrc, int srcstride, tfits_type srctype,
                         int arraysize, size_t N,
@@ -76,6 +113,18 @@ int fits_convert_data_2(void* vdest, int deststride, tfits_type desttype,
     int srcatomsize = fits_get_atom_size(srctype);
     anbool scaling = (bzero != 0.0) || (bscale != 1.0);
 
+    if (!scaling) {
+        switch (srctype) {
+        case TFITS_BIN_TYPE_B: CONVERT_FROM(uint8_t, int64_t); break;
+        case TFITS_BIN_TYPE_I: CONVERT_FROM(int16_t, int64_t); break;
+        case TFITS_BIN_TYPE_J: CONVERT_FROM(int32_t, int64_t); break;
+        case TFITS_BIN_TYPE_K: CONVERT_FROM(int64_t, int64_t); break;
+        case TFITS_BIN_TYPE_E: CONVERT_FROM(float,   double);  break;
+        case TFITS_BIN_TYPE_D: CONVERT_FROM(double,  double);  break;
+        default: break;
+        }
+    }
+
     // this loop is over rows of data
     for (i=0; i<N; i++) {
         // store local pointers so we can stride over the array, without
@@ -687,7 +736,16 @@ static int starts_with(const char* str, const char* start) {
 
 static const char* blankline = "                                                                                ";
 
-static int parse_header_block(const char* buf, qfits_header* hdr, int* found_it) {
+// Is this one of the cards needed to find the size of the data unit?
+static anbool is_size_card(const char* line) {
+    return (starts_with(line, "BITPIX ") || starts_with(line, "NAXIS") ||
+            starts_with(line, "EXTEND ") || starts_with(line, "END "));
+}
+
+// If "sizes_only", only the cards needed to find the size of the
+// data unit are added to "hdr".
+static int parse_header_block(const char* buf, qfits_header* hdr,
+                              anbool sizes_only, int* found_it) {
     char getval_buf[FITS_LINESZ+1];
     char getkey_buf[FITS_LINESZ+1];
     char getcom_buf[FITS_LINESZ+1];
@@ -701,6 +759,10 @@ static int parse_header_block(const char* buf, qfits_header* hdr, int* found_it)
         // Skip blank lines.
         if (!strcmp(line, blankline))
             continue;
+        if (sizes_only && !is_size_card(line)) {
+            line += 80;
+            continue;
+        }
         key = qfits_getkey_r(line, getkey_buf);
         if (!key)
             return -1;
@@ -740,25 +802,282 @@ anqfits_t* anqfits_open(const char* filename) {
     return anqfits_open_hdu(filename, -1);
 }
 
+/*
+ Reads header blocks from "in", starting with the one already in
+ "buf", until the END card.  Places the number of blocks in
+ *n_blocks.  Returns 1 if END was found, 0 if the file ended first,
+ -1 on a parse error.
+ */
+static int read_header(FILE* in, char* buf, qfits_header* hdr,
+                       anbool sizes_only, int* n_blocks) {
+    int found_it = 0;
+    *n_blocks = 0;
+    for (;;) {
+        (*n_blocks)++;
+        if (parse_header_block(buf, hdr, sizes_only, &found_it)) {
+            debug("parse_header_block() failed\n");
+            return -1;
+        }
+        if (found_it)
+            return 1;
+        if (fread(buf, 1, FITS_BLOCK_SIZE, in) != FITS_BLOCK_SIZE)
+            return 0;
+    }
+}
+
+/*
+ Finds the extension whose header should start at FITS block *block
+ (or the first block after it that starts with XTENSION), records its
+ offsets, and moves *block on to where the next one should start.
+ Only the header cards that give the size of the data unit are
+ parsed; the header is read again if it's asked for.
+
+ Returns 1 if an extension was found, 0 at the end of the file, -1 on
+ error.
+ */
+static int scan_next_ext(anqfits_t* qf, FILE* in, off_t* block,
+                         int* ext_capacity) {
+    char buf[FITS_BLOCK_SIZE];
+    qfits_header* hdr;
+    anqfits_ext_t* ext;
+    int hdr_blocks;
+    int rtn;
+
+    if (fseeko(in, *block * (off_t)FITS_BLOCK_SIZE, SEEK_SET)) {
+        qfits_error("anqfits: failed to fseeko in file %s: %s",
+                    qf->filename, strerror(errno));
+        return -1;
+    }
+    /* Look for extension start */
+    for (;;) {
+        if ((*block >= qf->filesize) ||
+            (fread(buf, 1, FITS_BLOCK_SIZE, in) != FITS_BLOCK_SIZE))
+            /* Reached end of file */
+            return 0;
+        /* Search for XTENSION at block top */
+        if (starts_with(buf, "XTENSION="))
+            break;
+        // FIXME -- should we really just skip the block if we don't find the "XTENSION=" header?
+        qfits_warning("Failed to find XTENSION in the FITS block following the previous data block -- whaddup?  Filename %s, block %i, hdu %i",
+                      qf->filename, (int)*block + 1, qf->Nexts-1);
+        (*block)++;
+    }
+    debug("Found XTENSION at block %i\n", (int)*block);
+
+    hdr = qfits_header_new();
+    rtn = read_header(in, buf, hdr, TRUE, &hdr_blocks);
+    if (rtn != 1) {
+        if (rtn == 0)
+            qdebug(printf("anqfits: XTENSION without END in %s\n",
+                          qf->filename););
+        qfits_header_destroy(hdr);
+        return rtn;
+    }
+
+    if (qf->Nexts >= *ext_capacity) {
+        anqfits_ext_t* exts = realloc(qf->exts, 2 * (*ext_capacity) *
+                                      sizeof(anqfits_ext_t));
+        if (!exts) {
+            qfits_header_destroy(hdr);
+            return -1;
+        }
+        qf->exts = exts;
+        *ext_capacity *= 2;
+    }
+    ext = qf->exts + qf->Nexts;
+    memset(ext, 0, sizeof(anqfits_ext_t));
+    ext->hdr_start = *block;
+    ext->hdr_size = hdr_blocks;
+    ext->data_start = *block + hdr_blocks;
+    // Until the next extension is found, the data run to the end of
+    // the file; the previous extension's data run up to this one.
+    ext->data_size = qf->filesize - ext->data_start;
+    ext[-1].data_size = ext->hdr_start - ext[-1].data_start;
+
+    *block = ext->data_start + (off_t)qfits_blocks_needed(get_data_bytes(hdr));
+    qfits_header_destroy(hdr);
+    debug("ext %i: hdr_start %i, hdr_size %i, data_start %i, next header at %i, blocks\n",
+          qf->Nexts, ext->hdr_start, ext->hdr_size, ext->data_start,
+          (int)*block);
+    qf->Nexts++;
+    return 1;
+}
+
+/*
+ Finds all the extensions (up to qf->max_hdu, if >= 0) after the
+ primary HDU, whose data unit ends at FITS block "block".  Returns 0
+ on success, -1 if a header can't be read.
+ */
+static int scan_exts(anqfits_t* qf, FILE* in, off_t block, int ext_capacity) {
+    for (;;) {
+        int rtn;
+        if ((qf->max_hdu >= 0) && (qf->Nexts > qf->max_hdu)) {
+            debug("Stopped reading after finding HDU %i\n", qf->max_hdu);
+            break;
+        }
+        rtn = scan_next_ext(qf, in, &block, &ext_capacity);
+        if (rtn == -1) {
+            ERROR("Failed to read the header of extension %i in FITS file \"%s\"",
+                  qf->Nexts, qf->filename);
+            return -1;
+        }
+        if (rtn == 0)
+            break;
+    }
+    debug("Found %i extensions\n", qf->Nexts);
+    return 0;
+}
+
+#define HDU_INDEX_MAGIC "ANQFITS_HDU_INDEX"
+#define HDU_INDEX_VERSION 1
+
+char* anqfits_hdu_index_filename(const char* fn) {
+    char* indexfn = NULL;
+    asprintf_safe(&indexfn, "%s.hdus", fn);
+    return indexfn;
+}
+
+/*
+ If there is an up-to-date HDU index beside the file, takes the
+ extension offsets from it rather than scanning the file.  Returns
+ TRUE if it did.
+
+ The index is a text file: a line with the magic string, version,
+ FITS file size in bytes, modification time, and number of
+ extensions, then one line per extension with its header start and
+ size and data start and size, in FITS blocks.
+ */
+static anbool read_hdu_index(anqfits_t* qf, const struct stat* sta) {
+    char* fn;
+    FILE* f;
+    int version, N, i;
+    anbool found = FALSE;
+    long long filesize, mtime;
+    anqfits_ext_t* exts = NULL;
+
+    fn = anqfits_hdu_index_filename(qf->filename);
+    f = fopen(fn, "r");
+    if (!f)
+        goto bailout;
+    if ((fscanf(f, HDU_INDEX_MAGIC " %i %lld %lld %i",
+                &version, &filesize, &mtime, &N) != 4) ||
+        (version != HDU_INDEX_VERSION) ||
+        (filesize != (long long)sta->st_size) ||
+        (mtime != (long long)sta->st_mtime) ||
+        (N < 1)) {
+        debug("HDU index %s is out of date or not valid\n", fn);
+        goto bailout;
+    }
+    exts = calloc(N, sizeof(anqfits_ext_t));
+    if (!exts)
+        goto bailout;
+    for (i=0; i<N; i++) {
+        anqfits_ext_t* ext = exts + i;
+        if (fscanf(f, " %i %i %i %i", &ext->hdr_start, &ext->hdr_size,
+                   &ext->data_start, &ext->data_size) != 4)
+            goto bailout;
+        // Each extension must follow on from the previous one, and
+        // the primary header must be where we found it.
+        if ((ext->hdr_size < 1) || (ext->data_size < 0) ||
+            (ext->data_start != ext->hdr_start + ext->hdr_size) ||
+            (ext->hdr_start != (i ? ext[-1].data_start + ext[-1].data_size : 0)) ||
+            ((off_t)ext->data_start + ext->data_size > qf->filesize)) {
+            debug("HDU index %s: invalid extension %i\n", fn, i);
+            goto bailout;
+        }
+    }
+    if (exts[0].data_start != qf->exts[0].data_start) {
+        debug("HDU index %s doesn't match the primary header\n", fn);
+        goto bailout;
+    }
+    if ((qf->max_hdu >= 0) && (N > qf->max_hdu + 1)) {
+        N = qf->max_hdu + 1;
+        exts[N-1].data_size = qf->filesize - exts[N-1].data_start;
+    }
+    debug("Read %i extensions from HDU index %s\n", N, fn);
+
+    exts[0].header = qf->exts[0].header;
+    free(qf->exts);
+    qf->exts = exts;
+    exts = NULL;
+    qf->Nexts = N;
+    found = TRUE;
+
+ bailout:
+    if (f)
+        fclose(f);
+    free(exts);
+    free(fn);
+    return found;
+}
+
+int anqfits_write_hdu_index(const anqfits_t* qf) {
+    struct stat sta;
+    char* fn = NULL;
+    char* tmpfn = NULL;
+    FILE* f = NULL;
+    int i, N;
+    int rtn = -1;
+
+    if (qf->max_hdu >= 0) {
+        ERROR("FITS file \"%s\" was opened only up to HDU %i; can't write an HDU index for it",
+              qf->filename, qf->max_hdu);
+        return -1;
+    }
+    N = anqfits_n_ext(qf);
+    if (stat(qf->filename, &sta)) {
+        SYSERROR("Failed to stat FITS file \"%s\"", qf->filename);
+        return -1;
+    }
+    if (sta.st_size / FITS_BLOCK_SIZE != qf->filesize) {
+        ERROR("FITS file \"%s\" has changed size since it was opened",
+              qf->filename);
+        return -1;
+    }
+    fn = anqfits_hdu_index_filename(qf->filename);
+    asprintf_safe(&tmpfn, "%s.tmp", fn);
+    f = fopen(tmpfn, "w");
+    if (!f) {
+        SYSERROR("Failed to open HDU index file \"%s\" for writing", tmpfn);
+        goto bailout;
+    }
+    fprintf(f, HDU_INDEX_MAGIC " %i %lld %lld %i\n", HDU_INDEX_VERSION,
+            (long long)sta.st_size, (long long)sta.st_mtime, N);
+    for (i=0; i<N; i++)
+        fprintf(f, "%i %i %i %i\n", qf->exts[i].hdr_start,
+                qf->exts[i].hdr_size, qf->exts[i].data_start,
+                qf->exts[i].data_size);
+    if (fclose(f)) {
+        f = NULL;
+        SYSERROR("Failed to write HDU index file \"%s\"", tmpfn);
+        goto bailout;
+    }
+    f = NULL;
+    // Write-then-rename so that readers never see a partial index.
+    if (rename(tmpfn, fn)) {
+        SYSERROR("Failed to rename \"%s\" to \"%s\"", tmpfn, fn);
+        goto bailout;
+    }
+    rtn = 0;
+
+ bailout:
+    if (f)
+        fclose(f);
+    if (rtn)
+        unlink(tmpfn);
+    free(tmpfn);
+    free(fn);
+    return rtn;
+}
+
 anqfits_t* anqfits_open_hdu(const char* filename, int hdu) {
     anqfits_t* qf = NULL;
-    // copied from qfits_cache.c: qfits_cache_add()
     FILE* in = NULL;
     struct stat sta;
-    size_t n_blocks;
-    int found_it;
-    int xtend;
-    size_t data_bytes;
-    int end_of_file;
-    size_t skip_blocks;
     char buf[FITS_BLOCK_SIZE];
-    int seeked;
-    int firsttime;
-    int i;
-
-    // initial maximum number of extensions: we grow automatically
-    int ext_capacity = 1024;
-
+    int n_blocks;
+    int xtend;
+    int ext_capacity = 16;
     qfits_header* hdr = NULL;
 
     /* Stat file to get its size */
@@ -788,46 +1107,19 @@ anqfits_t* anqfits_open_hdu(const char* filename, int hdu) {
         goto bailout;
     }
 
-    /*
-     * Browse through file to identify primary HDU size and see if there
-     * might be some extensions. The size of the primary data zone will
-     * also be estimated from the gathering of the NAXIS?? values and
-     * BITPIX.
-     */
-
-    n_blocks = 0;
-    found_it = 0;
-    firsttime = 1;
-
     assert(strlen(blankline) == 80);
 
-    // Parse this header
+    // Parse the primary header
     hdr = qfits_header_new();
-    while (!found_it) {
-        debug("Firsttime = %i\n", firsttime);
-        if (!firsttime) {
-            // Read next FITS block
-            debug("Reading next FITS block\n");
-            if (fread(buf, 1, FITS_BLOCK_SIZE, in) != FITS_BLOCK_SIZE) {
-                qdebug(printf("anqfits: error reading file %s\n", filename););
-                goto bailout;
-            }
-        }
-        firsttime = 0;
-        n_blocks++;
-        if (parse_header_block(buf, hdr, &found_it))
-            goto bailout;
+    if (read_header(in, buf, hdr, FALSE, &n_blocks) != 1) {
+        qdebug(printf("anqfits: error reading file %s\n", filename););
+        goto bailout;
     }
-    // otherwise we bail out trying to read blocks past the EOF...
-    assert(found_it);
-
-    xtend = qfits_header_getboolean(hdr, "EXTEND", 0);
-    data_bytes = get_data_bytes(hdr);
-
-    debug("primary header: data_bytes %zu\n", data_bytes);
 
     qf = calloc(1, sizeof(anqfits_t));
     qf->filename = strdup(filename);
+    qf->filesize = sta.st_size / FITS_BLOCK_SIZE;
+    qf->max_hdu = hdu;
     qf->exts = calloc(ext_capacity, sizeof(anqfits_ext_t));
     assert(qf->exts);
     if (!qf->exts)
@@ -835,159 +1127,26 @@ anqfits_t* anqfits_open_hdu(const char* filename, int hdu) {
 
     // Set first HDU offsets
     qf->exts[0].hdr_start = 0;
+    qf->exts[0].hdr_size = n_blocks;
     qf->exts[0].data_start = n_blocks;
-    qf->exts[0].header = hdr;
-    hdr = NULL;
+    qf->exts[0].data_size = qf->filesize - n_blocks;
     qf->Nexts = 1;
 
+    xtend = qfits_header_getboolean(hdr, "EXTEND", 0);
+    debug("primary header: %i blocks, data_bytes %zu\n", n_blocks,
+          get_data_bytes(hdr));
     debug("Extensions? %s\n", xtend ? "yes":"no");
-    
-    if (xtend) {
-        /* Look for extensions */
-        /*
-         * Register all extension offsets
-         */
-        hdr = qfits_header_new();
-        end_of_file = 0;
-        while (!end_of_file) {
-
-            if (qf->Nexts-1 == hdu) {
-                debug("Stopped reading after finding HDU %i\n", hdu);
-                //printf("Stopped reading after HDU %i\n", hdu);
-                // Could cache the file offset to continue reading later...
-                break;
-            }
-            /*
-             * Skip the previous data section if pixels were declared
-             */
-            if (data_bytes > 0) {
-                /* Skip as many blocks as there are declared pixels */
-                size_t off;
-                skip_blocks = qfits_blocks_needed(data_bytes);
-                off = skip_blocks;
-                off *= (size_t)FITS_BLOCK_SIZE;
-                seeked = fseeko(in, off, SEEK_CUR);
-                if (seeked == -1) {
-                    qfits_error("anqfits: failed to fseeko in file %s: %s",
-                                filename, strerror(errno));
-                    goto bailout;
-                }
-
-                debug("hdu %i, data_bytes %zu, skip_blocks %zu, off %zu, n_blocks %zu\n",
-                      qf->Nexts-1, data_bytes, skip_blocks, off, n_blocks);
-                /* Increase counter of current seen blocks. */
-                n_blocks += skip_blocks;
-                data_bytes = 0;
-            }
-            
-            /* Look for extension start */
-            found_it = 0;
-            while (!found_it && !end_of_file) {
-                if (fread(buf, 1, FITS_BLOCK_SIZE, in) != FITS_BLOCK_SIZE) {
-                    /* Reached end of file */
-                    end_of_file = 1;
-                    break;
-                }
-                n_blocks++;
-
-                /* Search for XTENSION at block top */
-                if (starts_with(buf, "XTENSION=")) {
-                    debug("Found XTENSION\n");
-                    /* Got an extension */
-                    found_it = 1;
-                    qf->exts[qf->Nexts].hdr_start = n_blocks-1;
-                } else {
-                    qfits_warning("Failed to find XTENSION in the FITS block following the previous data block -- whaddup?  Filename %s, block %i, hdu %i",
-                                  filename, n_blocks, qf->Nexts-1);
-                }
-                // FIXME -- should we really just skip the block if we don't find the "XTENSION=" header?
-            }
-            if (end_of_file)
-                break;
-
-            // Look for extension END
-            n_blocks--;
-            found_it = 0;
-            firsttime = 1;
-
-            if (!hdr)
-                hdr = qfits_header_new();
-
-            while (!found_it && !end_of_file) {
-                if (!firsttime) {
-                    if (fread(buf, 1, FITS_BLOCK_SIZE, in) != FITS_BLOCK_SIZE) {
-                        qdebug(printf("anqfits: XTENSION without END in %s\n",
-                                      filename););
-                        end_of_file = 1;
-                        break;
-                    }
-                }
-                firsttime = 0;
-                n_blocks++;
-
-                if (parse_header_block(buf, hdr, &found_it)) {
-                    debug("parse_header_block() failed: bailing\n");
-                    goto bailout;
-                }
-                debug("parse_header_block() succeeded: found END? %s\n",
-                      found_it ? "yes":"no");
-            }
-            if (found_it) {
-                data_bytes = get_data_bytes(hdr);
-                debug("This data block will have %zu bytes\n", data_bytes);
-
-                qf->exts[qf->Nexts].data_start = n_blocks;
-                qf->exts[qf->Nexts].header = hdr;
-                hdr = NULL;
-                qf->Nexts++;
-                if (qf->Nexts >= ext_capacity) {
-                    ext_capacity *= 2;
-                    qf->exts = realloc(qf->exts,
-                                       ext_capacity * sizeof(anqfits_ext_t));
-                    assert(qf->exts);
-                    if (!qf->exts)
-                        goto bailout;
-                }
-            }
-        }
-    }
-    debug("Found %i extensions\n", qf->Nexts);
-
-    if (hdr)
-        qfits_header_destroy(hdr);
+    qf->exts[0].header = hdr;
     hdr = NULL;
 
-    /* Close file */
-    fclose(in);
-    in = NULL;
-
-    // realloc
-    qf->exts = realloc(qf->exts, qf->Nexts * sizeof(anqfits_ext_t));
-    assert(qf->exts);
-    if (!qf->exts)
+    // The extension table is complete before the file is returned, so
+    // it never changes under a reader.
+    if (xtend && (hdu != 0) && !read_hdu_index(qf, &sta) &&
+        scan_exts(qf, in, qf->exts[0].data_start +
+                  (off_t)qfits_blocks_needed(get_data_bytes(qf->exts[0].header)),
+                  ext_capacity))
         goto bailout;
-
-    for (i=0; i<qf->Nexts; i++) {
-        qf->exts[i].hdr_size = qf->exts[i].data_start - qf->exts[i].hdr_start;
-        if (i == qf->Nexts-1) {
-            debug("st_size %zu, /block_size = %zu\n",
-                  (off_t)sta.st_size,
-                  (off_t)(sta.st_size / (size_t)FITS_BLOCK_SIZE));
-            qf->exts[i].data_size = ((sta.st_size/FITS_BLOCK_SIZE) -
-                                     qf->exts[i].data_start);
-        } else
-            qf->exts[i].data_size = (qf->exts[i+1].hdr_start -
-                                     qf->exts[i].data_start);
-        debug("  Ext %i: header size %i, data size %i; hdr=%p\n",
-              i, qf->exts[i].hdr_size, qf->exts[i].data_size,
-              qf->exts[i].header);
-        debug("ext %i: hdr_start %i, hdr_size %i, data_start %i, data_size %i, blocks\n",
-              i,
-              qf->exts[i].hdr_start, qf->exts[i].hdr_size,
-              qf->exts[i].data_start, qf->exts[i].data_size);
-    }
-    qf->filesize = sta.st_size / FITS_BLOCK_SIZE;
-
+    fclose(in);
     return qf;
 
  bailout:
@@ -995,11 +1154,7 @@ anqfits_t* anqfits_open_hdu(const char* filename, int hdu) {
         qfits_header_destroy(hdr);
     if (in)
         fclose(in);
-    if (qf) {
-        free(qf->filename);
-        free(qf->exts);
-        free(qf);
-    }
+    anqfits_close(qf);
     return NULL;
 }
 
@@ -73,15 +73,31 @@ typedef struct anqfits_ext_t anqfits_ext_t;
 
 struct anqfits_t {
     char* filename;
-    int Nexts;    // # of extensions in file
+    // # of extensions
+    int Nexts;
 	anqfits_ext_t* exts;
     off_t filesize ; // File size in FITS blocks
+    // Last HDU that was looked for, or -1 for all of them.
+    int max_hdu;
 };
 typedef struct anqfits_t anqfits_t;
 
 
 
 
+/**
+ Opens a FITS file, reading its primary header and finding the
+ offsets of all its extensions.  Returns NULL if the file can't be
+ read or any extension header is corrupt.
+
+ Finding the extensions means reading all their header blocks, but
+ only the cards that give the data sizes are parsed; the headers are
+ parsed in full when they are requested.  If a valid HDU index (see
+ anqfits_write_hdu_index) exists beside the file, the offsets are
+ taken from it instead and no scanning is done.
+
+ The extension offsets don't change after the file is opened.
+ */
 anqfits_t* anqfits_open(const char* filename);
 
 // Open the given file, but only parse up to the given HDU number.
@@ -89,6 +105,25 @@ anqfits_t* anqfits_open(const char* filename);
 // number of HDUs the file is reported to contain will be hdu+1.
 anqfits_t* anqfits_open_hdu(const char* filename, int hdu);
 
+/**
+ Writes an "HDU index" listing the offsets and sizes of all the
+ extensions in "qf" beside the file (see anqfits_hdu_index_filename),
+ so that later calls to anqfits_open() on it don't have to scan for
+ them.
+
+ The index records the size and modification time of the FITS file,
+ and is ignored if they have changed since; rewriting the file within
+ the same second and at the same size would fool it, so remove the
+ index when rewriting a file in place.
+
+ Returns 0 on success.
+ */
+int anqfits_write_hdu_index(const anqfits_t* qf);
+
+// Returns a newly-allocated string: the HDU index filename for the
+// given FITS file.
+char* anqfits_hdu_index_filename(const char* fn);
+
 void anqfits_close(anqfits_t* qf);
 
 int anqfits_n_ext(const anqfits_t* qf);
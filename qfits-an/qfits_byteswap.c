@@ -33,6 +33,18 @@
 
 #include "qfits_byteswap.h"
 
+/*
+ The SSSE3 and AVX2 versions of qfits_swap_bytes_array are compiled
+ with "target" attributes, so they get built whatever the -march flags
+ are, and are only called if the CPU we're running on supports them.
+ */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define QFITS_SWAP_X86 1
+#include <immintrin.h>
+#else
+#define QFITS_SWAP_X86 0
+#endif
+
 // does qfits think this platform is big-endian?
 int qfits_is_platform_big_endian() {
 #ifdef WORDS_BIGENDIAN
@@ -139,4 +151,130 @@ void qfits_swap_bytes(void * p, int s)
     }
 }
 
+/*
+ Plain C: swaps "n" consecutive "s"-byte values starting at "c".
+ */
+static void swap_array_plain(unsigned char* c, int s, size_t n) {
+    unsigned char t;
+    size_t i;
+    switch (s) {
+    case 2:
+        for (i=0; i<n; i++, c+=2) {
+            t = c[0]; c[0] = c[1]; c[1] = t;
+        }
+        break;
+    case 4:
+        for (i=0; i<n; i++, c+=4) {
+            t = c[0]; c[0] = c[3]; c[3] = t;
+            t = c[1]; c[1] = c[2]; c[2] = t;
+        }
+        break;
+    case 8:
+        for (i=0; i<n; i++, c+=8) {
+            t = c[0]; c[0] = c[7]; c[7] = t;
+            t = c[1]; c[1] = c[6]; c[6] = t;
+            t = c[2]; c[2] = c[5]; c[5] = t;
+            t = c[3]; c[3] = c[4]; c[4] = t;
+        }
+        break;
+    default:
+        for (i=0; i<n; i++, c+=s)
+            qfits_swap_bytes(c, s);
+        break;
+    }
+}
+
+#if QFITS_SWAP_X86
+
+/*
+ Byte shuffles that reverse each 2-, 4- or 8-byte value in 16 bytes.
+ (The AVX2 shuffle works within each 16-byte half, so it uses the same
+ pattern twice.)  The values that don't fill a whole vector at the end
+ are done in plain C.
+ */
+static const char swap_shuffles[3][16] = {
+    { 1,0, 3,2, 5,4, 7,6, 9,8, 11,10, 13,12, 15,14 },
+    { 3,2,1,0, 7,6,5,4, 11,10,9,8, 15,14,13,12 },
+    { 7,6,5,4,3,2,1,0, 15,14,13,12,11,10,9,8 },
+};
+
+static const char* swap_shuffle(int s) {
+    return swap_shuffles[(s == 2) ? 0 : ((s == 4) ? 1 : 2)];
+}
+
+__attribute__((target("ssse3")))
+static void swap_array_ssse3(unsigned char* c, int s, size_t n) {
+    size_t nb = n * (size_t)s;
+    size_t i;
+    __m128i shuf = _mm_loadu_si128((const __m128i*)swap_shuffle(s));
+    for (i=0; i+16<=nb; i+=16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(c + i));
+        _mm_storeu_si128((__m128i*)(c + i), _mm_shuffle_epi8(v, shuf));
+    }
+    swap_array_plain(c + i, s, (nb - i) / s);
+}
+
+__attribute__((target("avx2")))
+static void swap_array_avx2(unsigned char* c, int s, size_t n) {
+    size_t nb = n * (size_t)s;
+    size_t i;
+    __m128i half = _mm_loadu_si128((const __m128i*)swap_shuffle(s));
+    __m256i shuf = _mm256_inserti128_si256(_mm256_castsi128_si256(half),
+                                           half, 1);
+    for (i=0; i+32<=nb; i+=32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(c + i));
+        _mm256_storeu_si256((__m256i*)(c + i), _mm256_shuffle_epi8(v, shuf));
+    }
+    swap_array_plain(c + i, s, (nb - i) / s);
+}
+
+// 0: plain C; 1: SSSE3; 2: AVX2; -1: not yet checked.
+static int swap_simd_level = -1;
+
+static int get_swap_simd_level(void) {
+    if (swap_simd_level < 0) {
+        int level = 0;
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            level = 2;
+        else if (__builtin_cpu_supports("ssse3"))
+            level = 1;
+        swap_simd_level = level;
+    }
+    return swap_simd_level;
+}
+
+#endif
+
+/*----------------------------------------------------------------------------*/
+/**
+  @brief    Swaps bytes in an array of values of the given size
+  @param    p pointer to the first value
+  @param    s size of each value
+  @param    n number of values
+  @return    void
+
+  Equivalent to calling qfits_swap_bytes on each value in turn, but
+  values of size 2, 4 and 8 are done many at a time (with SSSE3 or AVX2
+  byte shuffles, where the CPU has them).
+ */
+/*----------------------------------------------------------------------------*/
+void qfits_swap_bytes_array(void * p, int s, size_t n)
+{
+    unsigned char* c = (unsigned char*)p;
+#if QFITS_SWAP_X86
+    if ((s == 2) || (s == 4) || (s == 8)) {
+        switch (get_swap_simd_level()) {
+        case 2:
+            swap_array_avx2(c, s, n);
+            return;
+        case 1:
+            swap_array_ssse3(c, s, n);
+            return;
+        }
+    }
+#endif
+    swap_array_plain(c, s, n);
+}
+
 /**@}*/
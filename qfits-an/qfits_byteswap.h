@@ -41,5 +41,6 @@
 unsigned short qfits_swap_bytes_16(unsigned short w);
 unsigned int qfits_swap_bytes_32(unsigned int dw);
 void qfits_swap_bytes(void * p, int s);
+void qfits_swap_bytes_array(void * p, int s, size_t n);
 
 #endif
@@ -39,6 +39,8 @@
 #include "qfits_error.h"
 #include "qfits_memory.h"
 
+#include <pthread.h>
+
 struct qfits_header {
     void    *   first;         /* Pointer to list start */
     void    *   last;          /* Pointer to list end */
@@ -46,6 +48,10 @@ struct qfits_header {
     /* For efficient looping internally */
     void    *   current;
     int         current_idx;
+    /* Hash index of the first card with each key (see header_find) */
+    void    **  index;         /* Buckets: chains of keytuples */
+    int         index_size;    /* Number of buckets (a power of 2) */
+    int         index_n;       /* Number of keys in the index */
 };
 
 
@@ -71,6 +77,9 @@ typedef struct _keytuple_ {
     /** Implemented as a doubly-linked list */
     struct _keytuple_ * next;
     struct _keytuple_ * prev;
+
+    /** Next in the header's hash-index bucket, if indexed */
+    struct _keytuple_ * hnext;
 } keytuple;
 
 /*----------------------------------------------------------------------------*/
@@ -148,6 +157,9 @@ static void keytuple_del(keytuple *);
 //static void keytuple_dmp(const keytuple *);
 static keytype keytuple_type(const char *);
 static int qfits_header_makeline(char *, const keytuple *, int);
+static keytuple * header_find(const qfits_header *, const char *);
+static void header_index_add(qfits_header *, keytuple *);
+static void header_index_free(qfits_header *);
 
 /*----------------------------------------------------------------------------*/
 /**
@@ -202,6 +214,10 @@ qfits_header * qfits_header_new(void)
     h->current = NULL;
     h->current_idx = -1;
 
+    h->index = NULL;
+    h->index_size = 0;
+    h->index_n = 0;
+
     return h;
 }
 
@@ -300,6 +316,9 @@ void qfits_header_add(
     k->prev = kbf;
 
     hdr->n ++;
+    hdr->current = NULL;
+    hdr->current_idx = -1;
+    header_index_add(hdr, k);
     return;
 }
 
@@ -335,11 +354,7 @@ void qfits_header_add_after(
 
     qfits_expand_keyword_r(after, exp_after);
     /* Locate where the entry is requested */
-    kreq = (keytuple*)(hdr->first);
-    while (kreq!=NULL) {
-        if (!strcmp(kreq->key, exp_after)) break;
-        kreq = kreq->next;
-    }
+    kreq = header_find(hdr, exp_after);
     if (kreq==NULL) return;
     k = keytuple_new(key, val, com, lin);
 
@@ -348,6 +363,10 @@ void qfits_header_add_after(
     kreq->next = k;
     k->prev = kreq;
     hdr->n ++;
+    hdr->current = NULL;
+    hdr->current_idx = -1;
+    /* The new card may now be the first with its key: re-index later. */
+    header_index_free(hdr);
     return;
 }
 
@@ -381,6 +400,7 @@ void qfits_header_append(
     if (hdr->n==0) {
         hdr->first = hdr->last = k;
         hdr->n = 1;
+        header_index_add(hdr, k);
         return;
     }
     last  = (keytuple*)hdr->last;
@@ -388,6 +408,7 @@ void qfits_header_append(
     k->prev = last;
     hdr->last = k;
     hdr->n++;
+    header_index_add(hdr, k);
     return;
 }
 
@@ -410,19 +431,24 @@ void qfits_header_del(qfits_header * hdr, const char * key)
     if (hdr==NULL || key==NULL) return;
 
     qfits_expand_keyword_r(key, xkey);
-    k = (keytuple*)hdr->first;
-    while (k!=NULL) {
-        if (!strcmp(k->key, xkey)) break;
-        k = k->next;
-    }
+    k = header_find(hdr, xkey);
     if (k==NULL)
         return;
+    /* A later card with the same key may become the first: re-index later. */
+    header_index_free(hdr);
     if(k == hdr->first) {
         hdr->first = k->next;
+        if (k->next) k->next->prev = NULL;
     } else {
         k->prev->next = k->next;
-        k->next->prev = k->prev;
+        if (k->next) k->next->prev = k->prev;
     }
+    if (k == hdr->last)
+        hdr->last = k->prev;
+    hdr->n--;
+    /* The card indices have changed. */
+    hdr->current = NULL;
+    hdr->current_idx = -1;
     keytuple_del(k);
     return;
 }
@@ -453,11 +479,7 @@ void qfits_header_mod(
     if (hdr==NULL || key==NULL) return;
 
     qfits_expand_keyword_r(key, xkey);
-    k = (keytuple*)hdr->first;
-    while (k!=NULL) {
-        if (!strcmp(k->key, xkey)) break;
-        k=k->next;
-    }
+    k = header_find(hdr, xkey);
     if (k==NULL) return;
     
     if (k->val) qfits_free(k->val);
@@ -538,6 +560,7 @@ int qfits_header_sort(qfits_header ** hdr)
 
     /* Replace the input header by the sorted one */
     (*hdr)->first = (*hdr)->last = NULL;
+    header_index_free(*hdr);
     qfits_header_destroy(*hdr);
     *hdr = sorted;
     
@@ -592,6 +615,7 @@ void qfits_header_destroy(qfits_header * hdr)
         keytuple_del(k);
         k = kn;
     }
+    header_index_free(hdr);
     qfits_free(hdr);
     return;
 }
@@ -618,11 +642,7 @@ char * qfits_header_getstr(const qfits_header * hdr, const char * key)
     if (hdr==NULL || key==NULL) return NULL;
 
     qfits_expand_keyword_r(key, xkey);
-    k = (keytuple*)hdr->first;
-    while (k!=NULL) {
-        if (!strcmp(k->key, xkey)) break;
-        k=k->next;
-    }
+    k = header_find(hdr, xkey);
     if (k==NULL) return NULL;
     return k->val;
 }
@@ -743,6 +763,9 @@ int qfits_header_setitem(
 
     k = get_keytuple(hdr, idx);
 
+    // the key may change.
+    header_index_free(hdr);
+
     // free existing strings as per keytuple_del
     if (k->key)
         qfits_free(k->key);
@@ -802,11 +825,7 @@ char * qfits_header_getcom(const qfits_header * hdr, const char * key)
     if (hdr==NULL || key==NULL) return NULL;
 
     qfits_expand_keyword_r(key, xkey);
-    k = (keytuple*)hdr->first;
-    while (k!=NULL) {
-        if (!strcmp(k->key, xkey)) break;
-        k=k->next;
-    }
+    k = header_find(hdr, xkey);
     if (k==NULL) return NULL;
     return k->com;
 }
@@ -999,6 +1018,135 @@ int qfits_header_list(
 
 /**@}*/
 
+/*----------------------------------------------------------------------------*/
+/*
+  Keyed lookups.
+
+  Finding a card by key is a linear scan with a string compare per
+  card, which adds up for headers with hundreds or thousands of cards
+  that get dozens of lookups.  So, once a header has at least
+  QFITS_HEADER_INDEX_MIN cards, the first keyed lookup builds a hash
+  index from each key to the first card with that key (the card that
+  the linear scan would find).  Cards are chained into their buckets
+  through their "hnext" pointers.
+
+  Appending a card just adds it to the index if its key is new.  Other
+  changes that could change which card comes first for a key (deleting,
+  inserting in the middle, changing keys, sorting) throw the index away,
+  and the next lookup rebuilds it.
+
+  Lookups are const, as far as callers are concerned; building the
+  index is done under a lock so that readers of a shared header remain
+  safe.
+ */
+/*----------------------------------------------------------------------------*/
+
+#define QFITS_HEADER_INDEX_MIN 32
+
+static pthread_mutex_t header_index_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#if defined(__GNUC__)
+#define INDEX_LOAD(x)      __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define INDEX_STORE(x, v)  __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+#else
+#define INDEX_LOAD(x)      (x)
+#define INDEX_STORE(x, v)  ((x) = (v))
+#endif
+
+/* FNV-1a */
+static unsigned int key_hash(const char * key)
+{
+    unsigned int h = 2166136261u;
+    for (; *key; key++) {
+        h ^= (unsigned char)(*key);
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static keytuple * index_lookup(void ** index, int size, const char * key)
+{
+    keytuple * k = index[key_hash(key) & (size-1)];
+    for (; k; k = k->hnext)
+        if (!strcmp(k->key, key))
+            return k;
+    return NULL;
+}
+
+/* Adds "k" to the bucket table, unless its key is already there. */
+static int index_insert(void ** index, int size, keytuple * k)
+{
+    unsigned int b;
+    if (index_lookup(index, size, k->key))
+        return 0;
+    b = key_hash(k->key) & (size-1);
+    k->hnext = index[b];
+    index[b] = k;
+    return 1;
+}
+
+static void header_index_build(qfits_header * hdr)
+{
+    void ** index;
+    keytuple * k;
+    int size = 64;
+    int n = 0;
+
+    while (size < 2 * hdr->n)
+        size *= 2;
+    index = qfits_calloc(size, sizeof(void*));
+    for (k = (keytuple*)hdr->first; k; k = k->next)
+        n += index_insert(index, size, k);
+    hdr->index_size = size;
+    hdr->index_n = n;
+    INDEX_STORE(hdr->index, index);
+}
+
+static void header_index_free(qfits_header * hdr)
+{
+    if (!hdr->index) return;
+    qfits_free(hdr->index);
+    hdr->index = NULL;
+    hdr->index_size = 0;
+    hdr->index_n = 0;
+}
+
+/* Called when card "k" has been appended to the header. */
+static void header_index_add(qfits_header * hdr, keytuple * k)
+{
+    if (!hdr->index) return;
+    if (2 * (hdr->index_n + 1) > hdr->index_size) {
+        /* grow */
+        header_index_free(hdr);
+        return;
+    }
+    hdr->index_n += index_insert(hdr->index, hdr->index_size, k);
+}
+
+/* Returns the first card whose key is "xkey" (already expanded). */
+static keytuple * header_find(const qfits_header * chdr, const char * xkey)
+{
+    qfits_header * hdr = (qfits_header*)chdr;
+    void ** index;
+    keytuple * k;
+
+    if (hdr->n < QFITS_HEADER_INDEX_MIN) {
+        for (k = (keytuple*)hdr->first; k; k = k->next)
+            if (!strcmp(k->key, xkey))
+                return k;
+        return NULL;
+    }
+    index = INDEX_LOAD(hdr->index);
+    if (!index) {
+        pthread_mutex_lock(&header_index_lock);
+        if (!hdr->index)
+            header_index_build(hdr);
+        index = hdr->index;
+        pthread_mutex_unlock(&header_index_lock);
+    }
+    return index_lookup(index, hdr->index_size, xkey);
+}
+
 /*----------------------------------------------------------------------------*/
 /**
   @brief    keytuple constructor
@@ -1049,6 +1197,7 @@ static keytuple * keytuple_new(
     }
     k->next = NULL;
     k->prev = NULL;
+    k->hnext = NULL;
     k->typ = keytuple_type(key);
 
     return k;
@@ -861,6 +861,9 @@ unsigned char * qfits_query_column_seq(
 
 
 
+// Rows per block when copying column data and swapping their bytes.
+#define QFITS_SWAP_BLOCK 4096
+
 static int qfits_query_column_seq_to_array_endian(
 												  const qfits_table	    *   th,
 												  int                 colnum,
@@ -876,7 +879,7 @@ static int qfits_query_column_seq_to_array_endian(
 	unsigned char   *   r;
     unsigned char   *   inbuf;
     int                 table_width;
-	int                 i;
+	int                 i, i0;
 	int do_swap;
 
 	int maxind;
@@ -954,30 +957,35 @@ static int qfits_query_column_seq_to_array_endian(
 			do_swap = 1;
 #endif
 
-    /* Copy the values in array */
-    /* Get only the selected rows */
-    for (i=0; i<nb_rows; i++) {
-        /* Copy all atoms on this field into array */
-		if (indices) {
-			memcpy(r, inbuf + (indices[i]*table_width), field_size);
-		} else {
-			memcpy(r, inbuf, field_size);
-			/* Jump to next line */
-			inbuf += table_width;
+    /* Copy the values in array, a block of rows at a time */
+	for (i0=0; i0<nb_rows; i0+=QFITS_SWAP_BLOCK) {
+		int nb = MIN(QFITS_SWAP_BLOCK, nb_rows - i0);
+		unsigned char* r0 = r;
+		/* Get only the selected rows */
+		for (i=i0; i<i0+nb; i++) {
+			/* Copy all atoms on this field into array */
+			if (indices) {
+				memcpy(r, inbuf + (indices[i]*table_width), field_size);
+			} else {
+				memcpy(r, inbuf, field_size);
+				/* Jump to next line */
+				inbuf += table_width;
+			}
+			r += dest_stride;
 		}
 
 #ifndef WORDS_BIGENDIAN
+		/* Swap the block while it's in cache */
 		if (do_swap) {
-			int j;
-			unsigned char* r2 = r;
-			for (j=0; j<col->atom_nb; j++) {
-				qfits_swap_bytes(r2, col->atom_size);
-				r2 += col->atom_size;
-			}
+			if (dest_stride == field_size)
+				qfits_swap_bytes_array(r0, col->atom_size,
+									   (size_t)nb * col->atom_nb);
+			else
+				for (i=0; i<nb; i++)
+					qfits_swap_bytes_array(r0 + (size_t)i * dest_stride,
+										   col->atom_size, col->atom_nb);
 		}
 #endif
-
-        r += dest_stride;
 	}
 
     //qfits_fdealloc(start, 0, size);
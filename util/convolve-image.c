@@ -51,12 +51,77 @@ float* convolve_separable_f(const float* img, int W, int H,
 }
 
 
+/*
+ Convolves a row of "W" pixels, for output pixels [jlo, jhi), placing
+ sum(kernel * weight * img) in "sum" and sum(kernel * weight) in
+ "sumw".  Output pixel j sees input pixels j - k + K0; the caller
+ ensures those are all in [0, W).  This is the inner loop, written so
+ that it vectorizes: the per-pixel sums are over the same terms in the
+ same order as the straightforward loop.
+ */
+static void convolve_row_interior(const float* img, const float* weight,
+								  int jlo, int jhi,
+								  const float* kernel, int K0, int NK,
+								  float* sum, float* sumw) {
+	int j, k;
+	for (j=jlo; j<jhi; j++)
+		sum[j] = sumw[j] = 0;
+	for (k=0; k<NK; k++) {
+		const float kv = kernel[k];
+		const float* in = img - k + K0;
+		if (weight) {
+			const float* w = weight - k + K0;
+			for (j=jlo; j<jhi; j++) {
+				sum[j]  += kv * w[j] * in[j];
+				sumw[j] += kv * w[j];
+			}
+		} else {
+			for (j=jlo; j<jhi; j++)
+				sum[j] += kv * in[j];
+		}
+	}
+	if (!weight) {
+		float sw = 0;
+		for (k=0; k<NK; k++)
+			sw += kernel[k];
+		for (j=jlo; j<jhi; j++)
+			sumw[j] = sw;
+	}
+}
+
+// Output pixel "j" of a row, near an edge.
+static void convolve_row_edge(const float* img, const float* weight, int W,
+							  int j, const float* kernel, int K0, int NK,
+							  float* sum, float* sumw) {
+	int k;
+	float s = 0, sw = 0;
+	/*
+	 This is true convolution, so the kernel is flipped;
+	 in this loop we are adding image pixels from right to left.
+	 */
+	for (k = MAX(0, j + K0 - (W-1));
+		 k < MIN(NK, j + K0 + 1); k++) {
+		int p = j - k + K0;
+		if (weight) {
+			s  += kernel[k] * weight[p] * img[p];
+			sw += kernel[k] * weight[p];
+		} else {
+			s  += kernel[k] * img[p];
+			sw += kernel[k];
+		}
+	}
+	sum[j] = s;
+	sumw[j] = sw;
+}
+
 float* convolve_separable_weighted_f(const float* img, int W, int H,
 							  const float* weight,
 							  const float* kernel, int K0, int NK,
 							  float* outimg, float* tempimg) {
 	float* freeimg = NULL;
-	int i, j, k;
+	float* sum;
+	float* sumw;
+	int i, j, k, jlo, jhi;
 
 	if (!tempimg)
 		freeimg = tempimg = malloc(W * H * sizeof(float));
@@ -64,67 +129,46 @@ float* convolve_separable_weighted_f(const float* img, int W, int H,
 	if (!outimg)
 		outimg = malloc(W * H * sizeof(float));
 
+	sum  = malloc(W * sizeof(float));
+	sumw = malloc(W * sizeof(float));
+
+	// output pixels [jlo, jhi) use all the kernel samples.
+	jlo = MIN(W, MAX(0, NK - 1 - K0));
+	jhi = MIN(W, MAX(jlo, W - K0));
+
+	// convolve in x, from "img" to "tempimg".
 	for (i=0; i<H; i++) {
-		/* // DEBUG
-		 anbool touchedleft = FALSE;
-		 anbool touchedright = FALSE;
-		 */
-		for (j=0; j<W; j++) {
-			float sum = 0;
-			float sumw = 0;
-			/*
-			 This is true convolution, so the kernel is flipped;
-			 in this loop we are adding image pixels from right to left.
-			 */
-
-			/*
-			 printf("j=%i, W=%i, K0=%i, NK=%i, unrestricted j = [%i, %i),"
-			 "k -> [%i, %i), j -> [%i, %i)\n",
-			 j, W, K0, NK, j-0+K0, j-NK+K0, MAX(0, j + K0 - (W-1)), MIN(NK, j + K0 + 1),
-			 j + K0 - MAX(0, j + K0 - (W-1)), j + K0 - MIN(NK, j + K0 + 1));
-			 */
-
-			for (k = MAX(0, j + K0 - (W-1));
-				 k < MIN(NK, j + K0 + 1); k++) {
-
-				/*
-				 assert((j - k + K0) >= 0);
-				 assert((k - k + K0) <= (W-1));
-				 touchedleft |= ((j - k + K0) == 0);
-				 touchedright |= ((j - k + K0) == (W-1));
-				 */
-
-				int p = i*W + j - k + K0;
-				if (weight) {
-					sum  += kernel[k] * weight[p] * img[p];
-					sumw += kernel[k] * weight[p];
-				} else {
-					sum  += kernel[k] * img[p];
-					sumw += kernel[k];
-				}
-			}
-			// store into temp image in transposed order
-			tempimg[j*H + i] = (sumw == 0.0) ? 0.0 : (sum / sumw);
-		}
-		//assert(touchedleft);
-		//assert(touchedright);
+		const float* row = img + i*W;
+		const float* wrow = (weight ? weight + i*W : NULL);
+		float* trow = tempimg + i*W;
+		for (j=0; j<jlo; j++)
+			convolve_row_edge(row, wrow, W, j, kernel, K0, NK, sum, sumw);
+		convolve_row_interior(row, wrow, jlo, jhi, kernel, K0, NK, sum, sumw);
+		for (j=jhi; j<W; j++)
+			convolve_row_edge(row, wrow, W, j, kernel, K0, NK, sum, sumw);
+		for (j=0; j<W; j++)
+			trow[j] = (sumw[j] == 0.0) ? 0.0 : (sum[j] / sumw[j]);
 	}
 
-	for (j=0; j<W; j++) {
-		for (i=0; i<H; i++) {
-			float sum = 0;
-			float sumw = 0;
-			for (k = MAX(0, i + K0 - (H-1));
-				 k < MIN(NK, i + K0 + 1); k++) {
-				int p = j*H + i - k + K0;
-				sum  += kernel[k] * tempimg[p];
-				sumw += kernel[k];
-			}
-			outimg[i*W + j] = (sumw == 0.0) ? 0.0 : (sum / sumw);
+	// convolve in y, from "tempimg" to "outimg", a whole row at a time.
+	for (i=0; i<H; i++) {
+		float sw = 0;
+		float* orow = outimg + i*W;
+		for (j=0; j<W; j++)
+			sum[j] = 0;
+		for (k = MAX(0, i + K0 - (H-1));
+			 k < MIN(NK, i + K0 + 1); k++) {
+			const float kv = kernel[k];
+			const float* in = tempimg + (i - k + K0) * W;
+			for (j=0; j<W; j++)
+				sum[j] += kv * in[j];
+			sw += kv;
 		}
+		for (j=0; j<W; j++)
+			orow[j] = (sw == 0.0) ? 0.0 : (sum[j] / sw);
 	}
+	free(sum);
+	free(sumw);
 	free(freeimg);
 	return outimg;
 }
-
-
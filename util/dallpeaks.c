@@ -23,12 +23,15 @@
 #include <math.h>
 #include <assert.h>
 #include <sys/param.h>
+#include <pthread.h>
 
 #include "dimage.h"
 #include "permutedsort.h"
 #include "simplexy-common.h"
 #include "log.h"
 #include "mathutil.h"
+#include "errors.h"
+#include "bl.h"
 
 /*
  * dallpeaks.c
@@ -133,6 +136,88 @@ static int max_gaussian(float* image, int W, int H, float sigma,
 }
 
 
+// Cutout buffers used while finding the peaks in one object.
+typedef struct {
+	float *oimage;
+	float *simage;
+	int npix;
+	int *xc;
+	int *yc;
+} peaks_scratch_t;
+
+static void peaks_scratch_init(peaks_scratch_t* s, int maxper) {
+	memset(s, 0, sizeof(peaks_scratch_t));
+	s->xc = malloc(sizeof(int) * maxper);
+	s->yc = malloc(sizeof(int) * maxper);
+}
+
+static void peaks_scratch_free(peaks_scratch_t* s) {
+	FREEVEC(s->oimage);
+	FREEVEC(s->simage);
+	FREEVEC(s->xc);
+	FREEVEC(s->yc);
+}
+
+// skip if it is smaller than 3x3 or bigger than maxsize.
+static anbool object_size_ok(int current, int xmin, int xmax,
+							 int ymin, int ymax, int maxsize) {
+	int onx = xmax - xmin + 1;
+	int ony = ymax - ymin + 1;
+	if (onx < 3 || ony < 3) {
+		logverb("Skipping object %i: too small, %ix%i (x %i:%i, y %i:%i)\n",
+				current, onx, ony, xmin,xmax, ymin,ymax);
+		return FALSE;
+	}
+	if (ony > maxsize || onx > maxsize) {
+		logverb("Skipping object %i: too big, %ix%i (x %i:%i, y %i:%i)\n",
+				current, onx, ony, xmin,xmax, ymin,ymax);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+// Bounding boxes of the objects, indexed by object number.
+typedef struct {
+	int nobj;
+	int *xmin, *xmax, *ymin, *ymax;
+} object_bounds_t;
+
+static void find_object_bounds(const int* object, int nx, int ny,
+							   object_bounds_t* b) {
+	int i, j, n;
+	n = 0;
+	for (i=0; i<nx*ny; i++)
+		n = MAX(n, object[i] + 1);
+	b->nobj = n;
+	b->xmin = malloc(MAX(1, n) * sizeof(int));
+	b->xmax = malloc(MAX(1, n) * sizeof(int));
+	b->ymin = malloc(MAX(1, n) * sizeof(int));
+	b->ymax = malloc(MAX(1, n) * sizeof(int));
+	for (i=0; i<n; i++) {
+		b->xmin[i] = nx + 1;
+		b->xmax[i] = -1;
+		b->ymin[i] = ny + 1;
+		b->ymax[i] = -1;
+	}
+	for (j=0; j<ny; j++)
+		for (i=0; i<nx; i++) {
+			int obj = object[j*nx + i];
+			if (obj < 0)
+				continue;
+			b->xmin[obj] = MIN(b->xmin[obj], i);
+			b->xmax[obj] = MAX(b->xmax[obj], i);
+			b->ymin[obj] = MIN(b->ymin[obj], j);
+			b->ymax[obj] = MAX(b->ymax[obj], j);
+		}
+}
+
+static void object_bounds_free(object_bounds_t* b) {
+	FREEVEC(b->xmin);
+	FREEVEC(b->xmax);
+	FREEVEC(b->ymin);
+	FREEVEC(b->ymax);
+}
+
 #define IMGTYPE float
 #define SUFFIX
 #include "dallpeaks.inc"
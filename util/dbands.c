@@ -0,0 +1,83 @@
+/*
+ This file is part of the Astrometry.net suite.
+
+ The Astrometry.net suite is free software; you can redistribute
+ it and/or modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation, version 2.
+
+ The Astrometry.net suite is distributed in the hope that it will be
+ useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with the Astrometry.net suite ; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "dimage.h"
+#include "errors.h"
+
+/*
+ * dbands.c
+ *
+ * Run a function over horizontal bands of rows, one thread per band.
+ */
+
+struct band {
+	dband_func func;
+	void* token;
+	int band;
+	int j0;
+	int j1;
+};
+
+static void* band_main(void* arg) {
+	struct band* b = arg;
+	b->func(b->token, b->band, b->j0, b->j1);
+	return NULL;
+}
+
+int dbands(int ny, int nthreads, dband_func func, void* token) {
+	struct band* bands;
+	pthread_t* threads;
+	int i, nstarted;
+
+	if (nthreads > ny)
+		nthreads = ny;
+	if (nthreads <= 1) {
+		func(token, 0, 0, ny);
+		return 1;
+	}
+	bands = malloc(nthreads * sizeof(struct band));
+	threads = malloc(nthreads * sizeof(pthread_t));
+	for (i=0; i<nthreads; i++) {
+		bands[i].func = func;
+		bands[i].token = token;
+		bands[i].band = i;
+		bands[i].j0 = (int)((long)ny * i / nthreads);
+		bands[i].j1 = (int)((long)ny * (i+1) / nthreads);
+	}
+	// the calling thread does the first band.
+	nstarted = 1;
+	for (i=1; i<nthreads; i++) {
+		if (pthread_create(threads + i, NULL, band_main, bands + i)) {
+			SYSERROR("Failed to create thread for rows %i to %i",
+					 bands[i].j0, bands[i].j1);
+			break;
+		}
+		nstarted++;
+	}
+	band_main(bands + 0);
+	for (i=1; i<nstarted; i++)
+		pthread_join(threads[i], NULL);
+	// run any bands whose threads could not be started.
+	for (i=nstarted; i<nthreads; i++)
+		band_main(bands + i);
+	free(bands);
+	free(threads);
+	return 1;
+}
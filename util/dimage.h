@@ -31,6 +31,14 @@ label_t collapsing_find_minlabel(label_t label, label_t *equivs);
 int dfind2(const int* image, int nx, int ny, int* objectimg, int* p_nobjects);
 int dfind2_u8(const unsigned char* image, int nx, int ny, int* objectimg, int* p_nobjects);
 
+/*
+ Splits rows [0, ny) into "nthreads" bands of consecutive rows and calls
+ "func(token, band, j0, j1)" for each band [j0, j1), each in its own
+ thread.  Returns after all have finished.
+ */
+typedef void (*dband_func)(void* token, int band, int j0, int j1);
+int dbands(int ny, int nthreads, dband_func func, void* token);
+
 float dselip(unsigned long k, unsigned long n, const float *arr);
 void dselip_cleanup(void);
 
@@ -46,6 +54,14 @@ int dobjects(float *image, int nx, int ny, float limit,
 int dmask(float *image, int nx, int ny, float limit,
 		  float dpsf, uint8_t* mask);
 
+/*
+ Like dmask(), but only sets the "mask" rows [j0, j1) (looking at the
+ rows within a box-size of them); other rows are untouched.  Returns 1
+ if any pixel in rows [j0, j1) is above "limit".  Prints nothing.
+ */
+int dmask_rows(float *image, int nx, int ny, float limit,
+			   float dpsf, uint8_t* mask, int j0, int j1);
+
 int dpeaks(float *image, int nx, int ny, int *npeaks, int *xcen,
            int *ycen, float sigma, float dlim, float saddle, int maxnpeaks,
            int smooth, int checkpeaks, float minpeak);
@@ -57,6 +73,10 @@ int dsigma_u8(uint8_t *image, int nx, int ny, int sp, int gridsize, float *sigma
 
 int dmedsmooth(const float *image, const uint8_t *masked,
                int nx, int ny, int halfbox, float *smooth);
+// Same result as dmedsmooth(), computed using "nthreads" threads.
+int dmedsmooth_threaded(const float *image, const uint8_t *masked,
+						int nx, int ny, int halfbox, float *smooth,
+						int nthreads);
 
 int dallpeaks(float *image, int nx, int ny, int *objects, float *xcen,
               float *ycen, int *npeaks, float dpsf, float sigma,
@@ -71,4 +91,23 @@ int dallpeaks_i16(int16_t *image, int nx, int ny, int *objects, float *xcen,
 				  float dlim, float saddle,
 				  int maxper, int maxnpeaks, float minpeak, int maxsize);
 
+/*
+ Same results as dallpeaks() etc, but the objects are shared out among
+ "nthreads" threads.
+ */
+int dallpeaks_threaded(float *image, int nx, int ny, int *objects, float *xcen,
+					   float *ycen, int *npeaks, float dpsf, float sigma,
+					   float dlim, float saddle, int maxper, int maxnpeaks,
+					   float minpeak, int maxsize, int nthreads);
+int dallpeaks_threaded_u8(uint8_t *image, int nx, int ny, int *objects,
+						  float *xcen, float *ycen, int *npeaks, float dpsf,
+						  float sigma, float dlim, float saddle, int maxper,
+						  int maxnpeaks, float minpeak, int maxsize,
+						  int nthreads);
+int dallpeaks_threaded_i16(int16_t *image, int nx, int ny, int *objects,
+						   float *xcen, float *ycen, int *npeaks, float dpsf,
+						   float sigma, float dlim, float saddle, int maxper,
+						   int maxnpeaks, float minpeak, int maxsize,
+						   int nthreads);
+
 #endif
@@ -26,6 +26,8 @@
 #include <sys/param.h>
 
 #include "simplexy-common.h"
+#include "dimage.h"
+#include "radix.h"
 
 /*
  * dmedsmooth.c
@@ -37,74 +39,40 @@
  * 1/2006 */
 
 
-float dselip(unsigned long k, unsigned long n, float *arr);
-
-int dmedsmooth(const float *image,
-               const uint8_t *masked,
-               int nx,
-               int ny,
-               int halfbox,
-               float *smooth)
-{
-    int i, j, ip, jp, ist, jst, nb, ind, jnd, sp;
-    int xoff, yoff, nm, nxgrid, nygrid;
-    int ypsize, ymsize, xpsize, xmsize;
-    float dx, dy, xkernel, ykernel;
-
-    float *arr = NULL;
-    int *xgrid = NULL;
-    int *ygrid = NULL;
-    float *grid = NULL;
-    int *xlo = NULL;
-    int *xhi = NULL;
-    int *ylo = NULL;
-    int *yhi = NULL;
-
-    /* get grids */
-    sp = halfbox;
-    nxgrid = MAX(1, nx / sp) + 2;
-    //printf("nxgrid %i\n", nxgrid);
+typedef struct {
+    const float *image;
+    const uint8_t *masked;
+    int nx, ny;
+    int sp;
+    int nxgrid, nygrid;
     // "xgrid" are the centers.
     // "xlo" are the (inclusive) lower-bounds
     // "xhi" are the (inclusive) upper-bounds
     // the grid cells may overlap.
-    xgrid = (int *) malloc((size_t)nxgrid * sizeof(int));
-    xlo = (int *) malloc((size_t)nxgrid * sizeof(int));
-    xhi = (int *) malloc((size_t)nxgrid * sizeof(int));
-    xoff = (nx - 1 - (nxgrid - 3) * sp) / 2;
-    for (i = 1;i < nxgrid - 1;i++)
-        xgrid[i] = (i - 1) * sp + xoff;
-    xgrid[0] = xgrid[1] - sp;
-    xgrid[nxgrid - 1] = xgrid[nxgrid - 2] + sp;
-    for (i = 0;i < nxgrid;i++) {
-        xlo[i] = MAX(xgrid[i] - sp, 0);
-        xhi[i] = MIN(xgrid[i] + sp, nx-1);
-        //printf("xlo[%i],xhi[%i] = %i,%i\n", i, i, xlo[i], xhi[i]);
-    }
-
-    nygrid = MAX(1, ny / sp) + 2;
-    //printf("nygrid %i\n", nygrid);
-    ylo = (int *) malloc(nygrid * sizeof(int));
-    yhi = (int *) malloc(nygrid * sizeof(int));
-    ygrid = (int *) malloc(nygrid * sizeof(int));
-    yoff = (ny - 1 - (nygrid - 3) * sp) / 2;
-    for (i = 1;i < nygrid - 1;i++)
-        ygrid[i] = (i - 1) * sp + yoff;
-    ygrid[0] = ygrid[1] - sp;
-    ygrid[nygrid - 1] = ygrid[nygrid - 2] + sp;
-
-    for (i = 0;i < nygrid;i++) {
-        ylo[i] = MAX(ygrid[i] - sp, 0);
-        yhi[i] = MIN(ygrid[i] + sp, ny-1);
-        //printf("ylo[%i],yhi[%i] = %i,%i\n", i, i, ylo[i], yhi[i]);
-    }
-
+    int *xgrid, *xlo, *xhi;
+    int *ygrid, *ylo, *yhi;
     // the median-filtered image (subsampled on a grid).
-    grid = (float *) malloc((size_t)(nxgrid * nygrid) * sizeof(float));
+    float *grid;
+    float *smooth;
+} medsmooth_t;
+
+// Computes the grid medians for grid rows [j0, j1).
+static void grid_medians(void* token, int band, int j0, int j1) {
+    medsmooth_t* ms = token;
+    const float* image = ms->image;
+    const uint8_t* masked = ms->masked;
+    int nx = ms->nx;
+    int sp = ms->sp;
+    int nxgrid = ms->nxgrid;
+    int *xlo = ms->xlo, *xhi = ms->xhi, *ylo = ms->ylo, *yhi = ms->yhi;
+    int i, j, ip, jp, nb, nm;
+    float *arr;
+    float *sorted;
 
     arr = (float *) malloc((size_t)((sp * 2 + 5) * (sp * 2 + 5)) * sizeof(float));
+    sorted = (float *) malloc((size_t)((sp * 2 + 5) * (sp * 2 + 5)) * sizeof(float));
 
-    for (j=0; j<nygrid; j++) {
+    for (j=j0; j<j1; j++) {
         for (i=0; i<nxgrid; i++) {
             nb = 0;
             for (jp=ylo[j]; jp<=yhi[j]; jp++) {
@@ -133,28 +101,43 @@ int dmedsmooth(const float *image,
             }
             if (nb > 1) {
                 nm = nb / 2;
-                grid[i + j*nxgrid] = dselip(nm, nb, arr);
+                // (same as dselip(), which isn't reentrant)
+                RadixSort11(arr, sorted, nb);
+                ms->grid[i + j*nxgrid] = sorted[nm];
             } else {
-                grid[i + j*nxgrid] = image[(long)xlo[i] + ((long)ylo[j]) * nx];
+                ms->grid[i + j*nxgrid] = image[(long)xlo[i] + ((long)ylo[j]) * nx];
             }
         }
     }
-    FREEVEC(xlo);
-    FREEVEC(ylo);
-    FREEVEC(xhi);
-    FREEVEC(yhi);
     FREEVEC(arr);
+    FREEVEC(sorted);
+}
 
-    for (j = 0;j < ny;j++)
+// Interpolates the grid medians into rows [r0, r1) of the output.
+static void interpolate_rows(void* token, int band, int r0, int r1) {
+    medsmooth_t* ms = token;
+    int nx = ms->nx;
+    int sp = ms->sp;
+    int nxgrid = ms->nxgrid, nygrid = ms->nygrid;
+    int *xgrid = ms->xgrid, *ygrid = ms->ygrid;
+    float *grid = ms->grid;
+    float *smooth = ms->smooth;
+    int i, j, ip, jp, ist, jst, ind, jnd;
+    int ypsize, ymsize, xpsize, xmsize;
+    float dx, dy, xkernel, ykernel;
+
+    for (j = r0;j < r1;j++)
         for (i = 0;i < nx;i++)
             smooth[i + j*nx] = 0.;
     for (j = 0;j < nygrid;j++) {
         jst = (long) ( (float) ygrid[j] - sp * 1.5);
         jnd = (long) ( (float) ygrid[j] + sp * 1.5);
-        if (jst < 0)
-            jst = 0;
-        if (jnd > ny - 1)
-            jnd = ny - 1;
+        if (jst < r0)
+            jst = r0;
+        if (jnd > r1 - 1)
+            jnd = r1 - 1;
+        if (jst > jnd)
+            continue;
         ypsize = sp;
         ymsize = sp;
         if (j == 0)
@@ -223,10 +206,90 @@ int dmedsmooth(const float *image,
             }
         }
     }
+}
 
-    FREEVEC(grid);
-    FREEVEC(xgrid);
-    FREEVEC(ygrid);
+/*
+ The grid rows are independent, as are the output rows (each output
+ pixel sums its grid contributions in the same order no matter how the
+ rows are split), so the threaded version gives identical results.
+ */
+int dmedsmooth_threaded(const float *image,
+                        const uint8_t *masked,
+                        int nx,
+                        int ny,
+                        int halfbox,
+                        float *smooth,
+                        int nthreads)
+{
+    medsmooth_t ms;
+    int i, sp;
+    int nxgrid, nygrid, xoff, yoff;
+
+    memset(&ms, 0, sizeof(medsmooth_t));
+    ms.image = image;
+    ms.masked = masked;
+    ms.nx = nx;
+    ms.ny = ny;
+    ms.smooth = smooth;
+
+    /* get grids */
+    sp = ms.sp = halfbox;
+    nxgrid = ms.nxgrid = MAX(1, nx / sp) + 2;
+    //printf("nxgrid %i\n", nxgrid);
+    ms.xgrid = (int *) malloc((size_t)nxgrid * sizeof(int));
+    ms.xlo = (int *) malloc((size_t)nxgrid * sizeof(int));
+    ms.xhi = (int *) malloc((size_t)nxgrid * sizeof(int));
+    xoff = (nx - 1 - (nxgrid - 3) * sp) / 2;
+    for (i = 1;i < nxgrid - 1;i++)
+        ms.xgrid[i] = (i - 1) * sp + xoff;
+    ms.xgrid[0] = ms.xgrid[1] - sp;
+    ms.xgrid[nxgrid - 1] = ms.xgrid[nxgrid - 2] + sp;
+    for (i = 0;i < nxgrid;i++) {
+        ms.xlo[i] = MAX(ms.xgrid[i] - sp, 0);
+        ms.xhi[i] = MIN(ms.xgrid[i] + sp, nx-1);
+        //printf("xlo[%i],xhi[%i] = %i,%i\n", i, i, xlo[i], xhi[i]);
+    }
+
+    nygrid = ms.nygrid = MAX(1, ny / sp) + 2;
+    //printf("nygrid %i\n", nygrid);
+    ms.ylo = (int *) malloc(nygrid * sizeof(int));
+    ms.yhi = (int *) malloc(nygrid * sizeof(int));
+    ms.ygrid = (int *) malloc(nygrid * sizeof(int));
+    yoff = (ny - 1 - (nygrid - 3) * sp) / 2;
+    for (i = 1;i < nygrid - 1;i++)
+        ms.ygrid[i] = (i - 1) * sp + yoff;
+    ms.ygrid[0] = ms.ygrid[1] - sp;
+    ms.ygrid[nygrid - 1] = ms.ygrid[nygrid - 2] + sp;
+
+    for (i = 0;i < nygrid;i++) {
+        ms.ylo[i] = MAX(ms.ygrid[i] - sp, 0);
+        ms.yhi[i] = MIN(ms.ygrid[i] + sp, ny-1);
+        //printf("ylo[%i],yhi[%i] = %i,%i\n", i, i, ylo[i], yhi[i]);
+    }
+
+    ms.grid = (float *) malloc((size_t)(nxgrid * nygrid) * sizeof(float));
+
+    dbands(nygrid, nthreads, grid_medians, &ms);
+    FREEVEC(ms.xlo);
+    FREEVEC(ms.ylo);
+    FREEVEC(ms.xhi);
+    FREEVEC(ms.yhi);
+
+    dbands(ny, nthreads, interpolate_rows, &ms);
+
+    FREEVEC(ms.grid);
+    FREEVEC(ms.xgrid);
+    FREEVEC(ms.ygrid);
 
     return 1;
 }
+
+int dmedsmooth(const float *image,
+               const uint8_t *masked,
+               int nx,
+               int ny,
+               int halfbox,
+               float *smooth)
+{
+    return dmedsmooth_threaded(image, masked, nx, ny, halfbox, smooth, 1);
+}
@@ -37,24 +37,24 @@
 
 typedef unsigned char u8;
 
-int dmask(float *image, int nx, int ny, float limit,
-		  float dpsf, uint8_t* mask) {
+int dmask_rows(float *image, int nx, int ny, float limit,
+			   float dpsf, uint8_t* mask, int j0, int j1) {
 	int i, j, ip, jp, ilo, ihi, jlo, jhi;
-    int flagged_one = 0;
+	int flagged_one = 0;
 	int boxsize = 3 * dpsf;
-    
-	memset(mask, 0, nx*ny);
 
 	/* This makes a mask which dfind uses when looking at the pixels; dfind
-	 * ignores any pixels the mask flagged as uninteresting. */
-	for (j=0; j<ny; j++) {
-		jlo = MAX(0,    j - boxsize);
-		jhi = MIN(ny-1, j + boxsize);
+	 * ignores any pixels the mask flagged as uninteresting.  Pixels within
+	 * a box-size of rows [j0, j1) can flag pixels in those rows. */
+	for (j=MAX(0, j0 - boxsize); j<MIN(ny, j1 + boxsize); j++) {
+		jlo = MAX(j0,   j - boxsize);
+		jhi = MIN(j1-1, j + boxsize);
 		for (i=0; i<nx; i++) {
 			if (image[i + j*nx] < limit)
                 continue;
 			/* this pixel is significant. */
-            flagged_one = 1;
+			if (j >= j0 && j < j1)
+				flagged_one = 1;
             ilo = MAX(0,    i - boxsize);
             ihi = MIN(nx-1, i + boxsize);
             /* now that we found a single interesting pixel, flag a box
@@ -65,8 +65,16 @@ int dmask(float *image, int nx, int ny, float limit,
                     mask[jp*nx + ip] = 1;
         }
 	}
+	return flagged_one;
+}
+
+int dmask(float *image, int nx, int ny, float limit,
+		  float dpsf, uint8_t* mask) {
+	int i;
+
+	memset(mask, 0, nx*ny);
 
-    if (!flagged_one) {
+    if (!dmask_rows(image, nx, ny, limit, dpsf, mask, 0, ny)) {
         /* no pixels were masked - what parameter settings would cause at
          least one pixel to be masked? */
         float maxval = -HUGE_VAL;
@@ -20,6 +20,7 @@
 #include <string.h>
 #include <errno.h>
 #include <stdio.h>
+#include <pthread.h>
 
 #include "errors.h"
 #include "ioutils.h"
@@ -28,6 +29,32 @@
 static pl* estack = NULL;
 static anbool atexit_registered = FALSE;
 
+/*
+ The global error state is shared by all threads (eg, indexes being
+ loaded in parallel report errors through it), so the functions that
+ use it hold this lock.  It's recursive because they call each other,
+ and an error function may report errors of its own.
+ */
+static pthread_mutex_t estack_lock;
+static pthread_once_t estack_lock_once = PTHREAD_ONCE_INIT;
+
+static void init_estack_lock(void) {
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&estack_lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+static void lock_estack(void) {
+	pthread_once(&estack_lock_once, init_estack_lock);
+	pthread_mutex_lock(&estack_lock);
+}
+
+static void unlock_estack(void) {
+	pthread_mutex_unlock(&estack_lock);
+}
+
 static err_t* error_copy(err_t* e) {
 	int i, N;
     err_t* copy = error_new();
@@ -50,51 +77,65 @@ static void print_errs(void) {
 
 void errors_start_logging_to_string() {
     err_t* err;
+    lock_estack();
     errors_push_state();
     err = errors_get_state();
     err->print = NULL;
     err->save = TRUE;
+    unlock_estack();
 }
 
 char* errors_stop_logging_to_string(const char* separator) {
     err_t* err;
     char* rtn;
+    lock_estack();
     err = errors_get_state();
     rtn = error_get_errs(err, separator);
     errors_pop_state();
+    unlock_estack();
     return rtn;
 }
 
 int errors_print_on_exit(FILE* fid) {
     err_t* e;
+    lock_estack();
     errors_push_state();
     e = errors_get_state();
     e->save = TRUE;
     e->print = NULL;
     print_errs_fid = fid;
+    unlock_estack();
     return atexit(print_errs);
 }
 
 void errors_log_to(FILE* f) {
     err_t* e;
+    lock_estack();
     e = errors_get_state();
     e->print = f;
+    unlock_estack();
 }
 
 void errors_use_function(errfunc_t* func, void* baton) {
     err_t* e;
+    lock_estack();
     e = errors_get_state();
     e->errfunc = func;
 	e->baton = baton;
 	e->print = NULL;
 	e->save = FALSE;
+    unlock_estack();
 }
 
 void errors_clear_stack() {
+    lock_estack();
     error_stack_clear(errors_get_state());
+    unlock_estack();
 }
 
 err_t* errors_get_state() {
+    err_t* e;
+    lock_estack();
     if (!estack) {
         estack = pl_new(4);
         // register an atexit() function to clean up.
@@ -104,50 +145,63 @@ err_t* errors_get_state() {
         }
     } 
     if (!pl_size(estack)) {
-        err_t* e = error_new();
+        e = error_new();
         e->print = stderr;
         pl_append(estack, e);
     }
-    return pl_get(estack, pl_size(estack)-1);
+    e = pl_get(estack, pl_size(estack)-1);
+    unlock_estack();
+    return e;
 }
 
 void errors_free() {
     int i;
-    if (!estack)
-        return;
-    for (i=0; i<pl_size(estack); i++) {
-        err_t* e = pl_get(estack, i);
-        error_free(e);
+    lock_estack();
+    if (estack) {
+        for (i=0; i<pl_size(estack); i++) {
+            err_t* e = pl_get(estack, i);
+            error_free(e);
+        }
+        pl_free(estack);
+        estack = NULL;
     }
-    pl_free(estack);
-    estack = NULL;
+    unlock_estack();
 }
 
 void errors_push_state() {
     err_t* now;
     err_t* snapshot;
+    lock_estack();
     // make sure the stack and current state are initialized
     errors_get_state();
     now = pl_pop(estack);
     snapshot = error_copy(now);
     pl_push(estack, snapshot);
     pl_push(estack, now);
+    unlock_estack();
 }
 
 void errors_pop_state() {
-    err_t* now = pl_pop(estack);
+    err_t* now;
+    lock_estack();
+    now = pl_pop(estack);
     error_free(now);
+    unlock_estack();
 }
 
 void errors_print_stack(FILE* f) {
+    lock_estack();
     error_print_stack(errors_get_state(), f);
+    unlock_estack();
 }
 
 void report_error(const char* modfile, int modline,
                   const char* modfunc, const char* fmt, ...) {
     va_list va;
     va_start(va, fmt);
+    lock_estack();
     error_reportv(errors_get_state(), modfile, modline, modfunc, fmt, va);
+    unlock_estack();
     va_end(va);
 }
 
@@ -181,7 +235,9 @@ void error_report(err_t* e, const char* module, int line, const char* func,
                   const char* fmt, ...) {
     va_list va;
     va_start(va, fmt);
+    lock_estack();
     error_reportv(errors_get_state(), module, line, func, fmt, va);
+    unlock_estack();
     va_end(va);
 }
 
@@ -53,6 +53,13 @@ struct errors {
 
 /***    Global functions    ***/
 
+/*
+ The global error state is shared by all threads; these functions
+ (and ERROR/SYSERROR) may be called from several threads at once.
+ The err_t returned by errors_get_state() is shared too, so don't
+ modify it while other threads might be reporting errors.
+ */
+
 err_t* errors_get_state();
 
 // takes a (deep) snapshot of the current error handling state and pushes it onto the
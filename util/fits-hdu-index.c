@@ -0,0 +1,95 @@
+/*
+ This file is part of the Astrometry.net suite.
+
+ The Astrometry.net suite is free software; you can redistribute
+ it and/or modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation, version 2.
+
+ The Astrometry.net suite is distributed in the hope that it will be
+ useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with the Astrometry.net suite ; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+
+#include "anqfits.h"
+#include "fitsioutils.h"
+#include "log.h"
+#include "errors.h"
+
+static const char* OPTIONS = "hvr";
+
+static void printHelp(char* progname) {
+	printf("%s  [options]  <fits-file> [<fits-file> ...]\n"
+		   "  Writes an index of the extensions in each FITS file, beside it,\n"
+		   "  so that opening it doesn't require scanning the whole file.\n"
+		   "    [-r]: remove the indexes instead\n"
+		   "    [-v]: verbose\n"
+		   "\n", progname);
+}
+
+int main(int argc, char *argv[]) {
+	int argchar;
+	char* progname = argv[0];
+	int loglvl = LOG_MSG;
+	anbool rmindex = FALSE;
+	int i;
+	int rtn = 0;
+
+	while ((argchar = getopt(argc, argv, OPTIONS)) != -1)
+		switch (argchar) {
+		case 'r':
+			rmindex = TRUE;
+			break;
+		case 'v':
+			loglvl++;
+			break;
+		case '?':
+		case 'h':
+			printHelp(progname);
+			return 0;
+		default:
+			return -1;
+		}
+	if (optind == argc) {
+		printHelp(progname);
+		exit(-1);
+	}
+	log_init(loglvl);
+	fits_use_error_system();
+
+	for (i=optind; i<argc; i++) {
+		char* fn = argv[i];
+		anqfits_t* anq;
+		if (rmindex) {
+			char* indexfn = anqfits_hdu_index_filename(fn);
+			if (unlink(indexfn) && (errno != ENOENT)) {
+				SYSERROR("Failed to remove HDU index \"%s\"", indexfn);
+				rtn = -1;
+			}
+			free(indexfn);
+			continue;
+		}
+		anq = anqfits_open(fn);
+		if (!anq) {
+			ERROR("Failed to open FITS file \"%s\"", fn);
+			rtn = -1;
+			continue;
+		}
+		if (anqfits_write_hdu_index(anq)) {
+			ERROR("Failed to write HDU index for \"%s\"", fn);
+			rtn = -1;
+		} else
+			logverb("%s: %i extensions\n", fn, anqfits_n_ext(anq));
+		anqfits_close(anq);
+	}
+	return rtn;
+}
@@ -17,6 +17,7 @@
 */
 
 #include <stdarg.h>
+#include <errno.h>
 #include <stdio.h>
 #include <sys/types.h>
 #include <sys/mman.h>
@@ -33,6 +34,9 @@
 #include "tic.h"
 #include "log.h"
 
+// stdio buffer size when writing.
+#define FITSBIN_WRITE_BUFSIZE (1024 * 1024)
+
 // For in-memory: storage of previously-written extensions.
 struct fitsext {
 	qfits_header* header;
@@ -159,6 +163,7 @@ int fitsbin_close(fitsbin_t* fb) {
             rtn = -1;
         }
     }
+    free(fb->writebuf);
     if (fb->primheader)
         qfits_header_destroy(fb->primheader);
     for (i=0; i<nchunks(fb); i++) {
@@ -522,6 +527,98 @@ int fitsbin_read_chunk(fitsbin_t* fb, fitsbin_chunk_t* chunk) {
     return 0;
 }
 
+static const char* advice_names[] = {
+	"normal", "random", "sequential", "willneed", "hugepage"
+};
+
+int fitsbin_advice_from_string(const char* str) {
+	int i;
+	for (i=0; i<sizeof(advice_names)/sizeof(char*); i++)
+		if (!strcasecmp(str, advice_names[i]))
+			return i;
+	return -1;
+}
+
+const char* fitsbin_advice_to_string(int advice) {
+	if (advice < 0 || advice >= sizeof(advice_names)/sizeof(char*))
+		return "(unknown)";
+	return advice_names[advice];
+}
+
+int fitsbin_madvise(fitsbin_t* fb, int advice) {
+	int i;
+	int adv;
+	int rtn = 0;
+
+	switch (advice) {
+	case FITSBIN_ADVICE_NORMAL:
+		adv = MADV_NORMAL;
+		break;
+	case FITSBIN_ADVICE_RANDOM:
+		adv = MADV_RANDOM;
+		break;
+	case FITSBIN_ADVICE_SEQUENTIAL:
+		adv = MADV_SEQUENTIAL;
+		break;
+	case FITSBIN_ADVICE_WILLNEED:
+		adv = MADV_WILLNEED;
+		break;
+	case FITSBIN_ADVICE_HUGEPAGE:
+#ifdef MADV_HUGEPAGE
+		adv = MADV_HUGEPAGE;
+		break;
+#else
+		logverb("Huge pages are not supported on this platform.\n");
+		return 0;
+#endif
+	default:
+		ERROR("Unknown fitsbin advice %i", advice);
+		return -1;
+	}
+
+	for (i=0; i<nchunks(fb); i++) {
+		fitsbin_chunk_t* chunk = get_chunk(fb, i);
+		if (!chunk->map)
+			continue;
+		if (madvise(chunk->map, chunk->mapsize, adv)) {
+			if (advice == FITSBIN_ADVICE_HUGEPAGE && errno == EINVAL) {
+				// (the kernel doesn't do huge pages for file maps)
+				logverb("Huge pages are not supported for file \"%s\".\n",
+						fb->filename);
+				return 0;
+			}
+			SYSERROR("Failed to madvise(%s) table \"%s\" in file \"%s\"",
+					 fitsbin_advice_to_string(advice), chunk->tablename,
+					 fb->filename);
+			rtn = -1;
+		}
+	}
+	return rtn;
+}
+
+int fitsbin_mlock(fitsbin_t* fb) {
+	int i;
+	for (i=0; i<nchunks(fb); i++) {
+		fitsbin_chunk_t* chunk = get_chunk(fb, i);
+		if (!chunk->map)
+			continue;
+		if (mlock(chunk->map, chunk->mapsize)) {
+			SYSERROR("Failed to mlock table \"%s\" (%zu bytes) in file \"%s\"",
+					 chunk->tablename, chunk->mapsize, fb->filename);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+size_t fitsbin_mapped_size(fitsbin_t* fb) {
+	int i;
+	size_t sz = 0;
+	for (i=0; i<nchunks(fb); i++)
+		sz += get_chunk(fb, i)->mapsize;
+	return sz;
+}
+
 int fitsbin_read(fitsbin_t* fb) {
     int i;
 
@@ -613,6 +710,11 @@ fitsbin_t* fitsbin_open_for_writing(const char* fn) {
         fitsbin_close(fb);
         return NULL;
 	}
+	// items are written one at a time; use a big buffer so that
+	// doesn't mean a syscall every few kilobytes.
+	fb->writebuf = malloc(FITSBIN_WRITE_BUFSIZE);
+	if (fb->writebuf)
+		setvbuf(fb->fid, fb->writebuf, _IOFBF, FITSBIN_WRITE_BUFSIZE);
     return fb;
 }
 
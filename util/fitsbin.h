@@ -142,6 +142,8 @@ struct fitsbin_t {
 
     // Writing:
     FILE* fid;
+    // stdio buffer for "fid" when writing.
+    char* writebuf;
 
 	// only used for in_memory():
 	anbool inmemory;
@@ -213,6 +215,45 @@ fitsbin_chunk_t* fitsbin_add_chunk(fitsbin_t* fb, fitsbin_chunk_t* chunk);
  */
 int fitsbin_read_chunk(fitsbin_t* fb, fitsbin_chunk_t* chunk);
 
+/**
+ Advice about how the mmap()'d chunks will be accessed (see madvise(2)).
+ */
+enum fitsbin_advice {
+	FITSBIN_ADVICE_NORMAL = 0,
+	FITSBIN_ADVICE_RANDOM,
+	FITSBIN_ADVICE_SEQUENTIAL,
+	FITSBIN_ADVICE_WILLNEED,
+	// back the maps with transparent huge pages, where available.
+	FITSBIN_ADVICE_HUGEPAGE,
+};
+
+/**
+ Parses "normal", "random", "sequential", "willneed", or "hugepage";
+ returns -1 if it's none of those.
+ */
+int fitsbin_advice_from_string(const char* str);
+
+const char* fitsbin_advice_to_string(int advice);
+
+/**
+ Applies the given FITSBIN_ADVICE_* to all the chunks that have been
+ read (and mmap()'d) so far.  HUGEPAGE is silently ignored if the kernel
+ doesn't support it for file maps.
+ */
+int fitsbin_madvise(fitsbin_t* fb, int advice);
+
+/**
+ Locks all the chunks that have been read so far into RAM (see
+ mlock(2)), reading them from disk if necessary.  They are unlocked
+ when the fitsbin is closed.
+ */
+int fitsbin_mlock(fitsbin_t* fb);
+
+/**
+ Returns the number of bytes mmap()'d for the chunks read so far.
+ */
+size_t fitsbin_mapped_size(fitsbin_t* fb);
+
 FILE* fitsbin_get_fid(fitsbin_t* fb);
 
 int fitsbin_close(fitsbin_t* fb);
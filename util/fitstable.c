@@ -19,6 +19,8 @@
 #include <string.h>
 #include <assert.h>
 #include <stdarg.h>
+#include <errno.h>
+#include <pthread.h>
 #include <sys/param.h>
 #include <errors.h>
 
@@ -28,6 +30,8 @@
 #include "ioutils.h"
 #include "an-endian.h"
 #include "anqfits.h"
+#include "qfits_memory.h"
+#include "qfits_byteswap.h"
 
 #include "log.h"
 
@@ -261,6 +265,169 @@ void fitstable_endian_flip_row_data(fitstable_t* table, void* data) {
 	}
 }
 
+/*
+ Buffered writing: rows are assembled, in FITS format, in a large
+ buffer that is written out when it fills.  With a background thread,
+ there are two buffers: one being filled while the other is written.
+ */
+struct fitstable_writer_t {
+	FILE* fid;
+	size_t bufsize;
+	char* bufs[2];
+	// the buffer being filled, and the number of bytes in it.
+	int cur;
+	size_t nbytes;
+
+	anbool threaded;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	// the buffer being written by the thread (or -1), and its length.
+	int pending;
+	size_t npending;
+	anbool quit;
+	// errno of the first failed write.
+	int err;
+};
+typedef struct fitstable_writer_t fitstable_writer_t;
+
+static int write_fully(FILE* fid, const char* buf, size_t n) {
+	if (fwrite(buf, 1, n, fid) != n)
+		return errno ? errno : EIO;
+	return 0;
+}
+
+static void* writer_thread(void* arg) {
+	fitstable_writer_t* w = arg;
+	pthread_mutex_lock(&w->mutex);
+	for (;;) {
+		char* buf;
+		size_t n;
+		int err;
+		while (w->pending == -1 && !w->quit)
+			pthread_cond_wait(&w->cond, &w->mutex);
+		if (w->pending == -1)
+			break;
+		buf = w->bufs[w->pending];
+		n = w->npending;
+		pthread_mutex_unlock(&w->mutex);
+		err = write_fully(w->fid, buf, n);
+		pthread_mutex_lock(&w->mutex);
+		if (err && !w->err)
+			w->err = err;
+		w->pending = -1;
+		pthread_cond_broadcast(&w->cond);
+	}
+	pthread_mutex_unlock(&w->mutex);
+	return NULL;
+}
+
+static int writer_error(fitstable_writer_t* w, const char* fn) {
+	int err;
+	if (w->threaded)
+		pthread_mutex_lock(&w->mutex);
+	err = w->err;
+	if (w->threaded)
+		pthread_mutex_unlock(&w->mutex);
+	if (!err)
+		return 0;
+	errno = err;
+	SYSERROR("Failed to write buffered rows to %s", fn);
+	return -1;
+}
+
+// Sends the buffer being filled to the file (or to the thread).
+static int writer_send(fitstable_writer_t* w, const char* fn) {
+	if (!w->nbytes)
+		return writer_error(w, fn);
+	if (!w->threaded) {
+		int err = write_fully(w->fid, w->bufs[0], w->nbytes);
+		w->nbytes = 0;
+		if (err && !w->err)
+			w->err = err;
+		return writer_error(w, fn);
+	}
+	pthread_mutex_lock(&w->mutex);
+	while (w->pending != -1)
+		pthread_cond_wait(&w->cond, &w->mutex);
+	w->pending = w->cur;
+	w->npending = w->nbytes;
+	pthread_cond_broadcast(&w->cond);
+	pthread_mutex_unlock(&w->mutex);
+	w->cur = 1 - w->cur;
+	w->nbytes = 0;
+	return writer_error(w, fn);
+}
+
+static int writer_flush(fitstable_writer_t* w, const char* fn) {
+	if (writer_send(w, fn))
+		return -1;
+	if (w->threaded) {
+		pthread_mutex_lock(&w->mutex);
+		while (w->pending != -1)
+			pthread_cond_wait(&w->cond, &w->mutex);
+		pthread_mutex_unlock(&w->mutex);
+	}
+	return writer_error(w, fn);
+}
+
+/*
+ Returns space for "n" more bytes at the end of the buffer (which are
+ counted as written), sending the buffer off first if they don't fit.
+ */
+static char* writer_append(fitstable_writer_t* w, size_t n, const char* fn) {
+	char* p;
+	if (w->nbytes + n > w->bufsize) {
+		if (writer_send(w, fn))
+			return NULL;
+		if (n > w->bufsize) {
+			int i;
+			// a single row that doesn't fit: grow the buffers.
+			if (writer_flush(w, fn))
+				return NULL;
+			for (i=0; i<(w->threaded ? 2 : 1); i++) {
+				char* newbuf = realloc(w->bufs[i], n);
+				if (!newbuf) {
+					SYSERROR("Failed to grow write buffer to %zu bytes", n);
+					return NULL;
+				}
+				w->bufs[i] = newbuf;
+			}
+			w->bufsize = n;
+		}
+	}
+	p = w->bufs[w->cur] + w->nbytes;
+	w->nbytes += n;
+	return p;
+}
+
+static int writer_free(fitstable_writer_t* w, const char* fn) {
+	int rtn;
+	if (!w)
+		return 0;
+	rtn = writer_flush(w, fn);
+	if (w->threaded) {
+		pthread_mutex_lock(&w->mutex);
+		w->quit = TRUE;
+		pthread_cond_broadcast(&w->cond);
+		pthread_mutex_unlock(&w->mutex);
+		pthread_join(w->thread, NULL);
+		pthread_mutex_destroy(&w->mutex);
+		pthread_cond_destroy(&w->cond);
+	}
+	free(w->bufs[0]);
+	free(w->bufs[1]);
+	free(w);
+	return rtn;
+}
+
+// Called before anything that uses table->fid directly.
+static int drain_writes(fitstable_t* table) {
+	if (!table->writer)
+		return 0;
+	return writer_flush(table->writer, table->fn);
+}
+
 static int write_row_data(fitstable_t* table, void* data, int R) {
 	assert(table);
 	assert(data);
@@ -273,7 +440,12 @@ static int write_row_data(fitstable_t* table, void* data, int R) {
 	}
 	if (R == 0)
 		R = fitstable_row_size(table);
-	if (fwrite(data, 1, R, table->fid) != R) {
+	if (table->writer) {
+		char* dest = writer_append(table->writer, R, table->fn);
+		if (!dest)
+			return -1;
+		memcpy(dest, data, R);
+	} else if (fwrite(data, 1, R, table->fid) != R) {
 		SYSERROR("Failed to write a row to %s", table->fn);
 		return -1;
 	}
@@ -668,30 +840,60 @@ static int write_one(fitstable_t* table, const void* struc, anbool flip,
     int Nbuf = 0;
 	int ret = 0;
 	int nc = ncols(table);
+	const char** coldata;
+	anbool skipping = FALSE;
 
 	char* thisrow = NULL;
+	char* bufrow = NULL;
 	int rowoff = 0;
 
-	if (in_memory(table)) {
-		ensure_row_list_exists(table);
-		thisrow = calloc(1, bl_datasize(table->rows));
+	coldata = malloc(MAX(nc, 1) * sizeof(char*));
+	if (!coldata) {
+		SYSERROR("Failed to allocate column pointers for writing");
+		return -1;
 	}
-
     for (i=0; i<nc; i++) {
-        fitscol_t* col;
-        const char* columndata;
-        col = getcol(table, i);
+        fitscol_t* col = getcol(table, i);
 		if (col->in_struct) {
 			if (struc)
-				columndata = struc + col->coffset;
+				coldata[i] = struc + col->coffset;
 			else
-				columndata = NULL;
+				coldata[i] = NULL;
 		} else {
 			if (struc)
-				columndata = NULL;
+				coldata[i] = NULL;
 			else
-				columndata = va_arg(*ap, void *);
+				coldata[i] = va_arg(*ap, void *);
 		}
+		if (!coldata[i])
+			skipping = TRUE;
+	}
+
+	if (in_memory(table)) {
+		ensure_row_list_exists(table);
+		thisrow = calloc(1, bl_datasize(table->rows));
+	} else if (table->writer) {
+		// Skipped columns may already have been written (with
+		// fitstable_write_one_column), so a row with any is written
+		// directly, seeking past them.
+		if (skipping)
+			ret = drain_writes(table);
+		else {
+			bufrow = writer_append(table->writer,
+								   fitstable_get_struct_size(table), table->fn);
+			if (!bufrow)
+				ret = -1;
+		}
+		if (ret) {
+			free(coldata);
+			return -1;
+		}
+	}
+
+    for (i=0; i<nc; i++) {
+        fitscol_t* col;
+        const char* columndata = coldata[i];
+        col = getcol(table, i);
 		// If "columndata" is NULL, fits_write_data_array
 		// skips the required number of bytes.
 		// This allows both structs and normal columns to coexist
@@ -715,6 +917,13 @@ static int write_one(fitstable_t* table, const void* struc, anbool flip,
 			int nb = fitscolumn_get_size(col);
 			memcpy(thisrow + rowoff, columndata, nb);
 			rowoff += nb;
+		} else if (bufrow) {
+			int nb = fitscolumn_get_size(col);
+			memcpy(bufrow + rowoff, columndata, nb);
+			if (flip && need_endian_flip() && col->fitssize > 1)
+				qfits_swap_bytes_array(bufrow + rowoff, col->fitssize,
+									   col->arraysize);
+			rowoff += nb;
 		} else {
 			ret = fits_write_data_array(table->fid, columndata,
 										col->fitstype, col->arraysize, flip);
@@ -723,6 +932,7 @@ static int write_one(fitstable_t* table, const void* struc, anbool flip,
 		}
     }
     free(buf);
+	free(coldata);
 	if (in_memory(table))
 		bl_append(table->rows, thisrow);
 	free(thisrow);
@@ -740,9 +950,78 @@ int fitstable_write_struct_noflip(fitstable_t* table, const void* struc) {
 }
 
 
+/*
+ With buffered writing, a block of structs is written a column at a
+ time: the column is gathered (and converted) into a contiguous
+ array, byte-swapped in one go, then scattered into the rows in the
+ write buffer.  Every column must be in the struct.
+ */
+#define WRITE_BLOCK_ROWS 4096
+
+static int write_struct_blocks(fitstable_t* table, const char* struc,
+							   int stride, int N) {
+	int R = fitstable_get_struct_size(table);
+	int nc = ncols(table);
+	int maxnb = 0;
+	char* colbuf;
+	int i, j, c;
+	// keep each block within the write buffer.
+	int B = MAX(1, MIN(WRITE_BLOCK_ROWS, table->writer->bufsize / MAX(R, 1)));
+
+	for (c=0; c<nc; c++)
+		maxnb = MAX(maxnb, fitscolumn_get_size(getcol(table, c)));
+	colbuf = malloc((size_t)B * maxnb);
+	if (!colbuf) {
+		SYSERROR("Failed to allocate column buffer for writing");
+		return -1;
+	}
+	for (i=0; i<N; i+=B) {
+		int n = MIN(B, N - i);
+		const char* src = struc + (size_t)i * stride;
+		char* rows;
+		int rowoff = 0;
+		rows = writer_append(table->writer, (size_t)n * R, table->fn);
+		if (!rows) {
+			free(colbuf);
+			return -1;
+		}
+		for (c=0; c<nc; c++) {
+			fitscol_t* col = getcol(table, c);
+			int nb = fitscolumn_get_size(col);
+			if (col->fitstype != col->ctype)
+				fits_convert_data(colbuf, nb, col->fitstype,
+								  src + col->coffset, stride, col->ctype,
+								  col->arraysize, n);
+			else
+				for (j=0; j<n; j++)
+					memcpy(colbuf + (size_t)j * nb,
+						   src + (size_t)j * stride + col->coffset, nb);
+			if (need_endian_flip() && col->fitssize > 1)
+				qfits_swap_bytes_array(colbuf, col->fitssize,
+									   (size_t)n * col->arraysize);
+			for (j=0; j<n; j++)
+				memcpy(rows + (size_t)j * R + rowoff, colbuf + (size_t)j * nb, nb);
+			rowoff += nb;
+		}
+		table->table->nr += n;
+	}
+	free(colbuf);
+	return 0;
+}
+
+static anbool all_columns_in_struct(const fitstable_t* table) {
+	int c;
+	for (c=0; c<ncols(table); c++)
+		if (!getcol(table, c)->in_struct)
+			return FALSE;
+	return TRUE;
+}
+
 int fitstable_write_structs(fitstable_t* table, const void* struc, int stride, int N) {
 	int i;
 	char* s = (char*)struc;
+	if (table->writer && N > 1 && all_columns_in_struct(table))
+		return write_struct_blocks(table, s, stride, N);
 	for (i=0; i<N; i++) {
 		if (fitstable_write_struct(table, s)) {
 			return -1;
@@ -788,6 +1067,8 @@ int fitstable_write_one_column(fitstable_t* table, int colnum,
 
 	off = offset_of_column(table, colnum);
 	if (!in_memory(table)) {
+		if (drain_writes(table))
+			return -1;
 		foffset = ftello(table->fid);
 		// jump to row start...
 		start = get_row_offset(table, rowoffset) + off;
@@ -845,6 +1126,162 @@ void fitstable_clear_table(fitstable_t* tab) {
     bl_remove_all(tab->cols);
 }
 
+/*
+ Columns are read from files a block of rows at a time: the column
+ data for a block are gathered from the rows, byte-swapped and
+ converted while they're in cache.  The file is mapped a window of
+ rows at a time.
+ */
+#define READ_BLOCK_ROWS 4096
+#define READ_WINDOW_BYTES (64 * 1024 * 1024)
+
+#define GATHER_LOOP(size)											\
+	for (i=0; i<N; i++)												\
+		memcpy(dest + (size_t)i * deststride,						\
+			   src + (size_t)i * srcstride, size)
+
+// Copies N "size"-byte fields, "srcstride" bytes apart, to "dest".
+static void gather_fields(char* dest, int deststride,
+						  const char* src, int srcstride, int size, int N) {
+	int i;
+	switch (size) {
+	case 1:
+		GATHER_LOOP(1);
+		break;
+	case 2:
+		GATHER_LOOP(2);
+		break;
+	case 4:
+		GATHER_LOOP(4);
+		break;
+	case 8:
+		GATHER_LOOP(8);
+		break;
+	default:
+		GATHER_LOOP(size);
+		break;
+	}
+}
+
+static int read_column_blocks(const fitstable_t* tab, int colnum,
+							  tfits_type ctype, int offset, int Nread,
+							  char* cdata, int cstride) {
+	const qfits_table* table = tab->table;
+	const qfits_col* col = table->col + colnum;
+	tfits_type fitstype = col->atom_type;
+	int fitssize = fits_get_atom_size(fitstype);
+	int arraysize = col->atom_nb;
+	int fieldsize = fitssize * arraysize;
+	int tabw = table->tab_w;
+	anbool flip = need_endian_flip() && (fitssize > 1);
+	anbool direct = (fitstype == ctype);
+	char* buf = NULL;
+	int wrows, w0, i;
+
+	if ((offset < 0) || (offset + Nread > table->nr)) {
+		ERROR("Requested rows [%i, %i) of a table with %i rows in %s",
+			  offset, offset + Nread, table->nr, tab->fn);
+		return -1;
+	}
+	if (!direct)
+		buf = malloc((size_t)READ_BLOCK_ROWS * fieldsize);
+	wrows = MAX(READ_BLOCK_ROWS, READ_WINDOW_BYTES / tabw);
+
+	for (w0=0; w0<Nread; w0+=wrows) {
+		int nw = MIN(wrows, Nread - w0);
+		int b0;
+		char* freeaddr;
+		size_t freesize;
+		const char* map;
+		map = qfits_falloc2(table->filename,
+							(size_t)col->off_beg + (size_t)tabw * (size_t)(offset + w0),
+							(size_t)(nw - 1) * (size_t)tabw + fieldsize,
+							&freeaddr, &freesize);
+		if (!map) {
+			ERROR("Failed to map rows %i to %i of table %s", offset + w0,
+				  offset + w0 + nw, tab->fn);
+			free(buf);
+			return -1;
+		}
+		for (b0=0; b0<nw; b0+=READ_BLOCK_ROWS) {
+			int nb = MIN(READ_BLOCK_ROWS, nw - b0);
+			const char* src = map + (size_t)b0 * tabw;
+			char* out = cdata + (size_t)(w0 + b0) * cstride;
+			if (direct) {
+				gather_fields(out, cstride, src, tabw, fieldsize, nb);
+				if (!flip)
+					continue;
+				if (cstride == fieldsize)
+					qfits_swap_bytes_array(out, fitssize, (size_t)nb * arraysize);
+				else
+					for (i=0; i<nb; i++)
+						qfits_swap_bytes_array(out + (size_t)i * cstride,
+											   fitssize, arraysize);
+			} else {
+				gather_fields(buf, fieldsize, src, tabw, fieldsize, nb);
+				if (flip)
+					qfits_swap_bytes_array(buf, fitssize, (size_t)nb * arraysize);
+				fits_convert_data(out, cstride, ctype, buf, fieldsize, fitstype,
+								  arraysize, nb);
+			}
+		}
+		qfits_fdealloc2(freeaddr, freesize);
+	}
+	free(buf);
+	return 0;
+}
+
+int fitstable_map_column(const fitstable_t* tab, const char* colname,
+						 tfits_type ctype, int offset, int N,
+						 fitstable_column_view_t* view) {
+	const qfits_col* col;
+	int colnum;
+	int fitssize;
+	const char* map;
+
+	memset(view, 0, sizeof(fitstable_column_view_t));
+	if (in_memory(tab))
+		return 1;
+	colnum = fits_find_column(tab->table, colname);
+	if (colnum == -1) {
+		ERROR("Column \"%s\" not found in FITS table %s", colname, tab->fn);
+		return -1;
+	}
+	col = tab->table->col + colnum;
+	fitssize = fits_get_atom_size(col->atom_type);
+	if ((tab->table->tab_t != QFITS_BINTABLE) || (col->atom_type != ctype) ||
+		(need_endian_flip() && (fitssize > 1)))
+		return 1;
+	if (N == -1)
+		N = tab->table->nr - offset;
+	if ((offset < 0) || (N <= 0) || (offset + N > tab->table->nr)) {
+		ERROR("Requested rows [%i, %i) of a table with %i rows in %s",
+			  offset, offset + N, tab->table->nr, tab->fn);
+		return -1;
+	}
+	map = qfits_falloc2(tab->table->filename,
+						(size_t)col->off_beg + (size_t)tab->table->tab_w * (size_t)offset,
+						(size_t)(N - 1) * (size_t)tab->table->tab_w +
+						(size_t)fitssize * col->atom_nb,
+						&view->mapaddr, &view->mapsize);
+	if (!map) {
+		ERROR("Failed to map column \"%s\" of table %s", colname, tab->fn);
+		return -1;
+	}
+	view->data = (void*)map;
+	view->stride = tab->table->tab_w;
+	view->N = N;
+	return 0;
+}
+
+void fitstable_unmap_column(fitstable_column_view_t* view) {
+	if (!view->mapaddr)
+		return;
+	qfits_fdealloc2(view->mapaddr, view->mapsize);
+	view->mapaddr = NULL;
+	view->data = NULL;
+}
+
 /**
  If "inds" is non-NULL, it's a list of indices to read.
  */
@@ -900,13 +1337,23 @@ static void* read_array_into(const fitstable_t* tab,
 	if (dest)
 		cdata = dest;
 	else
-		cdata = calloc(Nread * arraysize, csize);
+		cdata = calloc((size_t)Nread * arraysize, csize);
 
 	if (dest && deststride > 0)
 		cstride = deststride;
 	else
 		cstride = csize * arraysize;
 
+	if (!in_memory(tab) && !inds && (Nread > 0) && col->readable &&
+		(tab->table->tab_t == QFITS_BINTABLE) && (fitssize > 0) && (csize > 0)) {
+		if (read_column_blocks(tab, colnum, ctype, offset, Nread, cdata, cstride)) {
+			if (!dest)
+				free(cdata);
+			return NULL;
+		}
+		return cdata;
+	}
+
 	fitsstride = fitssize * arraysize;
 	if (csize < fitssize) {
 		// Need to allocate a bigger temp array and down-convert the data.
@@ -1052,14 +1499,23 @@ qfits_header* fitstable_get_header(fitstable_t* t) {
     return t->header;
 }
 
-void fitstable_next_extension(fitstable_t* tab) {
-	if (is_writing(tab))
-        fits_pad_file(tab->fid);
+int fitstable_next_extension(fitstable_t* tab) {
+	if (is_writing(tab)) {
+		if (drain_writes(tab)) {
+			ERROR("Failed to write the rows of extension %i of %s",
+				  tab->extension, tab->fn);
+			return -1;
+		}
+        if (fits_pad_file(tab->fid)) {
+			ERROR("Failed to pad extension %i of %s", tab->extension, tab->fn);
+			return -1;
+		}
+	}
 
 	if (in_memory(tab)) {
 		fitsext_t ext;
 		if (!tab->table)
-			return;
+			return 0;
 		// update NAXIS2
 		fitstable_fix_header(tab);
 		ext.table = tab->table;
@@ -1074,6 +1530,7 @@ void fitstable_next_extension(fitstable_t* tab) {
     tab->extension++;
     tab->table = NULL;
     tab->header = NULL;
+	return 0;
 }
 
 static fitstable_t* fitstable_new() {
@@ -1109,7 +1566,8 @@ fitstable_t* fitstable_open_in_memory() {
 int fitstable_switch_to_reading(fitstable_t* table) {
 	assert(in_memory(table));
 	// store the current extension.
-	fitstable_next_extension(table);
+	if (fitstable_next_extension(table))
+		return -1;
 	// This resets all the meta-data about the table, meaning a reader
 	// can then re-add columns it is interested in.
 	fitstable_clear_table(table);
@@ -1263,6 +1721,11 @@ int fitstable_close(fitstable_t* tab) {
     int i;
     int rtn = 0;
     if (!tab) return 0;
+	if (tab->writer) {
+		if (writer_free(tab->writer, tab->fn))
+			rtn = -1;
+		tab->writer = NULL;
+	}
 	if (is_writing(tab)) {
         if (fclose(tab->fid)) {
             SYSERROR("Failed to close output file %s", tab->fn);
@@ -1463,12 +1926,14 @@ int fitstable_read_extension(fitstable_t* tab, int ext) {
 
 int fitstable_write_primary_header(fitstable_t* t) {
 	if (in_memory(t)) return 0;
+	if (drain_writes(t)) return -1;
     return fitsfile_write_primary_header(t->fid, t->primheader,
                                          &t->end_header_offset, t->fn);
 }
 
 int fitstable_fix_primary_header(fitstable_t* t) {
 	if (in_memory(t)) return 0;
+	if (drain_writes(t)) return -1;
     return fitsfile_fix_primary_header(t->fid, t->primheader,
                                        &t->end_header_offset, t->fn);
 }
@@ -1493,6 +1958,7 @@ int fitstable_write_header(fitstable_t* t) {
         }
     }
 	if (in_memory(t)) return 0;
+	if (drain_writes(t)) return -1;
 
     return fitsfile_write_header(t->fid, t->header,
                                  &t->table_offset, &t->end_table_offset,
@@ -1500,6 +1966,7 @@ int fitstable_write_header(fitstable_t* t) {
 }
 
 int fitstable_pad_with(fitstable_t* t, char pad) {
+	if (drain_writes(t)) return -1;
     return fitsfile_pad_with(t->fid, pad);
 }
 
@@ -1508,6 +1975,7 @@ int fitstable_fix_header(fitstable_t* t) {
     fits_header_mod_int(t->header, "NAXIS2", t->table->nr, NULL);
 
 	if (in_memory(t)) return 0;
+	if (drain_writes(t)) return -1;
 
     if (fitsfile_fix_header(t->fid, t->header,
                             &t->table_offset, &t->end_table_offset,
@@ -1602,6 +2070,51 @@ void fitstable_use_buffered_reading(fitstable_t* tab, int elementsize, int Nbuff
     }
 }
 
+int fitstable_use_buffered_writing(fitstable_t* tab, size_t bufsize,
+                                   anbool threaded) {
+	fitstable_writer_t* w;
+	if (in_memory(tab) || !is_writing(tab))
+		return 0;
+	if (tab->writer) {
+		int rtn = writer_free(tab->writer, tab->fn);
+		tab->writer = NULL;
+		if (rtn)
+			return -1;
+	}
+	if (!bufsize)
+		bufsize = FITSTABLE_WRITE_BUFSIZE;
+	w = calloc(1, sizeof(fitstable_writer_t));
+	w->fid = tab->fid;
+	w->bufsize = bufsize;
+	w->pending = -1;
+	w->bufs[0] = malloc(bufsize);
+	if (threaded)
+		w->bufs[1] = malloc(bufsize);
+	if (!w->bufs[0] || (threaded && !w->bufs[1])) {
+		SYSERROR("Failed to allocate %zu-byte write buffers for %s",
+				 bufsize, tab->fn);
+		writer_free(w, tab->fn);
+		return -1;
+	}
+	if (threaded) {
+		pthread_mutex_init(&w->mutex, NULL);
+		pthread_cond_init(&w->cond, NULL);
+		if (pthread_create(&w->thread, NULL, writer_thread, w)) {
+			ERROR("Failed to start writer thread for %s; writing directly",
+				  tab->fn);
+			pthread_mutex_destroy(&w->mutex);
+			pthread_cond_destroy(&w->cond);
+		} else
+			w->threaded = TRUE;
+	}
+	tab->writer = w;
+	return 0;
+}
+
+int fitstable_flush_writes(fitstable_t* tab) {
+	return drain_writes(tab);
+}
+
 void fitstable_set_buffer_fill_function(fitstable_t* tab,
                                         int (*refill_buffer)(void* userdata, void* buffer, unsigned int offs, unsigned int nelems),
                                         void* userdata) {
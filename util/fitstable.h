@@ -157,6 +157,9 @@ struct fitstable_t {
     // Buffered reading.
     bread_t* br;
 
+    // Buffered writing (see fitstable_use_buffered_writing).
+    struct fitstable_writer_t* writer;
+
 	// When reading, via fitstable_read_row_data
 	FILE* readfid;
 
@@ -267,8 +270,8 @@ int fitstable_row_size(const fitstable_t* t);
 
 int fitstable_get_struct_size(const fitstable_t* table);
 
-// when writing...
-void fitstable_next_extension(fitstable_t* tab);
+// when writing: finishes the current extension.  Returns 0 on success.
+int fitstable_next_extension(fitstable_t* tab);
 
 // when writing: remove all existing columns from the table.
 void fitstable_clear_table(fitstable_t* tab);
@@ -368,6 +371,38 @@ void* fitstable_read_column_offset(const fitstable_t* tab,
                                    const char* colname, tfits_type ctype,
                                    int offset, int N);
 
+/**
+ A column of a FITS table file, mapped into memory without copying
+ (see fitstable_map_column).  Row "i" of the column starts at
+   (char*)data + i * stride
+ */
+struct fitstable_column_view_t {
+	void* data;
+	int stride;
+	int N;
+	// the mapping
+	char* mapaddr;
+	size_t mapsize;
+};
+typedef struct fitstable_column_view_t fitstable_column_view_t;
+
+/**
+ If rows [offset, offset+N) (N = -1: all rows) of column "colname"
+ can be used as type "ctype" exactly as they are in the file -- the
+ column has that FITS type and needs no byte-swapping on this machine
+ -- maps them into "view" and returns 0.  Release it with
+ fitstable_unmap_column().
+
+ Returns 1 if the data would need converting, or the table isn't in a
+ file; use fitstable_read_column_offset() etc instead.  Returns -1 on
+ error.
+ */
+int fitstable_map_column(const fitstable_t* tab, const char* colname,
+						 tfits_type ctype, int offset, int N,
+						 fitstable_column_view_t* view);
+
+void fitstable_unmap_column(fitstable_column_view_t* view);
+
 // NOTE NOTE NOTE, you must call this with *pointers* to the data to write.
 int fitstable_write_row(fitstable_t* table, ...);
 
@@ -455,6 +490,30 @@ void fitstable_set_buffer_fill_function(fitstable_t* tab,
                                         int (*refill_buffer)(void* userdata, void* buffer, unsigned int offs, unsigned int nelems),
                                         void* userdata);
 
+/**
+ When writing to a file: collect rows in a buffer of "bufsize" bytes
+ (0 for the default of FITSTABLE_WRITE_BUFSIZE) and write it out when
+ it fills, rather than issuing small writes for each row.  If
+ "threaded", a background thread writes out each full buffer while
+ the next one is being filled.  The bytes written to the file are the
+ same either way (columns that are not given any data are written as
+ zeros).
+
+ The buffer is flushed by all the fitstable functions that touch the
+ file directly (headers, padding, fitstable_write_one_column,
+ fitstable_close, ...); call fitstable_flush_writes() before using
+ "tab->fid" yourself (eg, ftello()).
+
+ Returns 0 on success.
+ */
+#define FITSTABLE_WRITE_BUFSIZE (4 * 1024 * 1024)
+int fitstable_use_buffered_writing(fitstable_t* tab, size_t bufsize,
+                                   anbool threaded);
+
+// Writes out any rows held by buffered writing, and waits for them to
+// reach the file.  Returns -1 if any buffered write failed.
+int fitstable_flush_writes(fitstable_t* tab);
+
 void fitstable_print_missing(fitstable_t* tab, FILE* f);
 
 void fitstable_error_report_missing(fitstable_t* tab);
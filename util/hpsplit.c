@@ -49,7 +49,7 @@
  rows that are within (or within range) of the healpix.
  */
 
-const char* OPTIONS = "hvn:r:d:m:o:gc:t:b:";
+const char* OPTIONS = "hvn:r:d:m:o:gc:t:b:B:";
 
 void printHelp(char* progname) {
 	boilerplate_help_header(stdout);
@@ -63,6 +63,7 @@ void printHelp(char* progname) {
 		   "    [-c <name>]: copy given column name to the output files\n"
 		   "    [-t <temp-dir>]: use the given temp dir; default is /tmp\n"
 		   "    [-b <backref-file>]: save the filenumber->filename map in this file; enables writing backreferences too\n"
+		   "    [-B <MB>]: buffer the output rows, using this many megabytes in total, split among the outputs; default: no buffering\n"
 		   "    [-v]: +verbose\n"
 		   "\n", progname);
 }
@@ -100,6 +101,8 @@ int main(int argc, char *argv[]) {
 	int NHP;
 	double md;
 	char* backref = NULL;
+	double bufmb = 0.0;
+	size_t bufsize = 0;
 	
 	fitstable_t* intable;
 	fitstable_t** outtables;
@@ -113,6 +116,9 @@ int main(int argc, char *argv[]) {
 		case 'b':
 			backref = optarg;
 			break;
+		case 'B':
+			bufmb = atof(optarg);
+			break;
 		case 't':
 			tempdir = optarg;
 			break;
@@ -172,6 +178,11 @@ int main(int argc, char *argv[]) {
 	logmsg("%i output healpixes\n", NHP);
 	outtables = calloc(NHP, sizeof(fitstable_t*));
 	assert(outtables);
+	if (bufmb > 0) {
+		// (any or all of the outputs may be open at once)
+		bufsize = (size_t)(bufmb * 1024 * 1024 / NHP);
+		logverb("Buffering %zu bytes of rows for each output\n", bufsize);
+	}
 
 	md = deg2dist(margin);
 
@@ -465,6 +476,12 @@ int main(int argc, char *argv[]) {
 						ERROR("Failed to write output file headers for \"%s\"", outfn);
 						exit(-1);
 					}
+					// rows arrive one at a time: collect them in a buffer.
+					if (bufsize &&
+						fitstable_use_buffered_writing(out, bufsize, FALSE)) {
+						ERROR("Failed to set up buffered writing for \"%s\"", outfn);
+						exit(-1);
+					}
 					outtables[hp] = out;
 				}
 
@@ -525,7 +542,12 @@ int main(int argc, char *argv[]) {
 		for (ii=0; ii<NHP; ii++) {
 		  if (!outtables[ii])
 		    continue;
-		  off_t offset = ftello(outtables[ii]->fid);
+		  off_t offset;
+		  if (fitstable_flush_writes(outtables[ii])) {
+		    ERROR("Failed to write rows for healpix %i after reading input file \"%s\"", ii, originfn);
+		    exit(-1);
+		  }
+		  offset = ftello(outtables[ii]->fid);
 		  if (fitstable_fix_header(outtables[ii])) {
 		    ERROR("Failed to fix header for healpix %i after reading input file \"%s\"", ii, originfn);
 		    exit(-1);
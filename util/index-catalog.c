@@ -0,0 +1,200 @@
+/*
+ This file is part of the Astrometry.net suite.
+
+ The Astrometry.net suite is free software; you can redistribute
+ it and/or modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation, version 2.
+
+ The Astrometry.net suite is distributed in the hope that it will be
+ useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with the Astrometry.net suite ; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+#include <stdlib.h>
+#include <string.h>
+
+#include "index-catalog.h"
+#include "healpix.h"
+#include "log.h"
+#include "errors.h"
+
+index_catalog_t* index_catalog_new() {
+	index_catalog_t* cat = calloc(1, sizeof(index_catalog_t));
+	cat->allsky = bl_new(16, sizeof(index_catalog_entry_t));
+	cat->tiles = bl_new(4, sizeof(index_catalog_tiles_t));
+	return cat;
+}
+
+int index_catalog_n(const index_catalog_t* cat) {
+	return cat->n;
+}
+
+static index_catalog_tiles_t* get_tiles(index_catalog_t* cat, int nside) {
+	index_catalog_tiles_t newtiles;
+	int i;
+	for (i=0; i<bl_size(cat->tiles); i++) {
+		index_catalog_tiles_t* tiles = bl_access(cat->tiles, i);
+		if (tiles->nside == nside)
+			return tiles;
+	}
+	memset(&newtiles, 0, sizeof(index_catalog_tiles_t));
+	newtiles.nside = nside;
+	return bl_append(cat->tiles, &newtiles);
+}
+
+void index_catalog_add(index_catalog_t* cat, index_t* index, int id) {
+	index_catalog_entry_t entry;
+	index_catalog_tiles_t* tiles;
+
+	entry.index = index;
+	entry.id = id;
+	entry.healpix = index->healpix;
+	cat->n++;
+	if (index->healpix == -1 || index->hpnside <= 0) {
+		bl_append(cat->allsky, &entry);
+		return;
+	}
+	tiles = get_tiles(cat, index->hpnside);
+	if (tiles->n == tiles->size) {
+		tiles->size = (tiles->size ? tiles->size * 2 : 64);
+		tiles->entries = realloc(tiles->entries,
+								 tiles->size * sizeof(index_catalog_entry_t));
+	}
+	tiles->entries[tiles->n++] = entry;
+	tiles->sorted = FALSE;
+}
+
+static int compare_entries(const void* v1, const void* v2) {
+	const index_catalog_entry_t* e1 = v1;
+	const index_catalog_entry_t* e2 = v2;
+	if (e1->healpix != e2->healpix)
+		return (e1->healpix < e2->healpix) ? -1 : 1;
+	if (e1->id != e2->id)
+		return (e1->id < e2->id) ? -1 : 1;
+	return 0;
+}
+
+static void add_if_in_range(index_catalog_entry_t* entry, double ra, double dec,
+							double radius_deg, double quadlo, double quadhi,
+							il* found) {
+	if (!index_overlaps_scale_range(entry->index, quadlo, quadhi))
+		return;
+	if (!index_is_within_range(entry->index, ra, dec, radius_deg))
+		return;
+	il_append(found, entry->id);
+}
+
+// Adds the indexes of healpix "hp" that match.
+static void add_tile(index_catalog_tiles_t* tiles, int hp, double ra,
+					 double dec, double radius_deg, double quadlo,
+					 double quadhi, il* found) {
+	int lo = 0, hi = tiles->n;
+	// find the first entry with healpix >= hp.
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (tiles->entries[mid].healpix < hp)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	for (; lo<tiles->n && tiles->entries[lo].healpix == hp; lo++)
+		add_if_in_range(tiles->entries + lo, ra, dec, radius_deg, quadlo,
+						quadhi, found);
+}
+
+static void search_tiles(index_catalog_tiles_t* tiles, double ra, double dec,
+						 double radius_deg, double quadlo, double quadhi,
+						 il* found) {
+	int nside = tiles->nside;
+	il* queue;
+	il* seen;
+	int i, start;
+	int nfound = il_size(found);
+	anbool scanall = FALSE;
+
+	if (!tiles->sorted) {
+		qsort(tiles->entries, tiles->n, sizeof(index_catalog_entry_t),
+			  compare_entries);
+		tiles->sorted = TRUE;
+	}
+
+	/*
+	 The healpixes within range of the position are connected, so we
+	 can find them with a breadth-first search out from the one
+	 containing it.  (The neighbours are checked against a slightly
+	 larger radius so that rounding can't disconnect them; the indexes
+	 themselves are checked exactly.)  If the search region covers more
+	 healpixes than there are tiles, just look at each tile instead.
+	 */
+	queue = il_new(256);
+	seen = il_new(256);
+	start = radecdegtohealpix(ra, dec, nside);
+	il_append(queue, start);
+	il_insert_unique_ascending(seen, start);
+	for (i=0; i<il_size(queue); i++) {
+		int hp = il_get(queue, i);
+		int nbrs[8];
+		int j, nn;
+		if (il_size(seen) > tiles->n) {
+			scanall = TRUE;
+			break;
+		}
+		add_tile(tiles, hp, ra, dec, radius_deg, quadlo, quadhi, found);
+		nn = healpix_get_neighbours(hp, nbrs, nside);
+		for (j=0; j<nn; j++) {
+			if (il_insert_unique_ascending(seen, nbrs[j]) == -1)
+				continue;
+			if (healpix_distance_to_radec(nbrs[j], nside, ra, dec, NULL) >
+				radius_deg * (1.0 + 1e-6) + 1e-9)
+				continue;
+			il_append(queue, nbrs[j]);
+		}
+	}
+	debug("Index catalog: looked at %i of the Nside=%i healpixes%s\n",
+		  il_size(seen), nside, scanall ? "; scanning all tiles" : "");
+	il_free(queue);
+	il_free(seen);
+
+	if (scanall) {
+		il_remove_index_range(found, nfound, il_size(found) - nfound);
+		for (i=0; i<tiles->n; i++)
+			add_if_in_range(tiles->entries + i, ra, dec, radius_deg, quadlo,
+							quadhi, found);
+	}
+}
+
+int index_catalog_search(index_catalog_t* cat, double ra, double dec,
+						 double radius_deg, double quadlo, double quadhi,
+						 il* ids) {
+	il* found = il_new(256);
+	int i, N;
+
+	for (i=0; i<bl_size(cat->allsky); i++)
+		add_if_in_range(bl_access(cat->allsky, i), ra, dec, radius_deg,
+						quadlo, quadhi, found);
+	for (i=0; i<bl_size(cat->tiles); i++)
+		search_tiles(bl_access(cat->tiles, i), ra, dec, radius_deg,
+					 quadlo, quadhi, found);
+	il_sort(found, 1);
+	N = il_size(found);
+	il_append_list(ids, found);
+	il_free(found);
+	return N;
+}
+
+void index_catalog_free(index_catalog_t* cat) {
+	int i;
+	if (!cat)
+		return;
+	for (i=0; i<bl_size(cat->tiles); i++) {
+		index_catalog_tiles_t* tiles = bl_access(cat->tiles, i);
+		free(tiles->entries);
+	}
+	bl_free(cat->tiles);
+	bl_free(cat->allsky);
+	free(cat);
+}
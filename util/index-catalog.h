@@ -0,0 +1,84 @@
+/*
+ This file is part of the Astrometry.net suite.
+
+ The Astrometry.net suite is free software; you can redistribute
+ it and/or modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation, version 2.
+
+ The Astrometry.net suite is distributed in the hope that it will be
+ useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with the Astrometry.net suite ; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#ifndef AN_INDEX_CATALOG_H
+#define AN_INDEX_CATALOG_H
+
+#include "index.h"
+#include "bl.h"
+
+/**
+ A catalog of index metadata, keyed by healpix tile, for finding the
+ indexes (eg, the per-healpix tiles of the 4200 or 5000 series) that
+ cover part of a given region of sky without looking at all of them.
+
+ Each index is added with an integer "id" of the caller's choosing
+ (eg, its position in a list); searches return ids.  The indexes are
+ not loaded or freed by the catalog; only their metadata are used.
+ */
+typedef struct {
+	// all-sky indexes (healpix == -1): "index_catalog_entry_t"s.
+	bl* allsky;
+	// for each healpix Nside that appears: "index_catalog_tiles_t"s.
+	bl* tiles;
+	int n;
+} index_catalog_t;
+
+typedef struct {
+	index_t* index;
+	int id;
+	int healpix;
+} index_catalog_entry_t;
+
+typedef struct {
+	int nside;
+	// sorted by healpix then id, once "sorted" is set.
+	index_catalog_entry_t* entries;
+	int n;
+	int size;
+	anbool sorted;
+} index_catalog_tiles_t;
+
+index_catalog_t* index_catalog_new();
+
+/**
+ Adds an index (whose metadata, at least, must be loaded) to the
+ catalog.
+ */
+void index_catalog_add(index_catalog_t* cat, index_t* index, int id);
+
+// How many indexes?
+int index_catalog_n(const index_catalog_t* cat);
+
+/**
+ Finds the indexes that contain quads of sizes that overlap [quadlo,
+ quadhi] (in arcsec; see index_overlaps_scale_range), and that are
+ within "radius_deg" degrees of "ra","dec" (see
+ index_is_within_range).  Their ids are added to "ids" in ascending
+ order.  Returns the number found.
+
+ Only the healpix tiles near the position are looked at: the cost
+ grows with the number of tiles in range, not with the size of the
+ catalog.
+ */
+int index_catalog_search(index_catalog_t* cat, double ra, double dec,
+						 double radius_deg, double quadlo, double quadhi,
+						 il* ids);
+
+void index_catalog_free(index_catalog_t* cat);
+
+#endif
@@ -16,6 +16,10 @@
  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
 */
 
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <stdint.h>
+
 #include "index.h"
 #include "log.h"
 #include "errors.h"
@@ -143,6 +147,31 @@ char* index_get_qidx_filename(const char* indexname) {
     return qidxfn;
 }
 
+int64_t index_get_file_size(const index_t* index) {
+	char *quadfn=NULL, *ckdtfn=NULL, *skdtfn=NULL;
+	anbool singlefile;
+	int64_t total = 0;
+	char* fns[3];
+	int i;
+	struct stat st;
+	get_filenames(index->indexname, &quadfn, &ckdtfn, &skdtfn, &singlefile);
+	fns[0] = quadfn;
+	fns[1] = ckdtfn;
+	fns[2] = skdtfn;
+	for (i=0; i<(singlefile ? 1 : 3); i++) {
+		if (stat(fns[i], &st)) {
+			SYSERROR("Failed to stat index file \"%s\"", fns[i]);
+			total = -1;
+			break;
+		}
+		total += st.st_size;
+	}
+	free(quadfn);
+	free(ckdtfn);
+	free(skdtfn);
+	return total;
+}
+
 anbool index_is_file_index(const char* filename) {
     char* ckdtfn, *skdtfn, *quadfn;
     anbool singlefile;
@@ -509,6 +538,70 @@ int index_close_fds(index_t* ind) {
 	return 0;
 }
 
+int index_set_mmap_policy(index_t* index, const index_mmap_policy_t* policy) {
+	fitsbin_t* fbs[3];
+	int advice[3];
+	int i;
+	int rtn = 0;
+
+	fbs[0] = (index->codekd ? index->codekd->tree->io : NULL);
+	fbs[1] = (index->quads ? index->quads->fb : NULL);
+	fbs[2] = (index->starkd ? index->starkd->tree->io : NULL);
+	advice[0] = policy->codes;
+	advice[1] = policy->quads;
+	advice[2] = policy->stars;
+
+	for (i=0; i<3; i++) {
+		if (!fbs[i])
+			continue;
+		if (advice[i] != FITSBIN_ADVICE_NORMAL &&
+			fitsbin_madvise(fbs[i], advice[i]))
+			rtn = -1;
+		if (policy->lock) {
+			if (fitsbin_mlock(fbs[i]))
+				rtn = -1;
+			else
+				logverb("Locked %zu bytes of index %s into memory\n",
+						fitsbin_mapped_size(fbs[i]), index->indexname);
+		}
+	}
+	return rtn;
+}
+
+int index_prefetch_radec(index_t* index, double ra, double dec, double radius_deg) {
+	startree_t* skdt = index->starkd;
+	char* fn = NULL;
+	double xyz[3], lo[3], hi[3];
+	double r;
+	int d, n;
+
+	if (!index_is_within_range(index, ra, dec, radius_deg))
+		return 0;
+	if (!skdt) {
+		// (a private copy: the index may be reloaded meanwhile.)
+		anbool singlefile;
+		get_filenames(index->indexname, NULL, NULL, &fn, &singlefile);
+		skdt = startree_open(fn);
+		if (!skdt) {
+			ERROR("Failed to read star kdtree from file %s", fn);
+			free(fn);
+			return -1;
+		}
+	}
+	// the box around the search circle on the unit sphere.
+	radecdeg2xyzarr(ra, dec, xyz);
+	r = deg2dist(MIN(radius_deg, 180.0));
+	for (d=0; d<3; d++) {
+		lo[d] = xyz[d] - r;
+		hi[d] = xyz[d] + r;
+	}
+	n = kdtree_prefetch_box(skdt->tree, lo, hi);
+	if (skdt != index->starkd)
+		startree_close(skdt);
+	free(fn);
+	return n;
+}
+
 void index_close(index_t* index) {
 	if (!index) return;
 	free(index->indexname);
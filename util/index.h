@@ -19,6 +19,8 @@
 #ifndef AN_INDEX_H
 #define AN_INDEX_H
 
+#include <stdint.h>
+
 #include "quadfile.h"
 #include "starkd.h"
 #include "codekd.h"
@@ -102,6 +104,19 @@ anbool index_overlaps_scale_range(index_t* indx, double quadlo, double quadhi);
  */
 anbool index_is_within_range(index_t* indx, double ra, double dec, double radius_deg);
 
+/**
+ Starts reading in (from disk to the page cache) the stars of this
+ index's star kdtree that are within "radius_deg" degrees of "ra",
+ "dec" (in degrees), so that the first searches of that region don't
+ wait on page faults.  If the index is loaded, its star kdtree is used;
+ otherwise (eg, only its metadata are loaded) the star kdtree is opened
+ and closed again, which leaves the pages cached.
+
+ Returns the number of stars in the prefetched kdtree nodes (a few
+ more than are within range), or -1 on error.
+ */
+int index_prefetch_radec(index_t* indx, double ra, double dec, double radius_deg);
+
 /**
  Reads index metadata from the given 'filename' into the given 'indx' struct.
 
@@ -118,6 +133,13 @@ char* index_get_quad_filename(const char* indexname);
 
 char* index_get_qidx_filename(const char* indexname);
 
+/**
+ Returns the total size, in bytes, of the file(s) holding this index
+ (roughly how much memory it takes when it is loaded and used), or -1
+ on error.
+ */
+int64_t index_get_file_size(const index_t* index);
+
 #define INDEX_ONLY_LOAD_METADATA 2
 //#define INDEX_ONLY_LOAD_SKDT     4
 
@@ -178,6 +200,26 @@ void index_close(index_t* index);
  */
 void index_free(index_t* index);
 
+/**
+ How the memory-mapped parts of an index are to be used.  The "codes",
+ "quads" and "stars" fields are FITSBIN_ADVICE_* values for the code
+ kdtree, quad list and star kdtree; if "lock" is set, they are all
+ locked into RAM with mlock().
+ */
+typedef struct {
+	int codes;
+	int quads;
+	int stars;
+	anbool lock;
+} index_mmap_policy_t;
+
+/**
+ Applies the given policy to the (loaded) parts of this index.  Returns
+ 0 on success; failures (eg, hitting RLIMIT_MEMLOCK) are logged, and
+ leave the index usable.
+ */
+int index_set_mmap_policy(index_t* index, const index_mmap_policy_t* policy);
+
 int index_get_missing_cut_params(int indexid, int* hpnside, int* nsweep,
 								 double* dedup, int* margin, char** band);
 
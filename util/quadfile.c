@@ -20,6 +20,8 @@
 #include <math.h>
 #include <string.h>
 #include <assert.h>
+#include <stdint.h>
+#include <sys/param.h>
 
 #include "quadfile.h"
 #include "qfits_header.h"
@@ -30,11 +32,18 @@
 #include "an-endian.h"
 
 #define CHUNK_QUADS 0
+// packed quads
+#define CHUNK_PACKBLOCKS 1
+#define CHUNK_PACKBITS   2
 
 static fitsbin_chunk_t* quads_chunk(quadfile* qf) {
     return fitsbin_get_chunk(qf->fb, CHUNK_QUADS);
 }
 
+static int n_pack_blocks(const quadfile* qf) {
+	return (qf->numquads + qf->packblock - 1) / qf->packblock;
+}
+
 static int callback_read_header(fitsbin_t* fb, fitsbin_chunk_t* chunk) {
     qfits_header* primheader = fitsbin_get_primary_header(fb);
 	quadfile* qf = chunk->userdata;
@@ -57,9 +66,27 @@ static int callback_read_header(fitsbin_t* fb, fitsbin_chunk_t* chunk) {
         ERROR("Quad file was written with the wrong endianness");
 		return -1;
     }
+	qf->packblock = 0;
+	if (qfits_header_getboolean(primheader, "QPACKED", 0)) {
+		qf->packblock = qfits_header_getint(primheader, "QPBLOCK", 0);
+		if (qf->packblock <= 0) {
+			ERROR("Packed quad file has invalid block size QPBLOCK = %i", qf->packblock);
+			return -1;
+		}
+	}
 
-    chunk->itemsize = qf->dimquads * sizeof(uint32_t);
-    chunk->nrows = qf->numquads;
+	if (streq(chunk->tablename, "quads")) {
+		chunk->itemsize = qf->dimquads * sizeof(uint32_t);
+		chunk->nrows = qf->numquads;
+	} else if (streq(chunk->tablename, "quadblocks")) {
+		if (!qf->packblock) {
+			ERROR("Quad file has a \"quadblocks\" table but QPACKED is not set");
+			return -1;
+		}
+		chunk->itemsize = sizeof(quadfile_block_t);
+		chunk->nrows = n_pack_blocks(qf);
+	} else
+		chunk->itemsize = sizeof(uint64_t);
 	return 0;
 }
 
@@ -93,12 +120,24 @@ static quadfile* new_quadfile(const char* fn, anqfits_t* fits, anbool writing) {
 
     fitsbin_chunk_init(&chunk);
     chunk.tablename = "quads";
-    chunk.required = 1;
+    // (either this or the packed tables are required)
+    chunk.required = writing;
     chunk.callback_read_header = callback_read_header;
     chunk.userdata = qf;
     fitsbin_add_chunk(qf->fb, &chunk);
     fitsbin_chunk_clean(&chunk);
-    
+
+    if (!writing) {
+        fitsbin_chunk_init(&chunk);
+        chunk.tablename = "quadblocks";
+        chunk.callback_read_header = callback_read_header;
+        chunk.userdata = qf;
+        fitsbin_add_chunk(qf->fb, &chunk);
+        chunk.tablename = "quadbits";
+        fitsbin_add_chunk(qf->fb, &chunk);
+        fitsbin_chunk_clean(&chunk);
+    }
+
 	return qf;
 }
 
@@ -149,6 +188,15 @@ static quadfile* my_open(const char* fn, anqfits_t* fits) {
     }
     chunk = quads_chunk(qf);
 	qf->quadarray = chunk->data;
+	if (!qf->quadarray) {
+		qf->packblocks = fitsbin_get_chunk(qf->fb, CHUNK_PACKBLOCKS)->data;
+		qf->packbits = fitsbin_get_chunk(qf->fb, CHUNK_PACKBITS)->data;
+		if (!(qf->packblock && qf->packblocks && qf->packbits)) {
+			ERROR("Couldn't find table \"quads\" (or packed quads) in file \"%s\"",
+				  fitsbin_get_filename(qf->fb));
+			goto bailout;
+		}
+	}
     return qf;
 
  bailout:
@@ -304,6 +352,18 @@ int quadfile_write_quad(quadfile* qf, unsigned int* stars) {
 
 int quadfile_write_all_quads_to(quadfile* qf, FILE* fid) {
 	fitsbin_chunk_t* chunk = quads_chunk(qf);
+	if (quadfile_is_packed(qf)) {
+		unsigned int i;
+		uint32_t stars[DQMAX];
+		for (i=0; i<qf->numquads; i++) {
+			quadfile_get_stars(qf, i, stars);
+			if (fitsbin_write_items_to(chunk, stars, 1, fid)) {
+				ERROR("Failed to write quad %i", i);
+				return -1;
+			}
+		}
+		return 0;
+	}
 	if (fitsbin_write_items_to(chunk, qf->quadarray, quadfile_nquads(qf), fid)) {
 		ERROR("Failed to write %i quads", quadfile_nquads(qf));
 		return -1;
@@ -311,6 +371,171 @@ int quadfile_write_all_quads_to(quadfile* qf, FILE* fid) {
 	return 0;
 }
 
+anbool quadfile_is_packed(const quadfile* qf) {
+	return (qf->packbits != NULL);
+}
+
+static int nbits_needed(uint64_t x) {
+	int n = 0;
+	while (x) {
+		n++;
+		x >>= 1;
+	}
+	return n;
+}
+
+// (star IDs are 32-bit, so their differences need 33 bits.)
+static uint64_t zigzag(int64_t x) {
+	return (x >= 0) ? (uint64_t)(2 * x) : (uint64_t)(-2 * x - 1);
+}
+
+static int64_t unzigzag(uint64_t z) {
+	return (int64_t)(z >> 1) ^ -(int64_t)(z & 1);
+}
+
+static void put_bits(uint64_t* words, uint64_t bit, int nbits, uint64_t val) {
+	uint64_t w = bit >> 6;
+	int shift = bit & 63;
+	if (!nbits)
+		return;
+	words[w] |= (val << shift);
+	if (shift + nbits > 64)
+		words[w+1] |= (val >> (64 - shift));
+}
+
+static uint64_t get_bits(const uint64_t* words, uint64_t bit, int nbits) {
+	uint64_t w = bit >> 6;
+	int shift = bit & 63;
+	uint64_t v;
+	if (!nbits)
+		return 0;
+	v = words[w] >> shift;
+	if (shift + nbits > 64)
+		v |= words[w+1] << (64 - shift);
+	return v & ((1ULL << nbits) - 1);
+}
+
+int quadfile_write_packed_to(quadfile* qf, int blocksize, FILE* fid,
+							 size_t* p_nbytes) {
+	int nblocks;
+	quadfile_block_t* blocks;
+	uint64_t* words;
+	uint64_t nbits;
+	size_t nwords;
+	int b, j;
+	int D = qf->dimquads;
+	qfits_header* hdr;
+	fitsbin_chunk_t chunk;
+	int rtn = -1;
+
+	if (!qf->numquads) {
+		ERROR("Quad file has no quads to pack");
+		return -1;
+	}
+	if (!blocksize)
+		blocksize = QUADFILE_DEFAULT_PACK_BLOCK;
+	nblocks = (qf->numquads + blocksize - 1) / blocksize;
+	blocks = calloc(nblocks, sizeof(quadfile_block_t));
+	if (!blocks) {
+		SYSERROR("Failed to allocate %i packed quad blocks", nblocks);
+		return -1;
+	}
+
+	// Choose each block's base and bit widths, and find the total size.
+	nbits = 0;
+	for (b=0; b<nblocks; b++) {
+		quadfile_block_t* blk = blocks + b;
+		unsigned int q0 = b * blocksize;
+		unsigned int q1 = MIN(q0 + blocksize, qf->numquads);
+		uint32_t lo = UINT32_MAX, hi = 0;
+		uint64_t maxdelta = 0;
+		unsigned int q;
+		for (q=q0; q<q1; q++) {
+			unsigned int stars[DQMAX];
+			quadfile_get_stars(qf, q, stars);
+			lo = MIN(lo, stars[0]);
+			hi = MAX(hi, stars[0]);
+			for (j=1; j<D; j++)
+				maxdelta = MAX(maxdelta, zigzag((int64_t)stars[j] - (int64_t)stars[0]));
+		}
+		blk->bitoffset = nbits;
+		blk->base = lo;
+		blk->nbits_first = nbits_needed(hi - lo);
+		blk->nbits_delta = nbits_needed(maxdelta);
+		nbits += (uint64_t)(q1 - q0) * (blk->nbits_first + (D-1) * blk->nbits_delta);
+	}
+	// (plus a word of padding so that reading never runs off the end)
+	nwords = (nbits + 63) / 64 + 1;
+	words = calloc(nwords, sizeof(uint64_t));
+	if (!words) {
+		SYSERROR("Failed to allocate %zu words for packed quads", nwords);
+		goto bailout;
+	}
+
+	for (b=0; b<nblocks; b++) {
+		quadfile_block_t* blk = blocks + b;
+		unsigned int q0 = b * blocksize;
+		unsigned int q1 = MIN(q0 + blocksize, qf->numquads);
+		uint64_t bit = blk->bitoffset;
+		unsigned int q;
+		for (q=q0; q<q1; q++) {
+			unsigned int stars[DQMAX];
+			quadfile_get_stars(qf, q, stars);
+			put_bits(words, bit, blk->nbits_first, stars[0] - blk->base);
+			bit += blk->nbits_first;
+			for (j=1; j<D; j++) {
+				put_bits(words, bit, blk->nbits_delta,
+						 zigzag((int64_t)stars[j] - (int64_t)stars[0]));
+				bit += blk->nbits_delta;
+			}
+		}
+	}
+
+	hdr = fitsbin_get_primary_header(qf->fb);
+	add_to_header(hdr, qf);
+	if (qfits_header_getstr(hdr, "QPACKED"))
+		qfits_header_mod(hdr, "QPACKED", "T", "The quads are packed.");
+	else
+		qfits_header_add(hdr, "QPACKED", "T", "The quads are packed.", NULL);
+	fits_header_set_int(hdr, "QPBLOCK", blocksize, "Number of quads per packed block.");
+	if (fitsbin_write_primary_header_to(qf->fb, fid)) {
+		ERROR("Failed to write quadfile header");
+		goto bailout;
+	}
+
+	fitsbin_chunk_init(&chunk);
+	chunk.tablename = "quadblocks";
+	chunk.itemsize = sizeof(quadfile_block_t);
+	chunk.nrows = nblocks;
+	chunk.data = blocks;
+	if (fitsbin_write_chunk_to(qf->fb, &chunk, fid) ||
+		fits_pad_file(fid)) {
+		ERROR("Failed to write packed quad blocks");
+		goto bailout;
+	}
+	fitsbin_chunk_clean(&chunk);
+
+	fitsbin_chunk_init(&chunk);
+	chunk.tablename = "quadbits";
+	chunk.itemsize = sizeof(uint64_t);
+	chunk.nrows = nwords;
+	chunk.data = words;
+	if (fitsbin_write_chunk_to(qf->fb, &chunk, fid) ||
+		fits_pad_file(fid)) {
+		ERROR("Failed to write packed quads");
+		goto bailout;
+	}
+	fitsbin_chunk_clean(&chunk);
+
+	if (p_nbytes)
+		*p_nbytes = nblocks * sizeof(quadfile_block_t) + nwords * sizeof(uint64_t);
+	rtn = 0;
+ bailout:
+	free(blocks);
+	free(words);
+	return rtn;
+}
+
 int quadfile_fix_header(quadfile* qf) {
 	qfits_header* hdr;
 	fitsbin_t* fb = qf->fb;
@@ -346,6 +571,20 @@ int quadfile_get_stars(const quadfile* qf, unsigned int quadid, unsigned int* st
 		return -1;
 	}
 
+	if (qf->packbits) {
+		const quadfile_block_t* blk = qf->packblocks + (quadid / qf->packblock);
+		uint64_t bit = blk->bitoffset + (uint64_t)(quadid % qf->packblock) *
+			(blk->nbits_first + (qf->dimquads - 1) * blk->nbits_delta);
+		stars[0] = blk->base + get_bits(qf->packbits, bit, blk->nbits_first);
+		bit += blk->nbits_first;
+		for (i=1; i<qf->dimquads; i++) {
+			stars[i] = (int64_t)stars[0] +
+				unzigzag(get_bits(qf->packbits, bit, blk->nbits_delta));
+			bit += blk->nbits_delta;
+		}
+		return 0;
+	}
+
     for (i=0; i<qf->dimquads; i++) {
         stars[i] = qf->quadarray[quadid * qf->dimquads + i];
     }
@@ -27,6 +27,26 @@
 #include "fitsbin.h"
 #include "anqfits.h"
 
+/**
+ Packed quads (see quadfile_write_packed_to()) are stored in blocks of
+ "packblock" quads.  Within a block, each quad takes
+ (nbits_first + (dimquads-1) * nbits_delta) bits: its first star as an
+ offset from "base", then the other stars as zigzag-coded differences
+ from the first star.
+ */
+struct quadfile_block {
+	// bit offset of the block's first quad in "packbits".
+	uint64_t bitoffset;
+	// the smallest first-star ID in the block.
+	uint32_t base;
+	uint8_t nbits_first;
+	uint8_t nbits_delta;
+	uint16_t padding;
+};
+typedef struct quadfile_block quadfile_block_t;
+
+#define QUADFILE_DEFAULT_PACK_BLOCK 64
+
 struct quadfile {
 	unsigned int numquads;
 	unsigned int numstars;
@@ -45,6 +65,11 @@ struct quadfile {
 	fitsbin_t* fb;
 	// when reading:
 	uint32_t* quadarray;
+
+	// when reading packed quads: (quadarray is NULL)
+	int packblock;
+	quadfile_block_t* packblocks;
+	uint64_t* packbits;
 };
 typedef struct quadfile quadfile;
 
@@ -92,4 +117,21 @@ int quadfile_write_header_to(quadfile* qf, FILE* fid);
 
 int quadfile_write_all_quads_to(quadfile* qf, FILE* fid);
 
+// Reading: are the quads stored packed?
+anbool quadfile_is_packed(const quadfile* qf);
+
+/**
+ Writes the header and quads of "qf" (open for reading) to "fid", in
+ the packed format, with "blocksize" quads per block (0 for the
+ default).  The packed format is usually less than half the size; it
+ compresses best when the quads' stars have nearby IDs, as they do in
+ index files, where the stars are in kdtree order.
+
+ The result can be read with quadfile_open(), or appended to to form an
+ index file.  The packed size is returned in "p_nbytes", if non-NULL.
+ A quad file with no quads can't be packed.  Returns 0 on success.
+ */
+int quadfile_write_packed_to(quadfile* qf, int blocksize, FILE* fid,
+                             size_t* p_nbytes);
+
 #endif
@@ -204,3 +204,68 @@ void RadixSort11(real32 *farray, real32 *sorted, uint32 elements)
 	// memcpy(array, sorted, elements * 4);
 }
 
+
+// ================================================================================================
+// Radix sort of 64-bit keys with values: LSD, so it's stable.  11-bit digits, as above; a
+// digit that is the same for all the keys (eg, the exponent bits of a narrow range of
+// magnitudes) costs only its share of the histogramming pass.
+// ================================================================================================
+#define _k(x, p)	((uint32)((x) >> (11 * (p))) & 0x7FF)
+
+void RadixSort11Keys64(uint64_t *keys, uint32 *vals,
+					   uint64_t *keys2, uint32 *vals2, size_t elements)
+{
+	const uint32 kHist = 2048;
+	const int kPasses = 6;
+	size_t i;
+	int p;
+	size_t *b0;
+	uint64_t *src = keys, *dst = keys2, *tk;
+	uint32 *vsrc = vals, *vdst = vals2, *tv;
+
+	if (elements < 2)
+		return;
+	b0 = calloc(kHist * kPasses, sizeof(size_t));
+
+	// 1.  histogram all the digits in one pass
+	for (i = 0; i < elements; i++) {
+		uint64_t ki = keys[i];
+		pf(keys);
+		for (p = 0; p < kPasses; p++)
+			b0[p * kHist + _k(ki, p)] ++;
+	}
+
+	for (p = 0; p < kPasses; p++) {
+		size_t *b = b0 + p * kHist;
+		size_t sum = 0, tsum;
+		uint32 j;
+
+		// 2.  skip digits shared by every key
+		if (b[_k(src[0], p)] == elements)
+			continue;
+
+		// 3.  each histogram entry becomes the position of its first element
+		for (j = 0; j < kHist; j++) {
+			tsum = b[j] + sum;
+			b[j] = sum;
+			sum = tsum;
+		}
+
+		// 4.  scatter src -> dst
+		for (i = 0; i < elements; i++) {
+			uint64_t ki = src[i];
+			size_t pos = b[_k(ki, p)]++;
+			pf2(src);
+			dst[pos] = ki;
+			vdst[pos] = vsrc[i];
+		}
+		tk = src; src = dst; dst = tk;
+		tv = vsrc; vsrc = vdst; vdst = tv;
+	}
+
+	if (src != keys) {
+		memcpy(keys, src, elements * sizeof(uint64_t));
+		memcpy(vals, vsrc, elements * sizeof(uint32));
+	}
+	free(b0);
+}
@@ -9,6 +9,7 @@
 #define RADIX_H_
 
 #include <stdint.h>
+#include <stddef.h>
 
 typedef uint32_t uint32;
 typedef float    real32;
@@ -17,4 +18,11 @@ typedef float    real32;
 // Your input array will be modified.
 void RadixSort11(real32 *farray, real32 *sorted, uint32 elements);
 
+// Stable sort of 64-bit unsigned "keys" into ascending order, carrying
+// a 32-bit value (eg, the original index) along with each key.
+// "keys2" and "vals2" are scratch space of the same size; the result
+// ends up in "keys" and "vals".
+void RadixSort11Keys64(uint64_t *keys, uint32 *vals,
+					   uint64_t *keys2, uint32 *vals2, size_t elements);
+
 #endif
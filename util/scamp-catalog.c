@@ -99,7 +99,10 @@ int scamp_catalog_write_field_header(scamp_cat_t* scamp, const qfits_header* hdr
         ERROR("Failed to fix scamp catalog header.\n");
         return -1;
     }
-    fitstable_next_extension(scamp->table);
+    if (fitstable_next_extension(scamp->table)) {
+        ERROR("Failed to finish scamp catalog extension.\n");
+        return -1;
+    }
     fitstable_clear_table(scamp->table);
 
     if (scamp->ref) {
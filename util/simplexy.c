@@ -131,6 +131,249 @@ static void write_fits_i16_image(const int16_t* img, int nx, int ny, const char*
 }
 
 
+/*
+ The multi-threaded mode splits the image into horizontal bands of
+ rows, one per thread.  Each band is processed along with a halo of the
+ neighbouring rows -- the median-filter box for the u8 background, the
+ PSF kernel radius for smoothing, the mask box size for masking -- so
+ the results are the same as processing the whole image at once.  The
+ connected-components labelling is done on the whole mask, so objects
+ that cross band edges aren't split (and so needn't be de-duplicated);
+ finding the peaks in each object is then shared out among the threads.
+ */
+struct bands {
+	int nx, ny;
+	// ctmf
+	const uint8_t* image_u8;
+	uint8_t* bg_u8;
+	int halfbox;
+	// dsmooth2
+	float* bgsub;
+	int16_t* bgsub_i16;
+	float dpsf;
+	float* smoothed;
+	// dmask
+	float limit;
+	uint8_t* mask;
+	int* flagged;
+};
+
+static void ctmf_band(void* token, int band, int j0, int j1) {
+	struct bands* b = token;
+	int nx = b->nx;
+	int r = b->halfbox;
+	int lo, hi;
+	uint8_t* bg;
+	lo = MAX(0, j0 - r);
+	hi = MIN(b->ny, j1 + r);
+	// ctmf needs at least 2r+1 rows; extra rows don't change the result.
+	if (hi - lo < 2*r+1) {
+		if (lo == 0)
+			hi = MIN(b->ny, 2*r+1);
+		else
+			lo = MAX(0, hi - (2*r+1));
+	}
+	bg = malloc((size_t)nx * (hi - lo));
+	ctmf(b->image_u8 + (size_t)lo * nx, bg, nx, hi - lo, nx, nx, r, 1, 512*1024);
+	memcpy(b->bg_u8 + (size_t)j0 * nx, bg + (size_t)(j0 - lo) * nx,
+		   (size_t)nx * (j1 - j0));
+	free(bg);
+}
+
+static void smooth_band(void* token, int band, int j0, int j1) {
+	struct bands* b = token;
+	int nx = b->nx;
+	// (the dsmooth2 kernel radius)
+	int half = (int)ceilf(3. * b->dpsf);
+	int lo, hi;
+	float* sm;
+	lo = MAX(0, j0 - half);
+	hi = MIN(b->ny, j1 + half);
+	sm = malloc((size_t)nx * (hi - lo) * sizeof(float));
+	if (b->bgsub)
+		dsmooth2(b->bgsub + (size_t)lo * nx, nx, hi - lo, b->dpsf, sm);
+	else
+		dsmooth2_i16(b->bgsub_i16 + (size_t)lo * nx, nx, hi - lo, b->dpsf, sm);
+	memcpy(b->smoothed + (size_t)j0 * nx, sm + (size_t)(j0 - lo) * nx,
+		   (size_t)nx * (j1 - j0) * sizeof(float));
+	free(sm);
+}
+
+static void mask_band(void* token, int band, int j0, int j1) {
+	struct bands* b = token;
+	memset(b->mask + (size_t)j0 * b->nx, 0, (size_t)b->nx * (j1 - j0));
+	b->flagged[band] = dmask_rows(b->smoothed, b->nx, b->ny, b->limit,
+								  b->dpsf, b->mask, j0, j1);
+}
+
+static void median_filter_u8(simplexy_t* s, const uint8_t* img, uint8_t* bg,
+							 int r) {
+	struct bands b;
+	if (s->nthreads <= 1) {
+		ctmf(img, bg, s->nx, s->ny, s->nx, s->nx, r, 1, 512*1024);
+		return;
+	}
+	memset(&b, 0, sizeof(struct bands));
+	b.nx = s->nx;
+	b.ny = s->ny;
+	b.image_u8 = img;
+	b.bg_u8 = bg;
+	b.halfbox = r;
+	dbands(s->ny, s->nthreads, ctmf_band, &b);
+}
+
+/*
+ ctmf() keeps its histogram counts in 16 bits, so the (2r+1)^2 pixels
+ in the box must number fewer than 65536; it also needs the image to be
+ at least 2r+1 pixels in each direction.
+ */
+#define CTMF_MAX_RADIUS 127
+
+static int ctmf_radius(simplexy_t* s) {
+	int r = s->halfbox;
+	if (r > CTMF_MAX_RADIUS) {
+		logverb("simplexy: reducing median-filter half-box from %i to %i\n",
+				r, CTMF_MAX_RADIUS);
+		r = CTMF_MAX_RADIUS;
+	}
+	if (MIN(s->nx, s->ny) < 2*r+1)
+		r = floor(((float)MIN(s->nx, s->ny) - 1.0) / 2.0);
+	assert(MIN(s->nx, s->ny) >= 2*r+1);
+	return r;
+}
+
+/*
+ Background estimation for float images with ctmf(): a median over the
+ sliding box around every pixel, rather than medians on a grid that are
+ then interpolated, so it follows strong gradients more closely.
+
+ ctmf() works on 8-bit images, so the image is quantized.  The range is
+ set by the medians of coarse blocks (so the stars don't stretch it),
+ padded by 8 sigma on each side; the median of a quantized value is the
+ quantized median, so the background is good to one quantization step,
+ which is a fraction of sigma unless the background spans a range of
+ more than a few hundred sigma.
+ */
+static void ctmf_background(simplexy_t* s, float* bg) {
+	int nx = s->nx, ny = s->ny;
+	int r = ctmf_radius(s);
+	int block = MAX(1, s->halfbox);
+	int stride = MAX(1, block / 16);
+	int bi, bj, i, j, nb, nmed;
+	float *samples, *medians;
+	float bmin, bmax, lo, q, fill;
+	uint8_t *img8, *med8;
+	int qfill;
+
+	// block medians, from a subsample of each block.
+	medians = malloc(((nx + block - 1) / block) * ((ny + block - 1) / block) *
+					 sizeof(float));
+	samples = malloc(((block + stride - 1) / stride) *
+					 ((block + stride - 1) / stride) * sizeof(float));
+	nmed = 0;
+	for (bj=0; bj<ny; bj+=block)
+		for (bi=0; bi<nx; bi+=block) {
+			nb = 0;
+			for (j=bj; j<MIN(ny, bj+block); j+=stride)
+				for (i=bi; i<MIN(nx, bi+block); i+=stride) {
+					float f = s->image[j*nx + i];
+					if (!isfinite(f))
+						continue;
+					samples[nb++] = f;
+				}
+			if (nb == 0)
+				continue;
+			medians[nmed++] = dselip(nb/2, nb, samples);
+		}
+	free(samples);
+	if (nmed == 0) {
+		// no finite pixels at all.
+		for (i=0; i<nx*ny; i++)
+			bg[i] = 0.0;
+		free(medians);
+		return;
+	}
+	bmin = bmax = medians[0];
+	for (i=1; i<nmed; i++) {
+		bmin = MIN(bmin, medians[i]);
+		bmax = MAX(bmax, medians[i]);
+	}
+	fill = dselip(nmed/2, nmed, medians);
+	free(medians);
+
+	lo = bmin - 8. * s->sigma;
+	q = ((bmax + 8. * s->sigma) - lo) / 255.;
+	if (!(q > 0))
+		q = 1.0;
+	logverb("simplexy: ctmf background: range [%g, %g], step %g (%g sigma)\n",
+			lo, lo + 255. * q, q, q / s->sigma);
+
+	img8 = malloc(nx * ny);
+	med8 = malloc(nx * ny);
+	qfill = MAX(0, MIN(255, (int)floor((fill - lo) / q)));
+	for (i=0; i<nx*ny; i++) {
+		float f = s->image[i];
+		float v;
+		if (!isfinite(f)) {
+			img8[i] = qfill;
+			continue;
+		}
+		v = floor((f - lo) / q);
+		img8[i] = (v < 0) ? 0 : ((v > 255) ? 255 : (uint8_t)v);
+	}
+	median_filter_u8(s, img8, med8, r);
+	free(img8);
+	// (the middle of the quantization step)
+	for (i=0; i<nx*ny; i++)
+		bg[i] = lo + ((float)med8[i] + 0.5) * q;
+	free(med8);
+}
+
+static void smooth_image(simplexy_t* s, float* bgsub, int16_t* bgsub_i16,
+						 float* smoothed) {
+	struct bands b;
+	if (s->nthreads <= 1) {
+		if (bgsub)
+			dsmooth2(bgsub, s->nx, s->ny, s->dpsf, smoothed);
+		else
+			dsmooth2_i16(bgsub_i16, s->nx, s->ny, s->dpsf, smoothed);
+		return;
+	}
+	memset(&b, 0, sizeof(struct bands));
+	b.nx = s->nx;
+	b.ny = s->ny;
+	b.bgsub = bgsub;
+	b.bgsub_i16 = bgsub_i16;
+	b.dpsf = s->dpsf;
+	b.smoothed = smoothed;
+	dbands(s->ny, s->nthreads, smooth_band, &b);
+}
+
+static int mask_image(simplexy_t* s, float* smoothed, float limit,
+					  uint8_t* mask) {
+	struct bands b;
+	int i, flagged;
+	if (s->nthreads <= 1)
+		return dmask(smoothed, s->nx, s->ny, limit, s->dpsf, mask);
+	memset(&b, 0, sizeof(struct bands));
+	b.nx = s->nx;
+	b.ny = s->ny;
+	b.smoothed = smoothed;
+	b.limit = limit;
+	b.dpsf = s->dpsf;
+	b.mask = mask;
+	b.flagged = calloc(s->nthreads, sizeof(int));
+	dbands(s->ny, s->nthreads, mask_band, &b);
+	flagged = 0;
+	for (i=0; i<s->nthreads; i++)
+		flagged |= b.flagged[i];
+	free(b.flagged);
+	if (!flagged)
+		// (for its explanation of why)
+		return dmask(smoothed, s->nx, s->ny, limit, s->dpsf, mask);
+	return 1;
+}
+
 void simplexy_fill_in_defaults(simplexy_t* s) {
 	if (s->dpsf == 0)
 		s->dpsf = SIMPLEXY_DEFAULT_DPSF;
@@ -214,6 +457,8 @@ int simplexy_run(simplexy_t* s) {
             s->dpsf, s->plim, s->dlim, s->saddle);
     logverb("simplexy: maxper=%d, maxnpeaks=%d, maxsize=%d, halfbox=%d\n",
             s->maxper, s->maxnpeaks, s->maxsize, s->halfbox);
+	if (s->nthreads > 1)
+		logverb("simplexy: using %i threads\n", s->nthreads);
 
 	if (s->invert) {
 		if (s->image) {
@@ -225,6 +470,18 @@ int simplexy_run(simplexy_t* s) {
 		}
 	}
 
+	// estimate the noise in the image (sigma)
+	if (s->sigma == 0.0) {
+		logverb("simplexy: measuring image noise (sigma)...\n");
+		if (s->image_u8)
+			dsigma_u8(s->image_u8, nx, ny, 5, 0, &(s->sigma));
+		else
+			dsigma(s->image, nx, ny, 5, 0, &(s->sigma));
+		logverb("simplexy: found sigma=%g.\n", s->sigma);
+	} else {
+		logverb("simplexy: assuming sigma=%g.\n", s->sigma);
+	}
+
 	if (s->nobgsub) {
 		if (s->image)
 			bgsub = s->image;
@@ -243,7 +500,11 @@ int simplexy_run(simplexy_t* s) {
 			float* medianfiltered;
 			medianfiltered = malloc(nx * ny * sizeof(float));
 			bgfree = medianfiltered;
-			dmedsmooth(s->image, NULL, nx, ny, s->halfbox, medianfiltered);
+			if (s->bgmethod == SIMPLEXY_BG_CTMF)
+				ctmf_background(s, medianfiltered);
+			else
+				dmedsmooth_threaded(s->image, NULL, nx, ny, s->halfbox,
+									medianfiltered, s->nthreads);
 
 			if (s->bgimgfn) {
 				logverb("Writing background (median-filtered) image \"%s\"\n", s->bgimgfn);
@@ -260,12 +521,10 @@ int simplexy_run(simplexy_t* s) {
 			// u8 image: run faster ctmf() median-smoother.
 			unsigned char* medianfiltered_u8;
 
-			if (MIN(nx,ny) < 2*s->halfbox+1)
-				s->halfbox = floor(((float)MIN(nx,ny) - 1.0) / 2.0);
-			assert(MIN(nx,ny) >= 2*s->halfbox+1);
+			s->halfbox = ctmf_radius(s);
 
 			medianfiltered_u8 = malloc(nx * ny * sizeof(unsigned char));
-			ctmf(s->image_u8, medianfiltered_u8, nx, ny, nx, nx, s->halfbox, 1, 512*1024);
+			median_filter_u8(s, s->image_u8, medianfiltered_u8, s->halfbox);
 
 			if (s->bgimgfn) {
 				logverb("Writing background (median-filtered) image \"%s\"\n", s->bgimgfn);
@@ -295,10 +554,7 @@ int simplexy_run(simplexy_t* s) {
 		smoothfree = smoothed;
 		/* smooth by the point spread function (the optimal detection
 		 filter, since we assume a symmetric Gaussian PSF) */
-		if (bgsub)
-			dsmooth2(bgsub, nx, ny, s->dpsf, smoothed);
-		else
-			dsmooth2_i16(bgsub_i16, nx, ny, s->dpsf, smoothed);
+		smooth_image(s, bgsub, bgsub_i16, smoothed);
 	} else {
 		if (bgsub)
 			smoothed = bgsub;
@@ -316,18 +572,6 @@ int simplexy_run(simplexy_t* s) {
 		write_fits_float_image(smoothed, nx, ny, s->smoothimgfn);
 	}
 
-	// estimate the noise in the image (sigma)
-	if (s->sigma == 0.0) {
-		logverb("simplexy: measuring image noise (sigma)...\n");
-		if (s->image_u8)
-			dsigma_u8(s->image_u8, nx, ny, 5, 0, &(s->sigma));
-		else
-			dsigma(s->image, nx, ny, 5, 0, &(s->sigma));
-		logverb("simplexy: found sigma=%g.\n", s->sigma);
-	} else {
-		logverb("simplexy: assuming sigma=%g.\n", s->sigma);
-	}
-
 	/* The noise in the psf-smoothed image is (approximately) 
 	 *    sigma / (2 * sqrt(pi) * dpsf)
 	 * This ignores the pixelization, replacing the sum by integral.
@@ -344,7 +588,7 @@ int simplexy_run(simplexy_t* s) {
 
 	/* find pixels above the noise level, and flag a box of pixels around each one. */
 	mask = malloc(nx*ny);
-	if (!dmask(smoothed, nx, ny, limit, s->dpsf, mask)) {
+	if (!mask_image(s, smoothed, limit, mask)) {
 		FREEVEC(smoothfree);
 		return 0;
 	}
@@ -407,11 +651,14 @@ int simplexy_run(simplexy_t* s) {
 	/* find all peaks within each object */
     logverb("simplexy: finding peaks...\n");
 	if (bgsub)
-		dallpeaks(bgsub, nx, ny, ccimg, s->x, s->y, &(s->npeaks), s->dpsf,
-				  s->sigma, s->dlim, s->saddle, s->maxper, s->maxnpeaks, s->sigma, s->maxsize);
+		dallpeaks_threaded(bgsub, nx, ny, ccimg, s->x, s->y, &(s->npeaks),
+						   s->dpsf, s->sigma, s->dlim, s->saddle, s->maxper,
+						   s->maxnpeaks, s->sigma, s->maxsize, s->nthreads);
 	else
-		dallpeaks_i16(bgsub_i16, nx, ny, ccimg, s->x, s->y, &(s->npeaks), s->dpsf,
-					  s->sigma, s->dlim, s->saddle, s->maxper, s->maxnpeaks, s->sigma, s->maxsize);
+		dallpeaks_threaded_i16(bgsub_i16, nx, ny, ccimg, s->x, s->y,
+							   &(s->npeaks), s->dpsf, s->sigma, s->dlim,
+							   s->saddle, s->maxper, s->maxnpeaks, s->sigma,
+							   s->maxsize, s->nthreads);
     logmsg("simplexy: found %i sources.\n", s->npeaks);
 	FREEVEC(ccimg);
 
@@ -34,6 +34,12 @@
 #define SIMPLEXY_U8_DEFAULT_PLIM     4.0
 #define SIMPLEXY_U8_DEFAULT_SADDLE   2.0
 
+// Background estimation methods for float images ("bgmethod"):
+// medians on a grid of "halfbox" spacing, interpolated (dmedsmooth)
+#define SIMPLEXY_BG_GRID 0
+// median in a sliding box around each pixel (ctmf, on a quantized image)
+#define SIMPLEXY_BG_CTMF 1
+
 struct simplexy_t {
     /******
      Inputs
@@ -62,6 +68,10 @@ struct simplexy_t {
 	// don't do background subtraction.
 	anbool nobgsub;
 
+	// how to estimate the background of float images: SIMPLEXY_BG_*.
+	// (u8 images always use ctmf.)
+	int bgmethod;
+
 	// global background.
 	float globalbg;
 
@@ -72,6 +82,10 @@ struct simplexy_t {
 	// otherwise a value will be estimated.
     float sigma;
 
+	// If > 1, split the work among this many threads.  The results are
+	// the same as with one.
+	int nthreads;
+
     /******
      Outputs
      ******/
@@ -22,14 +22,21 @@
 
 #include "tabsort.h"
 #include "fitsioutils.h"
+#include "log.h"
 
-static const char* OPTIONS = "hd";
+static const char* OPTIONS = "hdm:t:T:v";
 
 static void printHelp(char* progname) {
 	printf("%s  [options]  <column-name> <input-file> <output-file>\n"
            "  options include:\n"
-		   "      [-d]: sort in descending order (default, ascending)\n",
-		   progname);
+		   "      [-d]: sort in descending order (default, ascending)\n"
+		   "    For tables larger than memory, sort pieces and merge them\n"
+		   "    (this keeps rows with equal values in their original order):\n"
+		   "      [-m <MB>]: use about this much memory (default %i MB)\n"
+		   "      [-t <threads>]: number of threads for sorting pieces (default 1)\n"
+		   "      [-T <temp-dir>]: where to put the pieces\n"
+		   "      [-v]: verbose\n",
+		   progname, (int)(TABSORT_DEFAULT_MEMORY / (1024 * 1024)));
 }
 
 extern char *optarg;
@@ -42,12 +49,32 @@ int main(int argc, char *argv[]) {
 	char* colname = NULL;
 	char* progname = argv[0];
 	anbool descending = FALSE;
+	anbool external = FALSE;
+	size_t mem = 0;
+	int nthreads = 1;
+	char* tempdir = NULL;
+	int loglvl = LOG_MSG;
 
     while ((argchar = getopt(argc, argv, OPTIONS)) != -1)
         switch (argchar) {
 		case 'd':
 			descending = TRUE;
 			break;
+		case 'm':
+			mem = (size_t)atoi(optarg) * 1024 * 1024;
+			external = TRUE;
+			break;
+		case 't':
+			nthreads = atoi(optarg);
+			external = TRUE;
+			break;
+		case 'T':
+			tempdir = optarg;
+			external = TRUE;
+			break;
+		case 'v':
+			loglvl++;
+			break;
         case '?':
         case 'h':
 			printHelp(progname);
@@ -65,8 +92,12 @@ int main(int argc, char *argv[]) {
     infn    = argv[optind+1];
     outfn   = argv[optind+2];
 
+    log_init(loglvl);
     fits_use_error_system();
 
+	if (external)
+		return tabsort_external(infn, outfn, colname, descending, mem,
+								nthreads, tempdir);
     return tabsort(infn, outfn, colname, descending);
 }
 
@@ -21,21 +21,463 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/mman.h>
+#include <sys/param.h>
 
+#include "tabsort.h"
 #include "anqfits.h"
 #include "ioutils.h"
 #include "fitsioutils.h"
 #include "permutedsort.h"
+#include "radix.h"
 #include "errors.h"
+#include "log.h"
 
-int tabsort(const char* infn, const char* outfn, const char* colname,
-            anbool descending) {
+/*
+ External sorting: the table is cut into runs that fit in the memory
+ budget; each run is read, sorted (with a radix sort on keys that
+ order the same way as the column values) and written to a temp file,
+ by several threads at once.  The runs are then merged, at most
+ MERGE_FANIN at a time.  The result is a stable sort.
+ */
+#define MERGE_FANIN 64
+// size of the buffer for gathering output rows.
+#define OUT_BUFSIZE (1024 * 1024)
+
+typedef struct {
+	int fd;
+	off_t datstart;
+	size_t rowsize;
+	int keyoff;
+	tfits_type keytype;
+	anbool descending;
+	size_t N;
+	size_t runrows;
+	int nruns;
+	char** runfns;
+	// next run to sort, and whether any has failed; guarded by "mutex".
+	int nextrun;
+	anbool failed;
+	pthread_mutex_t mutex;
+} extsort_t;
+
+// Rows to be written, gathered into a buffer.
+typedef struct {
+	FILE* fid;
+	char* buf;
+	size_t n;
+	size_t size;
+} rowwriter_t;
+
+static int rowwriter_flush(rowwriter_t* w) {
+	if (w->n && fwrite(w->buf, 1, w->n, w->fid) != w->n) {
+		SYSERROR("Failed to write sorted rows");
+		return -1;
+	}
+	w->n = 0;
+	return 0;
+}
+
+static int rowwriter_put(rowwriter_t* w, const unsigned char* row, size_t R) {
+	if (w->n + R > w->size && rowwriter_flush(w))
+		return -1;
+	if (R > w->size)
+		return (fwrite(row, 1, R, w->fid) == R) ? 0 : -1;
+	memcpy(w->buf + w->n, row, R);
+	w->n += R;
+	return 0;
+}
+
+/*
+ Returns a key that sorts (as an unsigned integer) the same way that
+ the big-endian FITS value does with compare_{doubles,floats,int64}_
+ {asc,desc}: -0 and +0 are equal, and NaNs come last either way.
+ */
+static uint64_t sort_key(const unsigned char* p, tfits_type type,
+						 anbool descending) {
+	uint64_t u = 0;
+	int i, n = (type == TFITS_BIN_TYPE_E) ? 4 : 8;
+	for (i=0; i<n; i++)
+		u = (u << 8) | p[i];
+	switch (type) {
+	case TFITS_BIN_TYPE_D:
+		if ((u << 1) > (UINT64_C(0x7FF) << 53))
+			return UINT64_MAX;
+		if ((u << 1) == 0)
+			u = 0;
+		u = (u >> 63) ? ~u : (u | (UINT64_C(1) << 63));
+		break;
+	case TFITS_BIN_TYPE_E:
+		if ((uint32_t)(u << 1) > (UINT32_C(0xFF) << 24))
+			return UINT64_MAX;
+		if ((uint32_t)(u << 1) == 0)
+			u = 0;
+		u = (u >> 31) ? (~u & 0xFFFFFFFF) : (u | 0x80000000);
+		break;
+	default:
+		u ^= (UINT64_C(1) << 63);
+		break;
+	}
+	if (descending)
+		u = ~u;
+	return u;
+}
+
+static int read_rows(int fd, off_t offset, void* vbuf, size_t nbytes) {
+	char* buf = vbuf;
+	while (nbytes) {
+		ssize_t nr = pread(fd, buf, nbytes, offset);
+		if (nr <= 0) {
+			if (nr < 0 && errno == EINTR)
+				continue;
+			SYSERROR("Failed to read table rows");
+			return -1;
+		}
+		buf += nr;
+		offset += nr;
+		nbytes -= nr;
+	}
+	return 0;
+}
+
+typedef struct {
+	unsigned char* rows;
+	uint64_t* keys;
+	uint32_t* vals;
+	uint64_t* keys2;
+	uint32_t* vals2;
+	char* outbuf;
+} runbufs_t;
+
+static void free_runbufs(runbufs_t* b) {
+	free(b->rows);
+	free(b->keys);
+	free(b->vals);
+	free(b->keys2);
+	free(b->vals2);
+	free(b->outbuf);
+}
+
+static int alloc_runbufs(extsort_t* s, runbufs_t* b) {
+	memset(b, 0, sizeof(runbufs_t));
+	b->rows  = malloc(s->runrows * s->rowsize);
+	b->keys  = malloc(s->runrows * sizeof(uint64_t));
+	b->vals  = malloc(s->runrows * sizeof(uint32_t));
+	b->keys2 = malloc(s->runrows * sizeof(uint64_t));
+	b->vals2 = malloc(s->runrows * sizeof(uint32_t));
+	b->outbuf = malloc(OUT_BUFSIZE);
+	if (!b->rows || !b->keys || !b->vals || !b->keys2 || !b->vals2 ||
+		!b->outbuf) {
+		SYSERROR("Failed to allocate buffers for sorting %zu rows", s->runrows);
+		free_runbufs(b);
+		return -1;
+	}
+	return 0;
+}
+
+// Sorts run number "run" and writes it to "fout".
+static int sort_run(extsort_t* s, runbufs_t* b, int run, FILE* fout) {
+	size_t r0 = (size_t)run * s->runrows;
+	size_t n = MIN(s->runrows, s->N - r0);
+	size_t R = s->rowsize;
+	rowwriter_t w;
+	size_t i;
+
+	if (read_rows(s->fd, s->datstart + (off_t)r0 * (off_t)R, b->rows, n * R))
+		return -1;
+	for (i=0; i<n; i++) {
+		b->keys[i] = sort_key(b->rows + i*R + s->keyoff, s->keytype,
+							  s->descending);
+		b->vals[i] = i;
+	}
+	RadixSort11Keys64(b->keys, b->vals, b->keys2, b->vals2, n);
+
+	w.fid = fout;
+	w.buf = b->outbuf;
+	w.n = 0;
+	w.size = OUT_BUFSIZE;
+	for (i=0; i<n; i++)
+		if (rowwriter_put(&w, b->rows + (size_t)b->vals[i] * R, R))
+			return -1;
+	return rowwriter_flush(&w);
+}
+
+static void* sort_runs_thread(void* arg) {
+	extsort_t* s = arg;
+	runbufs_t b;
+	if (alloc_runbufs(s, &b)) {
+		pthread_mutex_lock(&s->mutex);
+		s->failed = TRUE;
+		pthread_mutex_unlock(&s->mutex);
+		return NULL;
+	}
+	for (;;) {
+		int run;
+		FILE* fout;
+		int rtn;
+		pthread_mutex_lock(&s->mutex);
+		run = s->failed ? s->nruns : s->nextrun++;
+		pthread_mutex_unlock(&s->mutex);
+		if (run >= s->nruns)
+			break;
+		fout = fopen(s->runfns[run], "wb");
+		if (!fout) {
+			SYSERROR("Failed to open temp file %s", s->runfns[run]);
+			rtn = -1;
+		} else {
+			rtn = sort_run(s, &b, run, fout);
+			if (fclose(fout)) {
+				SYSERROR("Failed to close temp file %s", s->runfns[run]);
+				rtn = -1;
+			}
+		}
+		if (rtn) {
+			pthread_mutex_lock(&s->mutex);
+			s->failed = TRUE;
+			pthread_mutex_unlock(&s->mutex);
+		}
+	}
+	free_runbufs(&b);
+	return NULL;
+}
+
+typedef struct {
+	FILE* fid;
+	unsigned char* buf;
+	size_t bufrows;
+	size_t nrows;
+	size_t i;
+	uint64_t key;
+} runreader_t;
+
+// Moves to the next row of the run; returns 0 when the run is done.
+static int runreader_next(extsort_t* s, runreader_t* r) {
+	r->i++;
+	if (r->i >= r->nrows) {
+		r->nrows = fread(r->buf, s->rowsize, r->bufrows, r->fid);
+		r->i = 0;
+		if (!r->nrows)
+			return 0;
+	}
+	r->key = sort_key(r->buf + r->i * s->rowsize + s->keyoff, s->keytype,
+					  s->descending);
+	return 1;
+}
+
+// Heap order: by key, then by run, which keeps the merge stable.
+static anbool reader_before(const runreader_t* rs, int a, int b) {
+	if (rs[a].key != rs[b].key)
+		return rs[a].key < rs[b].key;
+	return a < b;
+}
+
+static void sift_down(const runreader_t* rs, int* heap, int n, int i) {
+	for (;;) {
+		int c = 2*i + 1;
+		int t;
+		if (c >= n)
+			break;
+		if (c+1 < n && reader_before(rs, heap[c+1], heap[c]))
+			c++;
+		if (!reader_before(rs, heap[c], heap[i]))
+			break;
+		t = heap[c];
+		heap[c] = heap[i];
+		heap[i] = t;
+		i = c;
+	}
+}
+
+// Merges the runs in files "fns" into "fout".
+static int merge_runs(extsort_t* s, char** fns, int k, size_t mem,
+					  FILE* fout) {
+	runreader_t* rs;
+	int* heap;
+	int i, n;
+	rowwriter_t w;
+	int rtn = -1;
+
+	rs = calloc(k, sizeof(runreader_t));
+	heap = malloc(k * sizeof(int));
+	w.fid = fout;
+	w.n = 0;
+	w.size = OUT_BUFSIZE;
+	w.buf = malloc(w.size);
+	if (!rs || !heap || !w.buf) {
+		SYSERROR("Failed to allocate merge buffers");
+		goto bailout;
+	}
+	n = 0;
+	for (i=0; i<k; i++) {
+		runreader_t* r = rs + i;
+		r->bufrows = MAX(1, mem / (size_t)k / s->rowsize);
+		r->buf = malloc(r->bufrows * s->rowsize);
+		r->fid = fopen(fns[i], "rb");
+		if (!r->buf || !r->fid) {
+			SYSERROR("Failed to open temp file %s for merging", fns[i]);
+			goto bailout;
+		}
+		r->i = r->nrows = 0;
+		if (runreader_next(s, r))
+			heap[n++] = i;
+	}
+	for (i=n/2-1; i>=0; i--)
+		sift_down(rs, heap, n, i);
+
+	while (n) {
+		runreader_t* r = rs + heap[0];
+		if (rowwriter_put(&w, r->buf + r->i * s->rowsize, s->rowsize))
+			goto bailout;
+		if (!runreader_next(s, r)) {
+			if (ferror(r->fid)) {
+				SYSERROR("Failed to read temp file %s", fns[heap[0]]);
+				goto bailout;
+			}
+			heap[0] = heap[--n];
+		}
+		sift_down(rs, heap, n, 0);
+	}
+	rtn = rowwriter_flush(&w);
+
+ bailout:
+	if (rs) {
+		for (i=0; i<k; i++) {
+			if (rs[i].fid)
+				fclose(rs[i].fid);
+			free(rs[i].buf);
+		}
+	}
+	free(rs);
+	free(heap);
+	free(w.buf);
+	return rtn;
+}
+
+static void remove_temp_files(char** fns, int n) {
+	int i;
+	for (i=0; i<n; i++) {
+		if (!fns[i])
+			continue;
+		if (unlink(fns[i]))
+			SYSERROR("Failed to delete temp file %s", fns[i]);
+		free(fns[i]);
+		fns[i] = NULL;
+	}
+}
+
+// Sorts the rows of a table and writes them to "fout".
+static int sort_table_external(FILE* fin, off_t datstart, qfits_table* table,
+							   qfits_col* col, anbool descending, FILE* fout,
+							   size_t mem, int nthreads, const char* tempdir) {
+	extsort_t s;
+	int i;
+	int rtn = -1;
+	size_t permem;
+
+	memset(&s, 0, sizeof(extsort_t));
+	s.fd = fileno(fin);
+	s.datstart = datstart;
+	s.rowsize = table->tab_w;
+	// (off_beg is the file offset of the column in the first row)
+	s.keyoff = col->off_beg - datstart;
+	s.keytype = col->atom_type;
+	s.descending = descending;
+	s.N = table->nr;
+	if (!s.N || !s.rowsize)
+		return 0;
+	if (nthreads < 1)
+		nthreads = 1;
+	if (!mem)
+		mem = TABSORT_DEFAULT_MEMORY;
+
+	// each row in a run needs a copy of itself, two keys and two values.
+	permem = mem / nthreads;
+	s.runrows = permem /
+		(s.rowsize + 2 * (sizeof(uint64_t) + sizeof(uint32_t)));
+	s.runrows = MAX(1, MIN(s.runrows, (size_t)UINT32_MAX));
+	s.nruns = (s.N + s.runrows - 1) / s.runrows;
+	nthreads = MIN(nthreads, s.nruns);
+
+	if (s.nruns == 1) {
+		runbufs_t b;
+		logverb("Sorting %zu rows in memory\n", s.N);
+		if (alloc_runbufs(&s, &b))
+			return -1;
+		rtn = sort_run(&s, &b, 0, fout);
+		free_runbufs(&b);
+		return rtn;
+	}
+
+	logverb("Sorting %zu rows in %i runs of %zu rows, using %i threads\n",
+			s.N, s.nruns, s.runrows, nthreads);
+	s.runfns = calloc(s.nruns, sizeof(char*));
+	for (i=0; i<s.nruns; i++)
+		s.runfns[i] = create_temp_file("tabsort", tempdir);
+	pthread_mutex_init(&s.mutex, NULL);
+	if (nthreads == 1)
+		sort_runs_thread(&s);
+	else {
+		pthread_t* threads = malloc(nthreads * sizeof(pthread_t));
+		int nstarted = 0;
+		for (i=0; i<nthreads; i++) {
+			if (pthread_create(threads + i, NULL, sort_runs_thread, &s))
+				break;
+			nstarted++;
+		}
+		if (!nstarted)
+			sort_runs_thread(&s);
+		for (i=0; i<nstarted; i++)
+			pthread_join(threads[i], NULL);
+		free(threads);
+	}
+	pthread_mutex_destroy(&s.mutex);
+	if (s.failed) {
+		ERROR("Failed to sort runs");
+		goto bailout;
+	}
+
+	// merge passes, until there are few enough runs to merge into the output.
+	while (s.nruns > MERGE_FANIN) {
+		int nnew = (s.nruns + MERGE_FANIN - 1) / MERGE_FANIN;
+		char** newfns = calloc(nnew, sizeof(char*));
+		logverb("Merging %i runs into %i\n", s.nruns, nnew);
+		for (i=0; i<nnew; i++) {
+			int k = MIN(MERGE_FANIN, s.nruns - i * MERGE_FANIN);
+			FILE* f;
+			newfns[i] = create_temp_file("tabsort", tempdir);
+			f = fopen(newfns[i], "wb");
+			if (!f || merge_runs(&s, s.runfns + i * MERGE_FANIN, k, mem, f) ||
+				fclose(f)) {
+				ERROR("Failed to merge runs into temp file %s", newfns[i]);
+				remove_temp_files(newfns, i+1);
+				free(newfns);
+				goto bailout;
+			}
+			remove_temp_files(s.runfns + i * MERGE_FANIN, k);
+		}
+		free(s.runfns);
+		s.runfns = newfns;
+		s.nruns = nnew;
+	}
+	logverb("Merging %i runs\n", s.nruns);
+	rtn = merge_runs(&s, s.runfns, s.nruns, mem, fout);
+
+ bailout:
+	remove_temp_files(s.runfns, s.nruns);
+	free(s.runfns);
+	return rtn;
+}
+
+static int do_tabsort(const char* infn, const char* outfn, const char* colname,
+					  anbool descending, anbool external, size_t mem,
+					  int nthreads, const char* tempdir) {
 	FILE* fin;
 	FILE* fout;
 	int ext, nextens;
-	int start, size;
+	off_t start, size;
     void* data = NULL;
     int* perm = NULL;
     unsigned char* map = NULL;
@@ -80,7 +522,7 @@ int tabsort(const char* infn, const char* outfn, const char* colname,
 		int (*sort_func)(const void*, const void*);
 		unsigned char* tabledata;
 		unsigned char* tablehdr;
-		int hdrstart, hdrsize, datsize, datstart;
+		off_t hdrstart, hdrsize, datsize, datstart;
 		int i;
 
         hdrstart = anqfits_header_start(anq, ext);
@@ -102,6 +544,28 @@ int tabsort(const char* infn, const char* outfn, const char* colname,
 			continue;
 		}
 		col = table->col + c;
+		if (external) {
+			if (col->atom_type != TFITS_BIN_TYPE_D &&
+				col->atom_type != TFITS_BIN_TYPE_E &&
+				col->atom_type != TFITS_BIN_TYPE_K) {
+				ERROR("Column %s is neither FITS type D, E, nor K.  Skipping.", colname);
+				continue;
+			}
+			// Copy the table header without change, then the sorted rows.
+			if (pipe_file_offset(fin, hdrstart, hdrsize, fout) ||
+				sort_table_external(fin, datstart, table, col, descending,
+									fout, mem, nthreads, tempdir)) {
+				ERROR("Failed to sort extension %i", ext);
+				goto bailout;
+			}
+			if (fits_pad_file(fout)) {
+				ERROR("Failed to add padding to extension %i", ext);
+				goto bailout;
+			}
+			qfits_table_close(table);
+			continue;
+		}
+
 		switch (col->atom_type) {
 		case TFITS_BIN_TYPE_D:
 			data = realloc(data, table->nr * sizeof(double));
@@ -199,3 +663,15 @@ int tabsort(const char* infn, const char* outfn, const char* colname,
     return -1;
 }
 
+
+int tabsort(const char* infn, const char* outfn, const char* colname,
+            anbool descending) {
+	return do_tabsort(infn, outfn, colname, descending, FALSE, 0, 0, NULL);
+}
+
+int tabsort_external(const char* infn, const char* outfn, const char* colname,
+					 anbool descending, size_t mem, int nthreads,
+					 const char* tempdir) {
+	return do_tabsort(infn, outfn, colname, descending, TRUE, mem, nthreads,
+					  tempdir);
+}
@@ -19,9 +19,33 @@
 #ifndef TABSORT_H
 #define TABSORT_H
 
+#include <stddef.h>
+
 #include "an-bool.h"
 
+/**
+ Sorts the rows of each table in "infn" by column "colname" (of FITS
+ type D, E or K), writing to "outfn".  The whole table is read into
+ memory.
+ */
 int tabsort(const char* infn, const char* outfn, const char* colname,
             anbool descending);
 
+#define TABSORT_DEFAULT_MEMORY ((size_t)1024 * 1024 * 1024)
+
+/**
+ Like tabsort(), but for tables larger than memory: uses at most about
+ "mem" bytes (0 for TABSORT_DEFAULT_MEMORY) of memory, sorting pieces
+ of the table in "nthreads" threads, writing them to temp files in
+ "tempdir" (NULL for the default), and then merging them.
+
+ Rows with equal values stay in their original order; NaNs go last.
+ Where the values are distinct, the output is byte-identical to
+ tabsort()'s; tabsort() isn't stable, so rows with equal values may
+ come out in a different order from it.
+ */
+int tabsort_external(const char* infn, const char* outfn, const char* colname,
+                     anbool descending, size_t mem, int nthreads,
+                     const char* tempdir);
+
 #endif
@@ -20,6 +20,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdarg.h>
+#include <stdlib.h>
 
 #include "cutest.h"
 #include "convolve-image.h"
@@ -47,3 +48,104 @@ void test_conv_1(CuTest* tc) {
 }
 
 
+
+// The straightforward version: loop over output pixels.
+static void convolve_reference(const float* img, int W, int H,
+							   const float* weight, const float* kernel,
+							   int K0, int NK, float* out) {
+	float* temp = malloc(W * H * sizeof(float));
+	int i, j, k;
+	for (i=0; i<H; i++)
+		for (j=0; j<W; j++) {
+			float sum = 0, sumw = 0;
+			for (k=0; k<NK; k++) {
+				int p = j - k + K0;
+				if (p < 0 || p >= W)
+					continue;
+				p += i*W;
+				sum  += kernel[k] * (weight ? weight[p] : 1.0) * img[p];
+				sumw += kernel[k] * (weight ? weight[p] : 1.0);
+			}
+			temp[i*W + j] = (sumw == 0.0) ? 0.0 : (sum / sumw);
+		}
+	for (i=0; i<H; i++)
+		for (j=0; j<W; j++) {
+			float sum = 0, sumw = 0;
+			for (k=0; k<NK; k++) {
+				int p = i - k + K0;
+				if (p < 0 || p >= H)
+					continue;
+				sum  += kernel[k] * temp[p*W + j];
+				sumw += kernel[k];
+			}
+			out[i*W + j] = (sumw == 0.0) ? 0.0 : (sum / sumw);
+		}
+	free(temp);
+}
+
+void test_conv_vs_reference(CuTest* tc) {
+	int sizes[][2] = { { 97, 61 }, { 4, 30 }, { 30, 2 } };
+	double sigmas[] = { 0.7, 2.0, 5.0 };
+	int a, b, i, w;
+	srand(0);
+	for (a=0; a<sizeof(sizes)/sizeof(sizes[0]); a++)
+		for (b=0; b<sizeof(sigmas)/sizeof(double); b++)
+			for (w=0; w<2; w++) {
+				int W = sizes[a][0], H = sizes[a][1];
+				float* img = malloc(W * H * sizeof(float));
+				float* weight = NULL;
+				float* ref = malloc(W * H * sizeof(float));
+				float* cimg;
+				float* kernel;
+				int K0, NK;
+				for (i=0; i<W*H; i++)
+					img[i] = rand() / (float)RAND_MAX;
+				if (w) {
+					// a constant with some masked pixels.
+					weight = malloc(W * H * sizeof(float));
+					for (i=0; i<W*H; i++)
+						weight[i] = (rand() % 5) ? 2.0 : 0.0;
+				}
+				kernel = convolve_get_gaussian_kernel_f(sigmas[b], 4., &K0, &NK);
+				convolve_reference(img, W, H, weight, kernel, K0, NK, ref);
+				cimg = convolve_separable_weighted_f(img, W, H, weight, kernel,
+													 K0, NK, NULL, NULL);
+				for (i=0; i<W*H; i++)
+					CuAssertDblEquals(tc, ref[i], cimg[i], 1e-6);
+				// in-place
+				convolve_separable_weighted_f(img, W, H, weight, kernel,
+											  K0, NK, img, NULL);
+				for (i=0; i<W*H; i++)
+					CuAssertDblEquals(tc, ref[i], img[i], 1e-6);
+				free(cimg);
+				free(kernel);
+				free(img);
+				free(ref);
+				free(weight);
+			}
+}
+
+// Kernels that aren't centred, including ones lying wholly to one side
+// of the output pixel (K0 < 0 or K0 >= NK).
+void test_conv_offset_kernel(CuTest* tc) {
+	float kernel[] = { 1.0, 2.0, 1.0 };
+	int NK = 3;
+	int offsets[] = { -4, -2, 0, 1, 2, 5 };
+	int W = 7, H = 5;
+	int a, i;
+	float img[7*5];
+	float ref[7*5];
+	float* cimg;
+	srand(0);
+	for (i=0; i<W*H; i++)
+		img[i] = rand() / (float)RAND_MAX;
+	for (a=0; a<sizeof(offsets)/sizeof(int); a++) {
+		int K0 = offsets[a];
+		convolve_reference(img, W, H, NULL, kernel, K0, NK, ref);
+		cimg = convolve_separable_weighted_f(img, W, H, NULL, kernel,
+											 K0, NK, NULL, NULL);
+		for (i=0; i<W*H; i++)
+			CuAssertDblEquals(tc, ref[i], cimg[i], 1e-6);
+		free(cimg);
+	}
+}
@@ -127,3 +127,72 @@ void test_dsmooth2_inplace(CuTest* tc) {
     free(smooth1);
     free(smooth2);
 }
+
+// The straightforward version of dsmooth2: loop over output pixels.
+static void dsmooth2_reference(float* image, int nx, int ny, float sigma,
+							   float* smooth) {
+	int i, j, npix, half, start, end, sample;
+	float neghalfinvvar, total, scale, dx, sum;
+	float* kernel;
+	float* temp;
+
+	npix = 2 * ((int) ceilf(3. * sigma)) + 1;
+	half = npix / 2;
+	kernel = malloc(npix * sizeof(float));
+	neghalfinvvar = -1.0 / (2.0 * sigma * sigma);
+	for (i=0; i<npix; i++) {
+		dx = ((float) i - 0.5 * ((float)npix - 1.));
+		kernel[i] = exp((dx * dx) * neghalfinvvar);
+	}
+	total = 0.0;
+	for (i=0; i<npix; i++)
+		total += kernel[i];
+	scale = 1. / total;
+	for (i=0; i<npix; i++)
+		kernel[i] *= scale;
+
+	temp = malloc(nx * ny * sizeof(float));
+	for (j=0; j<ny; j++)
+		for (i=0; i<nx; i++) {
+			start = (i - half < 0) ? 0 : i - half;
+			end = (i + half > nx-1) ? nx-1 : i + half;
+			sum = 0.0;
+			for (sample=start; sample<=end; sample++)
+				sum += image[j*nx + sample] * kernel[sample - i + half];
+			temp[j*nx + i] = sum;
+		}
+	for (i=0; i<nx; i++)
+		for (j=0; j<ny; j++) {
+			start = (j - half < 0) ? 0 : j - half;
+			end = (j + half > ny-1) ? ny-1 : j + half;
+			sum = 0.0;
+			for (sample=start; sample<=end; sample++)
+				sum += temp[sample*nx + i] * kernel[sample - j + half];
+			smooth[j*nx + i] = sum;
+		}
+	free(temp);
+	free(kernel);
+}
+
+void test_dsmooth2_vs_reference(CuTest* tc) {
+	// include images smaller than the kernel.
+	int sizes[][2] = { { 101, 77 }, { 64, 3 }, { 5, 50 }, { 1, 1 } };
+	float sigmas[] = { 0.5, 1.0, 2.5, 6.0 };
+	int a, b;
+	for (a=0; a<sizeof(sizes)/sizeof(sizes[0]); a++)
+		for (b=0; b<sizeof(sigmas)/sizeof(float); b++) {
+			int nx = sizes[a][0], ny = sizes[a][1];
+			float* img = random_image(nx, ny);
+			float* s1 = malloc(nx * ny * sizeof(float));
+			float* s2 = malloc(nx * ny * sizeof(float));
+			dsmooth2_reference(img, nx, ny, sigmas[b], s1);
+			dsmooth2(img, nx, ny, sigmas[b], s2);
+			CuAssertIntEquals(tc, 0, compare_images(s1, s2, nx, ny, 1e-6));
+			// in-place
+			dsmooth2(img, nx, ny, sigmas[b], img);
+			CuAssertIntEquals(tc, 0, compare_images(s1, img, nx, ny, 1e-6));
+			free(img);
+			free(s1);
+			free(s2);
+		}
+}
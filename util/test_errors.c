@@ -1,3 +1,5 @@
+#include <pthread.h>
+
 #include "errors.h"
 #include "cutest.h"
 
@@ -39,3 +41,31 @@ void test_err_func(CuTest* tc) {
 	errors_print_stack(stdout);
 }
 
+
+static void* report_errors(void* arg) {
+	int i;
+	for (i=0; i<1000; i++)
+		ERROR("thread %li error %i", (long)arg, i);
+	return NULL;
+}
+
+void test_errors_threads(CuTest* tc) {
+	pthread_t threads[8];
+	char* errs;
+	int i, N;
+	// (undo test_err_func)
+	errors_use_function(NULL, NULL);
+	errors_clear_stack();
+	errors_start_logging_to_string();
+	for (i=0; i<8; i++)
+		CuAssertIntEquals(tc, 0, pthread_create(threads + i, NULL, report_errors, (void*)(long)i));
+	for (i=0; i<8; i++)
+		pthread_join(threads[i], NULL);
+	errs = errors_stop_logging_to_string("\n");
+	N = 0;
+	for (i=0; errs[i]; i++)
+		if (errs[i] == '\n')
+			N++;
+	CuAssertIntEquals(tc, 8*1000 - 1, N);
+	free(errs);
+}
@@ -146,6 +146,48 @@ void test_fitsbin_2(CuTest* ct) {
 }
 
 
+void test_fitsbin_madvise(CuTest* ct) {
+    fitsbin_t* in, *out;
+    int i;
+    int N = 1000;
+    double outdata[1000];
+    char* fn;
+    fitsbin_chunk_t chunk;
+
+    CuAssertIntEquals(ct, FITSBIN_ADVICE_WILLNEED, fitsbin_advice_from_string("willneed"));
+    CuAssertIntEquals(ct, FITSBIN_ADVICE_RANDOM, fitsbin_advice_from_string("RANDOM"));
+    CuAssertIntEquals(ct, -1, fitsbin_advice_from_string("sometimes"));
+
+    fn = get_tmpfile(0);
+    out = fitsbin_open_for_writing(fn);
+    CuAssertPtrNotNull(ct, out);
+    CuAssertIntEquals(ct, 0, fitsbin_write_primary_header(out));
+    for (i=0; i<N; i++)
+        outdata[i] = i;
+    fitsbin_chunk_init(&chunk);
+    chunk.tablename = "test3";
+    chunk.itemsize = sizeof(double);
+    chunk.nrows = N;
+    chunk.data = outdata;
+    CuAssertIntEquals(ct, 0, fitsbin_write_chunk(out, &chunk));
+    CuAssertIntEquals(ct, 0, fitsbin_fix_primary_header(out));
+    CuAssertIntEquals(ct, 0, fitsbin_close(out));
+    fitsbin_chunk_clean(&chunk);
+
+    in = fitsbin_open(fn);
+    CuAssertPtrNotNull(ct, in);
+    fitsbin_chunk_init(&chunk);
+    chunk.tablename = "test3";
+    CuAssertIntEquals(ct, 0, fitsbin_read_chunk(in, &chunk));
+    CuAssert(ct, "mapped", fitsbin_mapped_size(in) >= N * sizeof(double));
+
+    for (i=FITSBIN_ADVICE_NORMAL; i<=FITSBIN_ADVICE_HUGEPAGE; i++)
+        CuAssertIntEquals(ct, 0, fitsbin_madvise(in, i));
+    CuAssertIntEquals(ct, 0, fitsbin_mlock(in));
+    // the data must be unchanged.
+    CuAssertIntEquals(ct, 0, memcmp(outdata, chunk.data, sizeof(outdata)));
+    CuAssertIntEquals(ct, 0, fitsbin_close(in));
+}
 
 void test_inmemory_fitsbin_1(CuTest* ct) {
     fitsbin_t* fb;
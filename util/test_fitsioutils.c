@@ -25,6 +25,8 @@
 
 #include "qfits_header.h"
 #include "qfits_rw.h"
+#include "qfits_std.h"
+#include "qfits_byteswap.h"
 
 #include "fitsioutils.h"
 #include "qfits_header.h"
@@ -185,3 +187,107 @@ void test_write_long_string(CuTest* tc) {
 }
 
 
+
+// The value of the first card with "key", found by looking at each card.
+static anbool scan_for_key(const qfits_header* hdr, const char* key,
+						   char* val) {
+	char k[FITS_LINESZ+1];
+	int i;
+	for (i=0; i<qfits_header_n(hdr); i++) {
+		qfits_header_getitem(hdr, i, k, val, NULL, NULL);
+		if (!strcmp(k, key))
+			return TRUE;
+	}
+	return FALSE;
+}
+
+static void check_key(CuTest* tc, const qfits_header* hdr, const char* key) {
+	char val[FITS_LINESZ+1];
+	char* str = qfits_header_getstr(hdr, key);
+	if (!scan_for_key(hdr, key, val)) {
+		CuAssertPtrEquals(tc, NULL, str);
+		return;
+	}
+	CuAssertPtrNotNull(tc, str);
+	CuAssertStrEquals(tc, val, str);
+}
+
+// Keyed lookups in a big header (which get a hash index) must find the
+// same cards as looking at each card, through adds, mods and deletes.
+void test_header_index(CuTest* tc) {
+	qfits_header* hdr = qfits_header_default();
+	char key[16], val[16];
+	int i;
+
+	for (i=0; i<500; i++) {
+		sprintf(key, "KEY%i", i);
+		sprintf(val, "%i", i);
+		qfits_header_add(hdr, key, val, NULL, NULL);
+		if (i % 50 == 0) {
+			sprintf(val, "dup%i", i);
+			qfits_header_add(hdr, "DUP", val, NULL, NULL);
+			qfits_header_add(hdr, "COMMENT", val, NULL, NULL);
+		}
+	}
+	CuAssertIntEquals(tc, 500, qfits_header_getint(hdr, "KEY500", 500));
+	for (i=0; i<500; i+=7) {
+		sprintf(key, "KEY%i", i);
+		CuAssertIntEquals(tc, i, qfits_header_getint(hdr, key, -1));
+	}
+	CuAssertStrEquals(tc, "dup0", qfits_header_getstr(hdr, "DUP"));
+	// lower-case keys are expanded.
+	CuAssertIntEquals(tc, 42, qfits_header_getint(hdr, "key42", -1));
+	check_key(tc, hdr, "NOSUCHKEY");
+
+	// append after the index has been built.
+	qfits_header_append(hdr, "LATE", "1", NULL, NULL);
+	qfits_header_append(hdr, "DUP", "late", NULL, NULL);
+	check_key(tc, hdr, "LATE");
+	CuAssertStrEquals(tc, "dup0", qfits_header_getstr(hdr, "DUP"));
+
+	qfits_header_mod(hdr, "KEY10", "ten", NULL);
+	CuAssertStrEquals(tc, "ten", qfits_header_getstr(hdr, "KEY10"));
+
+	// deleting the first DUP makes the next one first.
+	qfits_header_del(hdr, "DUP");
+	CuAssertStrEquals(tc, "dup50", qfits_header_getstr(hdr, "DUP"));
+	qfits_header_del(hdr, "KEY20");
+	check_key(tc, hdr, "KEY20");
+	check_key(tc, hdr, "KEY21");
+
+	// insert a DUP that comes before all the others.
+	qfits_header_add_after(hdr, "KEY3", "DUP", "early", NULL, NULL);
+	CuAssertStrEquals(tc, "early", qfits_header_getstr(hdr, "DUP"));
+
+	// change a key.
+	qfits_header_setitem(hdr, 5, "RENAMED", "r", NULL, NULL);
+	check_key(tc, hdr, "RENAMED");
+
+	for (i=0; i<500; i+=3) {
+		sprintf(key, "KEY%i", i);
+		check_key(tc, hdr, key);
+	}
+	qfits_header_destroy(hdr);
+}
+
+void test_swap_bytes_array(CuTest* tc) {
+	int sizes[] = { 2, 4, 8, 3 };
+	unsigned char a[1003], b[1003];
+	int i, j, k;
+	for (i=0; i<sizeof(a); i++)
+		a[i] = (i * 37 + 11) & 0xff;
+	for (k=0; k<sizeof(sizes)/sizeof(int); k++) {
+		int s = sizes[k];
+		// various lengths, to check the vector tails; and an
+		// unaligned start.
+		for (j=0; j<=300/s; j+=1 + j/8) {
+			memcpy(b, a, sizeof(a));
+			qfits_swap_bytes_array(b + 1, s, j);
+			for (i=0; i<j; i++)
+				qfits_swap_bytes(a + 1 + i*s, s);
+			CuAssertIntEquals(tc, 0, memcmp(a, b, sizeof(a)));
+			for (i=0; i<j; i++)
+				qfits_swap_bytes(a + 1 + i*s, s);
+		}
+	}
+}
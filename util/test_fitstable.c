@@ -1,10 +1,14 @@
 #include <stddef.h>
+#include <unistd.h>
+#include <sys/time.h>
 
 #include "fitstable.h"
 #include "fitsioutils.h"
 #include "permutedsort.h"
 #include "an-endian.h"
 #include "qfits_header.h"
+#include "anqfits.h"
+#include "ioutils.h"
 
 #include "cutest.h"
 
@@ -1476,3 +1480,478 @@ void test_inmemory_struct_1(CuTest* ct) {
     CuAssertIntEquals(ct, 0, fitstable_close(tab));
 
 }
+
+static void check_exts_equal(CuTest* ct, const anqfits_t* a,
+                             const anqfits_t* b, int N) {
+    int i;
+    for (i=0; i<N; i++) {
+        CuAssertIntEquals(ct, (int)anqfits_header_start(a, i),
+                          (int)anqfits_header_start(b, i));
+        CuAssertIntEquals(ct, (int)anqfits_header_size(a, i),
+                          (int)anqfits_header_size(b, i));
+        CuAssertIntEquals(ct, (int)anqfits_data_start(a, i),
+                          (int)anqfits_data_start(b, i));
+        CuAssertIntEquals(ct, (int)anqfits_data_size(a, i),
+                          (int)anqfits_data_size(b, i));
+    }
+}
+
+void test_extension_offsets(CuTest* ct) {
+    fitstable_t* tab, *outtab;
+    anqfits_t* anq, *anq2;
+    char* fn;
+    char* indexfn;
+    qfits_header* hdr;
+    const qfits_header* chdr;
+    tfits_type dubl = fitscolumn_double_type();
+    int NE = 40;
+    int i, e;
+    double* indata;
+    struct timeval tv[2];
+
+    fn = get_tmpfile(3);
+    outtab = fitstable_open_for_writing(fn);
+    CuAssertPtrNotNull(ct, outtab);
+    CuAssertIntEquals(ct, 0, fitstable_write_primary_header(outtab));
+    for (e=0; e<NE; e++) {
+        if (e) {
+            fitstable_next_extension(outtab);
+            fitstable_clear_table(outtab);
+        }
+        fitstable_add_write_column(outtab, dubl, "X", "");
+        hdr = fitstable_get_header(outtab);
+        fits_header_add_int(hdr, "EXTNUM", e, NULL);
+        CuAssertIntEquals(ct, 0, fitstable_write_header(outtab));
+        // some of these span several FITS blocks.
+        for (i=0; i<e*50; i++) {
+            double x = e * 1000 + i;
+            CuAssertIntEquals(ct, 0, fitstable_write_row(outtab, &x));
+        }
+        CuAssertIntEquals(ct, 0, fitstable_fix_header(outtab));
+    }
+    CuAssertIntEquals(ct, 0, fitstable_close(outtab));
+
+    indexfn = anqfits_hdu_index_filename(fn);
+    unlink(indexfn);
+
+    // All the extensions are found when the file is opened.
+    anq = anqfits_open(fn);
+    CuAssertPtrNotNull(ct, anq);
+    CuAssertIntEquals(ct, NE+1, anq->Nexts);
+    chdr = anqfits_get_header_const(anq, 5);
+    CuAssertPtrNotNull(ct, chdr);
+    CuAssertIntEquals(ct, 4, qfits_header_getint(chdr, "EXTNUM", -1));
+    CuAssertIntEquals(ct, FITS_BLOCK_SIZE, (int)anqfits_data_size(anq, 5));
+    CuAssertIntEquals(ct, NE+1, anqfits_n_ext(anq));
+    for (e=0; e<NE; e++) {
+        CuAssertIntEquals(ct, (int)(anqfits_data_start(anq, e+1) +
+                                    anqfits_data_size(anq, e+1)),
+                          (int)(e+1 < NE ? anqfits_header_start(anq, e+2) :
+                                anq->filesize * FITS_BLOCK_SIZE));
+        chdr = anqfits_get_header_const(anq, e+1);
+        CuAssertIntEquals(ct, e, qfits_header_getint(chdr, "EXTNUM", -1));
+    }
+
+    // Only up to HDU 3.
+    anq2 = anqfits_open_hdu(fn, 3);
+    CuAssertIntEquals(ct, 4, anqfits_n_ext(anq2));
+    anqfits_close(anq2);
+
+    // Read via the HDU index.
+    CuAssertIntEquals(ct, 0, anqfits_write_hdu_index(anq));
+    anq2 = anqfits_open(fn);
+    CuAssertIntEquals(ct, NE+1, anq2->Nexts);
+    check_exts_equal(ct, anq, anq2, NE+1);
+    chdr = anqfits_get_header_const(anq2, 17);
+    CuAssertIntEquals(ct, 16, qfits_header_getint(chdr, "EXTNUM", -1));
+    anqfits_close(anq2);
+    anq2 = anqfits_open_hdu(fn, 3);
+    CuAssertIntEquals(ct, 4, anq2->Nexts);
+    CuAssertIntEquals(ct, (int)(anq->filesize * FITS_BLOCK_SIZE -
+                                anqfits_data_start(anq, 3)),
+                      (int)anqfits_data_size(anq2, 3));
+    anqfits_close(anq2);
+
+    tab = fitstable_open(fn);
+    CuAssertPtrNotNull(ct, tab);
+    CuAssertIntEquals(ct, 0, fitstable_open_extension(tab, 30));
+    CuAssertIntEquals(ct, 29 * 50, fitstable_nrows(tab));
+    indata = fitstable_read_column(tab, "X", dubl);
+    CuAssertPtrNotNull(ct, indata);
+    CuAssertIntEquals(ct, 29 * 1000 + 7, (int)indata[7]);
+    free(indata);
+    CuAssertIntEquals(ct, 0, fitstable_close(tab));
+
+    // Once the file has changed, the index is ignored.
+    gettimeofday(&tv[0], NULL);
+    tv[0].tv_sec += 10;
+    tv[1] = tv[0];
+    CuAssertIntEquals(ct, 0, utimes(fn, tv));
+    anq2 = anqfits_open(fn);
+    CuAssertIntEquals(ct, NE+1, anqfits_n_ext(anq2));
+    check_exts_equal(ct, anq, anq2, NE+1);
+    anqfits_close(anq2);
+
+    // A corrupt extension header makes the open fail.
+    unlink(indexfn);
+    {
+        FILE* f;
+        char card[FITS_BLOCK_SIZE];
+        char* naxis1;
+        off_t start = anqfits_header_start(anq, 20);
+        f = fopen(fn, "r+b");
+        CuAssertPtrNotNull(ct, f);
+        CuAssertIntEquals(ct, 0, fseeko(f, start, SEEK_SET));
+        CuAssertIntEquals(ct, FITS_BLOCK_SIZE, fread(card, 1, FITS_BLOCK_SIZE, f));
+        naxis1 = NULL;
+        for (i=0; i<FITS_BLOCK_SIZE; i+=80)
+            if (!strncmp(card + i, "NAXIS1  =", 9))
+                naxis1 = card + i;
+        CuAssertPtrNotNull(ct, naxis1);
+        naxis1[8] = ' ';
+        CuAssertIntEquals(ct, 0, fseeko(f, start, SEEK_SET));
+        CuAssertIntEquals(ct, FITS_BLOCK_SIZE, fwrite(card, 1, FITS_BLOCK_SIZE, f));
+        CuAssertIntEquals(ct, 0, fclose(f));
+    }
+    CuAssertPtrEquals(ct, NULL, anqfits_open(fn));
+    // ... unless it's beyond the last HDU asked for.
+    anq2 = anqfits_open_hdu(fn, 3);
+    CuAssertPtrNotNull(ct, anq2);
+    anqfits_close(anq2);
+
+    anqfits_close(anq);
+    free(indexfn);
+}
+
+/*
+ Columns bigger than a read block, read as each numeric type, in
+ pieces, and with a stride.
+ */
+void test_bulk_column_read(CuTest* ct) {
+    fitstable_t* tab, *outtab;
+    char* fn = get_tmpfile(4);
+    tfits_type types[] = { TFITS_BIN_TYPE_D, TFITS_BIN_TYPE_E, TFITS_BIN_TYPE_K,
+                           TFITS_BIN_TYPE_J, TFITS_BIN_TYPE_I, TFITS_BIN_TYPE_B };
+    char* names[] = { "D", "E", "K", "J", "I", "B" };
+    int NT = sizeof(types) / sizeof(tfits_type);
+    int N = 10007;
+    int i, j, k;
+    double* d;
+    int32_t* ints;
+    double strided[3 * 100];
+    fitstable_column_view_t view;
+
+    outtab = fitstable_open_for_writing(fn);
+    CuAssertPtrNotNull(ct, outtab);
+    for (j=0; j<NT; j++)
+        fitstable_add_write_column_convert(outtab, types[j], fitscolumn_double_type(),
+                                           names[j], "");
+    fitstable_add_write_column_array_convert(outtab, TFITS_BIN_TYPE_J,
+                                             fitscolumn_double_type(), 3, "A", "");
+    CuAssertIntEquals(ct, 0, fitstable_write_primary_header(outtab));
+    CuAssertIntEquals(ct, 0, fitstable_write_header(outtab));
+    for (i=0; i<N; i++) {
+        double v = i % 251;
+        double a[3] = { i, -i, 2*i };
+        CuAssertIntEquals(ct, 0, fitstable_write_row(outtab, &v, &v, &v, &v, &v, &v, a));
+    }
+    CuAssertIntEquals(ct, 0, fitstable_fix_header(outtab));
+    CuAssertIntEquals(ct, 0, fitstable_close(outtab));
+
+    tab = fitstable_open(fn);
+    CuAssertPtrNotNull(ct, tab);
+    CuAssertIntEquals(ct, N, fitstable_nrows(tab));
+    for (j=0; j<NT; j++) {
+        for (k=0; k<NT; k++) {
+            char* data = fitstable_read_column(tab, names[j], types[k]);
+            int sz = fits_get_atom_size(types[k]);
+            CuAssertPtrNotNull(ct, data);
+            for (i=0; i<N; i++) {
+                double v = 0;
+                fits_convert_data(&v, 0, TFITS_BIN_TYPE_D, data + i*sz, 0,
+                                  types[k], 1, 1);
+                CuAssertDblEquals(ct, i % 251, v, 0);
+            }
+            free(data);
+        }
+        d = fitstable_read_column_offset(tab, names[j], fitscolumn_double_type(),
+                                         5000, 4100);
+        CuAssertPtrNotNull(ct, d);
+        for (i=0; i<4100; i++)
+            CuAssertDblEquals(ct, (5000 + i) % 251, d[i], 0);
+        free(d);
+        memset(strided, 0, sizeof(strided));
+        CuAssertIntEquals(ct, 0, fitstable_read_column_offset_into
+                          (tab, names[j], fitscolumn_double_type(), strided + 1,
+                           3 * sizeof(double), 300, 100));
+        for (i=0; i<100; i++) {
+            CuAssertDblEquals(ct, 0, strided[3*i], 0);
+            CuAssertDblEquals(ct, (300 + i) % 251, strided[3*i + 1], 0);
+            CuAssertDblEquals(ct, 0, strided[3*i + 2], 0);
+        }
+    }
+    ints = fitstable_read_column_array(tab, "A", fitscolumn_i32_type());
+    CuAssertPtrNotNull(ct, ints);
+    for (i=0; i<N; i++) {
+        CuAssertIntEquals(ct, i, ints[3*i]);
+        CuAssertIntEquals(ct, -i, ints[3*i+1]);
+        CuAssertIntEquals(ct, 2*i, ints[3*i+2]);
+    }
+    free(ints);
+
+    // Only bytes can be used in place on a little-endian machine.
+    CuAssertIntEquals(ct, 0, fitstable_map_column(tab, "B", TFITS_BIN_TYPE_B,
+                                                  100, -1, &view));
+    CuAssertIntEquals(ct, N - 100, view.N);
+    for (i=0; i<view.N; i++)
+        CuAssertIntEquals(ct, (100 + i) % 251,
+                          ((uint8_t*)view.data)[(size_t)i * view.stride]);
+    fitstable_unmap_column(&view);
+    CuAssertIntEquals(ct, 1, fitstable_map_column(tab, "B", TFITS_BIN_TYPE_D,
+                                                  0, -1, &view));
+    if (!IS_BIG_ENDIAN)
+        CuAssertIntEquals(ct, 1, fitstable_map_column(tab, "D", TFITS_BIN_TYPE_D,
+                                                      0, -1, &view));
+    CuAssertIntEquals(ct, 0, fitstable_close(tab));
+}
+
+void test_int64_column(CuTest* ct) {
+    fitstable_t* tab;
+    char* fn = get_tmpfile(9);
+    tfits_type K = TFITS_BIN_TYPE_K;
+    // (more than 2^53, so these aren't exact as doubles)
+    int64_t vals[] = { (1LL << 53) + 1, -(1LL << 60) - 3, INT64_MAX, 7, -1 };
+    int N = sizeof(vals) / sizeof(int64_t);
+    int64_t* kdata;
+    int64_t strided[2 * 5];
+    int32_t small[5];
+    int i;
+
+    tab = fitstable_open_for_writing(fn);
+    CuAssertPtrNotNull(ct, tab);
+    fitstable_add_write_column(tab, K, "BIG", "");
+    CuAssertIntEquals(ct, 0, fitstable_write_primary_header(tab));
+    CuAssertIntEquals(ct, 0, fitstable_write_header(tab));
+    for (i=0; i<N; i++)
+        CuAssertIntEquals(ct, 0, fitstable_write_row(tab, vals + i));
+    CuAssertIntEquals(ct, 0, fitstable_fix_header(tab));
+    CuAssertIntEquals(ct, 0, fitstable_close(tab));
+
+    tab = fitstable_open(fn);
+    CuAssertPtrNotNull(ct, tab);
+    kdata = fitstable_read_column(tab, "BIG", K);
+    CuAssertPtrNotNull(ct, kdata);
+    for (i=0; i<N; i++)
+        CuAssert(ct, "K column exact", kdata[i] == vals[i]);
+    CuAssertIntEquals(ct, 0, fitstable_close(tab));
+
+    // integer-to-integer conversions don't go through a double.
+    memset(strided, 0, sizeof(strided));
+    CuAssertIntEquals(ct, 0, fits_convert_data(strided, 2 * sizeof(int64_t), K,
+                                               kdata, sizeof(int64_t), K, 1, N));
+    for (i=0; i<N; i++) {
+        CuAssert(ct, "K to K exact", strided[2*i] == vals[i]);
+        CuAssert(ct, "K to K stride", strided[2*i+1] == 0);
+    }
+    CuAssertIntEquals(ct, 0, fits_convert_data(small, sizeof(int32_t), TFITS_BIN_TYPE_J,
+                                               kdata + 3, sizeof(int64_t), K, 1, 2));
+    CuAssertIntEquals(ct, 7, small[0]);
+    CuAssertIntEquals(ct, -1, small[1]);
+    CuAssertIntEquals(ct, 0, fits_convert_data(strided, sizeof(int64_t), K,
+                                               small, sizeof(int32_t), TFITS_BIN_TYPE_J,
+                                               1, 2));
+    CuAssert(ct, "J to K", strided[0] == 7 && strided[1] == -1);
+    free(kdata);
+}
+
+struct bufwrite_row {
+    double x;
+    int32_t id;
+    int16_t arr[3];
+    char name[5];
+};
+
+// Writes the same tables, using "bufsize" buffered writing (-1: none).
+static void write_bufwrite_table(CuTest* ct, const char* fn, int bufsize,
+                                 anbool threaded) {
+    fitstable_t* tab;
+    struct bufwrite_row rows[5000];
+    tfits_type i16 = fitscolumn_i16_type();
+    tfits_type i32 = fitscolumn_i32_type();
+    int32_t extra[10];
+    int i;
+
+    for (i=0; i<5000; i++) {
+        rows[i].x = i * 0.1;
+        rows[i].id = i * 1000;
+        rows[i].arr[0] = i;
+        rows[i].arr[1] = -i;
+        rows[i].arr[2] = 7;
+        sprintf(rows[i].name, "r%03i", i % 1000);
+    }
+    for (i=0; i<10; i++)
+        extra[i] = 100 + i;
+
+    tab = fitstable_open_for_writing(fn);
+    CuAssertPtrNotNull(ct, tab);
+    if (bufsize >= 0)
+        CuAssertIntEquals(ct, 0, fitstable_use_buffered_writing(tab, bufsize, threaded));
+    fitstable_add_write_column_struct(tab, fitscolumn_double_type(), 1,
+                                      offsetof(struct bufwrite_row, x),
+                                      TFITS_BIN_TYPE_E, "X", "");
+    fitstable_add_write_column_struct(tab, i32, 1,
+                                      offsetof(struct bufwrite_row, id),
+                                      TFITS_BIN_TYPE_K, "ID", "");
+    fitstable_add_write_column_struct(tab, i16, 3,
+                                      offsetof(struct bufwrite_row, arr),
+                                      i16, "ARR", "");
+    fitstable_add_write_column_struct(tab, fitscolumn_char_type(), 5,
+                                      offsetof(struct bufwrite_row, name),
+                                      fitscolumn_char_type(), "NAME", "");
+    fitstable_add_write_column(tab, i32, "EXTRA", "");
+    CuAssertIntEquals(ct, 0, fitstable_write_primary_header(tab));
+    CuAssertIntEquals(ct, 0, fitstable_write_header(tab));
+    CuAssertIntEquals(ct, 0, fitstable_write_structs(tab, rows, sizeof(struct bufwrite_row), 5000));
+    for (i=0; i<100; i++)
+        CuAssertIntEquals(ct, 0, fitstable_write_row(tab, extra + (i % 10)));
+    for (i=0; i<10; i++)
+        CuAssertIntEquals(ct, 0, fitstable_write_struct(tab, rows + i));
+    CuAssertIntEquals(ct, 0, fitstable_write_one_column(tab, 4, 0, 10, extra, sizeof(int32_t)));
+    CuAssertIntEquals(ct, 0, fitstable_fix_header(tab));
+
+    // a second extension of raw rows.
+    fitstable_next_extension(tab);
+    fitstable_clear_table(tab);
+    fitstable_add_write_column(tab, i32, "RAW", "");
+    CuAssertIntEquals(ct, 0, fitstable_write_header(tab));
+    for (i=0; i<3000; i++) {
+        int32_t v = i;
+        v32_hton(&v);
+        CuAssertIntEquals(ct, 0, fitstable_write_row_data(tab, &v));
+    }
+    CuAssertIntEquals(ct, 0, fitstable_fix_header(tab));
+    CuAssertIntEquals(ct, 0, fitstable_fix_primary_header(tab));
+    CuAssertIntEquals(ct, 0, fitstable_close(tab));
+}
+
+// Blanks the DATE cards, which can differ between two writes.
+static void blank_dates(char* buf, size_t len) {
+    size_t i;
+    for (i=0; i+80<=len; i+=80)
+        if (strncmp(buf + i, "DATE    = ", 10) == 0)
+            memset(buf + i, ' ', 80);
+}
+
+void test_buffered_writing(CuTest* ct) {
+    char fn[256];
+    char* expected;
+    size_t explen;
+    int bufsizes[] = { 0, 1000, 7, 0, 1000, 7 };
+    anbool threaded[] = { FALSE, FALSE, FALSE, TRUE, TRUE, TRUE };
+    fitstable_t* tab;
+    int32_t* ids;
+    int i;
+
+    strcpy(fn, get_tmpfile(5));
+    write_bufwrite_table(ct, fn, -1, FALSE);
+    expected = file_get_contents(fn, &explen, FALSE);
+    CuAssertPtrNotNull(ct, expected);
+    blank_dates(expected, explen);
+
+    for (i=0; i<sizeof(bufsizes)/sizeof(int); i++) {
+        char* got;
+        size_t len;
+        write_bufwrite_table(ct, fn, bufsizes[i], threaded[i]);
+        got = file_get_contents(fn, &len, FALSE);
+        CuAssertPtrNotNull(ct, got);
+        blank_dates(got, len);
+        CuAssertIntEquals(ct, (int)explen, (int)len);
+        CuAssert(ct, "buffered output is identical", memcmp(expected, got, len) == 0);
+        free(got);
+    }
+    free(expected);
+
+    tab = fitstable_open(fn);
+    CuAssertPtrNotNull(ct, tab);
+    CuAssertIntEquals(ct, 5110, fitstable_nrows(tab));
+    ids = fitstable_read_column(tab, "EXTRA", fitscolumn_i32_type());
+    CuAssertPtrNotNull(ct, ids);
+    CuAssertIntEquals(ct, 100, ids[0]);
+    CuAssertIntEquals(ct, 0, ids[4999]);
+    CuAssertIntEquals(ct, 105, ids[5005]);
+    free(ids);
+    ids = fitstable_read_column(tab, "ID", fitscolumn_i32_type());
+    CuAssertIntEquals(ct, 4999000, ids[4999]);
+    CuAssertIntEquals(ct, 0, ids[5050]);
+    CuAssertIntEquals(ct, 3000, ids[5103]);
+    free(ids);
+    CuAssertIntEquals(ct, 0, fitstable_close(tab));
+}
+
+// Writes a column first, then structs that skip it.
+static void write_skipped_table(CuTest* ct, const char* fn, int bufsize,
+                                anbool threaded) {
+    fitstable_t* tab;
+    double xs[100];
+    int32_t tags[100];
+    int i;
+    for (i=0; i<100; i++) {
+        xs[i] = i * 0.5;
+        tags[i] = 1000 + i;
+    }
+    tab = fitstable_open_for_writing(fn);
+    CuAssertPtrNotNull(ct, tab);
+    if (bufsize >= 0)
+        CuAssertIntEquals(ct, 0, fitstable_use_buffered_writing(tab, bufsize, threaded));
+    fitstable_add_write_column_struct(tab, fitscolumn_double_type(), 1, 0,
+                                      fitscolumn_double_type(), "X", "");
+    fitstable_add_write_column(tab, fitscolumn_i32_type(), "TAG", "");
+    CuAssertIntEquals(ct, 0, fitstable_write_primary_header(tab));
+    CuAssertIntEquals(ct, 0, fitstable_write_header(tab));
+    CuAssertIntEquals(ct, 0, fitstable_write_one_column(tab, 1, 0, 100, tags, sizeof(int32_t)));
+    CuAssertIntEquals(ct, 0, fitstable_write_structs(tab, xs, sizeof(double), 60));
+    for (i=60; i<100; i++)
+        CuAssertIntEquals(ct, 0, fitstable_write_struct(tab, xs + i));
+    CuAssertIntEquals(ct, 0, fitstable_fix_header(tab));
+    CuAssertIntEquals(ct, 0, fitstable_close(tab));
+}
+
+void test_buffered_writing_skipped_columns(CuTest* ct) {
+    char fn[256];
+    char* expected;
+    size_t explen;
+    int bufsizes[] = { 0, 100, 0, 100 };
+    anbool threaded[] = { FALSE, FALSE, TRUE, TRUE };
+    fitstable_t* tab;
+    int32_t* tags;
+    int i;
+
+    strcpy(fn, get_tmpfile(10));
+    write_skipped_table(ct, fn, -1, FALSE);
+    expected = file_get_contents(fn, &explen, FALSE);
+    CuAssertPtrNotNull(ct, expected);
+    blank_dates(expected, explen);
+
+    for (i=0; i<sizeof(bufsizes)/sizeof(int); i++) {
+        char* got;
+        size_t len;
+        write_skipped_table(ct, fn, bufsizes[i], threaded[i]);
+        got = file_get_contents(fn, &len, FALSE);
+        CuAssertPtrNotNull(ct, got);
+        blank_dates(got, len);
+        CuAssertIntEquals(ct, (int)explen, (int)len);
+        CuAssert(ct, "buffered output is identical", memcmp(expected, got, len) == 0);
+        free(got);
+    }
+    free(expected);
+
+    tab = fitstable_open(fn);
+    CuAssertPtrNotNull(ct, tab);
+    CuAssertIntEquals(ct, 100, fitstable_nrows(tab));
+    tags = fitstable_read_column(tab, "TAG", fitscolumn_i32_type());
+    CuAssertPtrNotNull(ct, tags);
+    for (i=0; i<100; i++)
+        CuAssertIntEquals(ct, 1000 + i, tags[i]);
+    free(tags);
+    CuAssertIntEquals(ct, 0, fitstable_close(tab));
+}
@@ -0,0 +1,93 @@
+/*
+ This file is part of the Astrometry.net suite.
+
+ The Astrometry.net suite is free software; you can redistribute
+ it and/or modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation, version 2.
+
+ The Astrometry.net suite is distributed in the hope that it will be
+ useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with the Astrometry.net suite ; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cutest.h"
+#include "index-catalog.h"
+#include "healpix.h"
+#include "mathutil.h"
+#include "starutil.h"
+#include "bl.h"
+
+static void set_meta(index_t* ind, int healpix, int nside,
+					 double scalelo, double scalehi) {
+	memset(ind, 0, sizeof(index_t));
+	ind->indexname = "fake";
+	ind->healpix = healpix;
+	ind->hpnside = nside;
+	ind->index_scale_lower = scalelo;
+	ind->index_scale_upper = scalehi;
+}
+
+/*
+ A "5000-series" set of tiles: two scales at Nside=2, one at Nside=8,
+ plus an all-sky index; searches must agree with looking at each.
+ */
+void test_index_catalog_search(CuTest* ct) {
+	int N = 2 * 48 + 768 + 1;
+	index_t* inds = malloc(N * sizeof(index_t));
+	index_catalog_t* cat = index_catalog_new();
+	double radii[] = { 0.01, 0.5, 3.0, 20.0, 70.0, 180.0 };
+	il* ids = il_new(256);
+	int i, j, k;
+
+	k = 0;
+	for (i=0; i<48; i++)
+		set_meta(inds + k++, i, 2, 1000, 1400);
+	for (i=0; i<768; i++)
+		set_meta(inds + k++, i, 8, 60, 85);
+	for (i=0; i<48; i++)
+		set_meta(inds + k++, i, 2, 1400, 2000);
+	set_meta(inds + k++, -1, 0, 5000, 7000);
+	CuAssertIntEquals(ct, N, k);
+	for (i=0; i<N; i++)
+		index_catalog_add(cat, inds + i, i);
+	CuAssertIntEquals(ct, N, index_catalog_n(cat));
+
+	srand(0);
+	for (j=0; j<200; j++) {
+		double ra = uniform_sample(0, 360);
+		double dec = rad2deg(asin(uniform_sample(-1, 1)));
+		double radius = radii[j % (sizeof(radii)/sizeof(double))];
+		double quadlo = (j % 3 == 0) ? 0 : 1300;
+		double quadhi = (j % 3 == 0) ? 1e6 : 1500;
+		int nexp = 0;
+
+		il_remove_all(ids);
+		index_catalog_search(cat, ra, dec, radius, quadlo, quadhi, ids);
+		for (i=0; i<N; i++) {
+			if (!(index_overlaps_scale_range(inds + i, quadlo, quadhi) &&
+				  index_is_within_range(inds + i, ra, dec, radius)))
+				continue;
+			CuAssert(ct, "missing index", nexp < il_size(ids));
+			CuAssertIntEquals(ct, i, il_get(ids, nexp));
+			nexp++;
+		}
+		CuAssertIntEquals(ct, nexp, il_size(ids));
+	}
+
+	// a small region near a healpix corner needs only a few tiles.
+	il_remove_all(ids);
+	index_catalog_search(cat, 45.0, 0.0, 0.5, 60, 85, ids);
+	CuAssert(ct, "found a few tiles", il_size(ids) >= 1 && il_size(ids) <= 4);
+
+	il_free(ids);
+	index_catalog_free(cat);
+	free(inds);
+}
@@ -1,9 +1,14 @@
 #include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "fitsbin.h"
 #include "fitsioutils.h"
 #include "quadfile.h"
 #include "errors.h"
+#include "ioutils.h"
+#include "starutil.h"
 
 #include "cutest.h"
 
@@ -66,3 +71,108 @@ void test_quadfile_inmemory_big(CuTest* ct) {
 		ERROR("Failed to close qf\n");
 	}
 }
+
+static void check_packed(CuTest* ct, quadfile* qf) {
+	quadfile* packed;
+	unsigned int quad[DQMAX];
+	unsigned int equad[DQMAX];
+	char* fn;
+	FILE* fid;
+	int i;
+	int N = quadfile_nquads(qf);
+	int D = quadfile_dimquads(qf);
+
+	fn = create_temp_file("test_quadfile_packed", NULL);
+	CuAssertPtrNotNull(ct, fn);
+	fid = fopen(fn, "wb");
+    CuAssertPtrNotNull(ct, fid);
+	CuAssertIntEquals(ct, 0, quadfile_write_packed_to(qf, 0, fid, NULL));
+	CuAssertIntEquals(ct, 0, fclose(fid));
+
+	packed = quadfile_open(fn);
+    CuAssertPtrNotNull(ct, packed);
+	CuAssertIntEquals(ct, TRUE, quadfile_is_packed(packed));
+	CuAssertIntEquals(ct, N, quadfile_nquads(packed));
+	CuAssertIntEquals(ct, D, quadfile_dimquads(packed));
+	CuAssertIntEquals(ct, 0, quadfile_check(packed));
+    for (i=0; i<N; i++) {
+		CuAssertIntEquals(ct, 0, quadfile_get_stars(qf, i, equad));
+		CuAssertIntEquals(ct, 0, quadfile_get_stars(packed, i, quad));
+		CuAssertIntEquals(ct, 0, memcmp(equad, quad, sizeof(unsigned int) * D));
+	}
+	CuAssertIntEquals(ct, 0, quadfile_close(packed));
+	unlink(fn);
+	free(fn);
+}
+
+void test_quadfile_packed(CuTest* ct) {
+    int i, d;
+    int D = 4;
+	int N = 1000;
+	unsigned int quad[4];
+	quadfile* qf;
+
+	qf = quadfile_open_in_memory();
+    CuAssertPtrNotNull(ct, qf);
+	qf->numstars = 100000;
+    CuAssertIntEquals(ct, 0, quadfile_write_header(qf));
+	srand(0);
+    for (i=0; i<N; i++) {
+		// nearby star IDs, with the occasional far-off one.
+		quad[0] = (i * 97) % qf->numstars;
+		for (d=1; d<D; d++)
+			quad[d] = (quad[0] + (rand() % 200) + (i % 50 ? 0 : 90000)) % qf->numstars;
+		CuAssertIntEquals(ct, 0, quadfile_write_quad(qf, quad));
+    }
+	CuAssertIntEquals(ct, 0, quadfile_switch_to_reading(qf));
+	CuAssertIntEquals(ct, FALSE, quadfile_is_packed(qf));
+	check_packed(ct, qf);
+	CuAssertIntEquals(ct, 0, quadfile_close(qf));
+}
+
+void test_quadfile_packed_wide(CuTest* ct) {
+	// star IDs more than 2^31 apart.
+	unsigned int quads[][4] = {
+		{ 0, 0xf0000000, 5, 0xefffffff },
+		{ 0xf0000000, 0, 1, 0x80000001 },
+		{ 0x7fffffff, 0x80000000, 0, 0xf0000000 },
+	};
+	quadfile* qf;
+	int i;
+
+	qf = quadfile_open_in_memory();
+    CuAssertPtrNotNull(ct, qf);
+	qf->numstars = 0xf0000001;
+    CuAssertIntEquals(ct, 0, quadfile_write_header(qf));
+	for (i=0; i<sizeof(quads)/sizeof(quads[0]); i++)
+		CuAssertIntEquals(ct, 0, quadfile_write_quad(qf, quads[i]));
+	CuAssertIntEquals(ct, 0, quadfile_switch_to_reading(qf));
+	check_packed(ct, qf);
+	CuAssertIntEquals(ct, 0, quadfile_close(qf));
+}
+
+void test_quadfile_packed_empty(CuTest* ct) {
+	quadfile* qf;
+	FILE* fid;
+	char* fn;
+	char* packedfn;
+
+	fn = create_temp_file("test_quadfile_empty", NULL);
+	CuAssertPtrNotNull(ct, fn);
+	qf = quadfile_open_for_writing(fn);
+    CuAssertPtrNotNull(ct, qf);
+	qf->numstars = 100;
+    CuAssertIntEquals(ct, 0, quadfile_write_header(qf));
+	packedfn = create_temp_file("test_quadfile_packed", NULL);
+	CuAssertPtrNotNull(ct, packedfn);
+	fid = fopen(packedfn, "wb");
+    CuAssertPtrNotNull(ct, fid);
+	// there's nothing to pack.
+	CuAssertIntEquals(ct, -1, quadfile_write_packed_to(qf, 0, fid, NULL));
+	CuAssertIntEquals(ct, 0, fclose(fid));
+	CuAssertIntEquals(ct, 0, quadfile_close(qf));
+	unlink(packedfn);
+	unlink(fn);
+	free(packedfn);
+	free(fn);
+}
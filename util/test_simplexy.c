@@ -19,6 +19,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
+#include <sys/param.h>
 
 #include "cutest.h"
 #include "dimage.h"
@@ -64,3 +66,124 @@ void test_simplexy_1(CuTest* tc) {
 	CuAssertIntEquals(tc, 1, rtn);
 	CuAssertIntEquals(tc, 1, N);
 }
+
+// A smooth background, noise, and some stars (some crowded, some near edges).
+static float* fake_image(int W, int H) {
+	float* img = malloc(W * H * sizeof(float));
+	int i, j, k;
+	srand(42);
+	for (j=0; j<H; j++)
+		for (i=0; i<W; i++)
+			img[j*W + i] = 20. + 0.05 * i + 0.03 * j +
+				10. * ((float)rand() / (float)RAND_MAX);
+	for (k=0; k<150; k++) {
+		float x = W * ((float)rand() / (float)RAND_MAX);
+		float y = H * ((float)rand() / (float)RAND_MAX);
+		float flux = 50. + 150. * ((float)rand() / (float)RAND_MAX);
+		for (j=MAX(0, (int)y-8); j<MIN(H, (int)y+9); j++)
+			for (i=MAX(0, (int)x-8); i<MIN(W, (int)x+9); i++)
+				img[j*W + i] += flux * exp(-((i-x)*(i-x) + (j-y)*(j-y)) / (2.*1.5*1.5));
+	}
+	return img;
+}
+
+static void run_simplexy(simplexy_t* s, const float* img, int W, int H,
+						 anbool u8, int nthreads) {
+	int i;
+	if (u8) {
+		simplexy_set_u8_defaults(s);
+		s->image_u8 = malloc(W * H);
+		for (i=0; i<W*H; i++)
+			s->image_u8[i] = MIN(255, (int)img[i]);
+	} else {
+		simplexy_set_defaults(s);
+		s->image = malloc(W * H * sizeof(float));
+		memcpy(s->image, img, W * H * sizeof(float));
+	}
+	s->nx = W;
+	s->ny = H;
+	s->halfbox = 25;
+	s->nthreads = nthreads;
+	simplexy_run(s);
+}
+
+void test_simplexy_threaded(CuTest* tc) {
+	int W = 400, H = 300;
+	float* img = fake_image(W, H);
+	int u8, nthreads, i;
+
+	log_init(LOG_MSG);
+	for (u8=0; u8<2; u8++) {
+		simplexy_t serial;
+		run_simplexy(&serial, img, W, H, u8, 1);
+		CuAssertTrue(tc, serial.npeaks > 50);
+		for (nthreads=2; nthreads<=7; nthreads+=5) {
+			simplexy_t s;
+			run_simplexy(&s, img, W, H, u8, nthreads);
+			CuAssertIntEquals(tc, serial.npeaks, s.npeaks);
+			for (i=0; i<s.npeaks; i++) {
+				CuAssertTrue(tc, serial.x[i] == s.x[i]);
+				CuAssertTrue(tc, serial.y[i] == s.y[i]);
+				CuAssertTrue(tc, serial.flux[i] == s.flux[i]);
+				CuAssertTrue(tc, serial.background[i] == s.background[i]);
+			}
+			simplexy_free_contents(&s);
+		}
+		simplexy_free_contents(&serial);
+	}
+	free(img);
+}
+
+static int compare_floats(const void* v1, const void* v2) {
+	float f1 = *(const float*)v1;
+	float f2 = *(const float*)v2;
+	return (f1 < f2) ? -1 : ((f1 > f2) ? 1 : 0);
+}
+
+/*
+ With a strong gradient, the ctmf background at each source should be
+ the median of the box around it, to within a quantization step.
+ */
+void test_simplexy_ctmf_background(CuTest* tc) {
+	int W = 300, H = 240, r = 12;
+	float* img = fake_image(W, H);
+	float* box = malloc((2*r+1) * (2*r+1) * sizeof(float));
+	simplexy_t s;
+	int i, j, k, nchecked = 0;
+
+	for (j=0; j<H; j++)
+		for (i=0; i<W; i++)
+			img[j*W + i] += 0.01 * (i-150)*(i-150) + 0.5 * j;
+
+	log_init(LOG_MSG);
+	simplexy_set_defaults(&s);
+	s.image = malloc(W * H * sizeof(float));
+	memcpy(s.image, img, W * H * sizeof(float));
+	s.nx = W;
+	s.ny = H;
+	s.halfbox = r;
+	s.bgmethod = SIMPLEXY_BG_CTMF;
+	simplexy_run(&s);
+	CuAssertTrue(tc, s.npeaks > 50);
+	for (k=0; k<s.npeaks; k++) {
+		int x = (int)(s.x[k] + 0.5);
+		int y = (int)(s.y[k] + 0.5);
+		int n = 0;
+		float median, step;
+		if (x < r || y < r || x >= W-r || y >= H-r)
+			continue;
+		for (j=y-r; j<=y+r; j++)
+			for (i=x-r; i<=x+r; i++)
+				box[n++] = img[j*W + i];
+		qsort(box, n, sizeof(float), compare_floats);
+		median = box[n/2];
+		// the background here spans ~350, plus 8 sigma on each side.
+		step = (350. + 16. * s.sigma) / 255.;
+		CuAssertDblEquals(tc, median, s.background[k], step);
+		nchecked++;
+	}
+	CuAssertTrue(tc, nchecked > 20);
+	simplexy_free_contents(&s);
+	free(box);
+	free(img);
+}
@@ -0,0 +1,174 @@
+/*
+  This file is part of the Astrometry.net suite.
+
+  The Astrometry.net suite is free software; you can redistribute
+  it and/or modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation, version 2.
+
+  The Astrometry.net suite is distributed in the hope that it will be
+  useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with the Astrometry.net suite ; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cutest.h"
+#include "tabsort.h"
+#include "fitstable.h"
+#include "fitsioutils.h"
+#include "ioutils.h"
+#include "radix.h"
+
+#define NROWS 20000
+
+static float mags[NROWS];
+static anbool mags_desc;
+
+static void write_table(CuTest* ct, const char* fn) {
+	fitstable_t* tab;
+	int i;
+	tab = fitstable_open_for_writing(fn);
+	CuAssertPtrNotNull(ct, tab);
+	fitstable_add_write_column(tab, fitscolumn_float_type(), "MAG", "");
+	fitstable_add_write_column(tab, fitscolumn_double_type(), "RA", "");
+	fitstable_add_write_column(tab, fitscolumn_i32_type(), "INDEX", "");
+	CuAssertIntEquals(ct, 0, fitstable_write_primary_header(tab));
+	CuAssertIntEquals(ct, 0, fitstable_write_header(tab));
+	srand(42);
+	for (i=0; i<NROWS; i++) {
+		// lots of ties, some NaNs, and both zeros.
+		float mag = (rand() % 500) * 0.1 - 10;
+		double ra = i * 0.01;
+		int32_t ind = i;
+		if (i % 997 == 0)
+			mag = NAN;
+		if (i % 1001 == 0)
+			mag = (i % 2) ? -0.0 : 0.0;
+		mags[i] = mag;
+		CuAssertIntEquals(ct, 0, fitstable_write_row(tab, &mag, &ra, &ind));
+	}
+	CuAssertIntEquals(ct, 0, fitstable_fix_header(tab));
+	CuAssertIntEquals(ct, 0, fitstable_close(tab));
+}
+
+// (by bits, because we're compiled with -ffinite-math-only)
+static anbool is_nan(float f) {
+	uint32_t u;
+	memcpy(&u, &f, sizeof(u));
+	return (u & 0x7fffffff) > 0x7f800000;
+}
+
+// by magnitude, NaNs last, then by original position.
+static int compare_rows(const void* v1, const void* v2) {
+	int i1 = *(const int*)v1;
+	int i2 = *(const int*)v2;
+	float m1 = mags[i1], m2 = mags[i2];
+	if (is_nan(m1) != is_nan(m2))
+		return is_nan(m1) ? 1 : -1;
+	if (!is_nan(m1) && m1 != m2) {
+		if (mags_desc)
+			return (m1 > m2) ? -1 : 1;
+		return (m1 < m2) ? -1 : 1;
+	}
+	return (i1 < i2) ? -1 : 1;
+}
+
+static void check_sorted(CuTest* ct, const char* fn, anbool desc) {
+	fitstable_t* tab;
+	int32_t* inds;
+	double* ras;
+	int expected[NROWS];
+	int i;
+
+	for (i=0; i<NROWS; i++)
+		expected[i] = i;
+	mags_desc = desc;
+	qsort(expected, NROWS, sizeof(int), compare_rows);
+
+	tab = fitstable_open(fn);
+	CuAssertPtrNotNull(ct, tab);
+	CuAssertIntEquals(ct, NROWS, fitstable_nrows(tab));
+	inds = fitstable_read_column(tab, "INDEX", fitscolumn_i32_type());
+	ras = fitstable_read_column(tab, "RA", fitscolumn_double_type());
+	CuAssertPtrNotNull(ct, inds);
+	CuAssertPtrNotNull(ct, ras);
+	for (i=0; i<NROWS; i++) {
+		CuAssertIntEquals(ct, expected[i], inds[i]);
+		CuAssertDblEquals(ct, expected[i] * 0.01, ras[i], 1e-12);
+	}
+	free(inds);
+	free(ras);
+	CuAssertIntEquals(ct, 0, fitstable_close(tab));
+}
+
+void test_tabsort_external(CuTest* ct) {
+	char* infn = create_temp_file("test_tabsort", NULL);
+	char* outfn = create_temp_file("test_tabsort", NULL);
+	char* out2fn = create_temp_file("test_tabsort", NULL);
+	char* a;
+	char* b;
+	size_t alen, blen;
+
+	write_table(ct, infn);
+
+	// in memory (one run)
+	CuAssertIntEquals(ct, 0, tabsort_external(infn, outfn, "MAG", FALSE, 0, 1, NULL));
+	check_sorted(ct, outfn, FALSE);
+
+	// many runs, in several threads, with more than one merge pass.
+	CuAssertIntEquals(ct, 0, tabsort_external(infn, outfn, "MAG", FALSE, 8192, 3, NULL));
+	check_sorted(ct, outfn, FALSE);
+	CuAssertIntEquals(ct, 0, tabsort_external(infn, outfn, "MAG", TRUE, 100000, 2, NULL));
+	check_sorted(ct, outfn, TRUE);
+
+	// with distinct values, the result is the same as tabsort()'s.
+	CuAssertIntEquals(ct, 0, tabsort(infn, out2fn, "RA", TRUE));
+	CuAssertIntEquals(ct, 0, tabsort_external(infn, outfn, "RA", TRUE, 50000, 4, NULL));
+	a = file_get_contents(outfn, &alen, FALSE);
+	b = file_get_contents(out2fn, &blen, FALSE);
+	CuAssertPtrNotNull(ct, a);
+	CuAssertPtrNotNull(ct, b);
+	CuAssertIntEquals(ct, (int)blen, (int)alen);
+	CuAssert(ct, "same as tabsort", memcmp(a, b, alen) == 0);
+	free(a);
+	free(b);
+
+	unlink(infn);
+	unlink(outfn);
+	unlink(out2fn);
+	free(infn);
+	free(outfn);
+	free(out2fn);
+}
+
+void test_radix_sort_keys(CuTest* ct) {
+	int N = 10000;
+	uint64_t* keys = malloc(N * sizeof(uint64_t));
+	uint64_t* keys2 = malloc(N * sizeof(uint64_t));
+	uint32_t* vals = malloc(N * sizeof(uint32_t));
+	uint32_t* vals2 = malloc(N * sizeof(uint32_t));
+	int i;
+	srand(0);
+	for (i=0; i<N; i++) {
+		keys[i] = ((uint64_t)(rand() % 100) << 50) | (rand() % 3);
+		vals[i] = i;
+	}
+	RadixSort11Keys64(keys, vals, keys2, vals2, N);
+	for (i=1; i<N; i++) {
+		CuAssert(ct, "sorted", keys[i-1] <= keys[i]);
+		if (keys[i-1] == keys[i])
+			CuAssert(ct, "stable", vals[i-1] < vals[i]);
+	}
+	free(keys);
+	free(keys2);
+	free(vals);
+	free(vals2);
+}
@@ -74,6 +74,19 @@ int get_resource_stats(double* p_usertime, double* p_systime, long* p_maxrss) {
 	return 0;
 }
 
+int get_page_faults(long* p_majflt, long* p_minflt) {
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage)) {
+		SYSERROR("Failed to get resource stats (getrusage)");
+		return 1;
+	}
+	if (p_majflt)
+		*p_majflt = usage.ru_majflt;
+	if (p_minflt)
+		*p_minflt = usage.ru_minflt;
+	return 0;
+}
+
 void toc() {
 	double utime, stime;
 	long rss;
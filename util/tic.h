@@ -24,6 +24,9 @@
 
 void tic();
 int get_resource_stats(double* p_usertime, double* p_systime, long* p_maxrss);
+
+// Returns the number of major (requiring I/O) and minor page faults so far.
+int get_page_faults(long* p_majflt, long* p_minflt);
 void toc();
 
 double millis_between(struct timeval* tv1, struct timeval* tv2);
@@ -349,7 +349,8 @@ int xylist_open_field(xylist_t* ls, int i) {
  */
 int xylist_next_field(xylist_t* ls) {
     if (is_writing(ls)) {
-		fitstable_next_extension(ls->table);
+		if (fitstable_next_extension(ls->table))
+			return -1;
         fitstable_clear_table(ls->table);
         ls->nfields++;
     } else {